@@ -0,0 +1,338 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+/* Microbenchmarks of the host side code which runs per byte of an image:
+ * parsing, block checks and frame encoding. Every case is repeated until it
+ * has run for BENCH_MIN_TIME; images are synthetic and sized from 64 kB up
+ * to the largest code flash. Run with `make bench`. */
+
+#include "srec.h"
+#include "block.h"
+#include "rl78.h"
+#include "session.h"
+#include "transport.h"
+#include "crc16_ccit.h"
+#include "latency.h"
+#include "image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MIN_TIME      200000      /* us per case */
+#define BENCH_RECORD_SIZE   32          /* data bytes per S3 record */
+
+static const unsigned int bench_sizes[] = { 64 * 1024, 256 * 1024, IMAGE_CODE_MAX_SIZE };
+
+#define BENCH_SIZES (sizeof bench_sizes / sizeof bench_sizes[0])
+
+typedef struct
+{
+    unsigned char *image;
+    unsigned int size;
+    char *hex;                  /* the image as hex digits */
+    const char *srec;           /* name of the image as an S-record file */
+    unsigned char *parsed;
+    rl78_session_t session;
+    rl78_log_t log;
+} bench_t;
+
+/* Keeps the results of the measured calls alive */
+static volatile unsigned int bench_sink;
+
+/* Transport which takes every frame and answers nothing, so the encoders
+ * are measured without a port */
+static
+int bench_open(void *ctx, rl78_session_t *s, const char *port)
+{
+    (void)ctx;
+    s->port_name = port;
+    return 0;
+}
+
+static
+int bench_set(void *ctx, rl78_session_t *s, int value)
+{
+    (void)ctx;
+    (void)s;
+    (void)value;
+    return 0;
+}
+
+static
+int bench_set_parity(void *ctx, rl78_session_t *s, int enable, int odd_parity)
+{
+    (void)ctx;
+    (void)s;
+    (void)enable;
+    (void)odd_parity;
+    return 0;
+}
+
+static
+int bench_session(void *ctx, rl78_session_t *s)
+{
+    (void)ctx;
+    (void)s;
+    return 0;
+}
+
+static
+int bench_write(void *ctx, rl78_session_t *s, const void *buf, int len)
+{
+    (void)ctx;
+    (void)s;
+    bench_sink += ((const unsigned char*)buf)[len - 1];
+    return len;
+}
+
+static
+int bench_read(void *ctx, rl78_session_t *s, void *buf, int len)
+{
+    (void)ctx;
+    (void)s;
+    (void)buf;
+    (void)len;
+    return 0;
+}
+
+static
+void bench_delay(void *ctx, rl78_session_t *s, unsigned int us)
+{
+    (void)ctx;
+    (void)s;
+    (void)us;
+}
+
+static const rl78_transport_t bench_transport =
+{
+    bench_open,
+    bench_set,
+    bench_set_parity,
+    bench_set,
+    bench_set,
+    bench_set,
+    bench_session,
+    bench_write,
+    bench_read,
+    bench_delay,
+    bench_session,
+};
+
+/* One pass over the image; returns the number of bytes processed */
+typedef unsigned long long (*bench_func_t)(bench_t *b);
+
+static
+unsigned long long bench_srec_read(bench_t *b)
+{
+    if (SREC_NO_ERROR != srec_read(b->srec, b->parsed, IMAGE_CODE_MAX_SIZE, NULL, 0, &b->log))
+    {
+        fprintf(stderr, "Unable to parse %s\n", b->srec);
+        exit(EXIT_FAILURE);
+    }
+    return b->size;
+}
+
+static
+unsigned long long bench_ascii2hex(bench_t *b)
+{
+    unsigned int i;
+    unsigned int sum = 0;
+    for (i = 0; i < b->size; ++i)
+    {
+        sum += ascii2hex(&b->hex[2 * i], 2);
+    }
+    bench_sink += sum;
+    return b->size;
+}
+
+static
+unsigned long long bench_checksum(bench_t *b)
+{
+    unsigned int address;
+    unsigned int sum = 0;
+    for (address = 0; address < b->size; address += FLASH_BLOCK_SIZE)
+    {
+        sum += rl78_checksum(&b->image[address], FLASH_BLOCK_SIZE);
+    }
+    bench_sink += sum;
+    return b->size;
+}
+
+/* Blank blocks are the worst case: every byte has to be looked at */
+static
+unsigned long long bench_blank(bench_t *b)
+{
+    unsigned int address;
+    unsigned int blank = 0;
+    for (address = 0; address < b->size; address += FLASH_BLOCK_SIZE)
+    {
+        blank += block_is_blank(&b->parsed[address], FLASH_BLOCK_SIZE);
+    }
+    bench_sink += blank;
+    return b->size;
+}
+
+static
+unsigned long long bench_crc16(bench_t *b)
+{
+    bench_sink += crc16(b->image, b->size);
+    return b->size;
+}
+
+/* The Programming command of every block, counted in wire bytes */
+static
+unsigned long long bench_send_cmd(bench_t *b)
+{
+    unsigned long long bytes = 0;
+    unsigned int address;
+    for (address = 0; address < b->size; address += FLASH_BLOCK_SIZE)
+    {
+        const unsigned int end = address + FLASH_BLOCK_SIZE - 1;
+        const unsigned char buf[6] =
+        {
+            address, address >> 8, address >> 16,
+            end, end >> 8, end >> 16,
+        };
+        bytes += rl78_send_cmd(&b->session, CMD_PROGRAMMING, buf, sizeof buf);
+    }
+    return bytes;
+}
+
+/* The data frames of the whole image, counted in wire bytes */
+static
+unsigned long long bench_send_data(bench_t *b)
+{
+    unsigned long long bytes = 0;
+    unsigned int address;
+    for (address = 0; address < b->size; address += 256)
+    {
+        bytes += rl78_send_data(&b->session, &b->image[address], 256,
+                                0 == (address + 256) % FLASH_BLOCK_SIZE);
+    }
+    return bytes;
+}
+
+static
+void bench_run(bench_t *b, const char *name, bench_func_t func)
+{
+    unsigned long long bytes = 0;
+    unsigned long long elapsed;
+    const unsigned long long start = latency_now();
+    do
+    {
+        bytes += func(b);
+        elapsed = latency_now() - start;
+    }
+    while (BENCH_MIN_TIME > elapsed);
+    printf("%-16s %7u kB %10.3f %10.1f\n", name, b->size / 1024,
+           elapsed * 1000.0 / bytes, (double)bytes / elapsed);
+}
+
+/* Pseudo-random code with blank gaps, as an S3 file of BENCH_RECORD_SIZE byte
+ * records */
+static
+int bench_image(bench_t *b, unsigned int size, const char *filename)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    unsigned int i;
+    unsigned int x = 2463534242U;
+    b->size = size;
+    for (i = 0; i < size; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        b->image[i] = (0 == (i / FLASH_BLOCK_SIZE) % 8) ? 0xFF : x;
+        b->hex[2 * i] = digits[b->image[i] >> 4];
+        b->hex[2 * i + 1] = digits[b->image[i] & 0x0F];
+    }
+    FILE *f = fopen(filename, "w");
+    if (NULL == f)
+    {
+        return -1;
+    }
+    unsigned int address;
+    for (address = 0; address < size; address += BENCH_RECORD_SIZE)
+    {
+        unsigned char record[5 + BENCH_RECORD_SIZE];
+        unsigned int sum = 0;
+        record[0] = 5 + BENCH_RECORD_SIZE;
+        record[1] = address >> 24;
+        record[2] = address >> 16;
+        record[3] = address >> 8;
+        record[4] = address;
+        memcpy(&record[5], &b->image[address], BENCH_RECORD_SIZE);
+        fputs("S3", f);
+        for (i = 0; i < sizeof record; ++i)
+        {
+            fprintf(f, "%02X", record[i]);
+            sum += record[i];
+        }
+        fprintf(f, "%02X\n", ~sum & 0xFF);
+    }
+    fprintf(f, "S70500000000FA\n");
+    return fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filename = (1 < argc) ? argv[1] : "rl78bench.mot";
+    bench_t b;
+    memset(&b, 0, sizeof b);
+    rl78_log_init(&b.log, 0);
+    rl78_session_init(&b.session, 0);
+    b.session.communication_mode = 2;
+    b.session.transport = &bench_transport;
+    b.srec = filename;
+    b.image = malloc(IMAGE_CODE_MAX_SIZE);
+    b.hex = malloc(2 * IMAGE_CODE_MAX_SIZE);
+    b.parsed = malloc(IMAGE_CODE_MAX_SIZE);
+    if (NULL == b.image
+        || NULL == b.hex
+        || NULL == b.parsed)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    printf("%-16s %10s %10s %10s\n", "Benchmark", "Image", "ns/byte", "MB/s");
+    unsigned int i;
+    for (i = 0; i < BENCH_SIZES; ++i)
+    {
+        if (0 != bench_image(&b, bench_sizes[i], filename))
+        {
+            fprintf(stderr, "Unable to write %s\n", filename);
+            return EXIT_FAILURE;
+        }
+        memset(b.parsed, 0xFF, IMAGE_CODE_MAX_SIZE);
+        bench_run(&b, "srec_read", bench_srec_read);
+        bench_run(&b, "ascii2hex", bench_ascii2hex);
+        bench_run(&b, "rl78_checksum", bench_checksum);
+        memset(b.parsed, 0xFF, IMAGE_CODE_MAX_SIZE);
+        bench_run(&b, "block_is_blank", bench_blank);
+        bench_run(&b, "crc16", bench_crc16);
+        bench_run(&b, "rl78_send_cmd", bench_send_cmd);
+        bench_run(&b, "rl78_send_data", bench_send_data);
+    }
+    remove(filename);
+    free(b.image);
+    free(b.hex);
+    free(b.parsed);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,617 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+/* End-to-end benchmark of the erase, program and verify paths of rl78.c
+ * against the bootloader model of model.c, in both communication modes and
+ * at every baud rate of the bootloader. For each phase it prints the wall
+ * time on the virtual clock of the model, the least time the line and the
+ * device need for it, and the overhead of the host over that minimum. The
+ * times are compared with a baseline file, and the run fails if a phase has
+ * become slower than the baseline by more than the tolerance. Run with
+ * `make bench-e2e`; -u writes the current times as the new baseline.
+ *
+ * With -f the line is damaged by the fault shim of fault.c instead, and a
+ * number of jobs is run at one baud rate to find out how many of them succeed
+ * and what the failures and slow recoveries cost per good board. */
+
+#include "rl78.h"
+#include "fsm.h"
+#include "session.h"
+#include "model.h"
+#include "fault.h"
+#include "block.h"
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define E2E_CODE_SIZE       (64 * 1024)
+#define E2E_TOLERANCE       5.0         /* % over the baseline */
+#define E2E_LINE_LENGTH     128
+#define E2E_JOBS            100         /* jobs of a fault run */
+
+static const int e2e_bauds[] = { 115200, 250000, 500000, 1000000 };
+
+#define E2E_BAUDS (sizeof e2e_bauds / sizeof e2e_bauds[0])
+
+#define E2E_ERASE       0
+#define E2E_PROGRAM     1
+#define E2E_VERIFY      2
+#define E2E_PHASES      3
+
+static const char *const e2e_phase_names[E2E_PHASES] = { "erase", "program", "verify" };
+
+typedef struct
+{
+    double wall;                /* ms */
+    double minimum;             /* ms */
+    double baseline;            /* ms, 0 if not in the baseline */
+} e2e_result_t;
+
+typedef struct
+{
+    model_timing_t timing;
+    unsigned char *image;
+    block_info_t blocks[E2E_CODE_SIZE / FLASH_BLOCK_SIZE];
+    e2e_result_t results[2][E2E_BAUDS][E2E_PHASES];
+    unsigned int read_timeout;  /* ms, 0 for the default of a session */
+    const fault_config_t *faults;   /* NULL for a clean line */
+    fault_counts_t counts;      /* faults injected into all jobs */
+    rl78_log_t log;
+} e2e_t;
+
+static
+const char *e2e_mode_name(int wire)
+{
+    return 1 == wire ? "1-wire" : "2-wire";
+}
+
+static
+void usage(void)
+{
+    printf("rl78bench-e2e [options] <baseline>\n"
+           "\t-u\tWrite the results as the new baseline\n"
+           "\t-t n\tTolerated slowdown over the baseline, in %% (default %.0f)\n"
+           "\t-c n\tDevice turnaround of a frame, in us (default %u)\n"
+           "\t-e n\tDevice time of Block Erase, in us (default %u)\n"
+           "\t-w n\tDevice time of programming a data frame, in us (default %u)\n"
+           "\t-r n\tDevice time of reading a data frame, in us (default %u)\n"
+           "rl78bench-e2e -f spec [options]\n"
+           "\t-f spec\tInject faults (see src/fault.h) and count good jobs\n"
+           "\t-n n\tNumber of jobs (default %u)\n"
+           "\t-m n\tCommunication mode, 1 or 2 (default 2)\n"
+           "\t-b n\tBaud rate (default 1000000)\n"
+           "\t-o n\tRead timeout, in ms (default %u)\n"
+           "rl78bench-e2e -s [-f spec] [options]\n"
+           "\t-s\tRun the state machine of fsm.c as a deterministic simulation\n",
+           E2E_TOLERANCE, MODEL_DEFAULT_COMMAND, MODEL_DEFAULT_ERASE, MODEL_DEFAULT_WRITE, MODEL_DEFAULT_READ,
+           E2E_JOBS, SESSION_DEFAULT_READ_TIMEOUT);
+}
+
+/* Pseudo-random code with blank gaps, as in bench.c */
+static
+void e2e_image(e2e_t *e)
+{
+    unsigned int x = 2463534242U;
+    unsigned int i;
+    for (i = 0; i < E2E_CODE_SIZE; ++i)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        e->image[i] = (0 == (i / FLASH_BLOCK_SIZE) % 8) ? 0xFF : x;
+    }
+    block_scan(e->image, E2E_CODE_SIZE, FLASH_BLOCK_SIZE, e->blocks);
+}
+
+static
+int e2e_phase(e2e_t *e, rl78_session_t *s, model_t *m, int phase, e2e_result_t *r)
+{
+    const unsigned long long start = model_now(m);
+    const unsigned long long minimum = model_line_time(m) + model_busy_time(m);
+    int rc;
+    switch (phase)
+    {
+    case E2E_ERASE:
+        rc = rl78_erase(s, CODE_OFFSET, E2E_CODE_SIZE);
+        break;
+    case E2E_PROGRAM:
+        rc = rl78_program(s, CODE_OFFSET, e->image, E2E_CODE_SIZE, e->blocks);
+        break;
+    default:
+        rc = rl78_verify(s, CODE_OFFSET, e->image, E2E_CODE_SIZE, e->blocks);
+        break;
+    }
+    r->wall = (model_now(m) - start) / 1e6;
+    r->minimum = (model_line_time(m) + model_busy_time(m) - minimum) / 1e6;
+    return rc;
+}
+
+static
+void e2e_count(fault_counts_t *total, const fault_counts_t *counts)
+{
+    total->dropped += counts->dropped;
+    total->flipped += counts->flipped;
+    total->truncated += counts->truncated;
+    total->stalls += counts->stalls;
+    total->delayed += counts->delayed;
+}
+
+/* Session at baud on a model of a device full of old code, damaged by the
+ * faults of e if there are any. Job number job of a fault run gets its own
+ * seed. */
+static
+model_t *e2e_open(e2e_t *e, rl78_session_t *s, int wire, int baud, unsigned int job, fault_t **f)
+{
+    rl78_session_init(s, 0);
+    s->mode = (1 == wire ? MODE_UART_1 : MODE_UART_2) | MODE_RESET_DTR;
+    s->baud = baud;
+    if (0 < e->read_timeout)
+    {
+        s->read_timeout = e->read_timeout;
+    }
+    model_t *m = model_start(s, &e->timing, E2E_CODE_SIZE);
+    *f = NULL;
+    if (NULL != m
+        && NULL != e->faults)
+    {
+        fault_config_t config = *e->faults;
+        config.seed += job;
+        *f = fault_start(s, &config);
+        // Failed jobs are counted, not reported
+        s->log.func = rl78_log_quiet;
+        s->log.ctx = &e->log;
+    }
+    if (NULL == m
+        || (NULL != e->faults && NULL == *f))
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return m;
+}
+
+static
+void e2e_close(e2e_t *e, rl78_session_t *s, model_t *m, fault_t *f)
+{
+    serial_close(s);
+    if (NULL != f)
+    {
+        e2e_count(&e->counts, fault_counts(f));
+        fault_stop(s, f);
+    }
+    model_stop(s, m);
+}
+
+/* Connect at baud and run all phases; elapsed is set to the time of the
+ * whole job, in ms */
+static
+int e2e_run(e2e_t *e, int wire, int baud, unsigned int job, e2e_result_t results[E2E_PHASES], double *elapsed)
+{
+    rl78_session_t s;
+    fault_t *f;
+    model_t *m = e2e_open(e, &s, wire, baud, job, &f);
+    const unsigned long long start = model_now(m);
+    int rc = serial_open(&s, "model");
+    if (0 == rc)
+    {
+        rc = rl78_reset_init(&s, 0);
+    }
+    int phase;
+    for (phase = 0; 0 == rc && E2E_PHASES > phase; ++phase)
+    {
+        rc = e2e_phase(e, &s, m, phase, &results[phase]);
+    }
+    *elapsed = (model_now(m) - start) / 1e6;
+    e2e_close(e, &s, m, f);
+    if (0 != rc
+        && NULL == e->faults)
+    {
+        fprintf(stderr, "%s %u bps: %s failed (%d)\n", e2e_mode_name(wire), baud,
+                E2E_PHASES >= phase && 0 < phase ? e2e_phase_names[phase - 1] : "connect", rc);
+    }
+    return rc;
+}
+
+/* Clock of rl78_fsm_wait(): the virtual time of the model, in us */
+static
+unsigned long long e2e_clock(void *ctx)
+{
+    return model_now((model_t*)ctx) / 1000;
+}
+
+/* Connect and run all phases with the state machine of fsm.c on the virtual
+ * clock alone; elapsed is set to the time of the whole job, in ns */
+static
+int e2e_fsm(e2e_t *e, int wire, int baud, unsigned long long *elapsed)
+{
+    rl78_session_t s;
+    fault_t *f;
+    model_t *m = e2e_open(e, &s, wire, baud, 0, &f);
+    model_virtual(m);
+    rl78_fsm_t fsm;
+    rl78_fsm_init(&fsm, &s);
+    const unsigned long long start = model_now(m);
+    int rc = serial_open(&s, "model");
+    int phase;
+    for (phase = -1; 0 == rc && E2E_PHASES > phase; ++phase)
+    {
+        switch (phase)
+        {
+        case -1:
+            rl78_fsm_reset_init(&fsm);
+            break;
+        case E2E_ERASE:
+            rl78_fsm_erase(&fsm, CODE_OFFSET, E2E_CODE_SIZE);
+            break;
+        case E2E_PROGRAM:
+            rl78_fsm_program(&fsm, CODE_OFFSET, e->image, E2E_CODE_SIZE, e->blocks);
+            break;
+        default:
+            rl78_fsm_verify(&fsm, CODE_OFFSET, e->image, E2E_CODE_SIZE, e->blocks);
+            break;
+        }
+        rc = rl78_fsm_wait(&fsm, e2e_clock, m);
+    }
+    *elapsed = model_now(m) - start;
+    e2e_close(e, &s, m, f);
+    return rc;
+}
+
+/* Every job of the state machine runs twice and has to end the same way at
+ * the same virtual time; on a clean line it also has to succeed */
+static
+int e2e_simulate(e2e_t *e)
+{
+    int retcode = EXIT_SUCCESS;
+    int wire;
+    unsigned int b;
+    printf("%-7s %8s %10s %8s\n", "Mode", "Baud", "Time, ms", "Result");
+    for (wire = 1; wire <= 2; ++wire)
+    {
+        for (b = 0; b < E2E_BAUDS; ++b)
+        {
+            unsigned long long first;
+            unsigned long long second;
+            const int rc = e2e_fsm(e, wire, e2e_bauds[b], &first);
+            const int repeated = e2e_fsm(e, wire, e2e_bauds[b], &second);
+            const int failed = (rc != repeated || first != second || (NULL == e->faults && 0 != rc));
+            printf("%-7s %8u %10.3f %8d%s\n", e2e_mode_name(wire), e2e_bauds[b], first / 1e6, rc,
+                   (rc != repeated || first != second) ? "  NOT REPEATABLE" : (failed ? "  FAILED" : ""));
+            if (failed)
+            {
+                retcode = EXIT_FAILURE;
+            }
+        }
+    }
+    if (NULL != e->faults)
+    {
+        fault_report(&e->counts, &e->log);
+    }
+    return retcode;
+}
+
+/* Run jobs on a damaged line. A failed board is taken to be flashed again,
+ * so the time per good board includes the time of the failed jobs. */
+static
+int e2e_faults(e2e_t *e, int wire, int baud, unsigned int jobs)
+{
+    e2e_result_t results[E2E_PHASES];
+    const fault_config_t *faults = e->faults;
+    double clean;
+    e->faults = NULL;
+    if (0 != e2e_run(e, wire, baud, 0, results, &clean))
+    {
+        return EXIT_FAILURE;
+    }
+    e->faults = faults;
+    unsigned int good = 0;
+    double good_time = 0;
+    double failed_time = 0;
+    unsigned int job;
+    for (job = 0; job < jobs; ++job)
+    {
+        double elapsed;
+        if (0 == e2e_run(e, wire, baud, job, results, &elapsed))
+        {
+            ++good;
+            good_time += elapsed;
+        }
+        else
+        {
+            failed_time += elapsed;
+        }
+    }
+    printf("%s %u bps, read timeout %u ms\n", e2e_mode_name(wire), baud,
+           0 < e->read_timeout ? e->read_timeout : SESSION_DEFAULT_READ_TIMEOUT);
+    printf("Jobs: %u of %u succeeded\n", good, jobs);
+    printf("Clean job: %.3f ms\n", clean);
+    if (0 < good)
+    {
+        printf("Good jobs: %.3f ms on average, %.3f ms of recovery\n", good_time / good, good_time / good - clean);
+    }
+    if (good < jobs)
+    {
+        printf("Failed jobs: %.3f ms on average, %.3f ms lost\n", failed_time / (jobs - good), failed_time);
+    }
+    if (0 < good)
+    {
+        const double per_board = (good_time + failed_time) / good;
+        printf("Time per good board: %.3f ms, %.1f%% over a clean job\n", per_board, (per_board - clean) * 100 / clean);
+    }
+    fault_report(&e->counts, &e->log);
+    return EXIT_SUCCESS;
+}
+
+static
+int e2e_find(const char *name, const char *const *names, int count)
+{
+    int i;
+    for (i = 0; i < count; ++i)
+    {
+        if (0 == strcmp(name, names[i]))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Read the baseline into the results; the device times of the baseline have
+ * to be the ones of this run */
+static
+int e2e_load(e2e_t *e, const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (NULL == f)
+    {
+        fprintf(stderr, "Unable to read the baseline %s (run with -u to create it)\n", filename);
+        return -1;
+    }
+    static const char *const modes[2] = { "1-wire", "2-wire" };
+    char line[E2E_LINE_LENGTH];
+    int rc = 0;
+    int timing_found = 0;
+    unsigned int line_number = 0;
+    while (0 == rc
+           && NULL != fgets(line, sizeof line, f))
+    {
+        char mode[16];
+        char phase[16];
+        unsigned int baud;
+        double wall;
+        model_timing_t timing;
+        ++line_number;
+        if ('#' == line[0]
+            || '\n' == line[0])
+        {
+            continue;
+        }
+        if (4 == sscanf(line, "timing %u %u %u %u", &timing.command, &timing.erase, &timing.write, &timing.read))
+        {
+            timing_found = 1;
+            if (0 != memcmp(&timing, &e->timing, sizeof timing))
+            {
+                fprintf(stderr, "%s has been taken with other device times (%u %u %u %u us)\n", filename,
+                        timing.command, timing.erase, timing.write, timing.read);
+                rc = -1;
+            }
+            continue;
+        }
+        if (4 != sscanf(line, "%15s %u %15s %lf", mode, &baud, phase, &wall))
+        {
+            fprintf(stderr, "%s:%u: Malformed line\n", filename, line_number);
+            rc = -1;
+            continue;
+        }
+        const int wire = e2e_find(mode, modes, 2);
+        const int p = e2e_find(phase, e2e_phase_names, E2E_PHASES);
+        unsigned int b;
+        for (b = 0; b < E2E_BAUDS && (unsigned int)e2e_bauds[b] != baud; ++b)
+        {
+        }
+        if (0 <= wire
+            && 0 <= p
+            && E2E_BAUDS > b)
+        {
+            e->results[wire][b][p].baseline = wall;
+        }
+    }
+    fclose(f);
+    if (0 == rc
+        && !timing_found)
+    {
+        fprintf(stderr, "%s: No device times\n", filename);
+        rc = -1;
+    }
+    return rc;
+}
+
+static
+int e2e_save(const e2e_t *e, const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (NULL == f)
+    {
+        fprintf(stderr, "Unable to write the baseline %s\n", filename);
+        return -1;
+    }
+    fprintf(f, "# Baseline of rl78bench-e2e: <mode> <baud> <phase> <wall time, ms>\n");
+    fprintf(f, "# Device times, us: command erase write read\n");
+    fprintf(f, "timing %u %u %u %u\n", e->timing.command, e->timing.erase, e->timing.write, e->timing.read);
+    int wire;
+    unsigned int b;
+    int p;
+    for (wire = 0; wire < 2; ++wire)
+    {
+        for (b = 0; b < E2E_BAUDS; ++b)
+        {
+            for (p = 0; p < E2E_PHASES; ++p)
+            {
+                fprintf(f, "%s %u %s %.3f\n", e2e_mode_name(wire + 1), e2e_bauds[b], e2e_phase_names[p],
+                        e->results[wire][b][p].wall);
+            }
+        }
+    }
+    return fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+    static e2e_t e;
+    double tolerance = E2E_TOLERANCE;
+    int update = 0;
+    fault_config_t faults;
+    unsigned int jobs = E2E_JOBS;
+    int fault_wire = 2;
+    int fault_baud = 1000000;
+    int simulate = 0;
+    int opt;
+    model_timing_init(&e.timing);
+    rl78_log_init(&e.log, 0);
+    while (-1 != (opt = getopt(argc, argv, "ut:c:e:w:r:f:n:m:b:o:sh?")))
+    {
+        switch (opt)
+        {
+        case 'u':
+            update = 1;
+            break;
+        case 't':
+            tolerance = strtod(optarg, NULL);
+            break;
+        case 'c':
+            e.timing.command = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            e.timing.erase = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            e.timing.write = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            e.timing.read = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            if (0 != fault_parse(&faults, optarg))
+            {
+                fprintf(stderr, "Invalid fault spec: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            e.faults = &faults;
+            break;
+        case 'n':
+            jobs = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            fault_wire = (1 == strtol(optarg, NULL, 0)) ? 1 : 2;
+            break;
+        case 'b':
+            fault_baud = strtol(optarg, NULL, 0);
+            break;
+        case 'o':
+            e.read_timeout = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            simulate = 1;
+            break;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if ((NULL == e.faults && !simulate && optind + 1 != argc)
+        || ((NULL != e.faults || simulate) && optind != argc)
+        || 0 >= fault_baud)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    const char *baseline = argv[optind];
+    if (NULL == e.faults
+        && !simulate
+        && !update
+        && 0 != e2e_load(&e, baseline))
+    {
+        return EXIT_FAILURE;
+    }
+    e.image = malloc(E2E_CODE_SIZE);
+    if (NULL == e.image)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    e2e_image(&e);
+    if (simulate)
+    {
+        const int rc = e2e_simulate(&e);
+        free(e.image);
+        return rc;
+    }
+    if (NULL != e.faults)
+    {
+        const int rc = e2e_faults(&e, fault_wire, fault_baud, jobs);
+        free(e.image);
+        return rc;
+    }
+    printf("%-7s %8s %-8s %10s %10s %9s %10s\n", "Mode", "Baud", "Phase", "Wall, ms", "Min, ms", "Overhead", "Baseline");
+    int retcode = EXIT_SUCCESS;
+    int wire;
+    unsigned int b;
+    int p;
+    for (wire = 1; wire <= 2; ++wire)
+    {
+        for (b = 0; b < E2E_BAUDS; ++b)
+        {
+            double elapsed;
+            if (0 != e2e_run(&e, wire, e2e_bauds[b], 0, e.results[wire - 1][b], &elapsed))
+            {
+                free(e.image);
+                return EXIT_FAILURE;
+            }
+            for (p = 0; p < E2E_PHASES; ++p)
+            {
+                const e2e_result_t *r = &e.results[wire - 1][b][p];
+                const int regressed = !update
+                    && 0 < r->baseline
+                    && r->wall > r->baseline * (1 + tolerance / 100);
+                printf("%-7s %8u %-8s %10.3f %10.3f %8.1f%% %10.3f%s\n", e2e_mode_name(wire), e2e_bauds[b],
+                       e2e_phase_names[p], r->wall, r->minimum, (r->wall - r->minimum) * 100 / r->minimum,
+                       r->baseline, regressed ? "  REGRESSION" : "");
+                if (regressed)
+                {
+                    retcode = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    free(e.image);
+    if (update
+        && 0 != e2e_save(&e, baseline))
+    {
+        return EXIT_FAILURE;
+    }
+    if (EXIT_SUCCESS != retcode)
+    {
+        fprintf(stderr, "Slower than %s by more than %.1f%%\n", baseline, tolerance);
+    }
+    return retcode;
+}
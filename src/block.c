@@ -0,0 +1,307 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "block.h"
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PRIME64_1   0x9E3779B185EBCA87ULL
+#define PRIME64_2   0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3   0x165667B19E3779F9ULL
+#define PRIME64_4   0x85EBCA77C2B2AE63ULL
+#define PRIME64_5   0x27D4EB2F165667C5ULL
+
+#define STRIPE_SIZE 32
+
+static inline
+uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline
+uint64_t read64(const unsigned char *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+static inline
+uint32_t read32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof value);
+    return value;
+}
+
+static inline
+uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline
+uint64_t xxh64_merge(uint64_t acc, uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static
+uint64_t xxh64_finish(uint64_t h, const unsigned char *p, unsigned int len)
+{
+    for (; 8 <= len; len -= 8, p += 8)
+    {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (4 <= len)
+    {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        len -= 4;
+        p += 4;
+    }
+    for (; len; --len, ++p)
+    {
+        h ^= *p * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+#ifndef __SSE2__
+/* Add bytes pairwise into 16-bit lanes; a stripe adds at most 8 * 255 to a
+ * lane, so the lanes are folded every stripe. */
+static inline
+uint64_t block_sum_stripe(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+{
+    const uint64_t lanes = (a & 0x00FF00FF00FF00FFULL) + ((a >> 8) & 0x00FF00FF00FF00FFULL)
+        + (b & 0x00FF00FF00FF00FFULL) + ((b >> 8) & 0x00FF00FF00FF00FFULL)
+        + (c & 0x00FF00FF00FF00FFULL) + ((c >> 8) & 0x00FF00FF00FF00FFULL)
+        + (d & 0x00FF00FF00FF00FFULL) + ((d >> 8) & 0x00FF00FF00FF00FFULL);
+    return (lanes & 0xFFFF) + ((lanes >> 16) & 0xFFFF) + ((lanes >> 32) & 0xFFFF) + (lanes >> 48);
+}
+#endif
+
+/* Scan one block in a single pass: blank status, byte sum and XXH64.
+ * Stripes of 32 bytes feed the four hash lanes, while the same bytes are
+ * folded into the blank and sum accumulators (with SSE2 when available). */
+static
+void block_scan_one(const unsigned char *p, unsigned int len, block_info_t *info)
+{
+    const uint64_t seed = 0;
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+    unsigned int stripes = len / STRIPE_SIZE;
+    const unsigned char *const start = p;
+    unsigned int blank;
+    unsigned int sum;
+#ifdef __SSE2__
+    __m128i all = _mm_set1_epi8((char)0xFF);
+    __m128i acc = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    for (; stripes; --stripes, p += STRIPE_SIZE)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i*)p);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+        all = _mm_and_si128(all, _mm_and_si128(a, b));
+        acc = _mm_add_epi64(acc, _mm_add_epi64(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero)));
+        v1 = xxh64_round(v1, read64(p));
+        v2 = xxh64_round(v2, read64(p + 8));
+        v3 = xxh64_round(v3, read64(p + 16));
+        v4 = xxh64_round(v4, read64(p + 24));
+    }
+    blank = (0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi8(all, _mm_set1_epi8((char)0xFF))));
+    sum = (unsigned int)_mm_cvtsi128_si32(acc) + (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#else
+    uint64_t all = ~0ULL;
+    uint64_t acc = 0;
+    for (; stripes; --stripes, p += STRIPE_SIZE)
+    {
+        const uint64_t a = read64(p);
+        const uint64_t b = read64(p + 8);
+        const uint64_t c = read64(p + 16);
+        const uint64_t d = read64(p + 24);
+        all &= a & b & c & d;
+        acc += block_sum_stripe(a, b, c, d);
+        v1 = xxh64_round(v1, a);
+        v2 = xxh64_round(v2, b);
+        v3 = xxh64_round(v3, c);
+        v4 = xxh64_round(v4, d);
+    }
+    blank = (~0ULL == all);
+    sum = (unsigned int)acc;
+#endif
+    uint64_t h;
+    if (STRIPE_SIZE <= len)
+    {
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+    h += len;
+    const unsigned int tail = len - (p - start);
+    unsigned int i;
+    for (i = 0; i < tail; ++i)
+    {
+        blank &= (0xFF == p[i]);
+        sum += p[i];
+    }
+    info->blank = blank;
+    info->checksum = (0U - sum) & 0xFFFFU;
+    info->hash = xxh64_finish(h, p, tail);
+}
+
+void block_scan(const void *mem, unsigned int size, unsigned int block_size, block_info_t *blocks)
+{
+    const unsigned char *p = (const unsigned char*)mem;
+    for (; size; ++blocks)
+    {
+        const unsigned int len = (block_size < size) ? block_size : size;
+        block_scan_one(p, len, blocks);
+        p += len;
+        size -= len;
+    }
+}
+
+void block_update(const void *mem, unsigned int size, unsigned int block_size, block_info_t *blocks,
+                  const unsigned char *dirty)
+{
+    const unsigned char *p = (const unsigned char*)mem;
+    for (; size; ++blocks, ++dirty)
+    {
+        const unsigned int len = (block_size < size) ? block_size : size;
+        if (*dirty)
+        {
+            block_scan_one(p, len, blocks);
+        }
+        p += len;
+        size -= len;
+    }
+}
+
+/* Stops at the first stripe with a programmed byte */
+int block_is_blank(const void *mem, unsigned int size)
+{
+    const unsigned char *p = (const unsigned char*)mem;
+    for (; STRIPE_SIZE <= size; size -= STRIPE_SIZE, p += STRIPE_SIZE)
+    {
+#ifdef __SSE2__
+        const __m128i a = _mm_loadu_si128((const __m128i*)p);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+        if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(a, b), _mm_set1_epi8((char)0xFF))))
+        {
+            return 0;
+        }
+#else
+        if (~0ULL != (read64(p) & read64(p + 8) & read64(p + 16) & read64(p + 24)))
+        {
+            return 0;
+        }
+#endif
+    }
+    for (; size; --size, ++p)
+    {
+        if (0xFF != *p)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+unsigned int block_checksum(const void *mem, unsigned int size)
+{
+    const unsigned char *p = (const unsigned char*)mem;
+    unsigned int sum;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    const __m128i zero = _mm_setzero_si128();
+    for (; STRIPE_SIZE <= size; size -= STRIPE_SIZE, p += STRIPE_SIZE)
+    {
+        const __m128i a = _mm_loadu_si128((const __m128i*)p);
+        const __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+        acc = _mm_add_epi64(acc, _mm_add_epi64(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero)));
+    }
+    sum = (unsigned int)_mm_cvtsi128_si32(acc) + (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#else
+    uint64_t acc = 0;
+    for (; STRIPE_SIZE <= size; size -= STRIPE_SIZE, p += STRIPE_SIZE)
+    {
+        acc += block_sum_stripe(read64(p), read64(p + 8), read64(p + 16), read64(p + 24));
+    }
+    sum = (unsigned int)acc;
+#endif
+    for (; size; --size, ++p)
+    {
+        sum += *p;
+    }
+    return (0U - sum) & 0xFFFFU;
+}
+
+unsigned long long block_hash(const void *mem, unsigned int size, unsigned long long seed)
+{
+    const unsigned char *p = (const unsigned char*)mem;
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+    uint64_t h;
+    const unsigned int len = size;
+    if (STRIPE_SIZE <= size)
+    {
+        for (; STRIPE_SIZE <= size; size -= STRIPE_SIZE, p += STRIPE_SIZE)
+        {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    }
+    else
+    {
+        h = seed + PRIME64_5;
+    }
+    return xxh64_finish(h + len, p, size);
+}
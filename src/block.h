@@ -0,0 +1,39 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef BLOCK_H__
+#define BLOCK_H__
+
+/* Per flash block summary of an image. Computed once after an image has been
+ * loaded and shared by program, verify and later phases. */
+typedef struct
+{
+    unsigned char blank;        /* all bytes are 0xFF */
+    unsigned short checksum;    /* RL78 checksum of the block */
+    unsigned long long hash;    /* XXH64 of the block */
+} block_info_t;
+
+void block_scan(const void *mem, unsigned int size, unsigned int block_size, block_info_t *blocks);
+void block_update(const void *mem, unsigned int size, unsigned int block_size, block_info_t *blocks,
+                  const unsigned char *dirty);
+int block_is_blank(const void *mem, unsigned int size);
+unsigned int block_checksum(const void *mem, unsigned int size);
+unsigned long long block_hash(const void *mem, unsigned int size, unsigned long long seed);
+
+#endif // BLOCK_H__
@@ -0,0 +1,512 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "capture.h"
+#include "session.h"
+#include "transport.h"
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPTURE_MAGIC       "RL78CAP\1"
+#define CAPTURE_MAGIC_SIZE  8
+#define CAPTURE_HEADER_SIZE 11
+
+struct capture
+{
+    const rl78_transport_t *lower;  /* transport of the session before the capture */
+    void *lower_ctx;
+    FILE *f;                        /* capture */
+    unsigned long long last;        /* us, time of the previous record */
+    int error;
+    unsigned char *data;            /* replay: the whole file */
+    size_t size;
+    size_t pos;
+    unsigned long record;           /* replay: number of the next record, from 1 */
+    int diverged;
+};
+
+typedef struct
+{
+    int type;
+    unsigned int arg;
+    unsigned int len;
+    const unsigned char *data;
+} capture_record_t;
+
+static const char *const capture_names[] =
+{
+    "nothing", "open", "baud", "parity", "dtr", "rts", "txd", "flush", "write", "read", "delay", "close"
+};
+
+static
+const char *capture_name(int type)
+{
+    return 0 <= type && CAPTURE_CLOSE >= type ? capture_names[type] : "unknown";
+}
+
+static
+void capture_put32(unsigned char *p, unsigned long long value)
+{
+    if (0xFFFFFFFFULL < value)
+    {
+        value = 0xFFFFFFFFULL;
+    }
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static
+unsigned int capture_get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static
+void capture_write_record(capture_t *c, int type, unsigned int arg, const void *data, int len)
+{
+    unsigned char header[CAPTURE_HEADER_SIZE];
+    const unsigned long long now = latency_now();
+    if (0 > len)
+    {
+        len = 0;
+    }
+    header[0] = type;
+    capture_put32(&header[1], now - c->last);
+    capture_put32(&header[5], arg);
+    header[9] = len;
+    header[10] = len >> 8;
+    c->last = now;
+    if (CAPTURE_HEADER_SIZE != fwrite(header, 1, CAPTURE_HEADER_SIZE, c->f)
+        || (0 < len && (size_t)len != fwrite(data, 1, len, c->f)))
+    {
+        c->error = 1;
+    }
+}
+
+static
+int capture_open(void *ctx, rl78_session_t *s, const char *port)
+{
+    capture_t *c = (capture_t*)ctx;
+    const int rc = transport_open(c->lower, c->lower_ctx, s, port);
+    capture_write_record(c, CAPTURE_OPEN, 0, port, strlen(port));
+    return rc;
+}
+
+static
+int capture_set_baud(void *ctx, rl78_session_t *s, int baud)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_write_record(c, CAPTURE_BAUD, baud, NULL, 0);
+    return transport_set_baud(c->lower, c->lower_ctx, s, baud);
+}
+
+static
+int capture_set_parity(void *ctx, rl78_session_t *s, int enable, int odd_parity)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_write_record(c, CAPTURE_PARITY, (enable ? 1 : 0) | (odd_parity ? 2 : 0), NULL, 0);
+    return transport_set_parity(c->lower, c->lower_ctx, s, enable, odd_parity);
+}
+
+static
+int capture_set_dtr(void *ctx, rl78_session_t *s, int level)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_write_record(c, CAPTURE_DTR, level, NULL, 0);
+    return transport_set_dtr(c->lower, c->lower_ctx, s, level);
+}
+
+static
+int capture_set_rts(void *ctx, rl78_session_t *s, int level)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_write_record(c, CAPTURE_RTS, level, NULL, 0);
+    return transport_set_rts(c->lower, c->lower_ctx, s, level);
+}
+
+static
+int capture_set_txd(void *ctx, rl78_session_t *s, int level)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_write_record(c, CAPTURE_TXD, level, NULL, 0);
+    return transport_set_txd(c->lower, c->lower_ctx, s, level);
+}
+
+static
+int capture_flush(void *ctx, rl78_session_t *s)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_write_record(c, CAPTURE_FLUSH, 0, NULL, 0);
+    return transport_flush(c->lower, c->lower_ctx, s);
+}
+
+static
+int capture_write(void *ctx, rl78_session_t *s, const void *buf, int len)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_write_record(c, CAPTURE_WRITE, 0, buf, len);
+    return transport_write(c->lower, c->lower_ctx, s, buf, len);
+}
+
+/* A failed read is captured as a read without data, a timeout */
+static
+int capture_read(void *ctx, rl78_session_t *s, void *buf, int len)
+{
+    capture_t *c = (capture_t*)ctx;
+    const int rc = transport_read(c->lower, c->lower_ctx, s, buf, len);
+    capture_write_record(c, CAPTURE_READ, len, buf, rc);
+    return rc;
+}
+
+static
+void capture_delay(void *ctx, rl78_session_t *s, unsigned int us)
+{
+    capture_t *c = (capture_t*)ctx;
+    transport_delay(c->lower, c->lower_ctx, s, us);
+    capture_write_record(c, CAPTURE_DELAY, us, NULL, 0);
+}
+
+static
+int capture_close(void *ctx, rl78_session_t *s)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_write_record(c, CAPTURE_CLOSE, 0, NULL, 0);
+    return transport_close(c->lower, c->lower_ctx, s);
+}
+
+static const rl78_transport_t capture_transport =
+{
+    capture_open,
+    capture_set_baud,
+    capture_set_parity,
+    capture_set_dtr,
+    capture_set_rts,
+    capture_set_txd,
+    capture_flush,
+    capture_write,
+    capture_read,
+    capture_delay,
+    capture_close,
+};
+
+static
+capture_t *capture_attach(rl78_session_t *s, const rl78_transport_t *transport)
+{
+    capture_t *c = calloc(1, sizeof *c);
+    if (NULL != c)
+    {
+        c->lower = s->transport;
+        c->lower_ctx = s->transport_ctx;
+        c->record = 1;
+        s->transport = transport;
+        s->transport_ctx = c;
+    }
+    return c;
+}
+
+capture_t *capture_start(rl78_session_t *s, const char *filename)
+{
+    FILE *f = fopen(filename, "wb");
+    if (NULL == f)
+    {
+        return NULL;
+    }
+    if (CAPTURE_MAGIC_SIZE != fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_SIZE, f))
+    {
+        fclose(f);
+        return NULL;
+    }
+    capture_t *c = capture_attach(s, &capture_transport);
+    if (NULL == c)
+    {
+        fclose(f);
+        return NULL;
+    }
+    c->f = f;
+    c->last = latency_now();
+    return c;
+}
+
+static
+int capture_diverge(capture_t *c, rl78_session_t *s, const char *what)
+{
+    rl78_log(&s->log, RL78_LOG_ERROR, "Replay diverges at record %lu: %s\n", c->record, what);
+    c->diverged = 1;
+    return -1;
+}
+
+/* Parse the record at the current position; 0 if there is one */
+static
+int capture_peek(capture_t *c, capture_record_t *r)
+{
+    if (CAPTURE_HEADER_SIZE > c->size - c->pos)
+    {
+        return -1;
+    }
+    const unsigned char *p = &c->data[c->pos];
+    r->type = p[0];
+    r->arg = capture_get32(&p[5]);
+    r->len = p[9] | (p[10] << 8);
+    r->data = &p[CAPTURE_HEADER_SIZE];
+    return CAPTURE_HEADER_SIZE + r->len > c->size - c->pos ? -1 : 0;
+}
+
+static
+void capture_skip(capture_t *c, const capture_record_t *r)
+{
+    c->pos += CAPTURE_HEADER_SIZE + r->len;
+    ++c->record;
+}
+
+/* Take the next record, which must be of the given type; delays of the
+ * captured run are passed over */
+static
+int capture_next(capture_t *c, rl78_session_t *s, int type, capture_record_t *r)
+{
+    char what[64];
+    if (c->diverged)
+    {
+        return -1;
+    }
+    for (;;)
+    {
+        if (0 != capture_peek(c, r))
+        {
+            snprintf(what, sizeof what, "%s expected, the capture ends", capture_name(type));
+            return capture_diverge(c, s, what);
+        }
+        if (CAPTURE_DELAY != r->type)
+        {
+            break;
+        }
+        capture_skip(c, r);
+    }
+    if (type != r->type)
+    {
+        snprintf(what, sizeof what, "%s expected, %s found", capture_name(type), capture_name(r->type));
+        return capture_diverge(c, s, what);
+    }
+    return 0;
+}
+
+/* Take the next record of a line setting, which must have the same value */
+static
+int capture_replay_setting(capture_t *c, rl78_session_t *s, int type, unsigned int arg)
+{
+    capture_record_t r;
+    if (0 != capture_next(c, s, type, &r))
+    {
+        return -1;
+    }
+    if (arg != r.arg)
+    {
+        char what[64];
+        snprintf(what, sizeof what, "%s %u expected, %u found", capture_name(type), r.arg, arg);
+        return capture_diverge(c, s, what);
+    }
+    capture_skip(c, &r);
+    return 0;
+}
+
+static
+int capture_replay_open(void *ctx, rl78_session_t *s, const char *port)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_record_t r;
+    if (0 != capture_next(c, s, CAPTURE_OPEN, &r))
+    {
+        return -1;
+    }
+    capture_skip(c, &r);
+    s->port_name = port;
+    return 0;
+}
+
+static
+int capture_replay_set_baud(void *ctx, rl78_session_t *s, int baud)
+{
+    return capture_replay_setting((capture_t*)ctx, s, CAPTURE_BAUD, baud);
+}
+
+static
+int capture_replay_set_parity(void *ctx, rl78_session_t *s, int enable, int odd_parity)
+{
+    return capture_replay_setting((capture_t*)ctx, s, CAPTURE_PARITY, (enable ? 1 : 0) | (odd_parity ? 2 : 0));
+}
+
+static
+int capture_replay_set_dtr(void *ctx, rl78_session_t *s, int level)
+{
+    return capture_replay_setting((capture_t*)ctx, s, CAPTURE_DTR, level);
+}
+
+static
+int capture_replay_set_rts(void *ctx, rl78_session_t *s, int level)
+{
+    return capture_replay_setting((capture_t*)ctx, s, CAPTURE_RTS, level);
+}
+
+static
+int capture_replay_set_txd(void *ctx, rl78_session_t *s, int level)
+{
+    return capture_replay_setting((capture_t*)ctx, s, CAPTURE_TXD, level);
+}
+
+static
+int capture_replay_flush(void *ctx, rl78_session_t *s)
+{
+    return capture_replay_setting((capture_t*)ctx, s, CAPTURE_FLUSH, 0);
+}
+
+static
+int capture_replay_write(void *ctx, rl78_session_t *s, const void *buf, int len)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_record_t r;
+    if (0 != capture_next(c, s, CAPTURE_WRITE, &r))
+    {
+        return -1;
+    }
+    if ((unsigned int)len != r.len
+        || 0 != memcmp(buf, r.data, len))
+    {
+        char what[64];
+        snprintf(what, sizeof what, "%i bytes sent differ from the %u captured", len, r.len);
+        return capture_diverge(c, s, what);
+    }
+    capture_skip(c, &r);
+    return len;
+}
+
+static
+int capture_replay_read(void *ctx, rl78_session_t *s, void *buf, int len)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_record_t r;
+    if (0 != capture_next(c, s, CAPTURE_READ, &r))
+    {
+        return -1;
+    }
+    if ((unsigned int)len != r.arg
+        || r.len > r.arg)
+    {
+        char what[64];
+        snprintf(what, sizeof what, "read of %u bytes expected, %i requested", r.arg, len);
+        return capture_diverge(c, s, what);
+    }
+    memcpy(buf, r.data, r.len);
+    capture_skip(c, &r);
+    return r.len;
+}
+
+/* Delays are not waited for, the run goes at full speed */
+static
+void capture_replay_delay(void *ctx, rl78_session_t *s, unsigned int us)
+{
+    capture_t *c = (capture_t*)ctx;
+    capture_record_t r;
+    (void)s;
+    (void)us;
+    if (!c->diverged
+        && 0 == capture_peek(c, &r)
+        && CAPTURE_DELAY == r.type)
+    {
+        capture_skip(c, &r);
+    }
+}
+
+static
+int capture_replay_close(void *ctx, rl78_session_t *s)
+{
+    return capture_replay_setting((capture_t*)ctx, s, CAPTURE_CLOSE, 0);
+}
+
+static const rl78_transport_t capture_replay_transport =
+{
+    capture_replay_open,
+    capture_replay_set_baud,
+    capture_replay_set_parity,
+    capture_replay_set_dtr,
+    capture_replay_set_rts,
+    capture_replay_set_txd,
+    capture_replay_flush,
+    capture_replay_write,
+    capture_replay_read,
+    capture_replay_delay,
+    capture_replay_close,
+};
+
+capture_t *capture_replay(rl78_session_t *s, const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (NULL == f)
+    {
+        return NULL;
+    }
+    unsigned char *data = NULL;
+    long size = -1;
+    if (0 == fseek(f, 0, SEEK_END))
+    {
+        size = ftell(f);
+    }
+    if (CAPTURE_MAGIC_SIZE <= size
+        && 0 == fseek(f, 0, SEEK_SET))
+    {
+        data = malloc(size);
+    }
+    if (NULL == data
+        || (size_t)size != fread(data, 1, size, f)
+        || 0 != memcmp(data, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE))
+    {
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    capture_t *c = capture_attach(s, &capture_replay_transport);
+    if (NULL == c)
+    {
+        free(data);
+        return NULL;
+    }
+    c->data = data;
+    c->size = size;
+    c->pos = CAPTURE_MAGIC_SIZE;
+    return c;
+}
+
+int capture_stop(rl78_session_t *s, capture_t *c)
+{
+    int rc = c->diverged ? -1 : 0;
+    s->transport = c->lower;
+    s->transport_ctx = c->lower_ctx;
+    if (NULL != c->f
+        && (0 != fclose(c->f) || c->error))
+    {
+        rc = -1;
+    }
+    free(c->data);
+    free(c);
+    return rc;
+}
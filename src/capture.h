@@ -0,0 +1,63 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef CAPTURE_H__
+#define CAPTURE_H__
+
+/* Binary capture of everything a session does on the line, and a transport
+ * which plays a capture back to the protocol code instead of a port.
+ *
+ * A capture file starts with the 8 bytes "RL78CAP\1", followed by records of
+ * a little-endian header and len bytes of data:
+ *
+ *   type   1 byte    CAPTURE_*
+ *   delta  4 bytes   us since the previous record
+ *   arg    4 bytes   baud rate, line level, requested length, ...
+ *   len    2 bytes   length of the data
+ *
+ * A replay answers each read with the bytes captured for it, at once, and
+ * fails as soon as the session does something else than the captured run. */
+
+#define CAPTURE_OPEN    1       /* data: port name */
+#define CAPTURE_BAUD    2       /* arg: baud rate */
+#define CAPTURE_PARITY  3       /* arg: bit 0 - enable, bit 1 - odd */
+#define CAPTURE_DTR     4       /* arg: level */
+#define CAPTURE_RTS     5       /* arg: level */
+#define CAPTURE_TXD     6       /* arg: level, 0 is a break */
+#define CAPTURE_FLUSH   7
+#define CAPTURE_WRITE   8       /* data: bytes sent */
+#define CAPTURE_READ    9       /* arg: bytes requested, data: bytes received */
+#define CAPTURE_DELAY   10      /* arg: us */
+#define CAPTURE_CLOSE   11
+
+typedef struct rl78_session rl78_session_t;
+typedef struct capture capture_t;
+
+/* Record the line activity of s to filename, on top of its current
+ * transport; NULL if the file cannot be created */
+capture_t *capture_start(rl78_session_t *s, const char *filename);
+/* Serve s from the capture in filename instead of a port; NULL if the file
+ * cannot be read */
+capture_t *capture_replay(rl78_session_t *s, const char *filename);
+/* Give s its previous transport back; 0 if the capture has been written or
+ * the replay has not diverged */
+int capture_stop(rl78_session_t *s, capture_t *c);
+
+#endif  // CAPTURE_H__
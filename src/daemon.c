@@ -0,0 +1,723 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "daemon.h"
+#include "session.h"
+#include "block.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define DAEMON_LINE_LENGTH  4096
+#define DAEMON_READ_CHUNK   65536
+
+typedef struct
+{
+    const char *name;
+    rl78_session_t session;
+    job_machine_t job;
+    job_result_t result;
+    const char *step;           /* last step reported to the client */
+    int selected;
+    const image_t *image;       /* of the request, shared by the ports */
+    const patch_table_t *patches;
+    unsigned int unit;
+    image_t patched;            /* copy of the image with the values of the unit */
+} daemon_port_t;
+
+typedef struct
+{
+    int valid;
+    unsigned long long key;     /* hash of the contents of the files */
+    unsigned long used;         /* request counter value of the last use */
+    image_t image;
+} daemon_image_t;
+
+typedef struct
+{
+    int client;
+    daemon_port_t *ports;
+    unsigned int nports;
+    daemon_port_t **running;
+    rl78_fsm_t **machines;
+    daemon_image_t cache[DAEMON_CACHE_SIZE];
+    unsigned long requests;
+    int parallel;
+    unsigned int threads;
+    const rl78_log_t *log;
+    job_options_t options;
+    const patch_table_t *patches;
+    const metrics_t *metrics;
+} daemon_t;
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static
+void daemon_signal(int sig)
+{
+    (void)sig;
+    daemon_stop = 1;
+}
+
+static
+void daemon_reply(daemon_t *d, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static
+void daemon_reply(daemon_t *d, const char *format, ...)
+{
+    if (0 > d->client)
+    {
+        return;
+    }
+    char line[DAEMON_LINE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof line - 1, format, args);
+    va_end(args);
+    if (0 > len)
+    {
+        return;
+    }
+    if ((int)sizeof line - 1 <= len)
+    {
+        len = sizeof line - 2;
+    }
+    line[len++] = '\n';
+    const char *p = line;
+    while (0 < len)
+    {
+        const ssize_t n = send(d->client, p, len, MSG_NOSIGNAL);
+        if (0 > n)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            // The client has gone; the request is completed anyway
+            d->client = -1;
+            return;
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+static
+void daemon_metric(void *ctx, const char *line)
+{
+    daemon_reply((daemon_t*)ctx, "metric %s", line);
+}
+
+/* Files are hashed in the given order: the same files in another order may
+ * give another image, if their records overlap. */
+static
+int daemon_hash_files(daemon_t *d, char *const *filenames, unsigned int nfiles, unsigned long long *key)
+{
+    unsigned char *chunk = malloc(DAEMON_READ_CHUNK);
+    if (NULL == chunk)
+    {
+        daemon_reply(d, "error Out of memory");
+        return -1;
+    }
+    unsigned long long hash = nfiles;
+    unsigned int i;
+    for (i = 0; i < nfiles; ++i)
+    {
+        FILE *file = fopen(filenames[i], "rb");
+        if (NULL == file)
+        {
+            daemon_reply(d, "error Unable to open file %s: %s", filenames[i], strerror(errno));
+            free(chunk);
+            return -1;
+        }
+        size_t len;
+        while (0 < (len = fread(chunk, 1, DAEMON_READ_CHUNK, file)))
+        {
+            hash = block_hash(chunk, len, hash);
+        }
+        const int failed = ferror(file);
+        fclose(file);
+        if (failed)
+        {
+            daemon_reply(d, "error Unable to read file %s", filenames[i]);
+            free(chunk);
+            return -1;
+        }
+        // Separates the files, so moving bytes between them changes the key
+        hash = block_hash(&i, sizeof i, hash);
+    }
+    free(chunk);
+    *key = hash;
+    return 0;
+}
+
+static
+const image_t *daemon_load_image(daemon_t *d, char *const *filenames, unsigned int nfiles)
+{
+    unsigned long long key;
+    if (0 != daemon_hash_files(d, filenames, nfiles, &key))
+    {
+        return NULL;
+    }
+    daemon_image_t *slot = &d->cache[0];
+    unsigned int i;
+    for (i = 0; i < DAEMON_CACHE_SIZE; ++i)
+    {
+        daemon_image_t *entry = &d->cache[i];
+        if (entry->valid && key == entry->key)
+        {
+            entry->used = d->requests;
+            daemon_reply(d, "image %016llx cached", key);
+            return &entry->image;
+        }
+        // Reuse a free slot or the least recently used one
+        if (slot->valid
+            && (!entry->valid || entry->used < slot->used))
+        {
+            slot = entry;
+        }
+    }
+    if (slot->valid)
+    {
+        image_free(&slot->image);
+        slot->valid = 0;
+    }
+    if (0 != image_init(&slot->image, IMAGE_CODE_MAX_SIZE, IMAGE_DATA_MAX_SIZE, d->log))
+    {
+        daemon_reply(d, "error Out of memory");
+        return NULL;
+    }
+    if (0 != image_load(&slot->image, (const char *const *)filenames, nfiles, d->parallel, d->threads, d->log))
+    {
+        image_free(&slot->image);
+        daemon_reply(d, "error Unable to load image");
+        return NULL;
+    }
+    slot->valid = 1;
+    slot->key = key;
+    slot->used = d->requests;
+    daemon_reply(d, "image %016llx loaded", key);
+    return &slot->image;
+}
+
+static
+const image_t *daemon_get_image(void *ctx, const job_result_t *device)
+{
+    daemon_port_t *port = (daemon_port_t*)ctx;
+    (void)device;
+    if (NULL == port->patches
+        || NULL == port->image)
+    {
+        return port->image;
+    }
+    // The cached image is left as it has been loaded
+    if (0 != image_patch_copy(&port->patched, port->image, port->patches, port->unit, &port->session.log))
+    {
+        rl78_log(&port->session.log, RL78_LOG_ERROR, "Patching failed\n");
+        return NULL;
+    }
+    return &port->patched;
+}
+
+static
+void daemon_report_step(daemon_t *d, daemon_port_t *port)
+{
+    const char *step = job_machine_step_name(&port->job);
+    if (step != port->step
+        && RL78_FSM_DONE != port->job.fsm.status)
+    {
+        daemon_reply(d, "step %s %s", port->name, step);
+    }
+    port->step = step;
+}
+
+static
+void daemon_next(void *ctx, rl78_fsm_t *m, unsigned int index)
+{
+    daemon_t *d = (daemon_t*)ctx;
+    (void)m;
+    job_machine_next(&d->running[index]->job);
+    daemon_report_step(d, d->running[index]);
+}
+
+static
+int daemon_parse_actions(const char *actions, job_options_t *options)
+{
+    memset(options, 0, sizeof *options);
+    for (; '\0' != *actions; ++actions)
+    {
+        switch (*actions)
+        {
+        case 'a':
+            options->erase = 1;
+            options->write = 1;
+            options->verify = 1;
+            options->reset_after = 1;
+            break;
+        case 'e':
+            options->erase = 1;
+            break;
+        case 'w':
+            options->write = 1;
+            break;
+        case 'c':
+            options->verify = 1;
+            break;
+        case 'r':
+            options->reset_after = 1;
+            break;
+        case 'i':
+            options->display_info = 1;
+            break;
+        case 'x':
+            options->nodata = 1;
+            break;
+        case 'y':
+            options->nocode = 1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static
+int daemon_select_ports(daemon_t *d, char *list)
+{
+    unsigned int i;
+    for (i = 0; i < d->nports; ++i)
+    {
+        d->ports[i].selected = (0 == strcmp(list, "all"));
+    }
+    if (0 == strcmp(list, "all"))
+    {
+        return 0;
+    }
+    char *save;
+    char *name;
+    for (name = strtok_r(list, ",", &save); NULL != name; name = strtok_r(NULL, ",", &save))
+    {
+        for (i = 0; i < d->nports; ++i)
+        {
+            if (0 == strcmp(name, d->ports[i].name))
+            {
+                d->ports[i].selected = 1;
+                break;
+            }
+        }
+        if (d->nports == i)
+        {
+            daemon_reply(d, "error Unknown port %s", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static
+int daemon_flash(daemon_t *d, char **words, unsigned int nwords)
+{
+    if (2 > nwords)
+    {
+        daemon_reply(d, "error Usage: flash <actions> <ports> [unit=<n>] [<file>...]");
+        return EINVAL;
+    }
+    job_options_t *options = &d->options;
+    if (0 != daemon_parse_actions(words[0], options))
+    {
+        daemon_reply(d, "error Unknown action in %s", words[0]);
+        return EINVAL;
+    }
+    if (0 != daemon_select_ports(d, words[1]))
+    {
+        return EINVAL;
+    }
+    unsigned int files = 2;
+    int has_unit = 0;
+    unsigned int unit = 0;
+    if (files < nwords
+        && 0 == strncmp(words[files], "unit=", 5))
+    {
+        char *endp;
+        unit = strtoul(words[files] + 5, &endp, 10);
+        if (words[files] + 5 == endp
+            || '\0' != *endp)
+        {
+            daemon_reply(d, "error Invalid unit %s", words[files] + 5);
+            return EINVAL;
+        }
+        has_unit = 1;
+        ++files;
+    }
+    if (has_unit
+        && NULL == d->patches)
+    {
+        daemon_reply(d, "error Unit given, but no patch table (-P)");
+        return EINVAL;
+    }
+    const image_t *image = NULL;
+    if (options->write || options->verify)
+    {
+        // Every board would get the values of the same unit
+        if (NULL != d->patches
+            && !has_unit)
+        {
+            daemon_reply(d, "error Unit not specified");
+            return EINVAL;
+        }
+        if (files == nwords)
+        {
+            daemon_reply(d, "error File not specified");
+            return ENOENT;
+        }
+        image = daemon_load_image(d, &words[files], nwords - files);
+        if (NULL == image)
+        {
+            return EIO;
+        }
+    }
+    unsigned int i;
+    unsigned int n = 0;
+    for (i = 0; i < d->nports; ++i)
+    {
+        daemon_port_t *port = &d->ports[i];
+        if (!port->selected)
+        {
+            continue;
+        }
+        port->image = image;
+        port->patches = has_unit ? d->patches : NULL;
+        if (has_unit)
+        {
+            port->unit = unit++;
+            daemon_reply(d, "unit %s %u", port->name, port->unit);
+        }
+        memset(&port->result, 0, sizeof port->result);
+        // A port which could not be opened before is given another chance
+        if (INVALID_HANDLE_VALUE == port->session.fd
+            && 0 != serial_open(&port->session, port->name))
+        {
+            port->result.retcode = EBADF;
+            port->result.error = "Unable to open port";
+            continue;
+        }
+        port->step = NULL;
+        job_machine_start(&port->job, &port->session, options, daemon_get_image, port, &port->result);
+        daemon_report_step(d, port);
+        d->machines[n] = &port->job.fsm;
+        d->running[n] = port;
+        ++n;
+    }
+    if (0 != rl78_fsm_run(d->machines, n, daemon_next, d))
+    {
+        for (i = 0; i < n; ++i)
+        {
+            d->running[i]->result.retcode = EIO;
+            d->running[i]->result.error = "Unable to start event loop";
+        }
+    }
+    int retcode = 0;
+    for (i = 0; i < d->nports; ++i)
+    {
+        const daemon_port_t *port = &d->ports[i];
+        if (!port->selected)
+        {
+            continue;
+        }
+        const job_result_t *result = &port->result;
+        // Device names are padded with spaces, which would split the reply
+        char device[sizeof result->device_name];
+        memcpy(device, result->device_name, sizeof device);
+        device[sizeof device - 1] = '\0';
+        char *end = device + strlen(device);
+        while (device < end && ' ' == end[-1])
+        {
+            *--end = '\0';
+        }
+        daemon_reply(d, "done %s %s %d %s %.2f %s",
+                     port->name,
+                     (0 == result->retcode) ? "OK" : "FAILED",
+                     result->retcode,
+                     ('\0' != device[0]) ? device : "-",
+                     result->seconds,
+                     (NULL != result->error) ? result->error : "");
+        metrics_job(port->session.metrics, port->name, &port->session, result);
+        if (0 == retcode)
+        {
+            retcode = result->retcode;
+        }
+    }
+    return retcode;
+}
+
+static
+int daemon_request(daemon_t *d, char *line)
+{
+    char *words[DAEMON_LINE_LENGTH / 2];
+    unsigned int nwords = 0;
+    char *save;
+    char *word;
+    for (word = strtok_r(line, " \t\r\n", &save); NULL != word; word = strtok_r(NULL, " \t\r\n", &save))
+    {
+        words[nwords++] = word;
+    }
+    if (0 == nwords)
+    {
+        return 0;
+    }
+    ++d->requests;
+    int retcode = 0;
+    if (0 == strcmp(words[0], "flash"))
+    {
+        retcode = daemon_flash(d, &words[1], nwords - 1);
+    }
+    else if (0 == strcmp(words[0], "ports"))
+    {
+        unsigned int i;
+        for (i = 0; i < d->nports; ++i)
+        {
+            daemon_reply(d, "port %s %s", d->ports[i].name,
+                         (INVALID_HANDLE_VALUE != d->ports[i].session.fd) ? "open" : "closed");
+        }
+    }
+    else if (0 == strcmp(words[0], "metrics"))
+    {
+        metrics_emit(d->metrics, daemon_metric, d);
+    }
+    else if (0 == strcmp(words[0], "shutdown"))
+    {
+        daemon_stop = 1;
+    }
+    else
+    {
+        daemon_reply(d, "error Unknown request %s", words[0]);
+        retcode = EINVAL;
+    }
+    daemon_reply(d, "end %d", retcode);
+    return retcode;
+}
+
+/* Requests are served one at a time, so a client which neither sends nor
+ * reads would hold off all the others; it is dropped after the timeout */
+static
+void daemon_serve(daemon_t *d, int client)
+{
+    struct timeval timeout;
+    timeout.tv_sec = DAEMON_IDLE_TIMEOUT;
+    timeout.tv_usec = 0;
+    if (0 != setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout)
+        || 0 != setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout))
+    {
+        rl78_log(d->log, RL78_LOG_ERROR, "Unable to set client timeout: %s\n", strerror(errno));
+        close(client);
+        return;
+    }
+    FILE *in = fdopen(client, "r");
+    if (NULL == in)
+    {
+        close(client);
+        return;
+    }
+    d->client = client;
+    char line[DAEMON_LINE_LENGTH];
+    while (!daemon_stop
+           && NULL != fgets(line, sizeof line, in))
+    {
+        if (NULL == strchr(line, '\n')
+            && !feof(in))
+        {
+            // Skip the rest of an overlong request
+            int c;
+            while (EOF != (c = fgetc(in)) && '\n' != c)
+            {
+            }
+            daemon_reply(d, "error Request is too long");
+            daemon_reply(d, "end %d", EINVAL);
+            continue;
+        }
+        daemon_request(d, line);
+    }
+    if (ferror(in)
+        && (EAGAIN == errno || EWOULDBLOCK == errno))
+    {
+        rl78_log(d->log, 1, "Client idle for %u s, closing\n", DAEMON_IDLE_TIMEOUT);
+    }
+    d->client = -1;
+    fclose(in);
+}
+
+/* Remove the socket of a previous instance; anything else at the path is
+ * left alone */
+static
+int daemon_unlink(const char *socket_path, const rl78_log_t *log)
+{
+    struct stat st;
+    if (0 != lstat(socket_path, &st))
+    {
+        if (ENOENT == errno)
+        {
+            return 0;
+        }
+        rl78_log(log, RL78_LOG_ERROR, "Unable to stat %s: %s\n", socket_path, strerror(errno));
+        return -1;
+    }
+    if (!S_ISSOCK(st.st_mode))
+    {
+        rl78_log(log, RL78_LOG_ERROR, "%s exists and is not a socket\n", socket_path);
+        return -1;
+    }
+    return unlink(socket_path);
+}
+
+static
+int daemon_listen(const char *socket_path, const rl78_log_t *log)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (sizeof addr.sun_path <= strlen(socket_path))
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Socket path is too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (0 > fd)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    // A socket left by a previous instance would make bind() fail
+    if (0 != daemon_unlink(socket_path, log))
+    {
+        close(fd);
+        return -1;
+    }
+    if (0 != bind(fd, (struct sockaddr*)&addr, sizeof addr)
+        || 0 != listen(fd, 8))
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int daemon_run(const char *socket_path, char *const *ports, unsigned int nports,
+               const rl78_session_t *defaults, int parallel, unsigned int threads,
+               const patch_table_t *patches)
+{
+    daemon_t d;
+    memset(&d, 0, sizeof d);
+    d.client = -1;
+    d.nports = nports;
+    d.parallel = parallel;
+    d.threads = threads;
+    d.patches = (NULL != patches && 0 < patches->count) ? patches : NULL;
+    d.log = &defaults->log;
+    d.metrics = defaults->metrics;
+    d.ports = calloc(nports, sizeof *d.ports);
+    d.running = calloc(nports, sizeof *d.running);
+    d.machines = calloc(nports, sizeof *d.machines);
+    if (NULL == d.ports
+        || NULL == d.running
+        || NULL == d.machines)
+    {
+        free(d.ports);
+        free(d.running);
+        free(d.machines);
+        rl78_log(d.log, RL78_LOG_ERROR, "Out of memory\n");
+        return ENOMEM;
+    }
+    const int listen_fd = daemon_listen(socket_path, d.log);
+    if (0 > listen_fd)
+    {
+        free(d.ports);
+        free(d.running);
+        free(d.machines);
+        return EIO;
+    }
+    unsigned int i;
+    for (i = 0; i < nports; ++i)
+    {
+        d.ports[i].name = ports[i];
+        d.ports[i].session = *defaults;
+        d.ports[i].session.latency = metrics_latency(defaults->metrics, ports[i]);
+        // Ports which are missing now are opened by the first request for them
+        serial_open(&d.ports[i].session, ports[i]);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = daemon_signal;
+    sigemptyset(&action.sa_mask);
+    // No SA_RESTART: accept() must return to check the flag
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    rl78_log(d.log, 1, "Listening on %s\n", socket_path);
+    while (!daemon_stop)
+    {
+        const int client = accept(listen_fd, NULL, NULL);
+        if (0 > client)
+        {
+            if (EINTR == errno || ECONNABORTED == errno)
+            {
+                continue;
+            }
+            rl78_log(d.log, RL78_LOG_ERROR, "Unable to accept connection: %s\n", strerror(errno));
+            break;
+        }
+        daemon_serve(&d, client);
+    }
+
+    close(listen_fd);
+    daemon_unlink(socket_path, d.log);
+    for (i = 0; i < nports; ++i)
+    {
+        if (INVALID_HANDLE_VALUE != d.ports[i].session.fd)
+        {
+            serial_close(&d.ports[i].session);
+        }
+        image_free(&d.ports[i].patched);
+    }
+    for (i = 0; i < DAEMON_CACHE_SIZE; ++i)
+    {
+        if (d.cache[i].valid)
+        {
+            image_free(&d.cache[i].image);
+        }
+    }
+    free(d.ports);
+    free(d.running);
+    free(d.machines);
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef DAEMON_H__
+#define DAEMON_H__
+
+#include "job.h"
+
+#define DAEMON_CACHE_SIZE   4       /* parsed images kept in memory */
+#define DAEMON_IDLE_TIMEOUT 30      /* s, of a silent client */
+
+/* Serve flashing jobs on a Unix domain socket. The ports are opened once and
+ * kept open; every port gets its own copy of the default session. Parsed
+ * images are cached by the hash of the contents of their files. The default
+ * session must have metrics; they count every job.
+ *
+ * One request per line, words are separated by spaces:
+ *   flash <actions> <port>[,<port>...]|all [unit=<n>] [<file>...]
+ *       actions are option letters: a, e, w, c, r, i, x, y; the unit is
+ *       required to write or verify with a patch table, the selected ports
+ *       take units <n>, <n>+1 and so on in the order the daemon was given
+ *       them
+ *   ports
+ *   metrics
+ *   shutdown
+ * Replies are lines as well:
+ *   image <hash> cached|loaded
+ *   unit <port> <n>
+ *   step <port> <step>
+ *   done <port> OK|FAILED <retcode> <device> <seconds> [<error>]
+ *   port <port> open|closed
+ *   metric <line of the Prometheus text format>
+ *   error <message>
+ *   end <retcode>
+ * Requests are served one at a time; the ports of a request run at once. A
+ * client which sends or reads nothing for DAEMON_IDLE_TIMEOUT s is dropped.
+ * An existing socket at the path is replaced, any other file is not. With a
+ * patch table (may be NULL) each port writes a patched copy of the cached
+ * image for its unit. */
+int daemon_run(const char *socket_path, char *const *ports, unsigned int nports,
+               const rl78_session_t *defaults, int parallel, unsigned int threads,
+               const patch_table_t *patches);
+
+#endif // DAEMON_H__
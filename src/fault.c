@@ -0,0 +1,334 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+#include "fault.h"
+#include "session.h"
+#include "transport.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FAULT_DEFAULT_STALL     500     /* ms */
+#define FAULT_WRITE_SIZE        (256 + 5)
+
+struct fault
+{
+    const rl78_transport_t *lower;  /* transport of the session before the faults */
+    void *lower_ctx;
+    fault_config_t config;
+    unsigned int random;            /* xorshift state */
+    fault_counts_t counts;
+};
+
+static
+unsigned int fault_next(fault_t *f)
+{
+    f->random ^= f->random << 13;
+    f->random ^= f->random >> 17;
+    f->random ^= f->random << 5;
+    return f->random;
+}
+
+/* 1 with probability p */
+static
+int fault_hit(fault_t *f, double p)
+{
+    return 0 < p && (fault_next(f) >> 8) < p * (1U << 24);
+}
+
+static
+void fault_flip(fault_t *f, unsigned char *p, int len)
+{
+    int i;
+    for (i = 0; i < len; ++i)
+    {
+        if (fault_hit(f, f->config.flip))
+        {
+            p[i] ^= 1U << (fault_next(f) & 7);
+            ++f->counts.flipped;
+        }
+    }
+}
+
+static
+int fault_open(void *ctx, rl78_session_t *s, const char *port)
+{
+    fault_t *f = (fault_t*)ctx;
+    return transport_open(f->lower, f->lower_ctx, s, port);
+}
+
+static
+int fault_set_baud(void *ctx, rl78_session_t *s, int baud)
+{
+    fault_t *f = (fault_t*)ctx;
+    return transport_set_baud(f->lower, f->lower_ctx, s, baud);
+}
+
+static
+int fault_set_parity(void *ctx, rl78_session_t *s, int enable, int odd_parity)
+{
+    fault_t *f = (fault_t*)ctx;
+    return transport_set_parity(f->lower, f->lower_ctx, s, enable, odd_parity);
+}
+
+static
+int fault_set_dtr(void *ctx, rl78_session_t *s, int level)
+{
+    fault_t *f = (fault_t*)ctx;
+    return transport_set_dtr(f->lower, f->lower_ctx, s, level);
+}
+
+static
+int fault_set_rts(void *ctx, rl78_session_t *s, int level)
+{
+    fault_t *f = (fault_t*)ctx;
+    return transport_set_rts(f->lower, f->lower_ctx, s, level);
+}
+
+static
+int fault_set_txd(void *ctx, rl78_session_t *s, int level)
+{
+    fault_t *f = (fault_t*)ctx;
+    return transport_set_txd(f->lower, f->lower_ctx, s, level);
+}
+
+static
+int fault_flush(void *ctx, rl78_session_t *s)
+{
+    fault_t *f = (fault_t*)ctx;
+    return transport_flush(f->lower, f->lower_ctx, s);
+}
+
+/* The caller is told that all of a truncated write has been sent, as it would
+ * be by a port whose line has lost the rest */
+static
+int fault_write(void *ctx, rl78_session_t *s, const void *buf, int len)
+{
+    fault_t *f = (fault_t*)ctx;
+    unsigned char data[FAULT_WRITE_SIZE];
+    int n = len;
+    if (FAULT_WRITE_SIZE < len)
+    {
+        return transport_write(f->lower, f->lower_ctx, s, buf, len);
+    }
+    memcpy(data, buf, len);
+    fault_flip(f, data, len);
+    if (1 < len
+        && fault_hit(f, f->config.truncate))
+    {
+        n = fault_next(f) % len;
+        ++f->counts.truncated;
+    }
+    const int rc = transport_write(f->lower, f->lower_ctx, s, data, n);
+    return (rc == n) ? len : rc;
+}
+
+static
+int fault_read(void *ctx, rl78_session_t *s, void *buf, int len)
+{
+    fault_t *f = (fault_t*)ctx;
+    unsigned int delay = f->config.latency;
+    int timeout = 0;
+    if (fault_hit(f, f->config.stall))
+    {
+        delay += f->config.stall_time * 1000;
+        ++f->counts.stalls;
+        // Nothing arrives within the read timeout, the data comes later
+        if (s->read_timeout <= f->config.stall_time)
+        {
+            delay = s->read_timeout * 1000;
+            timeout = 1;
+        }
+    }
+    if (0 < delay)
+    {
+        transport_delay(f->lower, f->lower_ctx, s, delay);
+        f->counts.delayed += delay;
+    }
+    if (timeout)
+    {
+        return 0;
+    }
+    const int rc = transport_read(f->lower, f->lower_ctx, s, buf, len);
+    if (0 >= rc)
+    {
+        return rc;
+    }
+    unsigned char *p = (unsigned char*)buf;
+    int n = 0;
+    int i;
+    for (i = 0; i < rc; ++i)
+    {
+        if (fault_hit(f, f->config.drop))
+        {
+            ++f->counts.dropped;
+            continue;
+        }
+        p[n++] = p[i];
+    }
+    fault_flip(f, p, n);
+    return n;
+}
+
+static
+void fault_delay(void *ctx, rl78_session_t *s, unsigned int us)
+{
+    fault_t *f = (fault_t*)ctx;
+    transport_delay(f->lower, f->lower_ctx, s, us);
+}
+
+static
+int fault_close(void *ctx, rl78_session_t *s)
+{
+    fault_t *f = (fault_t*)ctx;
+    return transport_close(f->lower, f->lower_ctx, s);
+}
+
+static const rl78_transport_t fault_transport =
+{
+    fault_open,
+    fault_set_baud,
+    fault_set_parity,
+    fault_set_dtr,
+    fault_set_rts,
+    fault_set_txd,
+    fault_flush,
+    fault_write,
+    fault_read,
+    fault_delay,
+    fault_close,
+};
+
+static
+int fault_probability(const char *value, double *p)
+{
+    char *endp;
+    *p = strtod(value, &endp);
+    return (endp != value && 0 <= *p && 1 >= *p) ? 0 : -1;
+}
+
+static
+int fault_number(const char *value, unsigned int *n, char **endp)
+{
+    *n = strtoul(value, endp, 0);
+    return (*endp != value) ? 0 : -1;
+}
+
+int fault_parse(fault_config_t *config, const char *spec)
+{
+    memset(config, 0, sizeof *config);
+    config->stall_time = FAULT_DEFAULT_STALL;
+    config->seed = 1;
+    char *copy = strdup(spec);
+    if (NULL == copy)
+    {
+        return -1;
+    }
+    int rc = 0;
+    char *item;
+    char *save = NULL;
+    for (item = strtok_r(copy, ",", &save); 0 == rc && NULL != item; item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+        char *endp = NULL;
+        if (NULL == value)
+        {
+            rc = -1;
+            break;
+        }
+        *value++ = '\0';
+        if (0 == strcmp(item, "drop"))
+        {
+            rc = fault_probability(value, &config->drop);
+        }
+        else if (0 == strcmp(item, "flip"))
+        {
+            rc = fault_probability(value, &config->flip);
+        }
+        else if (0 == strcmp(item, "truncate"))
+        {
+            rc = fault_probability(value, &config->truncate);
+        }
+        else if (0 == strcmp(item, "latency"))
+        {
+            rc = fault_number(value, &config->latency, &endp) || '\0' != *endp;
+        }
+        else if (0 == strcmp(item, "stall"))
+        {
+            char *time = strchr(value, ':');
+            if (NULL != time)
+            {
+                *time++ = '\0';
+                rc = fault_number(time, &config->stall_time, &endp) || '\0' != *endp;
+            }
+            if (0 == rc)
+            {
+                rc = fault_probability(value, &config->stall);
+            }
+        }
+        else if (0 == strcmp(item, "seed"))
+        {
+            rc = fault_number(value, &config->seed, &endp) || '\0' != *endp;
+        }
+        else
+        {
+            rc = -1;
+        }
+    }
+    free(copy);
+    return rc ? -1 : 0;
+}
+
+fault_t *fault_start(rl78_session_t *s, const fault_config_t *config)
+{
+    fault_t *f = calloc(1, sizeof *f);
+    if (NULL == f)
+    {
+        return NULL;
+    }
+    f->config = *config;
+    // xorshift never leaves 0
+    f->random = (0 != config->seed) ? config->seed : 1;
+    f->lower = s->transport;
+    f->lower_ctx = s->transport_ctx;
+    s->transport = &fault_transport;
+    s->transport_ctx = f;
+    return f;
+}
+
+const fault_counts_t *fault_counts(const fault_t *f)
+{
+    return &f->counts;
+}
+
+void fault_report(const fault_counts_t *counts, const rl78_log_t *log)
+{
+    rl78_log(log, RL78_LOG_OUTPUT, "Faults: %lu bytes dropped, %lu bytes flipped, %lu writes truncated, "
+             "%lu stalls, %llu.%03llu ms delayed\n",
+             counts->dropped, counts->flipped, counts->truncated, counts->stalls,
+             counts->delayed / 1000, counts->delayed % 1000);
+}
+
+void fault_stop(rl78_session_t *s, fault_t *f)
+{
+    s->transport = f->lower;
+    s->transport_ctx = f->lower_ctx;
+    free(f);
+}
@@ -0,0 +1,75 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+#ifndef FAULT_H__
+#define FAULT_H__
+
+/* A transport which damages the traffic of the one below it, to measure what
+ * a noisy line costs. It sits on the serial port (or a pty, or the bootloader
+ * model of model.c) like a capture. Faults are drawn from a pseudo-random
+ * sequence, so a run with the same seed injects the same faults.
+ *
+ * A spec is a comma-separated list of key=value pairs:
+ *
+ *   drop=p         drop each received byte with probability p
+ *   flip=p         flip one bit of each byte sent or received with probability p
+ *   truncate=p     send only the beginning of a write with probability p
+ *   latency=us     add us before every read
+ *   stall=p[:ms]   hold a read back for ms (default 500) with probability p
+ *   seed=n         start of the pseudo-random sequence (default 1)
+ *
+ * e.g. "drop=0.0001,flip=0.0001,stall=0.01:200". */
+
+#include "log.h"
+
+typedef struct rl78_session rl78_session_t;
+typedef struct fault fault_t;
+
+typedef struct
+{
+    double drop;
+    double flip;
+    double truncate;
+    unsigned int latency;       /* us */
+    double stall;
+    unsigned int stall_time;    /* ms */
+    unsigned int seed;
+} fault_config_t;
+
+typedef struct
+{
+    unsigned long dropped;      /* bytes */
+    unsigned long flipped;      /* bytes */
+    unsigned long truncated;    /* writes */
+    unsigned long stalls;
+    unsigned long long delayed; /* us of latency and stalls */
+} fault_counts_t;
+
+/* 0 if spec is valid */
+int fault_parse(fault_config_t *config, const char *spec);
+/* Damage the traffic of s from now on; NULL if out of memory */
+fault_t *fault_start(rl78_session_t *s, const fault_config_t *config);
+const fault_counts_t *fault_counts(const fault_t *f);
+void fault_report(const fault_counts_t *counts, const rl78_log_t *log);
+/* Give s its previous transport back */
+void fault_stop(rl78_session_t *s, fault_t *f);
+
+#endif  // FAULT_H__
@@ -0,0 +1,118 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "filelock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+#ifndef WIN32
+int filelock_acquire(const char *filename, const rl78_log_t *log)
+{
+    const size_t len = strlen(filename);
+    char *lockname = malloc(len + 6);
+    if (NULL == lockname)
+    {
+        return -1;
+    }
+    memcpy(lockname, filename, len);
+    memcpy(lockname + len, ".lock", 6);
+    int fd = open(lockname, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (0 > fd)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to open %s: %s\n", lockname, strerror(errno));
+        free(lockname);
+        return -1;
+    }
+    int rc;
+    while (0 != (rc = flock(fd, LOCK_EX))
+           && EINTR == errno)
+    {
+    }
+    if (0 != rc)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to lock %s: %s\n", lockname, strerror(errno));
+        close(fd);
+        fd = -1;
+    }
+    free(lockname);
+    return fd;
+}
+
+void filelock_release(int lock)
+{
+    // Closing the last descriptor of the file drops the lock
+    close(lock);
+}
+#else
+int filelock_acquire(const char *filename, const rl78_log_t *log)
+{
+    (void)filename;
+    (void)log;
+    return 0;
+}
+
+void filelock_release(int lock)
+{
+    (void)lock;
+}
+#endif
+
+int filelock_replace(const char *filename, filelock_write_func_t write, const void *ctx,
+                     const rl78_log_t *log)
+{
+    const size_t len = strlen(filename);
+    char *tmpname = malloc(len + 5);
+    if (NULL == tmpname)
+    {
+        return -1;
+    }
+    memcpy(tmpname, filename, len);
+    memcpy(tmpname + len, ".tmp", 5);
+    FILE *out = fopen(tmpname, "w");
+    if (NULL == out)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to write %s: %s\n", tmpname, strerror(errno));
+        free(tmpname);
+        return -1;
+    }
+    write(out, ctx);
+    int rc = 0;
+#ifdef WIN32
+    // rename() does not replace existing files there
+    const int closed = fclose(out);
+    remove(filename);
+    if (0 != closed
+#else
+    if (0 != fclose(out)
+#endif
+        || 0 != rename(tmpname, filename))
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to write %s: %s\n", filename, strerror(errno));
+        remove(tmpname);
+        rc = -1;
+    }
+    free(tmpname);
+    return rc;
+}
@@ -0,0 +1,40 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef FILELOCK_H__
+#define FILELOCK_H__
+
+#include "log.h"
+#include <stdio.h>
+
+/* Exclusive lock of a state file which is shared by processes and replaced
+ * with rename(): the lock is held on <filename>.lock, which stays in place.
+ * Returns the lock for filelock_release(), or -1 if it could not be taken.
+ * Files are not locked on Windows. */
+int filelock_acquire(const char *filename, const rl78_log_t *log);
+void filelock_release(int lock);
+
+typedef void (*filelock_write_func_t)(FILE *out, const void *ctx);
+
+/* Replaces <filename> with what <write> puts to <filename>.tmp, so readers
+ * never see a partial file. Returns 0, or -1 if it could not be written. */
+int filelock_replace(const char *filename, filelock_write_func_t write, const void *ctx,
+                     const rl78_log_t *log);
+
+#endif // FILELOCK_H__
@@ -0,0 +1,1353 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "fsm.h"
+#include "serial.h"
+#include "trace.h"
+#include "wear.h"
+#include "progress.h"
+#include <string.h>
+
+#define FSM_OP_NONE             0
+#define FSM_OP_RESET_INIT       1
+#define FSM_OP_RESET            2
+#define FSM_OP_CMD_RESET        3
+#define FSM_OP_BAUD_RATE_SET    4
+#define FSM_OP_SIGNATURE        5
+#define FSM_OP_BLOCK_ERASE      6
+#define FSM_OP_BLANK_CHECK      7
+#define FSM_OP_PROGRAMMING      8
+#define FSM_OP_VERIFY           9
+
+#define FSM_LOOP_NONE           0
+#define FSM_LOOP_PROGRAM        1
+#define FSM_LOOP_ERASE          2
+#define FSM_LOOP_VERIFY         3
+
+#define FSM_LOOP_START          0
+#define FSM_LOOP_BLANK_CHECK    1
+#define FSM_LOOP_BLOCK_ERASE    2
+#define FSM_LOOP_WRITE          3
+
+/* The device answers a verify frame after it has compared the data */
+#define FSM_VERIFY_DELAY        10      /* ms */
+
+unsigned long long rl78_fsm_now(void)
+{
+    return latency_now();
+}
+
+static
+void fsm_progress(rl78_fsm_t *m, const char *mark)
+{
+    if (2 == m->s->log.level
+        && NULL == m->s->events)
+    {
+        rl78_log(&m->s->log, 2, "%s", mark);
+    }
+}
+
+/* Start of a traced span, 0 if the session is not traced */
+static
+unsigned long long fsm_trace_now(const rl78_fsm_t *m)
+{
+    return NULL != m->s->trace ? latency_now() : 0;
+}
+
+static
+void fsm_trace(const rl78_fsm_t *m, const char *name, const char *category,
+               unsigned long long start, unsigned long long end)
+{
+    if (NULL != m->s->trace)
+    {
+        trace_span(m->s->trace, m->s->trace_track, name, category, start, end);
+    }
+}
+
+/* Times of the erase and program commands per block, counted from <delay> ms
+ * after the command like the blocking commands which sleep that long first */
+static
+void fsm_wear_begin(rl78_fsm_t *m, unsigned int address, unsigned int delay)
+{
+    if (NULL != m->s->wear)
+    {
+        m->wear_start = latency_now() + delay * 1000ULL;
+        m->wear_address = address;
+    }
+}
+
+static
+void fsm_wear_end(const rl78_fsm_t *m, int op)
+{
+    if (NULL != m->s->wear)
+    {
+        const unsigned long long now = latency_now();
+        wear_record(m->s->wear, m->s->port_name, op, m->wear_address,
+                    (now > m->wear_start) ? now - m->wear_start : 0);
+    }
+}
+
+static
+void fsm_clear(rl78_fsm_t *m)
+{
+    m->tx_len = 0;
+    m->tx_pos = 0;
+    m->echo = 0;
+    m->rx_len = 0;
+    m->rx_expect = 0;
+    m->timeout = m->s->read_timeout;
+    m->deadline = RL78_FSM_NO_DEADLINE;
+    m->action = RL78_FSM_ACTION_NONE;
+}
+
+static
+void fsm_begin(rl78_fsm_t *m, int cmd)
+{
+    fsm_clear(m);
+    m->cmd = cmd;
+    m->phase = 0;
+    m->status = RL78_FSM_BUSY;
+}
+
+static
+void fsm_done(rl78_fsm_t *m, int rc)
+{
+    fsm_clear(m);
+    m->cmd = FSM_OP_NONE;
+    m->result = rc;
+}
+
+/* Queue bytes to be sent; explen is the length of the expected response */
+static
+void fsm_send(rl78_fsm_t *m, int len, int explen)
+{
+    m->tx_len = len;
+    m->tx_pos = 0;
+    // Everything sent comes back in single-wire mode
+    m->echo = (1 == m->s->communication_mode) ? len : 0;
+    m->rx_len = 0;
+    m->rx_expect = explen;
+    m->backlog_len = 0;
+    m->timeout = m->s->read_timeout;
+    m->deadline = RL78_FSM_NO_DEADLINE;
+}
+
+static
+void fsm_send_cmd(rl78_fsm_t *m, int cmd, const void *data, int len, int explen)
+{
+    const int frame_len = rl78_frame_cmd(m->tx, cmd, data, len);
+    ++m->s->stats.commands;
+    if (NULL != m->s->latency)
+    {
+        latency_start(m->s->latency, cmd);
+    }
+    m->trace_name = latency_command_name(latency_command(cmd));
+    m->trace_category = TRACE_CAT_COMMAND;
+    m->trace_start = fsm_trace_now(m);
+    fsm_send(m, frame_len, explen);
+}
+
+static
+void fsm_send_data(rl78_fsm_t *m, const void *data, int len, int last, int explen)
+{
+    const int frame_len = rl78_frame_data(m->tx, data, len, last);
+    ++m->s->stats.frames;
+    if (NULL != m->s->latency)
+    {
+        latency_start(m->s->latency, -1);
+    }
+    m->trace_name = "data";
+    m->trace_category = TRACE_CAT_DATA;
+    m->trace_start = fsm_trace_now(m);
+    fsm_send(m, frame_len, explen);
+}
+
+static
+void fsm_expect(rl78_fsm_t *m, int explen, unsigned int timeout)
+{
+    fsm_clear(m);
+    m->rx_expect = explen;
+    m->timeout = timeout;
+    // The response may have come together with the previous one
+    const int len = m->backlog_len;
+    m->backlog_len = 0;
+    rl78_fsm_input(m, m->backlog, len);
+}
+
+/* Take what comes as echo, until the line has been quiet for ms */
+static
+void fsm_drain(rl78_fsm_t *m, unsigned int ms)
+{
+    fsm_clear(m);
+    m->echo = sizeof m->rx;
+    m->timeout = ms;
+}
+
+static
+void fsm_delay(rl78_fsm_t *m, unsigned long long now, unsigned int ms)
+{
+    fsm_clear(m);
+    if (NULL != m->s->trace && 0 < ms)
+    {
+        const unsigned long long start = latency_now();
+        fsm_trace(m, "sleep", TRACE_CAT_SLEEP, start, start + ms * 1000ULL);
+    }
+    m->deadline = now + ms * 1000ULL;
+}
+
+static
+void fsm_action(rl78_fsm_t *m, int action, int arg)
+{
+    fsm_clear(m);
+    m->action = action;
+    m->action_arg = arg;
+    m->action_rc = 0;
+}
+
+static
+void fsm_set_reset(rl78_fsm_t *m, int value)
+{
+    const int level = (m->s->mode & MODE_INVERT_RESET) ? !value : value;
+    fsm_action(m, (MODE_RESET_RTS == (m->s->mode & MODE_RESET)) ? RL78_FSM_ACTION_RTS : RL78_FSM_ACTION_DTR, level);
+}
+
+/* Number of response bytes needed to complete the frame */
+static
+int fsm_rx_need(const rl78_fsm_t *m)
+{
+    if (0 == m->rx_expect)
+    {
+        return 0;
+    }
+    if (2 > m->rx_len)
+    {
+        return 2;
+    }
+    const int data_len = rl78_frame_header(m->rx);
+    if (0 > data_len)
+    {
+        // Malformed header, nothing more is read
+        return m->rx_len;
+    }
+    return data_len + 4;
+}
+
+static
+int fsm_frame(const rl78_fsm_t *m, unsigned char *data)
+{
+    if (2 > m->rx_len
+        || fsm_rx_need(m) > m->rx_len)
+    {
+        return RESPONSE_TIMEOUT_ERROR;
+    }
+    const int data_len = rl78_frame_header(m->rx);
+    if (0 > data_len)
+    {
+        return data_len;
+    }
+    if (m->rx_expect != data_len)
+    {
+        return RESPONSE_EXPECTED_LENGTH_ERROR;
+    }
+    return rl78_frame_check(m->rx, data_len, data);
+}
+
+static
+int fsm_response(rl78_fsm_t *m, unsigned char *data)
+{
+    const int rc = fsm_frame(m, data);
+    if (NULL != m->s->latency)
+    {
+        latency_stop(m->s->latency);
+    }
+    if (0 != m->trace_start)
+    {
+        // The frame is on the wire till the driver has written it
+        const unsigned long long sent = (0 != m->trace_sent) ? m->trace_sent : m->trace_start;
+        fsm_trace(m, m->trace_name, m->trace_category, m->trace_start, sent);
+        fsm_trace(m, "response", TRACE_CAT_WAIT, sent, latency_now());
+        m->trace_start = 0;
+        m->trace_sent = 0;
+    }
+    if (RESPONSE_OK == rc)
+    {
+        ++m->s->stats.responses;
+    }
+    else
+    {
+        ++m->s->stats.errors;
+    }
+    return rc;
+}
+
+/* Receive a response and check its status byte. Returns non-zero if the
+ * command has failed (and has been finished). */
+static
+int fsm_check_ack(rl78_fsm_t *m, unsigned char *data)
+{
+    const int rc = fsm_response(m, data);
+    if (RESPONSE_OK != rc)
+    {
+        rl78_log(&m->s->log, RL78_LOG_ERROR, "FAILED\n");
+        fsm_done(m, rc);
+        return 1;
+    }
+    if (STATUS_ACK != data[0])
+    {
+        rl78_log(&m->s->log, RL78_LOG_ERROR, "ACK not received\n");
+        fsm_done(m, data[0]);
+        return 1;
+    }
+    return 0;
+}
+
+/* Phases of reset-init after the mode byte; the step of a phase is run when
+ * m->phase is set to it, as the switch has already moved past the current one */
+#define FSM_HANDSHAKE_CHECK     11      /* answer to a poll is in */
+#define FSM_HANDSHAKE_DRAIN     12      /* rest of a garbled answer is read */
+#define FSM_HANDSHAKE_DONE      13      /* polling is over */
+
+/* Adaptive handshake as in rl78_handshake_poll(): "Reset" leaves the baud
+ * rate alone, so a late answer does no harm */
+static
+void fsm_handshake_poll(rl78_fsm_t *m)
+{
+    ++m->polls;
+    fsm_send_cmd(m, CMD_RESET, NULL, 0, 1);
+    m->timeout = RL78_HANDSHAKE_POLL;
+}
+
+/* A poll is only sent again if nothing at all has come back; a partial or
+ * garbled answer is read to its end, as are the answers to earlier polls
+ * after the first ACK */
+static
+void fsm_handshake_check(rl78_fsm_t *m, unsigned long long now)
+{
+    rl78_session_t *s = m->s;
+    unsigned char data[MAX_RESPONSE_LENGTH];
+    const int received = m->rx_len;
+    int rc = fsm_response(m, data);
+    if (RESPONSE_OK == rc
+        && STATUS_ACK != data[0])
+    {
+        rc = data[0];
+    }
+    if (0 == rc)
+    {
+        m->phase = FSM_HANDSHAKE_DONE;
+        if (1 < m->polls)
+        {
+            fsm_drain(m, RL78_HANDSHAKE_POLL);
+        }
+        else
+        {
+            fsm_delay(m, now, 0);
+        }
+        return;
+    }
+    if (now >= m->poll_until)
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "No answer from the bootloader within %u ms\n", s->read_timeout);
+        fsm_done(m, rc);
+        return;
+    }
+    ++s->stats.retries;
+    if (0 < received)
+    {
+        m->phase = FSM_HANDSHAKE_DRAIN;
+        fsm_drain(m, RL78_HANDSHAKE_POLL);
+        return;
+    }
+    m->phase = FSM_HANDSHAKE_CHECK;
+    fsm_handshake_poll(m);
+}
+
+static
+void fsm_reset_init_next(rl78_fsm_t *m, unsigned long long now)
+{
+    rl78_session_t *s = m->s;
+    switch (m->phase++)
+    {
+    case 0:
+        s->communication_mode = (MODE_UART_1 == (s->mode & MODE_UART)) ? 1 : 2;
+        rl78_log(&s->log, 4, "Using communication mode %u%s\n",
+                 (s->mode & (MODE_UART | MODE_RESET)) + 1,
+                 (s->mode & MODE_INVERT_RESET) ? " with RESET inversion" : "");
+        if (NULL != s->latency)
+        {
+            latency_phase_begin(s->latency, LATENCY_PHASE_CONNECT);
+        }
+        m->trace_phase = fsm_trace_now(m);
+        fsm_set_reset(m, 0);                                /* RESET -> 0 */
+        break;
+    case 1:
+        fsm_action(m, RL78_FSM_ACTION_TXD, 0);              /* TOOL0 -> 0 */
+        break;
+    case 2:
+        fsm_action(m, RL78_FSM_ACTION_FLUSH, 0);
+        break;
+    case 3:
+        fsm_delay(m, now, s->timing.reset_low);
+        break;
+    case 4:
+        fsm_set_reset(m, 1);                                /* RESET -> 1 */
+        break;
+    case 5:
+        m->released = now;
+        fsm_delay(m, now, s->timing.tool0_low);
+        break;
+    case 6:
+        fsm_action(m, RL78_FSM_ACTION_TXD, 1);              /* TOOL0 -> 1 */
+        break;
+    case 7:
+        fsm_delay(m, now, s->timing.tool0_high);
+        break;
+    case 8:
+        fsm_action(m, RL78_FSM_ACTION_FLUSH, 0);
+        break;
+    case 9:
+        rl78_log(&s->log, 3, "Send 1-byte data for setting mode\n");
+        m->tx[0] = (1 == s->communication_mode) ? SET_MODE_1WIRE_UART : SET_MODE_2WIRE_UART;
+        fsm_send(m, 1, 0);
+        break;
+    case 10:
+        if (!s->timing.adaptive)
+        {
+            m->phase = FSM_HANDSHAKE_DONE;
+            fsm_delay(m, now, s->timing.mode_settle);
+            break;
+        }
+        m->poll_until = now + s->read_timeout * 1000ULL;
+        m->polls = 0;
+        fsm_handshake_poll(m);
+        break;
+    case FSM_HANDSHAKE_CHECK:
+        fsm_handshake_check(m, now);
+        break;
+    case FSM_HANDSHAKE_DRAIN:
+        // Read what is left of a garbled answer before the next poll
+        m->phase = FSM_HANDSHAKE_CHECK;
+        fsm_handshake_poll(m);
+        break;
+    default:
+        m->baud = s->baud;
+        m->voltage = s->voltage;
+        m->handshake = 1;
+        fsm_begin(m, FSM_OP_BAUD_RATE_SET);
+        break;
+    }
+}
+
+static
+void fsm_reset_next(rl78_fsm_t *m, unsigned long long now)
+{
+    switch (m->phase++)
+    {
+    case 0:
+        fsm_action(m, RL78_FSM_ACTION_TXD, 1);              /* TOOL0 -> 1 */
+        break;
+    case 1:
+        fsm_set_reset(m, 0);                                /* RESET -> 0 */
+        break;
+    case 2:
+        fsm_delay(m, now, 10);
+        break;
+    case 3:
+        fsm_set_reset(m, 1);                                /* RESET -> 1 */
+        break;
+    default:
+        fsm_done(m, 0);
+        break;
+    }
+}
+
+static
+void fsm_cmd_reset_next(rl78_fsm_t *m)
+{
+    unsigned char data[MAX_RESPONSE_LENGTH];
+    switch (m->phase++)
+    {
+    case 0:
+        rl78_log(&m->s->log, 3, "Send \"Reset\" command\n");
+        fsm_send_cmd(m, CMD_RESET, NULL, 0, 1);
+        break;
+    default:
+        if (!fsm_check_ack(m, data))
+        {
+            rl78_log(&m->s->log, 3, "\tOK\n");
+            fsm_done(m, 0);
+        }
+        break;
+    }
+}
+
+static
+void fsm_baud_rate_set_next(rl78_fsm_t *m, unsigned long long now)
+{
+    rl78_session_t *s = m->s;
+    unsigned char data[MAX_RESPONSE_LENGTH];
+    switch (m->phase++)
+    {
+    case 0:
+        switch (m->baud)
+        {
+        default:
+            rl78_log(&s->log, RL78_LOG_ERROR, "Unsupported baudrate %ubps. Using default baudrate 115200bps.\n", m->baud);
+            m->baud = 115200;
+            // fall through
+        case 115200:
+            data[0] = RL78_BAUD_115200;
+            break;
+        case 250000:
+            data[0] = RL78_BAUD_250000;
+            break;
+        case 500000:
+            data[0] = RL78_BAUD_500000;
+            break;
+        case 1000000:
+            data[0] = RL78_BAUD_1000000;
+            break;
+        }
+        s->baud = m->baud;
+        data[1] = (int)(m->voltage * 10);
+        rl78_log(&s->log, 3, "Send \"Set Baud Rate\" command (baud=%ubps, voltage=%1.1fV)\n", m->baud, m->voltage);
+        fsm_send_cmd(m, CMD_BAUD_RATE_SET, data, 2, 3);
+        break;
+    case 1:
+        if (fsm_check_ack(m, data))
+        {
+            break;
+        }
+        if (m->handshake)
+        {
+            m->handshake = 0;
+            if (NULL != s->latency)
+            {
+                latency_phase_end(s->latency, 0);
+            }
+            fsm_trace(m, latency_phase_name(LATENCY_PHASE_CONNECT), TRACE_CAT_PHASE, m->trace_phase, fsm_trace_now(m));
+            s->handshake = (unsigned int)(now - m->released);
+            rl78_log(&s->log, 1, "Handshake: %u.%03u ms from RESET release to the first ACK\n",
+                     s->handshake / 1000, s->handshake % 1000);
+        }
+        rl78_log(&s->log, 3, "\tOK\n");
+        rl78_log(&s->log, 3, "\tFrequency: %u MHz\n", data[1]);
+        rl78_log(&s->log, 3, "\tMode: %s\n", 0 == data[2] ? "full-speed mode" : "wide-voltage mode");
+        /* If no need to change baudrate, just exit */
+        if (115200 == m->baud)
+        {
+            fsm_done(m, 0);
+            break;
+        }
+        fsm_action(m, RL78_FSM_ACTION_BAUD, m->baud);
+        break;
+    default:
+        fsm_done(m, m->action_rc);
+        break;
+    }
+}
+
+static
+void fsm_signature_next(rl78_fsm_t *m)
+{
+    rl78_session_t *s = m->s;
+    unsigned char data[MAX_RESPONSE_LENGTH];
+    switch (m->phase++)
+    {
+    case 0:
+        rl78_log(&s->log, 3, "Send \"Get Silicon Signature\" command\n");
+        fsm_send_cmd(m, CMD_SILICON_SIGNATURE, NULL, 0, 1);
+        break;
+    case 1:
+        if (!fsm_check_ack(m, data))
+        {
+            fsm_expect(m, 22, s->read_timeout);
+        }
+        break;
+    default:
+    {
+        const int rc = fsm_response(m, data);
+        if (RESPONSE_OK != rc)
+        {
+            rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
+            fsm_done(m, rc);
+            break;
+        }
+        memcpy(m->device_name, data + 3, 10);
+        m->device_name[10] = '\0';
+        unsigned int rom_code_address = 0;
+        unsigned int rom_data_address = 0;
+        memcpy(&rom_code_address, data + 13, 3);
+        memcpy(&rom_data_address, data + 16, 3);
+        m->code_size = rom_code_address + 1;
+        m->data_size = (rom_data_address != 0) ? (rom_data_address - DATA_OFFSET + 1) : 0;
+        rl78_log(&s->log, 3, "\tOK\n");
+        rl78_log(&s->log, 3, "\tDevice code: %02X%02X%02X\n", data[0], data[1], data[2]);
+        rl78_log(&s->log, 3, "\tDevice name: %s\n", m->device_name);
+        rl78_log(&s->log, 3, "\tCode flash size: %ukB\n", m->code_size / 1024);
+        if (m->data_size != 0)
+        {
+            rl78_log(&s->log, 3, "\tData flash size: %ukB\n", m->data_size / 1024);
+        }
+        else
+        {
+            rl78_log(&s->log, 3, "\tData flash not present\n");
+        }
+        rl78_log(&s->log, 3, "\tFirmware version: %X.%X%X\n", data[19], data[20], data[21]);
+        fsm_done(m, 0);
+        break;
+    }
+    }
+}
+
+static
+void fsm_block_erase_next(rl78_fsm_t *m)
+{
+    unsigned char data[MAX_RESPONSE_LENGTH];
+    switch (m->phase++)
+    {
+    case 0:
+        rl78_log(&m->s->log, 3, "Send \"Block Erase\" command (addres=%06X)\n", m->address);
+        fsm_wear_begin(m, m->address, 0);
+        fsm_send_cmd(m, CMD_BLOCK_ERASE, &m->address, 3, 1);
+        break;
+    default:
+        if (!fsm_check_ack(m, data))
+        {
+            fsm_wear_end(m, WEAR_ERASE);
+            rl78_log(&m->s->log, 3, "\tOK\n");
+            fsm_done(m, 0);
+        }
+        break;
+    }
+}
+
+static
+void fsm_blank_check_next(rl78_fsm_t *m)
+{
+    unsigned char data[MAX_RESPONSE_LENGTH];
+    switch (m->phase++)
+    {
+    case 0:
+        rl78_log(&m->s->log, 3, "Send \"Block Blank Check\" command (range=%06X..%06X)\n", m->address, m->address_end);
+        memcpy(data + 0, &m->address, 3);
+        memcpy(data + 3, &m->address_end, 3);
+        data[6] = 0;
+        fsm_send_cmd(m, CMD_BLOCK_BLANK_CHECK, data, 7, 1);
+        break;
+    default:
+    {
+        const int rc = fsm_response(m, data);
+        if (RESPONSE_OK != rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "FAILED\n");
+            fsm_done(m, rc);
+            break;
+        }
+        if (STATUS_ACK != data[0]
+            && STATUS_IVERIFY_BLANK_ERROR != data[0])
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "ACK not received\n");
+            fsm_done(m, data[0]);
+            break;
+        }
+        rl78_log(&m->s->log, 3, "\tOK\n");
+        rl78_log(&m->s->log, 3, (STATUS_ACK == data[0]) ? "\tBlock is empty\n" : "\tBlock is not empty\n");
+        fsm_done(m, (STATUS_ACK == data[0]) ? 0 : 1);
+        break;
+    }
+    }
+}
+
+static
+void fsm_send_next_data(rl78_fsm_t *m)
+{
+    const unsigned int len = (256 < m->rom_length) ? 256 : m->rom_length;
+    rl78_log(&m->s->log, 3, "\tSend data to address %06X\n", m->address);
+    fsm_send_data(m, m->rom, len, len == m->rom_length, 2);
+    m->address += len;
+    m->rom += len;
+    m->rom_length -= len;
+}
+
+/* Programming and Verify differ only in the completion of the command */
+static
+void fsm_data_cmd_next(rl78_fsm_t *m, int cmd)
+{
+    rl78_session_t *s = m->s;
+    unsigned char data[MAX_RESPONSE_LENGTH];
+    switch (m->phase++)
+    {
+    case 0:
+        rl78_log(&s->log, 3, "Send \"%s\" command (range=%06X..%06X)\n",
+                 (CMD_PROGRAMMING == cmd) ? "Programming" : "Verify", m->address, m->address_end);
+        memcpy(data + 0, &m->address, 3);
+        memcpy(data + 3, &m->address_end, 3);
+        m->length = m->address_end - m->address + 1;
+        m->rom_length = m->length;
+        fsm_send_cmd(m, cmd, data, 6, 1);
+        break;
+    case 1:
+        if (!fsm_check_ack(m, data))
+        {
+            fsm_send_next_data(m);
+            if (CMD_VERIFY == cmd)
+            {
+                m->timeout += FSM_VERIFY_DELAY;
+            }
+        }
+        break;
+    case 2:
+    {
+        const int rc = fsm_response(m, data);
+        if (RESPONSE_OK != rc)
+        {
+            rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
+            fsm_done(m, rc);
+            break;
+        }
+        if (STATUS_ACK != data[0])
+        {
+            rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
+            fsm_done(m, data[0]);
+            break;
+        }
+        if (STATUS_ACK != data[1])
+        {
+            rl78_log(&s->log, RL78_LOG_ERROR, (CMD_PROGRAMMING == cmd) ? "Data not written\n" : "Verify failed\n");
+            fsm_done(m, data[1]);
+            break;
+        }
+        if (m->rom_length)
+        {
+            m->phase = 2;
+            fsm_send_next_data(m);
+            if (CMD_VERIFY == cmd)
+            {
+                m->timeout += FSM_VERIFY_DELAY;
+            }
+        }
+        else if (CMD_PROGRAMMING == cmd)
+        {
+            // Status of completion comes after the block has been written
+            // and verified; the device is busy till then
+            const unsigned int final_delay = (m->length / 1024 + 1) * 3 / 2;
+            fsm_wear_begin(m, m->address_end + 1 - m->length, final_delay);
+            fsm_expect(m, 1, final_delay + s->read_timeout);
+        }
+        else
+        {
+            rl78_log(&s->log, 3, "\tOK\n");
+            fsm_done(m, 0);
+        }
+        break;
+    }
+    default:
+        // Only Programming has a status of completion
+        if (!fsm_check_ack(m, data))
+        {
+            fsm_wear_end(m, WEAR_PROGRAM);
+            rl78_log(&s->log, 3, "\tOK\n");
+            fsm_done(m, 0);
+        }
+        break;
+    }
+}
+
+static
+void fsm_start_cmd(rl78_fsm_t *m, int cmd, unsigned int address_start, unsigned int address_end, const void *rom)
+{
+    fsm_begin(m, cmd);
+    m->address = address_start;
+    m->address_end = address_end;
+    m->rom = (const unsigned char*)rom;
+}
+
+static
+int fsm_loop_phase(int loop)
+{
+    return (FSM_LOOP_PROGRAM == loop) ? LATENCY_PHASE_PROGRAM
+        : (FSM_LOOP_ERASE == loop) ? LATENCY_PHASE_ERASE : LATENCY_PHASE_VERIFY;
+}
+
+static
+void fsm_loop_finish(rl78_fsm_t *m)
+{
+    if (NULL != m->s->latency)
+    {
+        latency_phase_end(m->s->latency, (unsigned long long)(m->loop_total - m->loop_count) * FLASH_BLOCK_SIZE);
+    }
+    fsm_trace(m, latency_phase_name(fsm_loop_phase(m->loop)), TRACE_CAT_PHASE, m->trace_phase, fsm_trace_now(m));
+    fsm_progress(m, "\n");
+    if (NULL != m->s->events)
+    {
+        progress_phase_end(m->s->events, m->s->port_name, m->loop_total - m->loop_count);
+    }
+    m->loop = FSM_LOOP_NONE;
+    m->status = RL78_FSM_DONE;
+}
+
+static
+void fsm_loop_advance(rl78_fsm_t *m)
+{
+    const int operation = (FSM_LOOP_PROGRAM == m->loop) ? RL78_PROGRESS_PROGRAM
+        : (FSM_LOOP_ERASE == m->loop) ? RL78_PROGRESS_ERASE : RL78_PROGRESS_VERIFY;
+    rl78_session_progress(m->s, operation, m->loop_address, m->loop_total - m->loop_count + 1, m->loop_total);
+    if (NULL != m->s->events)
+    {
+        progress_block(m->s->events, m->s->port_name, m->loop_address, m->loop_total - m->loop_count + 1);
+    }
+    m->loop_mem += FLASH_BLOCK_SIZE;
+    m->loop_address += FLASH_BLOCK_SIZE;
+    --m->loop_count;
+    if (NULL != m->loop_blocks)
+    {
+        ++m->loop_blocks;
+    }
+    m->loop_phase = FSM_LOOP_START;
+}
+
+static
+int fsm_loop_blank(const rl78_fsm_t *m)
+{
+    if (NULL != m->loop_blocks)
+    {
+        return m->loop_blocks->blank;
+    }
+    return block_is_blank(m->loop_mem, FLASH_BLOCK_SIZE);
+}
+
+static
+void fsm_blank_check_block(rl78_fsm_t *m)
+{
+    fsm_start_cmd(m, FSM_OP_BLANK_CHECK, m->loop_address, m->loop_address + FLASH_BLOCK_SIZE - 1, NULL);
+    m->loop_phase = FSM_LOOP_BLANK_CHECK;
+}
+
+static
+void fsm_program_next(rl78_fsm_t *m)
+{
+    const int rc = m->result;
+    switch (m->loop_phase)
+    {
+    case FSM_LOOP_START:
+        while (m->loop_count && fsm_loop_blank(m))
+        {
+            rl78_log(&m->s->log, 3, "No data at block %06X\n", m->loop_address);
+            fsm_loop_advance(m);
+        }
+        if (0 == m->loop_count)
+        {
+            fsm_loop_finish(m);
+            break;
+        }
+        rl78_log(&m->s->log, 3, "Program block %06X\n", m->loop_address);
+        // Check if block is ready to program new content
+        fsm_blank_check_block(m);
+        break;
+    case FSM_LOOP_BLANK_CHECK:
+        if (0 > rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "Block Blank Check failed (%06X)\n", m->loop_address);
+            fsm_loop_finish(m);
+            break;
+        }
+        if (0 < rc)
+        {
+            // If block is not empty - erase it
+            fsm_start_cmd(m, FSM_OP_BLOCK_ERASE, m->loop_address, 0, NULL);
+            m->loop_phase = FSM_LOOP_BLOCK_ERASE;
+            break;
+        }
+        // fall through
+    case FSM_LOOP_BLOCK_ERASE:
+        if (0 > rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "Block Erase failed (%06X)\n", m->loop_address);
+            fsm_loop_finish(m);
+            break;
+        }
+        // Write new content
+        fsm_start_cmd(m, FSM_OP_PROGRAMMING, m->loop_address, m->loop_address + FLASH_BLOCK_SIZE - 1, m->loop_mem);
+        m->loop_phase = FSM_LOOP_WRITE;
+        break;
+    default:
+        if (0 > rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "Programming failed (%06X)\n", m->loop_address);
+            fsm_loop_finish(m);
+            break;
+        }
+        fsm_progress(m, "*");
+        fsm_loop_advance(m);
+        break;
+    }
+}
+
+static
+void fsm_erase_next(rl78_fsm_t *m)
+{
+    const int rc = m->result;
+    switch (m->loop_phase)
+    {
+    case FSM_LOOP_START:
+        if (0 == m->loop_count)
+        {
+            fsm_loop_finish(m);
+            break;
+        }
+        fsm_blank_check_block(m);
+        break;
+    case FSM_LOOP_BLANK_CHECK:
+        if (0 > rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "Block Blank Check failed (%06X)\n", m->loop_address);
+            fsm_loop_finish(m);
+            break;
+        }
+        if (0 < rc)
+        {
+            // If block is not empty
+            fsm_start_cmd(m, FSM_OP_BLOCK_ERASE, m->loop_address, 0, NULL);
+            m->loop_phase = FSM_LOOP_BLOCK_ERASE;
+            break;
+        }
+        // if block is already empty
+        fsm_progress(m, ".");
+        fsm_loop_advance(m);
+        break;
+    default:
+        if (0 > rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "Block Erase failed (%06X)\n", m->loop_address);
+            fsm_loop_finish(m);
+            break;
+        }
+        fsm_progress(m, "*");
+        fsm_loop_advance(m);
+        break;
+    }
+}
+
+static
+void fsm_verify_next(rl78_fsm_t *m)
+{
+    const int rc = m->result;
+    switch (m->loop_phase)
+    {
+    case FSM_LOOP_START:
+        if (0 == m->loop_count)
+        {
+            fsm_loop_finish(m);
+            break;
+        }
+        rl78_log(&m->s->log, 3, "Verify block %06X\n", m->loop_address);
+        if (fsm_loop_blank(m))
+        {
+            // Check if block is blank
+            fsm_blank_check_block(m);
+        }
+        else
+        {
+            // If block is not blank
+            fsm_start_cmd(m, FSM_OP_VERIFY, m->loop_address, m->loop_address + FLASH_BLOCK_SIZE - 1, m->loop_mem);
+            m->loop_phase = FSM_LOOP_WRITE;
+        }
+        break;
+    case FSM_LOOP_BLANK_CHECK:
+        if (0 > rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "Block Blank Check failed (%06X)\n", m->loop_address);
+            fsm_loop_finish(m);
+            break;
+        }
+        if (0 < rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "Block content does not match (%06X)\n", m->loop_address);
+            fsm_loop_finish(m);
+            break;
+        }
+        fsm_progress(m, ".");
+        fsm_loop_advance(m);
+        break;
+    default:
+        if (0 != rc)
+        {
+            rl78_log(&m->s->log, RL78_LOG_ERROR, "Block content does not match (%06X)\n", m->loop_address);
+            fsm_loop_finish(m);
+            break;
+        }
+        fsm_progress(m, "*");
+        fsm_loop_advance(m);
+        break;
+    }
+}
+
+static
+void fsm_advance(rl78_fsm_t *m, unsigned long long now)
+{
+    switch (m->cmd)
+    {
+    case FSM_OP_RESET_INIT:
+        fsm_reset_init_next(m, now);
+        return;
+    case FSM_OP_RESET:
+        fsm_reset_next(m, now);
+        return;
+    case FSM_OP_CMD_RESET:
+        fsm_cmd_reset_next(m);
+        return;
+    case FSM_OP_BAUD_RATE_SET:
+        fsm_baud_rate_set_next(m, now);
+        return;
+    case FSM_OP_SIGNATURE:
+        fsm_signature_next(m);
+        return;
+    case FSM_OP_BLOCK_ERASE:
+        fsm_block_erase_next(m);
+        return;
+    case FSM_OP_BLANK_CHECK:
+        fsm_blank_check_next(m);
+        return;
+    case FSM_OP_PROGRAMMING:
+        fsm_data_cmd_next(m, CMD_PROGRAMMING);
+        return;
+    case FSM_OP_VERIFY:
+        fsm_data_cmd_next(m, CMD_VERIFY);
+        return;
+    default:
+        break;
+    }
+    // The command is done, continue the loop it belongs to
+    switch (m->loop)
+    {
+    case FSM_LOOP_PROGRAM:
+        fsm_program_next(m);
+        break;
+    case FSM_LOOP_ERASE:
+        fsm_erase_next(m);
+        break;
+    case FSM_LOOP_VERIFY:
+        fsm_verify_next(m);
+        break;
+    default:
+        m->status = RL78_FSM_DONE;
+        break;
+    }
+}
+
+void rl78_fsm_init(rl78_fsm_t *m, rl78_session_t *s)
+{
+    memset(m, 0, sizeof *m);
+    m->s = s;
+    m->status = RL78_FSM_DONE;
+    fsm_clear(m);
+}
+
+static
+void fsm_start(rl78_fsm_t *m, int cmd, unsigned int address_start, unsigned int address_end, const void *rom)
+{
+    m->loop = FSM_LOOP_NONE;
+    m->result = 0;
+    fsm_start_cmd(m, cmd, address_start, address_end, rom);
+}
+
+void rl78_fsm_reset_init(rl78_fsm_t *m)
+{
+    fsm_start(m, FSM_OP_RESET_INIT, 0, 0, NULL);
+}
+
+void rl78_fsm_reset(rl78_fsm_t *m)
+{
+    fsm_start(m, FSM_OP_RESET, 0, 0, NULL);
+}
+
+void rl78_fsm_cmd_reset(rl78_fsm_t *m)
+{
+    fsm_start(m, FSM_OP_CMD_RESET, 0, 0, NULL);
+}
+
+void rl78_fsm_cmd_baud_rate_set(rl78_fsm_t *m, int baud, float voltage)
+{
+    fsm_start(m, FSM_OP_BAUD_RATE_SET, 0, 0, NULL);
+    m->baud = baud;
+    m->voltage = voltage;
+    m->handshake = 0;
+}
+
+void rl78_fsm_cmd_silicon_signature(rl78_fsm_t *m)
+{
+    fsm_start(m, FSM_OP_SIGNATURE, 0, 0, NULL);
+}
+
+void rl78_fsm_cmd_block_erase(rl78_fsm_t *m, unsigned int address)
+{
+    fsm_start(m, FSM_OP_BLOCK_ERASE, address, 0, NULL);
+}
+
+void rl78_fsm_cmd_block_blank_check(rl78_fsm_t *m, unsigned int address_start, unsigned int address_end)
+{
+    fsm_start(m, FSM_OP_BLANK_CHECK, address_start, address_end, NULL);
+}
+
+void rl78_fsm_cmd_programming(rl78_fsm_t *m, unsigned int address_start, unsigned int address_end, const void *rom)
+{
+    fsm_start(m, FSM_OP_PROGRAMMING, address_start, address_end, rom);
+}
+
+void rl78_fsm_cmd_verify(rl78_fsm_t *m, unsigned int address_start, unsigned int address_end, const void *rom)
+{
+    fsm_start(m, FSM_OP_VERIFY, address_start, address_end, rom);
+}
+
+static
+void fsm_start_loop(rl78_fsm_t *m, int loop, unsigned int address, const void *data, unsigned int size,
+                    const block_info_t *blocks)
+{
+    fsm_start(m, FSM_OP_NONE, 0, 0, NULL);
+    m->loop = loop;
+    m->loop_phase = FSM_LOOP_START;
+    m->loop_address = address;
+    m->loop_mem = (const unsigned char*)data;
+    // Make sure size is aligned to flash block boundary
+    m->loop_count = size / FLASH_BLOCK_SIZE;
+    m->loop_total = m->loop_count;
+    m->loop_blocks = blocks;
+    if (NULL != m->s->latency)
+    {
+        latency_phase_begin(m->s->latency, fsm_loop_phase(loop));
+    }
+    if (NULL != m->s->events)
+    {
+        progress_phase_begin(m->s->events, m->s->port_name, fsm_loop_phase(loop), address, m->loop_total);
+    }
+    m->trace_phase = fsm_trace_now(m);
+}
+
+void rl78_fsm_program(rl78_fsm_t *m, unsigned int address, const void *data, unsigned int size,
+                      const block_info_t *blocks)
+{
+    fsm_start_loop(m, FSM_LOOP_PROGRAM, address, data, size, blocks);
+}
+
+void rl78_fsm_erase(rl78_fsm_t *m, unsigned int start_address, unsigned int size)
+{
+    fsm_start_loop(m, FSM_LOOP_ERASE, start_address, NULL, size, NULL);
+}
+
+void rl78_fsm_verify(rl78_fsm_t *m, unsigned int address, const void *data, unsigned int size,
+                     const block_info_t *blocks)
+{
+    fsm_start_loop(m, FSM_LOOP_VERIFY, address, data, size, blocks);
+}
+
+int rl78_fsm_input_wanted(const rl78_fsm_t *m)
+{
+    if (RL78_FSM_BUSY != m->status
+        || m->tx_pos < m->tx_len)
+    {
+        return 0;
+    }
+    return m->echo + fsm_rx_need(m) - m->rx_len;
+}
+
+int rl78_fsm_step(rl78_fsm_t *m, unsigned long long now)
+{
+    while (RL78_FSM_BUSY == m->status)
+    {
+        if (RL78_FSM_ACTION_NONE != m->action)
+        {
+            return RL78_FSM_ACTION;
+        }
+        if (m->tx_pos < m->tx_len)
+        {
+            return RL78_FSM_BUSY;
+        }
+        if (0 < rl78_fsm_input_wanted(m))
+        {
+            // The timeout runs from the last byte received
+            if (RL78_FSM_NO_DEADLINE == m->deadline)
+            {
+                m->deadline = now + m->timeout * 1000ULL;
+            }
+            if (now < m->deadline)
+            {
+                return RL78_FSM_BUSY;
+            }
+            // A missing echo is not an error, a missing response is
+            m->echo = 0;
+        }
+        else if (RL78_FSM_NO_DEADLINE != m->deadline
+                 && now < m->deadline)
+        {
+            return RL78_FSM_BUSY;
+        }
+        fsm_advance(m, now);
+    }
+    return m->status;
+}
+
+int rl78_fsm_output(const rl78_fsm_t *m, const unsigned char **data)
+{
+    if (RL78_FSM_BUSY != m->status
+        || RL78_FSM_ACTION_NONE != m->action)
+    {
+        return 0;
+    }
+    *data = m->tx + m->tx_pos;
+    return m->tx_len - m->tx_pos;
+}
+
+void rl78_fsm_written(rl78_fsm_t *m, int len)
+{
+    m->tx_pos += len;
+    if (0 != m->trace_start
+        && m->tx_pos >= m->tx_len)
+    {
+        m->trace_sent = latency_now();
+    }
+}
+
+void rl78_fsm_input(rl78_fsm_t *m, const void *data, int len)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    if (0 < len)
+    {
+        m->deadline = RL78_FSM_NO_DEADLINE;
+    }
+    for (; 0 < len; --len, ++p)
+    {
+        if (0 < m->echo)
+        {
+            --m->echo;
+        }
+        else if (m->rx_len < fsm_rx_need(m))
+        {
+            m->rx[m->rx_len++] = *p;
+        }
+        else if (m->backlog_len < (int)sizeof m->backlog)
+        {
+            m->backlog[m->backlog_len++] = *p;
+        }
+    }
+}
+
+unsigned long long rl78_fsm_deadline(const rl78_fsm_t *m)
+{
+    return (RL78_FSM_BUSY == m->status) ? m->deadline : RL78_FSM_NO_DEADLINE;
+}
+
+void rl78_fsm_action_done(rl78_fsm_t *m, int rc)
+{
+    m->action = RL78_FSM_ACTION_NONE;
+    m->action_rc = rc;
+}
+
+int rl78_fsm_perform(rl78_fsm_t *m)
+{
+    int rc;
+    switch (m->action)
+    {
+    case RL78_FSM_ACTION_DTR:
+        rc = serial_set_dtr(m->s, m->action_arg);
+        break;
+    case RL78_FSM_ACTION_RTS:
+        rc = serial_set_rts(m->s, m->action_arg);
+        break;
+    case RL78_FSM_ACTION_TXD:
+        rc = serial_set_txd(m->s, m->action_arg);
+        break;
+    case RL78_FSM_ACTION_FLUSH:
+        rc = serial_flush(m->s);
+        break;
+    case RL78_FSM_ACTION_BAUD:
+        rc = serial_set_baud(m->s, m->action_arg);
+        break;
+    default:
+        rc = 0;
+        break;
+    }
+    rl78_fsm_action_done(m, rc);
+    return rc;
+}
+
+void rl78_fsm_abort(rl78_fsm_t *m, int rc)
+{
+    fsm_clear(m);
+    m->cmd = FSM_OP_NONE;
+    m->loop = FSM_LOOP_NONE;
+    m->result = rc;
+    m->status = RL78_FSM_DONE;
+}
+
+int rl78_fsm_result(const rl78_fsm_t *m)
+{
+    return m->result;
+}
+
+int rl78_fsm_wait(rl78_fsm_t *m, rl78_fsm_clock_func_t clock, void *ctx)
+{
+    for (;;)
+    {
+        const unsigned long long now = (NULL != clock) ? clock(ctx) : rl78_fsm_now();
+        const int status = rl78_fsm_step(m, now);
+        if (RL78_FSM_DONE == status)
+        {
+            return m->result;
+        }
+        if (RL78_FSM_ACTION == status)
+        {
+            rl78_fsm_perform(m);
+            continue;
+        }
+        const unsigned char *out;
+        int len = rl78_fsm_output(m, &out);
+        if (0 < len)
+        {
+            len = serial_write(m->s, out, len);
+            if (0 > len)
+            {
+                rl78_fsm_abort(m, len);
+                continue;
+            }
+            rl78_fsm_written(m, len);
+            continue;
+        }
+        len = rl78_fsm_input_wanted(m);
+        if (0 < len)
+        {
+            unsigned char in[len];
+            len = serial_read(m->s, in, len);
+            if (0 > len)
+            {
+                rl78_fsm_abort(m, len);
+                continue;
+            }
+            rl78_fsm_input(m, in, len);
+            continue;
+        }
+        const unsigned long long deadline = rl78_fsm_deadline(m);
+        if (RL78_FSM_NO_DEADLINE != deadline
+            && now < deadline)
+        {
+            serial_delay(m->s, deadline - now);
+        }
+    }
+}
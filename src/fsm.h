@@ -0,0 +1,165 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef FSM_H__
+#define FSM_H__
+
+#include "rl78.h"
+
+/* Non-blocking protocol engine
+ *
+ * A machine runs one command or one program/erase/verify loop at a time. It
+ * never touches the port itself: the driver writes the bytes returned by
+ * rl78_fsm_output(), passes received bytes to rl78_fsm_input(), performs
+ * control actions (reset line, TOOL0, baudrate) and calls rl78_fsm_step()
+ * whenever something has happened or the deadline has passed. Time is given
+ * by the driver in microseconds, so machines can be run on virtual time. */
+
+#define RL78_FSM_BUSY           0
+#define RL78_FSM_ACTION         1       /* rl78_fsm_perform() must be called */
+#define RL78_FSM_DONE           2       /* rl78_fsm_result() holds the result */
+
+#define RL78_FSM_ACTION_NONE    0
+#define RL78_FSM_ACTION_DTR     1
+#define RL78_FSM_ACTION_RTS     2
+#define RL78_FSM_ACTION_TXD     3
+#define RL78_FSM_ACTION_FLUSH   4
+#define RL78_FSM_ACTION_BAUD    5
+
+#define RL78_FSM_NO_DEADLINE    (~0ULL)
+
+typedef struct
+{
+    rl78_session_t *s;
+    int status;
+    int result;
+    /* Current exchange: a frame to be sent, its echo and the response */
+    unsigned char tx[262];
+    int tx_len;
+    int tx_pos;
+    int echo;                   /* echoed bytes still to be skipped (single-wire UART) */
+    unsigned char rx[MAX_RESPONSE_LENGTH];
+    int rx_len;
+    int rx_expect;              /* length of the data field of the response, 0 - none */
+    unsigned char backlog[MAX_RESPONSE_LENGTH];
+    int backlog_len;            /* bytes received after the response */
+    unsigned int timeout;       /* ms without incoming data */
+    unsigned long long deadline;
+    int action;
+    int action_arg;
+    int action_rc;
+    /* Current command */
+    int cmd;
+    int phase;
+    unsigned int address;
+    unsigned int address_end;
+    const unsigned char *rom;
+    unsigned int length;
+    unsigned int rom_length;        /* bytes still to be sent */
+    int baud;
+    float voltage;
+    /* Start of the busy time of the erase or program command in flight, in us */
+    unsigned long long wear_start;
+    unsigned int wear_address;
+    /* Bootloader entry: time of RESET release and end of adaptive polling */
+    int handshake;              /* "Set Baud Rate" follows a reset */
+    unsigned long long released;
+    unsigned long long poll_until;
+    unsigned int polls;         /* adaptive polls sent */
+    /* Trace of the frame in flight and of the loop or connection, in us */
+    const char *trace_name;
+    const char *trace_category;
+    unsigned long long trace_start;     /* 0 if no frame is traced */
+    unsigned long long trace_sent;
+    unsigned long long trace_phase;
+    /* Current program/erase/verify loop */
+    int loop;
+    int loop_phase;
+    unsigned int loop_address;
+    const unsigned char *loop_mem;
+    unsigned int loop_count;    /* blocks left */
+    unsigned int loop_total;
+    const block_info_t *loop_blocks;
+    /* Results of Silicon Signature */
+    char device_name[11];
+    unsigned int code_size;
+    unsigned int data_size;
+} rl78_fsm_t;
+
+void rl78_fsm_init(rl78_fsm_t *m, rl78_session_t *s);
+
+/* Start an operation. Results are the same as of the blocking functions. */
+void rl78_fsm_reset_init(rl78_fsm_t *m);
+void rl78_fsm_reset(rl78_fsm_t *m);
+void rl78_fsm_cmd_reset(rl78_fsm_t *m);
+void rl78_fsm_cmd_baud_rate_set(rl78_fsm_t *m, int baud, float voltage);
+void rl78_fsm_cmd_silicon_signature(rl78_fsm_t *m);
+void rl78_fsm_cmd_block_erase(rl78_fsm_t *m, unsigned int address);
+void rl78_fsm_cmd_block_blank_check(rl78_fsm_t *m, unsigned int address_start, unsigned int address_end);
+void rl78_fsm_cmd_programming(rl78_fsm_t *m, unsigned int address_start, unsigned int address_end, const void *rom);
+void rl78_fsm_cmd_verify(rl78_fsm_t *m, unsigned int address_start, unsigned int address_end, const void *rom);
+void rl78_fsm_program(rl78_fsm_t *m, unsigned int address, const void *data, unsigned int size,
+                      const block_info_t *blocks);
+void rl78_fsm_erase(rl78_fsm_t *m, unsigned int start_address, unsigned int size);
+void rl78_fsm_verify(rl78_fsm_t *m, unsigned int address, const void *data, unsigned int size,
+                     const block_info_t *blocks);
+
+/* Driver interface. Drivers account bytes in the session statistics. */
+int rl78_fsm_step(rl78_fsm_t *m, unsigned long long now);
+int rl78_fsm_output(const rl78_fsm_t *m, const unsigned char **data);
+void rl78_fsm_written(rl78_fsm_t *m, int len);
+int rl78_fsm_input_wanted(const rl78_fsm_t *m);
+void rl78_fsm_input(rl78_fsm_t *m, const void *data, int len);
+unsigned long long rl78_fsm_deadline(const rl78_fsm_t *m);
+int rl78_fsm_perform(rl78_fsm_t *m);
+void rl78_fsm_action_done(rl78_fsm_t *m, int rc);
+void rl78_fsm_abort(rl78_fsm_t *m, int rc);
+int rl78_fsm_result(const rl78_fsm_t *m);
+
+/* Blocking driver working through serial_*() of the session; clock gives
+ * the time in us, NULL for rl78_fsm_now(). With the clock of a transport on
+ * virtual time (see model.h) a run does not depend on the host. */
+typedef unsigned long long (*rl78_fsm_clock_func_t)(void *ctx);
+int rl78_fsm_wait(rl78_fsm_t *m, rl78_fsm_clock_func_t clock, void *ctx);
+#ifndef WIN32
+/* Run machines until all of them are done. Each time a machine is done,
+ * next() is called; it may start another operation on the machine. */
+typedef void (*rl78_fsm_next_func_t)(void *ctx, rl78_fsm_t *m, unsigned int index);
+int rl78_fsm_run(rl78_fsm_t *const *machines, unsigned int count, rl78_fsm_next_func_t next, void *ctx);
+
+/* The event loop behind rl78_fsm_run() for callers which add machines while
+ * others are running. A machine which stays done after next() is removed from
+ * the loop, its port is put back in blocking mode and finished() is called.
+ * One more descriptor may be watched; func() is called when it is readable. */
+typedef struct rl78_fsm_loop rl78_fsm_loop_t;
+typedef void (*rl78_fsm_watch_func_t)(void *ctx, int fd);
+rl78_fsm_loop_t *rl78_fsm_loop_create(rl78_fsm_next_func_t next, rl78_fsm_next_func_t finished, void *ctx);
+int rl78_fsm_loop_add(rl78_fsm_loop_t *loop, rl78_fsm_t *m, unsigned int index);
+int rl78_fsm_loop_watch(rl78_fsm_loop_t *loop, int fd, rl78_fsm_watch_func_t func, void *ctx);
+unsigned int rl78_fsm_loop_active(const rl78_fsm_loop_t *loop);
+/* Wait for the next event and handle it; 0 on success, -1 on error */
+int rl78_fsm_loop_iterate(rl78_fsm_loop_t *loop);
+void rl78_fsm_loop_destroy(rl78_fsm_loop_t *loop);
+#endif
+
+/* Monotonic time, in us */
+unsigned long long rl78_fsm_now(void);
+
+#endif // FSM_H__
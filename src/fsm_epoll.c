@@ -0,0 +1,346 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "fsm.h"
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define FSM_EPOLL_MAX_EVENTS    64
+#define FSM_EPOLL_WATCH         (~0U)   /* epoll data of the watched descriptor */
+
+typedef struct
+{
+    rl78_fsm_t *m;              /* NULL if the slot is free */
+    unsigned int index;
+    int flags;                  /* file status flags to be restored */
+    unsigned int events;        /* registered epoll events */
+} fsm_port_t;
+
+struct rl78_fsm_loop
+{
+    int ep;
+    rl78_fsm_next_func_t next;
+    rl78_fsm_next_func_t finished;
+    void *ctx;
+    fsm_port_t *ports;
+    unsigned int nports;
+    unsigned int active;
+    int watch_fd;
+    rl78_fsm_watch_func_t watch;
+    void *watch_ctx;
+};
+
+static
+void fsm_port_fail(rl78_fsm_t *m, const char *what)
+{
+    rl78_log(&m->s->log, RL78_LOG_ERROR, "Failed to %s port %s: %s\n",
+             what, (NULL != m->s->port_name) ? m->s->port_name : "", strerror(errno));
+    rl78_fsm_abort(m, -1);
+}
+
+/* Run the machine as far as it can go without waiting */
+static
+void fsm_port_pump(rl78_fsm_t *m, unsigned long long now)
+{
+    for (;;)
+    {
+        const int status = rl78_fsm_step(m, now);
+        if (RL78_FSM_ACTION == status)
+        {
+            rl78_fsm_perform(m);
+            continue;
+        }
+        if (RL78_FSM_BUSY != status)
+        {
+            return;
+        }
+        const unsigned char *out;
+        const int len = rl78_fsm_output(m, &out);
+        if (0 == len)
+        {
+            return;
+        }
+        const int rc = write(m->s->fd, out, len);
+        if (0 > rc)
+        {
+            if (EAGAIN != errno)
+            {
+                fsm_port_fail(m, "write to");
+            }
+            return;
+        }
+        rl78_log_hex(&m->s->log, 4, "\t\tsend", out, rc);
+        m->s->stats.bytes_sent += rc;
+        rl78_fsm_written(m, rc);
+    }
+}
+
+/* Read what is there; hangup is set if epoll has reported EPOLLHUP or
+ * EPOLLERR, which stay raised, so end of file then fails the machine instead
+ * of waking the loop at once until its deadline */
+static
+void fsm_port_read(rl78_fsm_t *m, int hangup)
+{
+    unsigned char in[256];
+    for (;;)
+    {
+        const int rc = read(m->s->fd, in, sizeof in);
+        if (0 >= rc)
+        {
+            if (0 > rc && EAGAIN != errno)
+            {
+                fsm_port_fail(m, "read from");
+            }
+            else if (0 == rc && hangup)
+            {
+                rl78_log(&m->s->log, RL78_LOG_ERROR, "Port %s hung up\n",
+                         (NULL != m->s->port_name) ? m->s->port_name : "");
+                rl78_fsm_abort(m, -1);
+            }
+            return;
+        }
+        rl78_log_hex(&m->s->log, 4, "\t\trecv", in, rc);
+        m->s->stats.bytes_received += rc;
+        rl78_fsm_input(m, in, rc);
+    }
+}
+
+rl78_fsm_loop_t *rl78_fsm_loop_create(rl78_fsm_next_func_t next, rl78_fsm_next_func_t finished, void *ctx)
+{
+    rl78_fsm_loop_t *loop = calloc(1, sizeof *loop);
+    if (NULL == loop)
+    {
+        return NULL;
+    }
+    loop->ep = epoll_create1(EPOLL_CLOEXEC);
+    if (0 > loop->ep)
+    {
+        free(loop);
+        return NULL;
+    }
+    loop->next = next;
+    loop->finished = finished;
+    loop->ctx = ctx;
+    loop->watch_fd = -1;
+    return loop;
+}
+
+int rl78_fsm_loop_add(rl78_fsm_loop_t *loop, rl78_fsm_t *m, unsigned int index)
+{
+    unsigned int slot;
+    for (slot = 0; slot < loop->nports && NULL != loop->ports[slot].m; ++slot)
+    {
+    }
+    if (loop->nports == slot)
+    {
+        const unsigned int nports = loop->nports ? loop->nports * 2 : 8;
+        fsm_port_t *ports = realloc(loop->ports, nports * sizeof *ports);
+        if (NULL == ports)
+        {
+            fsm_port_fail(m, "register");
+            return -1;
+        }
+        memset(ports + loop->nports, 0, (nports - loop->nports) * sizeof *ports);
+        loop->ports = ports;
+        loop->nports = nports;
+    }
+    fsm_port_t *port = &loop->ports[slot];
+    const int fd = m->s->fd;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.u32 = slot;
+    port->flags = fcntl(fd, F_GETFL);
+    if (0 > port->flags
+        || 0 > fcntl(fd, F_SETFL, port->flags | O_NONBLOCK)
+        || 0 > epoll_ctl(loop->ep, EPOLL_CTL_ADD, fd, &ev))
+    {
+        if (0 <= port->flags)
+        {
+            fcntl(fd, F_SETFL, port->flags);
+        }
+        fsm_port_fail(m, "poll");
+        return -1;
+    }
+    port->m = m;
+    port->index = index;
+    port->events = EPOLLIN;
+    ++loop->active;
+    return 0;
+}
+
+int rl78_fsm_loop_watch(rl78_fsm_loop_t *loop, int fd, rl78_fsm_watch_func_t func, void *ctx)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.u32 = FSM_EPOLL_WATCH;
+    if (0 > epoll_ctl(loop->ep, EPOLL_CTL_ADD, fd, &ev))
+    {
+        return -1;
+    }
+    loop->watch_fd = fd;
+    loop->watch = func;
+    loop->watch_ctx = ctx;
+    return 0;
+}
+
+unsigned int rl78_fsm_loop_active(const rl78_fsm_loop_t *loop)
+{
+    return loop->active;
+}
+
+static
+void fsm_loop_remove(rl78_fsm_loop_t *loop, unsigned int slot)
+{
+    fsm_port_t *port = &loop->ports[slot];
+    epoll_ctl(loop->ep, EPOLL_CTL_DEL, port->m->s->fd, NULL);
+    fcntl(port->m->s->fd, F_SETFL, port->flags);
+    port->m = NULL;
+    --loop->active;
+}
+
+int rl78_fsm_loop_iterate(rl78_fsm_loop_t *loop)
+{
+    const unsigned long long now = rl78_fsm_now();
+    unsigned long long deadline = RL78_FSM_NO_DEADLINE;
+    unsigned int i;
+    for (i = 0; i < loop->nports; ++i)
+    {
+        rl78_fsm_t *m = loop->ports[i].m;
+        if (NULL == m)
+        {
+            continue;
+        }
+        fsm_port_pump(m, now);
+        while (RL78_FSM_DONE == m->status
+               && NULL != loop->next)
+        {
+            loop->next(loop->ctx, m, loop->ports[i].index);
+            if (RL78_FSM_DONE == m->status)
+            {
+                break;
+            }
+            fsm_port_pump(m, now);
+        }
+        if (RL78_FSM_DONE == m->status)
+        {
+            const unsigned int index = loop->ports[i].index;
+            fsm_loop_remove(loop, i);
+            // The port is back in blocking mode; the callback may close it
+            if (NULL != loop->finished)
+            {
+                loop->finished(loop->ctx, m, index);
+            }
+            continue;
+        }
+        fsm_port_t *port = &loop->ports[i];
+        const unsigned char *out;
+        const unsigned int events = EPOLLIN | ((0 < rl78_fsm_output(m, &out)) ? EPOLLOUT : 0);
+        if (events != port->events)
+        {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof ev);
+            ev.events = events;
+            ev.data.u32 = i;
+            epoll_ctl(loop->ep, EPOLL_CTL_MOD, m->s->fd, &ev);
+            port->events = events;
+        }
+        if (deadline > rl78_fsm_deadline(m))
+        {
+            deadline = rl78_fsm_deadline(m);
+        }
+    }
+    if (0 == loop->active
+        && 0 > loop->watch_fd)
+    {
+        return 0;
+    }
+    int timeout = -1;
+    if (RL78_FSM_NO_DEADLINE != deadline)
+    {
+        // Rounded up, so that the deadline has passed on wakeup
+        timeout = (deadline > now) ? (int)((deadline - now + 999) / 1000) : 0;
+    }
+    struct epoll_event events[FSM_EPOLL_MAX_EVENTS];
+    const int n = epoll_wait(loop->ep, events, FSM_EPOLL_MAX_EVENTS, timeout);
+    if (0 > n)
+    {
+        return (EINTR == errno) ? 0 : -1;
+    }
+    int e;
+    for (e = 0; e < n; ++e)
+    {
+        const unsigned int slot = events[e].data.u32;
+        if (FSM_EPOLL_WATCH == slot)
+        {
+            loop->watch(loop->watch_ctx, loop->watch_fd);
+        }
+        else if (slot < loop->nports
+                 && NULL != loop->ports[slot].m
+                 && (events[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+        {
+            fsm_port_read(loop->ports[slot].m, 0 != (events[e].events & (EPOLLERR | EPOLLHUP)));
+        }
+    }
+    return 0;
+}
+
+void rl78_fsm_loop_destroy(rl78_fsm_loop_t *loop)
+{
+    unsigned int i;
+    for (i = 0; i < loop->nports; ++i)
+    {
+        if (NULL != loop->ports[i].m)
+        {
+            fsm_loop_remove(loop, i);
+        }
+    }
+    close(loop->ep);
+    free(loop->ports);
+    free(loop);
+}
+
+int rl78_fsm_run(rl78_fsm_t *const *machines, unsigned int count, rl78_fsm_next_func_t next, void *ctx)
+{
+    rl78_fsm_loop_t *loop = rl78_fsm_loop_create(next, NULL, ctx);
+    if (NULL == loop)
+    {
+        return -1;
+    }
+    unsigned int i;
+    for (i = 0; i < count; ++i)
+    {
+        // A machine which cannot be registered is aborted and stays done
+        rl78_fsm_loop_add(loop, machines[i], i);
+    }
+    int rc = 0;
+    while (0 == rc
+           && 0 < rl78_fsm_loop_active(loop))
+    {
+        rc = rl78_fsm_loop_iterate(loop);
+    }
+    rl78_fsm_loop_destroy(loop);
+    return rc;
+}
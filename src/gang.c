@@ -0,0 +1,206 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "gang.h"
+#include "session.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+typedef struct
+{
+    const job_options_t *options;
+    image_t *image;
+    image_loader_t *loader;
+    int loaded;
+    int load_rc;
+    const patch_table_t *patches;
+} gang_shared_t;
+
+typedef struct
+{
+    const char *port;
+    rl78_session_t session;
+    job_result_t result;
+    gang_shared_t *shared;
+    unsigned int unit;
+    image_t patched;            /* copy of the image with the values of the unit */
+#ifndef WIN32
+    job_machine_t job;
+#endif
+} gang_port_t;
+
+static
+const image_t *gang_get_image(void *ctx, const job_result_t *device)
+{
+    gang_port_t *port = (gang_port_t*)ctx;
+    gang_shared_t *shared = port->shared;
+    (void)device;
+    if (!shared->loaded)
+    {
+        shared->load_rc = (NULL != shared->loader) ? image_load_wait(shared->loader) : -1;
+        shared->loaded = 1;
+    }
+    if (0 != shared->load_rc)
+    {
+        return NULL;
+    }
+    if (NULL == shared->patches)
+    {
+        return shared->image;
+    }
+    if (0 != image_patch_copy(&port->patched, shared->image, shared->patches, port->unit, &port->session.log))
+    {
+        rl78_log(&port->session.log, RL78_LOG_ERROR, "Patching failed\n");
+        return NULL;
+    }
+    return &port->patched;
+}
+
+#ifndef WIN32
+static
+void gang_next(void *ctx, rl78_fsm_t *m, unsigned int index)
+{
+    gang_port_t *const *ports = (gang_port_t *const *)ctx;
+    (void)m;
+    job_machine_next(&ports[index]->job);
+}
+#endif
+
+int gang_run(char *const *ports, unsigned int nports, const job_options_t *options,
+             const rl78_session_t *defaults, image_t *image, image_loader_t *loader,
+             const patch_table_t *patches, unsigned int unit)
+{
+    gang_shared_t shared;
+    memset(&shared, 0, sizeof shared);
+    shared.options = options;
+    shared.image = image;
+    shared.loader = loader;
+    shared.patches = (NULL != patches && 0 < patches->count) ? patches : NULL;
+    gang_port_t *jobs = calloc(nports, sizeof *jobs);
+    if (NULL == jobs)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return ENOMEM;
+    }
+    unsigned int i;
+    for (i = 0; i < nports; ++i)
+    {
+        jobs[i].port = ports[i];
+        jobs[i].session = *defaults;
+        jobs[i].shared = &shared;
+        // Ports get consecutive units in the order they are given
+        jobs[i].unit = unit + i;
+        // One trace track per port
+        jobs[i].session.trace_track = i + 1;
+        if (NULL != defaults->trace)
+        {
+            trace_track(defaults->trace, i + 1, ports[i]);
+        }
+        if (NULL != defaults->metrics)
+        {
+            jobs[i].session.latency = metrics_latency(defaults->metrics, ports[i]);
+        }
+        if (0 != serial_open(&jobs[i].session, ports[i]))
+        {
+            jobs[i].result.retcode = EBADF;
+            jobs[i].result.error = "Unable to open port";
+        }
+    }
+#ifndef WIN32
+    // All ports are driven by a single event loop
+    rl78_fsm_t **machines = calloc(nports, sizeof *machines);
+    gang_port_t **open_jobs = calloc(nports, sizeof *open_jobs);
+    unsigned int n = 0;
+    for (i = 0; NULL != machines && NULL != open_jobs && i < nports; ++i)
+    {
+        if (INVALID_HANDLE_VALUE != jobs[i].session.fd)
+        {
+            job_machine_start(&jobs[i].job, &jobs[i].session, options,
+                              gang_get_image, &jobs[i], &jobs[i].result);
+            machines[n] = &jobs[i].job.fsm;
+            open_jobs[n] = &jobs[i];
+            ++n;
+        }
+    }
+    if (NULL == machines
+        || NULL == open_jobs
+        || 0 != rl78_fsm_run(machines, n, gang_next, open_jobs))
+    {
+        fprintf(stderr, "Unable to start event loop\n");
+        for (i = 0; i < nports; ++i)
+        {
+            if (INVALID_HANDLE_VALUE != jobs[i].session.fd)
+            {
+                jobs[i].result.retcode = EIO;
+                jobs[i].result.error = "Unable to start event loop";
+            }
+        }
+    }
+    free(machines);
+    free(open_jobs);
+#else
+    for (i = 0; i < nports; ++i)
+    {
+        if (INVALID_HANDLE_VALUE != jobs[i].session.fd)
+        {
+            job_run(&jobs[i].session, options, gang_get_image, &jobs[i], &jobs[i].result);
+        }
+    }
+#endif
+    for (i = 0; i < nports; ++i)
+    {
+        if (INVALID_HANDLE_VALUE != jobs[i].session.fd)
+        {
+            serial_close(&jobs[i].session);
+        }
+        image_free(&jobs[i].patched);
+    }
+    int retcode = 0;
+    unsigned int failed = 0;
+    printf("\n%-24s %-12s %-8s %8s  %s\n", "Port", "Device", "Result", "Time", "Error");
+    for (i = 0; i < nports; ++i)
+    {
+        const job_result_t *result = &jobs[i].result;
+        printf("%-24s %-12s %-8s %7.2fs  %s\n",
+               jobs[i].port,
+               ('\0' != result->device_name[0]) ? result->device_name : "-",
+               (0 == result->retcode) ? "OK" : "FAILED",
+               result->seconds,
+               (NULL != result->error) ? result->error : "");
+        if (NULL != defaults->metrics)
+        {
+            metrics_job(defaults->metrics, jobs[i].port, &jobs[i].session, result);
+        }
+        if (0 != result->retcode)
+        {
+            ++failed;
+            if (0 == retcode)
+            {
+                retcode = result->retcode;
+            }
+        }
+    }
+    printf("%u of %u ports succeeded\n", nports - failed, nports);
+    free(jobs);
+    return retcode;
+}
@@ -0,0 +1,36 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef GANG_H__
+#define GANG_H__
+
+#include "job.h"
+#include "image.h"
+
+/* Run the same job on several ports at once. Every port gets its own copy of
+ * the default session. The image is shared by all ports; it is taken from the
+ * loader when the first port needs it. With a patch table (may be NULL) each
+ * port writes a patched copy instead, the ports taking units <unit>, <unit>+1
+ * and so on in the order given. On POSIX hosts all ports are driven by one
+ * event loop on the calling thread. */
+int gang_run(char *const *ports, unsigned int nports, const job_options_t *options,
+             const rl78_session_t *defaults, image_t *image, image_loader_t *loader,
+             const patch_table_t *patches, unsigned int unit);
+
+#endif // GANG_H__
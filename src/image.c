@@ -0,0 +1,195 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "image.h"
+#include "srec.h"
+#include "rl78.h"
+#include <stdlib.h>
+#include <string.h>
+
+static
+unsigned int image_block_count(unsigned int size)
+{
+    return (size + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+}
+
+int image_init(image_t *image, unsigned int code_size, unsigned int data_size, const rl78_log_t *log)
+{
+    memset(image, 0, sizeof *image);
+    image->code_size = code_size;
+    image->data_size = data_size;
+    image->code = malloc(code_size + 1);
+    image->data = malloc(data_size + 1);
+    image->code_blocks = calloc(image_block_count(code_size) + 1, sizeof *image->code_blocks);
+    image->data_blocks = calloc(image_block_count(data_size) + 1, sizeof *image->data_blocks);
+    if (NULL == image->code
+        || NULL == image->data
+        || NULL == image->code_blocks
+        || NULL == image->data_blocks)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Out of memory\n");
+        image_free(image);
+        return -1;
+    }
+    memset(image->code, 0xFF, code_size);
+    memset(image->data, 0xFF, data_size);
+    return 0;
+}
+
+void image_free(image_t *image)
+{
+    free(image->code);
+    free(image->data);
+    free(image->code_blocks);
+    free(image->data_blocks);
+    memset(image, 0, sizeof *image);
+}
+
+int image_load(image_t *image, const char *const *filenames, unsigned int nfiles, int parallel, unsigned int threads,
+               const rl78_log_t *log)
+{
+    int rc;
+    if (rl78_log_enabled(log, 1))
+    {
+        unsigned int i;
+        for (i = 0; i < nfiles; ++i)
+        {
+            rl78_log(log, 1, "Read file \"%s\"\n", filenames[i]);
+        }
+    }
+    if (1 == nfiles && !parallel)
+    {
+        rc = srec_read(filenames[0], image->code, image->code_size, image->data, image->data_size, log);
+    }
+    else
+    {
+        rc = srec_read_files(filenames, nfiles, image->code, image->code_size, image->data, image->data_size,
+                             parallel ? threads : 1, log);
+    }
+    if (SREC_NO_ERROR == rc)
+    {
+        block_scan(image->code, image->code_size, FLASH_BLOCK_SIZE, image->code_blocks);
+        block_scan(image->data, image->data_size, FLASH_BLOCK_SIZE, image->data_blocks);
+    }
+    return rc;
+}
+
+int image_patch(image_t *image, const patch_table_t *patches, unsigned int unit, const rl78_log_t *log)
+{
+    // Only blocks touched by the patch table are scanned again
+    unsigned char *code_dirty = calloc(image_block_count(image->code_size) + 1, 1);
+    unsigned char *data_dirty = calloc(image_block_count(image->data_size) + 1, 1);
+    int rc = PATCH_MEMORY_ERROR;
+    if (NULL != code_dirty
+        && NULL != data_dirty)
+    {
+        rc = patch_table_apply(patches, unit,
+                               image->code, image->code_size,
+                               image->data, image->data_size,
+                               code_dirty, data_dirty, log);
+        block_update(image->code, image->code_size, FLASH_BLOCK_SIZE, image->code_blocks, code_dirty);
+        block_update(image->data, image->data_size, FLASH_BLOCK_SIZE, image->data_blocks, data_dirty);
+    }
+    free(code_dirty);
+    free(data_dirty);
+    return rc;
+}
+
+int image_patch_copy(image_t *copy, const image_t *image, const patch_table_t *patches, unsigned int unit,
+                     const rl78_log_t *log)
+{
+    if (NULL == copy->code
+        && 0 != image_init(copy, image->code_size, image->data_size, log))
+    {
+        return PATCH_MEMORY_ERROR;
+    }
+    memcpy(copy->code, image->code, image->code_size);
+    memcpy(copy->data, image->data, image->data_size);
+    memcpy(copy->code_blocks, image->code_blocks, image_block_count(image->code_size) * sizeof *copy->code_blocks);
+    memcpy(copy->data_blocks, image->data_blocks, image_block_count(image->data_size) * sizeof *copy->data_blocks);
+    return image_patch(copy, patches, unit, log);
+}
+
+static
+int image_region_fits(const block_info_t *blocks, unsigned int image_size, unsigned int size,
+                      unsigned int offset, const char *name, const rl78_log_t *log)
+{
+    unsigned int block;
+    for (block = size / FLASH_BLOCK_SIZE; block < image_block_count(image_size); ++block)
+    {
+        if (!blocks[block].blank)
+        {
+            rl78_log(log, RL78_LOG_ERROR, "Image has %s flash data at %06X, beyond the end of the device (%u kB)\n",
+                     name, offset + block * FLASH_BLOCK_SIZE, size / 1024);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int image_fits(const image_t *image, unsigned int code_size, unsigned int data_size, const rl78_log_t *log)
+{
+    return image_region_fits(image->code_blocks, image->code_size, code_size, CODE_OFFSET, "code", log)
+        && image_region_fits(image->data_blocks, image->data_size, data_size, DATA_OFFSET, "data", log);
+}
+
+#ifndef WIN32
+static
+void *image_loader_func(void *arg)
+{
+    image_loader_t *loader = (image_loader_t*)arg;
+    loader->rc = image_load(loader->image, loader->filenames, loader->nfiles,
+                            loader->parallel, loader->threads, loader->log);
+    return NULL;
+}
+#endif
+
+int image_load_start(image_loader_t *loader, image_t *image,
+                     const char *const *filenames, unsigned int nfiles, int parallel, unsigned int threads,
+                     const rl78_log_t *log)
+{
+    loader->image = image;
+    loader->filenames = filenames;
+    loader->nfiles = nfiles;
+    loader->parallel = parallel;
+    loader->threads = threads;
+    loader->log = log;
+    loader->rc = 0;
+#ifndef WIN32
+    loader->started = (0 == pthread_create(&loader->thread, NULL, image_loader_func, loader));
+    if (loader->started)
+    {
+        return 0;
+    }
+#endif
+    loader->rc = image_load(image, filenames, nfiles, parallel, threads, log);
+    return loader->rc;
+}
+
+int image_load_wait(image_loader_t *loader)
+{
+#ifndef WIN32
+    if (loader->started)
+    {
+        pthread_join(loader->thread, NULL);
+        loader->started = 0;
+    }
+#endif
+    return loader->rc;
+}
@@ -0,0 +1,77 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef IMAGE_H__
+#define IMAGE_H__
+
+#include "block.h"
+#include "patch.h"
+#include "log.h"
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+/* Largest code and data flash areas of RL78 parts. Images are loaded into
+ * buffers of this size before the size of the target device is known. */
+#define IMAGE_CODE_MAX_SIZE     (0x000F0000U)
+#define IMAGE_DATA_MAX_SIZE     (0x00008000U)
+
+typedef struct
+{
+    unsigned char *code;
+    unsigned int code_size;
+    unsigned char *data;
+    unsigned int data_size;
+    block_info_t *code_blocks;
+    block_info_t *data_blocks;
+} image_t;
+
+typedef struct
+{
+    image_t *image;
+    const char *const *filenames;
+    unsigned int nfiles;
+    int parallel;
+    unsigned int threads;
+    const rl78_log_t *log;
+    int rc;
+#ifndef WIN32
+    pthread_t thread;
+    int started;
+#endif
+} image_loader_t;
+
+int image_init(image_t *image, unsigned int code_size, unsigned int data_size, const rl78_log_t *log);
+void image_free(image_t *image);
+int image_load(image_t *image, const char *const *filenames, unsigned int nfiles, int parallel, unsigned int threads,
+               const rl78_log_t *log);
+int image_patch(image_t *image, const patch_table_t *patches, unsigned int unit, const rl78_log_t *log);
+/* Patch a private copy of a shared image for one unit; the buffers of <copy>
+ * are allocated on first use and reused for later units. Only the blocks
+ * touched by the table are scanned again. */
+int image_patch_copy(image_t *copy, const image_t *image, const patch_table_t *patches, unsigned int unit,
+                     const rl78_log_t *log);
+int image_fits(const image_t *image, unsigned int code_size, unsigned int data_size, const rl78_log_t *log);
+/* Load an image on a background thread; image_load_wait() returns its result */
+int image_load_start(image_loader_t *loader, image_t *image,
+                     const char *const *filenames, unsigned int nfiles, int parallel, unsigned int threads,
+                     const rl78_log_t *log);
+int image_load_wait(image_loader_t *loader);
+
+#endif // IMAGE_H__
@@ -0,0 +1,428 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "job.h"
+#include "rl78.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static
+int job_fail(rl78_session_t *s, job_result_t *result, int retcode, int status, const char *error)
+{
+    rl78_log(&s->log, RL78_LOG_ERROR, "%s\n", error);
+    result->retcode = retcode;
+    result->status = status;
+    result->error = error;
+    return retcode;
+}
+
+static
+void job_wear_start(rl78_session_t *s)
+{
+    if (NULL != s->wear)
+    {
+        wear_start(s->wear, s->port_name);
+    }
+}
+
+/* Blocks of a failed job are judged too, but only good jobs are learned from */
+static
+void job_wear_check(rl78_session_t *s, job_result_t *result)
+{
+    if (NULL == s->wear)
+    {
+        return;
+    }
+    wear_check(s->wear, s->port_name, result->device_name, s->baud, s->communication_mode, 0 == result->retcode,
+               &result->wear);
+    if (0 < result->wear.slow_blocks)
+    {
+        rl78_log(&s->log, RL78_LOG_OUTPUT, "Wear: %u block%s over the baseline, the slowest at %06X takes %.1f times the mean%s\n",
+                 result->wear.slow_blocks, (1 < result->wear.slow_blocks) ? "s" : "", result->wear.address, result->wear.ratio,
+                 result->wear.slow_board ? ", the board is slow" : "");
+    }
+    else if (result->wear.slow_board)
+    {
+        rl78_log(&s->log, RL78_LOG_OUTPUT, "Wear: the board is slow\n");
+    }
+}
+
+static
+int job_steps(rl78_session_t *s, const job_options_t *options,
+              job_image_func_t get_image, void *ctx, job_result_t *result)
+{
+    int rc;
+    if (1 == options->write
+        || 1 == options->erase
+        || 1 == options->verify
+        || 1 == options->display_info)
+    {
+        rc = rl78_reset_init(s, options->wait);
+        if (0 > rc)
+        {
+            return job_fail(s, result, EIO, rc, "Initialization failed");
+        }
+        rc = rl78_cmd_reset(s);
+        if (0 > rc)
+        {
+            return job_fail(s, result, EIO, rc, "Synchronization failed");
+        }
+        rc = rl78_cmd_silicon_signature(s, result->device_name, &result->code_size, &result->data_size);
+        if (0 > rc)
+        {
+            return job_fail(s, result, EIO, rc, "Silicon signature read failed");
+        }
+        const unsigned int code_size = result->code_size;
+        const unsigned int data_size = result->data_size;
+        if (1 == options->display_info)
+        {
+            rl78_log(&s->log, RL78_LOG_OUTPUT,
+                     "Device: %s\n"
+                     "Code size: %u kB\n"
+                     "Data size: %u kB\n",
+                     result->device_name, code_size / 1024, data_size / 1024
+                );
+        }
+        // Make sure the image is valid before flash is modified
+        const image_t *image = NULL;
+        if (1 == options->write
+            || 1 == options->verify)
+        {
+            image = get_image(ctx, result);
+            if (NULL == image)
+            {
+                return job_fail(s, result, EIO, 0, "Read failed");
+            }
+            if (code_size > image->code_size
+                || data_size > image->data_size
+                || !image_fits(image, code_size, data_size, &s->log))
+            {
+                return job_fail(s, result, EIO, 0, "Image does not fit the device");
+            }
+        }
+        if (!options->nocode && (1 == options->erase))
+        {
+            rl78_log(&s->log, 1, "Erase code flash\n");
+            rc = rl78_erase(s, CODE_OFFSET, code_size);
+            if (0 != rc)
+            {
+                return job_fail(s, result, EIO, rc, "Code flash erase failed");
+            }
+        }
+        if (!options->nodata && (1 == options->erase && data_size))
+        {
+            rl78_log(&s->log, 1, "Erase data flash\n");
+            rc = rl78_erase(s, DATA_OFFSET, data_size);
+            if (0 != rc)
+            {
+                return job_fail(s, result, EIO, rc, "Data flash erase failed");
+            }
+        }
+        if (!options->nocode && (1 == options->write))
+        {
+            rl78_log(&s->log, 1, "Write code flash\n");
+            rc = rl78_program(s, CODE_OFFSET, image->code, code_size, image->code_blocks);
+            if (0 != rc)
+            {
+                return job_fail(s, result, EIO, rc, "Code flash write failed");
+            }
+        }
+        if (!options->nodata && (1 == options->write && data_size))
+        {
+            rl78_log(&s->log, 1, "Write data flash\n");
+            rc = rl78_program(s, DATA_OFFSET, image->data, data_size, image->data_blocks);
+            if (0 != rc)
+            {
+                return job_fail(s, result, EIO, rc, "Data flash write failed");
+            }
+        }
+        if (!options->nocode && (1 == options->verify))
+        {
+            rl78_log(&s->log, 1, "Verify Code flash\n");
+            rc = rl78_verify(s, CODE_OFFSET, image->code, code_size, image->code_blocks);
+            if (0 != rc)
+            {
+                return job_fail(s, result, EIO, rc, "Code flash verification failed");
+            }
+        }
+        if (!options->nodata && (1 == options->verify && data_size))
+        {
+            rl78_log(&s->log, 1, "Verify Data flash\n");
+            rc = rl78_verify(s, DATA_OFFSET, image->data, data_size, image->data_blocks);
+            if (0 != rc)
+            {
+                return job_fail(s, result, EIO, rc, "Data flash verification failed");
+            }
+        }
+    }
+    if (1 == options->reset_after)
+    {
+        rl78_log(&s->log, 1, "Reset MCU\n");
+        rl78_reset(s);
+    }
+    return 0;
+}
+
+int job_run(rl78_session_t *s, const job_options_t *options,
+            job_image_func_t get_image, void *ctx, job_result_t *result)
+{
+    memset(result, 0, sizeof *result);
+    const unsigned long long start = latency_now();
+    job_wear_start(s);
+    job_steps(s, options, get_image, ctx, result);
+    result->seconds = (latency_now() - start) / 1e6;
+    job_wear_check(s, result);
+    return result->retcode;
+}
+
+#define JOB_STEP_RESET_INIT     0
+#define JOB_STEP_SYNC           1
+#define JOB_STEP_SIGNATURE      2
+#define JOB_STEP_IMAGE          3
+#define JOB_STEP_ERASE_CODE     4
+#define JOB_STEP_ERASE_DATA     5
+#define JOB_STEP_WRITE_CODE     6
+#define JOB_STEP_WRITE_DATA     7
+#define JOB_STEP_VERIFY_CODE    8
+#define JOB_STEP_VERIFY_DATA    9
+#define JOB_STEP_RESET          10
+#define JOB_STEP_DONE           11
+
+static const char *const job_step_names[] =
+{
+    "reset-init",
+    "sync",
+    "signature",
+    "image",
+    "erase-code",
+    "erase-data",
+    "write-code",
+    "write-data",
+    "verify-code",
+    "verify-data",
+    "reset",
+    "done",
+};
+
+static
+void job_machine_finish(job_machine_t *job)
+{
+    job->step = JOB_STEP_DONE;
+    job->result->seconds = (latency_now() - job->start) / 1e6;
+    job_wear_check(job->fsm.s, job->result);
+}
+
+static
+void job_machine_fail(job_machine_t *job, int retcode, int status, const char *error)
+{
+    job_fail(job->fsm.s, job->result, retcode, status, error);
+    job_machine_finish(job);
+}
+
+void job_machine_start(job_machine_t *job, rl78_session_t *s, const job_options_t *options,
+                       job_image_func_t get_image, void *ctx, job_result_t *result)
+{
+    memset(result, 0, sizeof *result);
+    rl78_fsm_init(&job->fsm, s);
+    job->options = options;
+    job->get_image = get_image;
+    job->ctx = ctx;
+    job->image = NULL;
+    job->result = result;
+    job->step = JOB_STEP_RESET_INIT;
+    job->start = latency_now();
+    job_wear_start(s);
+    if (!(options->write || options->erase || options->verify || options->display_info))
+    {
+        job->step = JOB_STEP_RESET;
+    }
+    // job_machine_next() goes on with the step after the current one
+    job->step -= 1;
+    job_machine_next(job);
+}
+
+void job_machine_next(job_machine_t *job)
+{
+    rl78_fsm_t *m = &job->fsm;
+    const job_options_t *options = job->options;
+    job_result_t *result = job->result;
+    const int rc = rl78_fsm_result(m);
+    // Check the result of the previous step and start the next one
+    while (JOB_STEP_DONE != job->step)
+    {
+        switch (++job->step)
+        {
+        case JOB_STEP_RESET_INIT:
+            rl78_fsm_reset_init(m);
+            return;
+        case JOB_STEP_SYNC:
+            if (0 > rc)
+            {
+                job_machine_fail(job, EIO, rc, "Initialization failed");
+                return;
+            }
+            rl78_fsm_cmd_reset(m);
+            return;
+        case JOB_STEP_SIGNATURE:
+            if (0 > rc)
+            {
+                job_machine_fail(job, EIO, rc, "Synchronization failed");
+                return;
+            }
+            rl78_fsm_cmd_silicon_signature(m);
+            return;
+        case JOB_STEP_IMAGE:
+            if (0 > rc)
+            {
+                job_machine_fail(job, EIO, rc, "Silicon signature read failed");
+                return;
+            }
+            memcpy(result->device_name, m->device_name, sizeof result->device_name);
+            result->code_size = m->code_size;
+            result->data_size = m->data_size;
+            if (1 == options->display_info)
+            {
+                rl78_log(&m->s->log, RL78_LOG_OUTPUT,
+                         "Device: %s\n"
+                         "Code size: %u kB\n"
+                         "Data size: %u kB\n",
+                         result->device_name, result->code_size / 1024, result->data_size / 1024
+                    );
+            }
+            // Make sure the image is valid before flash is modified
+            if (1 == options->write
+                || 1 == options->verify)
+            {
+                job->image = job->get_image(job->ctx, result);
+                if (NULL == job->image)
+                {
+                    job_machine_fail(job, EIO, 0, "Read failed");
+                    return;
+                }
+                if (result->code_size > job->image->code_size
+                    || result->data_size > job->image->data_size
+                    || !image_fits(job->image, result->code_size, result->data_size, &m->s->log))
+                {
+                    job_machine_fail(job, EIO, 0, "Image does not fit the device");
+                    return;
+                }
+            }
+            break;
+        case JOB_STEP_ERASE_CODE:
+            if (!options->nocode && (1 == options->erase))
+            {
+                rl78_log(&m->s->log, 1, "Erase code flash\n");
+                rl78_fsm_erase(m, CODE_OFFSET, result->code_size);
+                return;
+            }
+            break;
+        case JOB_STEP_ERASE_DATA:
+            if (!options->nocode && (1 == options->erase) && 0 != rc)
+            {
+                job_machine_fail(job, EIO, rc, "Code flash erase failed");
+                return;
+            }
+            if (!options->nodata && (1 == options->erase && result->data_size))
+            {
+                rl78_log(&m->s->log, 1, "Erase data flash\n");
+                rl78_fsm_erase(m, DATA_OFFSET, result->data_size);
+                return;
+            }
+            break;
+        case JOB_STEP_WRITE_CODE:
+            if (!options->nodata && (1 == options->erase && result->data_size) && 0 != rc)
+            {
+                job_machine_fail(job, EIO, rc, "Data flash erase failed");
+                return;
+            }
+            if (!options->nocode && (1 == options->write))
+            {
+                rl78_log(&m->s->log, 1, "Write code flash\n");
+                rl78_fsm_program(m, CODE_OFFSET, job->image->code, result->code_size, job->image->code_blocks);
+                return;
+            }
+            break;
+        case JOB_STEP_WRITE_DATA:
+            if (!options->nocode && (1 == options->write) && 0 != rc)
+            {
+                job_machine_fail(job, EIO, rc, "Code flash write failed");
+                return;
+            }
+            if (!options->nodata && (1 == options->write && result->data_size))
+            {
+                rl78_log(&m->s->log, 1, "Write data flash\n");
+                rl78_fsm_program(m, DATA_OFFSET, job->image->data, result->data_size, job->image->data_blocks);
+                return;
+            }
+            break;
+        case JOB_STEP_VERIFY_CODE:
+            if (!options->nodata && (1 == options->write && result->data_size) && 0 != rc)
+            {
+                job_machine_fail(job, EIO, rc, "Data flash write failed");
+                return;
+            }
+            if (!options->nocode && (1 == options->verify))
+            {
+                rl78_log(&m->s->log, 1, "Verify Code flash\n");
+                rl78_fsm_verify(m, CODE_OFFSET, job->image->code, result->code_size, job->image->code_blocks);
+                return;
+            }
+            break;
+        case JOB_STEP_VERIFY_DATA:
+            if (!options->nocode && (1 == options->verify) && 0 != rc)
+            {
+                job_machine_fail(job, EIO, rc, "Code flash verification failed");
+                return;
+            }
+            if (!options->nodata && (1 == options->verify && result->data_size))
+            {
+                rl78_log(&m->s->log, 1, "Verify Data flash\n");
+                rl78_fsm_verify(m, DATA_OFFSET, job->image->data, result->data_size, job->image->data_blocks);
+                return;
+            }
+            break;
+        case JOB_STEP_RESET:
+            if (!options->nodata && (1 == options->verify && result->data_size) && 0 != rc)
+            {
+                job_machine_fail(job, EIO, rc, "Data flash verification failed");
+                return;
+            }
+            if (1 == options->reset_after)
+            {
+                rl78_log(&m->s->log, 1, "Reset MCU\n");
+                rl78_fsm_reset(m);
+                return;
+            }
+            break;
+        default:
+            job_machine_finish(job);
+            return;
+        }
+    }
+}
+
+const char *job_machine_step_name(const job_machine_t *job)
+{
+    if (0 > job->step || JOB_STEP_DONE < job->step)
+    {
+        return "done";
+    }
+    return job_step_names[job->step];
+}
@@ -0,0 +1,82 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef JOB_H__
+#define JOB_H__
+
+#include "session.h"
+#include "image.h"
+#include "fsm.h"
+#include "wear.h"
+
+typedef struct
+{
+    char erase;
+    char write;
+    char verify;
+    char reset_after;
+    char display_info;
+    char nocode;
+    char nodata;
+    char wait;
+} job_options_t;
+
+typedef struct
+{
+    int retcode;                /* 0 on success, errno value otherwise */
+    const char *error;          /* step which has failed */
+    int status;                 /* STATUS_* or RESPONSE_* of the failed step, 0 if none */
+    char device_name[11];
+    unsigned int code_size;
+    unsigned int data_size;
+    double seconds;
+    wear_result_t wear;         /* slow blocks, if the session screens them */
+} job_result_t;
+
+/* Called after the device has been identified and before flash is modified.
+ * Returns the image to be written or NULL if the job must be aborted. */
+typedef const image_t *(*job_image_func_t)(void *ctx, const job_result_t *device);
+
+/* Mode, baudrate and voltage are taken from the session */
+int job_run(rl78_session_t *s, const job_options_t *options,
+            job_image_func_t get_image, void *ctx, job_result_t *result);
+
+/* The same job as a sequence of non-blocking operations. job_machine_next()
+ * is called each time the operation of the machine is done; it starts the
+ * next one. The job is finished when the machine stays done. The wait for a
+ * keypress is not supported. */
+typedef struct
+{
+    rl78_fsm_t fsm;
+    const job_options_t *options;
+    job_image_func_t get_image;
+    void *ctx;
+    const image_t *image;
+    job_result_t *result;
+    int step;
+    unsigned long long start;
+} job_machine_t;
+
+void job_machine_start(job_machine_t *job, rl78_session_t *s, const job_options_t *options,
+                       job_image_func_t get_image, void *ctx, job_result_t *result);
+void job_machine_next(job_machine_t *job);
+/* Name of the step the machine is busy with, "done" when it has finished */
+const char *job_machine_step_name(const job_machine_t *job);
+
+#endif // JOB_H__
@@ -0,0 +1,219 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "latency.h"
+#include "rl78.h"
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+static const char *const latency_names[LATENCY_COMMANDS] =
+{
+    "reset",
+    "baud-rate-set",
+    "signature",
+    "block-erase",
+    "blank-check",
+    "programming",
+    "verify",
+    "checksum",
+    "security",
+    "other",
+};
+
+static const char *const latency_phase_names[LATENCY_PHASES] =
+{
+    "connect",
+    "erase",
+    "program",
+    "verify",
+};
+
+unsigned long long latency_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000ULL + tv.tv_usec;
+#endif
+}
+
+void latency_init(latency_t *l)
+{
+    memset(l, 0, sizeof *l);
+    l->phase = LATENCY_NO_PHASE;
+    l->started = latency_now();
+}
+
+int latency_command(int cmd)
+{
+    switch (cmd)
+    {
+    case CMD_RESET:
+        return LATENCY_RESET;
+    case CMD_BAUD_RATE_SET:
+        return LATENCY_BAUD_RATE_SET;
+    case CMD_SILICON_SIGNATURE:
+        return LATENCY_SIGNATURE;
+    case CMD_BLOCK_ERASE:
+        return LATENCY_BLOCK_ERASE;
+    case CMD_BLOCK_BLANK_CHECK:
+        return LATENCY_BLANK_CHECK;
+    case CMD_PROGRAMMING:
+        return LATENCY_PROGRAMMING;
+    case CMD_VERIFY:
+        return LATENCY_VERIFY;
+    case CMD_CHECKSUM:
+        return LATENCY_CHECKSUM;
+    case CMD_SECURITY_SET:
+    case CMD_SECURITY_GET:
+    case CMD_SECURITY_RELEASE:
+        return LATENCY_SECURITY;
+    default:
+        return LATENCY_OTHER;
+    }
+}
+
+void latency_start(latency_t *l, int cmd)
+{
+    if (0 <= cmd)
+    {
+        l->command = latency_command(cmd);
+    }
+    l->start = latency_now();
+}
+
+void latency_stop(latency_t *l)
+{
+    if (0 == l->start)
+    {
+        return;
+    }
+    const unsigned long long elapsed = latency_now() - l->start;
+    l->start = 0;
+    latency_record(&l->commands[l->command], 0xFFFFFFFFULL < elapsed ? 0xFFFFFFFFU : (unsigned int)elapsed);
+}
+
+static
+unsigned int latency_bucket(unsigned int us)
+{
+    if (LATENCY_SUB_BUCKETS > us)
+    {
+        return us;
+    }
+    const unsigned int exponent = 31 - __builtin_clz(us);
+    return (exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS
+        + ((us >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+static
+unsigned int latency_bucket_limit(unsigned int bucket)
+{
+    if (LATENCY_SUB_BUCKETS > bucket)
+    {
+        return bucket;
+    }
+    const unsigned int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    const unsigned long long first = (unsigned long long)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << shift;
+    const unsigned long long limit = first + (1ULL << shift) - 1;
+    return 0xFFFFFFFFULL < limit ? 0xFFFFFFFFU : (unsigned int)limit;
+}
+
+void latency_record(latency_histogram_t *h, unsigned int us)
+{
+    if (0 == h->count || us < h->min)
+    {
+        h->min = us;
+    }
+    if (us > h->max)
+    {
+        h->max = us;
+    }
+    ++h->count;
+    h->total += us;
+    ++h->buckets[latency_bucket(us)];
+}
+
+unsigned int latency_percentile(const latency_histogram_t *h, double percentile)
+{
+    if (0 == h->count)
+    {
+        return 0;
+    }
+    unsigned long rank = (unsigned long)(percentile / 100.0 * h->count + 0.999999);
+    if (1 > rank)
+    {
+        rank = 1;
+    }
+    unsigned long seen = 0;
+    unsigned int i;
+    for (i = 0; LATENCY_BUCKETS > i; ++i)
+    {
+        seen += h->buckets[i];
+        if (rank <= seen)
+        {
+            // The bucket limit may exceed the largest sample
+            const unsigned int limit = latency_bucket_limit(i);
+            return limit < h->max ? limit : h->max;
+        }
+    }
+    return h->max;
+}
+
+const char *latency_command_name(int command)
+{
+    if (0 > command || LATENCY_COMMANDS <= command)
+    {
+        return "unknown";
+    }
+    return latency_names[command];
+}
+
+void latency_phase_begin(latency_t *l, int phase)
+{
+    l->phase = phase;
+    l->phase_start = latency_now();
+}
+
+void latency_phase_end(latency_t *l, unsigned long long bytes)
+{
+    if (LATENCY_NO_PHASE == l->phase)
+    {
+        return;
+    }
+    latency_phase_t *p = &l->phases[l->phase];
+    ++p->count;
+    p->time += latency_now() - l->phase_start;
+    p->bytes += bytes;
+    l->phase = LATENCY_NO_PHASE;
+}
+
+const char *latency_phase_name(int phase)
+{
+    if (0 > phase || LATENCY_PHASES <= phase)
+    {
+        return "unknown";
+    }
+    return latency_phase_names[phase];
+}
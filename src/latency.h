@@ -0,0 +1,101 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef LATENCY_H__
+#define LATENCY_H__
+
+
+/* Samples are kept in log-linear buckets: values below LATENCY_SUB_BUCKETS us
+ * get a bucket each, every further power of two is split into
+ * LATENCY_SUB_BUCKETS buckets, so a percentile is off by at most 1/16. */
+#define LATENCY_SUB_BITS        4
+#define LATENCY_SUB_BUCKETS     (1U << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS         (LATENCY_SUB_BUCKETS * (33 - LATENCY_SUB_BITS))
+
+#define LATENCY_RESET           0
+#define LATENCY_BAUD_RATE_SET   1
+#define LATENCY_SIGNATURE       2
+#define LATENCY_BLOCK_ERASE     3
+#define LATENCY_BLANK_CHECK     4
+#define LATENCY_PROGRAMMING     5
+#define LATENCY_VERIFY          6
+#define LATENCY_CHECKSUM        7
+#define LATENCY_SECURITY        8
+#define LATENCY_OTHER           9
+#define LATENCY_COMMANDS        10
+
+#define LATENCY_PHASE_CONNECT   0
+#define LATENCY_PHASE_ERASE     1
+#define LATENCY_PHASE_PROGRAM   2
+#define LATENCY_PHASE_VERIFY    3
+#define LATENCY_PHASES          4
+#define LATENCY_NO_PHASE        (-1)
+
+typedef struct
+{
+    unsigned long count;
+    unsigned long long total;   /* us */
+    unsigned int min;           /* us */
+    unsigned int max;           /* us */
+    unsigned int buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+typedef struct
+{
+    unsigned long count;
+    unsigned long long time;    /* us */
+    unsigned long long bytes;   /* flash bytes covered */
+} latency_phase_t;
+
+/* Round trips of one session: the time from sending a command or data frame
+ * till its response has been received, grouped by command. Time spent in the
+ * bootloader entry and in the erase, program and verify loops is summed per
+ * phase. */
+typedef struct
+{
+    unsigned long long started; /* us, when collection has been started */
+    int command;                /* LATENCY_* of the frame in flight */
+    unsigned long long start;   /* us, 0 if no frame is in flight */
+    latency_histogram_t commands[LATENCY_COMMANDS];
+    int phase;                  /* LATENCY_PHASE_* in progress */
+    unsigned long long phase_start;
+    latency_phase_t phases[LATENCY_PHASES];
+} latency_t;
+
+unsigned long long latency_now(void);
+void latency_init(latency_t *l);
+/* A command frame is sent; cmd is the CMD_* code. Data frames pass -1 and are
+ * accounted to the command they belong to. */
+void latency_start(latency_t *l, int cmd);
+/* A response has been received; frames which were not requested by a send
+ * (e.g. the data after an ACK) are not counted. */
+void latency_stop(latency_t *l);
+void latency_record(latency_histogram_t *h, unsigned int us);
+/* Upper bound of the bucket holding the given percentile (0..100), in us */
+unsigned int latency_percentile(const latency_histogram_t *h, double percentile);
+/* LATENCY_* of a CMD_* code */
+int latency_command(int cmd);
+const char *latency_command_name(int command);
+void latency_phase_begin(latency_t *l, int phase);
+/* Close the phase in progress, if any; bytes is the flash area it has covered */
+void latency_phase_end(latency_t *l, unsigned long long bytes);
+const char *latency_phase_name(int phase);
+
+#endif // LATENCY_H__
@@ -0,0 +1,382 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "rl78flash.h"
+#include "rl78.h"
+#include "session.h"
+#include "image.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if RL78FLASH_ERASE != RL78_PROGRESS_ERASE \
+    || RL78FLASH_PROGRAM != RL78_PROGRESS_PROGRAM \
+    || RL78FLASH_VERIFY != RL78_PROGRESS_VERIFY
+#error "Progress operations of the public API differ from the session ones"
+#endif
+
+struct rl78flash_session
+{
+    rl78_session_t s;
+    char *port;
+    int connected;
+    rl78flash_device_t device;
+};
+
+struct rl78flash_image
+{
+    image_t image;
+};
+
+int rl78flash_api_version(void)
+{
+    return RL78FLASH_API_VERSION;
+}
+
+const char *rl78flash_strerror(int rc)
+{
+    switch (rc)
+    {
+    case RL78FLASH_OK:
+        return "Success";
+    case RL78FLASH_EINVAL:
+        return "Invalid argument";
+    case RL78FLASH_ENOMEM:
+        return "Out of memory";
+    case RL78FLASH_EPORT:
+        return "Unable to open port";
+    case RL78FLASH_ECONNECT:
+        return "No answer from the bootloader";
+    case RL78FLASH_ESTATE:
+        return "Session is not connected";
+    case RL78FLASH_EFILE:
+        return "Read failed";
+    case RL78FLASH_EFIT:
+        return "Image does not fit the device";
+    case RL78FLASH_EERASE:
+        return "Flash erase failed";
+    case RL78FLASH_EPROGRAM:
+        return "Flash write failed";
+    case RL78FLASH_EVERIFY:
+        return "Flash verification failed";
+    default:
+        return "Unknown error";
+    }
+}
+
+void rl78flash_config_init(rl78flash_config_t *config)
+{
+    memset(config, 0, sizeof *config);
+    config->mode = 1;
+    config->baud = SESSION_DEFAULT_BAUD;
+    config->voltage = SESSION_DEFAULT_VOLTAGE;
+}
+
+static
+void rl78flash_log_setup(rl78_log_t *log, const rl78flash_config_t *config)
+{
+    rl78_log_init(log, (NULL != config) ? config->log_level : 0);
+    if (NULL != config
+        && NULL != config->log)
+    {
+        log->func = config->log;
+        log->ctx = config->ctx;
+    }
+}
+
+int rl78flash_open(rl78flash_session_t **session, const char *port, const rl78flash_config_t *config)
+{
+    if (NULL == session
+        || NULL == port
+        || NULL == config
+        || MODE_MIN_VALUE > config->mode - 1
+        || MODE_MAX_VALUE < config->mode - 1
+        || RL78_MIN_VOLTAGE > config->voltage
+        || RL78_MAX_VOLTAGE < config->voltage)
+    {
+        return RL78FLASH_EINVAL;
+    }
+    rl78flash_session_t *session_ = calloc(1, sizeof *session_);
+    if (NULL == session_)
+    {
+        return RL78FLASH_ENOMEM;
+    }
+    session_->port = strdup(port);
+    if (NULL == session_->port)
+    {
+        free(session_);
+        return RL78FLASH_ENOMEM;
+    }
+    rl78_session_t *s = &session_->s;
+    rl78_session_init(s, config->log_level);
+    rl78flash_log_setup(&s->log, config);
+    s->progress = config->progress;
+    s->progress_ctx = config->ctx;
+    s->mode = (config->mode - 1) | (config->invert_reset ? MODE_INVERT_RESET : 0);
+    s->baud = config->baud;
+    s->voltage = config->voltage;
+    if (0 != serial_open(s, session_->port))
+    {
+        free(session_->port);
+        free(session_);
+        return RL78FLASH_EPORT;
+    }
+    *session = session_;
+    return RL78FLASH_OK;
+}
+
+void rl78flash_close(rl78flash_session_t *session)
+{
+    if (NULL == session)
+    {
+        return;
+    }
+    serial_close(&session->s);
+    free(session->port);
+    free(session);
+}
+
+int rl78flash_connect(rl78flash_session_t *session, rl78flash_device_t *device)
+{
+    if (NULL == session)
+    {
+        return RL78FLASH_EINVAL;
+    }
+    rl78_session_t *s = &session->s;
+    session->connected = 0;
+    if (0 > rl78_reset_init(s, 0)
+        || 0 > rl78_cmd_reset(s)
+        || 0 > rl78_cmd_silicon_signature(s, session->device.name,
+                                          &session->device.code_size, &session->device.data_size))
+    {
+        return RL78FLASH_ECONNECT;
+    }
+    session->connected = 1;
+    if (NULL != device)
+    {
+        *device = session->device;
+    }
+    return RL78FLASH_OK;
+}
+
+int rl78flash_reset(rl78flash_session_t *session)
+{
+    if (NULL == session)
+    {
+        return RL78FLASH_EINVAL;
+    }
+    rl78_log(&session->s.log, 1, "Reset MCU\n");
+    rl78_reset(&session->s);
+    session->connected = 0;
+    return RL78FLASH_OK;
+}
+
+int rl78flash_image_load(rl78flash_image_t **image, const char *const *filenames, unsigned int nfiles,
+                         const rl78flash_config_t *config)
+{
+    if (NULL == image
+        || NULL == filenames
+        || 0 == nfiles)
+    {
+        return RL78FLASH_EINVAL;
+    }
+    rl78flash_image_t *image_ = calloc(1, sizeof *image_);
+    if (NULL == image_)
+    {
+        return RL78FLASH_ENOMEM;
+    }
+    rl78_log_t log;
+    rl78flash_log_setup(&log, config);
+    if (0 != image_init(&image_->image, IMAGE_CODE_MAX_SIZE, IMAGE_DATA_MAX_SIZE, &log))
+    {
+        free(image_);
+        return RL78FLASH_ENOMEM;
+    }
+    if (0 != image_load(&image_->image, filenames, nfiles, 0, 0, &log))
+    {
+        image_free(&image_->image);
+        free(image_);
+        return RL78FLASH_EFILE;
+    }
+    *image = image_;
+    return RL78FLASH_OK;
+}
+
+void rl78flash_image_free(rl78flash_image_t *image)
+{
+    if (NULL == image)
+    {
+        return;
+    }
+    image_free(&image->image);
+    free(image);
+}
+
+/* Checks common to the calls which touch flash of the connected device */
+static
+int rl78flash_check(const rl78flash_session_t *session, const rl78flash_image_t *image, int areas)
+{
+    if (NULL == session
+        || 0 == (areas & RL78FLASH_ALL)
+        || 0 != (areas & ~RL78FLASH_ALL))
+    {
+        return RL78FLASH_EINVAL;
+    }
+    if (!session->connected)
+    {
+        return RL78FLASH_ESTATE;
+    }
+    if (NULL != image
+        && !image_fits(&image->image, session->device.code_size, session->device.data_size, &session->s.log))
+    {
+        return RL78FLASH_EFIT;
+    }
+    return RL78FLASH_OK;
+}
+
+static
+unsigned int rl78flash_used_blocks(const block_info_t *blocks, unsigned int size)
+{
+    unsigned int used = 0;
+    unsigned int i;
+    for (i = 0; i < size / FLASH_BLOCK_SIZE; ++i)
+    {
+        used += !blocks[i].blank;
+    }
+    return used;
+}
+
+int rl78flash_plan(rl78flash_session_t *session, const rl78flash_image_t *image, int areas,
+                   rl78flash_plan_t *plan)
+{
+    if (NULL == image
+        || NULL == plan)
+    {
+        return RL78FLASH_EINVAL;
+    }
+    const int rc = rl78flash_check(session, image, areas);
+    if (RL78FLASH_OK != rc)
+    {
+        return rc;
+    }
+    memset(plan, 0, sizeof *plan);
+    const rl78flash_device_t *device = &session->device;
+    if (areas & RL78FLASH_CODE)
+    {
+        plan->code_blocks = device->code_size / FLASH_BLOCK_SIZE;
+        plan->code_used = rl78flash_used_blocks(image->image.code_blocks, device->code_size);
+    }
+    if (areas & RL78FLASH_DATA)
+    {
+        plan->data_blocks = device->data_size / FLASH_BLOCK_SIZE;
+        plan->data_used = rl78flash_used_blocks(image->image.data_blocks, device->data_size);
+    }
+    return RL78FLASH_OK;
+}
+
+int rl78flash_erase(rl78flash_session_t *session, int areas)
+{
+    const int rc = rl78flash_check(session, NULL, areas);
+    if (RL78FLASH_OK != rc)
+    {
+        return rc;
+    }
+    rl78_session_t *s = &session->s;
+    if (areas & RL78FLASH_CODE)
+    {
+        rl78_log(&s->log, 1, "Erase code flash\n");
+        if (0 != rl78_erase(s, CODE_OFFSET, session->device.code_size))
+        {
+            return RL78FLASH_EERASE;
+        }
+    }
+    if ((areas & RL78FLASH_DATA) && session->device.data_size)
+    {
+        rl78_log(&s->log, 1, "Erase data flash\n");
+        if (0 != rl78_erase(s, DATA_OFFSET, session->device.data_size))
+        {
+            return RL78FLASH_EERASE;
+        }
+    }
+    return RL78FLASH_OK;
+}
+
+int rl78flash_program(rl78flash_session_t *session, const rl78flash_image_t *image, int areas)
+{
+    if (NULL == image)
+    {
+        return RL78FLASH_EINVAL;
+    }
+    const int rc = rl78flash_check(session, image, areas);
+    if (RL78FLASH_OK != rc)
+    {
+        return rc;
+    }
+    rl78_session_t *s = &session->s;
+    const image_t *img = &image->image;
+    if (areas & RL78FLASH_CODE)
+    {
+        rl78_log(&s->log, 1, "Write code flash\n");
+        if (0 != rl78_program(s, CODE_OFFSET, img->code, session->device.code_size, img->code_blocks))
+        {
+            return RL78FLASH_EPROGRAM;
+        }
+    }
+    if ((areas & RL78FLASH_DATA) && session->device.data_size)
+    {
+        rl78_log(&s->log, 1, "Write data flash\n");
+        if (0 != rl78_program(s, DATA_OFFSET, img->data, session->device.data_size, img->data_blocks))
+        {
+            return RL78FLASH_EPROGRAM;
+        }
+    }
+    return RL78FLASH_OK;
+}
+
+int rl78flash_verify(rl78flash_session_t *session, const rl78flash_image_t *image, int areas)
+{
+    if (NULL == image)
+    {
+        return RL78FLASH_EINVAL;
+    }
+    const int rc = rl78flash_check(session, image, areas);
+    if (RL78FLASH_OK != rc)
+    {
+        return rc;
+    }
+    rl78_session_t *s = &session->s;
+    const image_t *img = &image->image;
+    if (areas & RL78FLASH_CODE)
+    {
+        rl78_log(&s->log, 1, "Verify Code flash\n");
+        if (0 != rl78_verify(s, CODE_OFFSET, img->code, session->device.code_size, img->code_blocks))
+        {
+            return RL78FLASH_EVERIFY;
+        }
+    }
+    if ((areas & RL78FLASH_DATA) && session->device.data_size)
+    {
+        rl78_log(&s->log, 1, "Verify Data flash\n");
+        if (0 != rl78_verify(s, DATA_OFFSET, img->data, session->device.data_size, img->data_blocks))
+        {
+            return RL78FLASH_EVERIFY;
+        }
+    }
+    return RL78FLASH_OK;
+}
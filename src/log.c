@@ -0,0 +1,113 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "log.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+void rl78_log_init(rl78_log_t *log, int level)
+{
+    log->level = level;
+    log->func = rl78_log_stdio;
+    log->ctx = NULL;
+    log->hex = NULL;
+    log->hex_ctx = NULL;
+}
+
+/* Default sink: errors go to stderr, everything else to stdout */
+void rl78_log_stdio(void *ctx, int level, const char *message)
+{
+    (void)ctx;
+    FILE *stream = (RL78_LOG_ERROR == level) ? stderr : stdout;
+    fputs(message, stream);
+    const size_t len = strlen(message);
+    if (stdout == stream
+        && (0 == len || '\n' != message[len - 1]))
+    {
+        fflush(stdout);
+    }
+}
+
+static
+void rl78_log_emit(const rl78_log_t *log, int level, const char *message)
+{
+    if (NULL == log || NULL == log->func)
+    {
+        rl78_log_stdio(NULL, level, message);
+    }
+    else
+    {
+        log->func(log->ctx, level, message);
+    }
+}
+
+void rl78_log_quiet(void *ctx, int level, const char *message)
+{
+    if (RL78_LOG_ERROR != level)
+    {
+        rl78_log_emit((const rl78_log_t*)ctx, level, message);
+    }
+}
+
+void rl78_log(const rl78_log_t *log, int level, const char *format, ...)
+{
+    // Errors are reported even without a log
+    if (RL78_LOG_ERROR != level && !rl78_log_enabled(log, level))
+    {
+        return;
+    }
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof message, format, args);
+    va_end(args);
+    rl78_log_emit(log, level, message);
+}
+
+void rl78_log_hex(const rl78_log_t *log, int level, const char *prefix, const void *data, int len)
+{
+    if (!rl78_log_enabled(log, level) || 0 > len)
+    {
+        return;
+    }
+    if (NULL != log->hex)
+    {
+        log->hex(log->hex_ctx, level, prefix, data, len);
+        return;
+    }
+    static const char digits[] = "0123456789ABCDEF";
+    const unsigned char *p = (const unsigned char*)data;
+    char message[64 + len * 3 + 2];
+    int pos = snprintf(message, 64, "%s(%u): ", prefix, len);
+    if (64 <= pos)
+    {
+        pos = 63;
+    }
+    int i;
+    for (i = 0; i < len; ++i)
+    {
+        message[pos++] = digits[p[i] >> 4];
+        message[pos++] = digits[p[i] & 0x0F];
+        message[pos++] = ' ';
+    }
+    message[pos++] = '\n';
+    message[pos] = '\0';
+    rl78_log_emit(log, level, message);
+}
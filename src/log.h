@@ -0,0 +1,52 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef LOG_H__
+#define LOG_H__
+
+#define RL78_LOG_OUTPUT (-1)    /* requested output and prompts, always shown */
+#define RL78_LOG_ERROR  0
+
+/* Receives one formatted message. Messages do not always end with a newline
+ * (progress marks are partial lines). */
+typedef void (*rl78_log_func_t)(void *ctx, int level, const char *message);
+/* Receives the bytes of a hex dump to be formatted later, off the I/O path */
+typedef void (*rl78_log_hex_func_t)(void *ctx, int level, const char *prefix, const void *data, int len);
+
+typedef struct
+{
+    int level;                  /* messages above this level are dropped */
+    rl78_log_func_t func;
+    void *ctx;
+    rl78_log_hex_func_t hex;    /* NULL: hex dumps are formatted for func */
+    void *hex_ctx;
+} rl78_log_t;
+
+void rl78_log_init(rl78_log_t *log, int level);
+void rl78_log_stdio(void *ctx, int level, const char *message);
+/* Sink passing everything but errors to the log given as ctx, for exchanges
+ * which are expected to fail */
+void rl78_log_quiet(void *ctx, int level, const char *message);
+void rl78_log(const rl78_log_t *log, int level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+void rl78_log_hex(const rl78_log_t *log, int level, const char *prefix, const void *data, int len);
+
+#define rl78_log_enabled(log, lvl) (NULL != (log) && (lvl) <= (log)->level)
+
+#endif // LOG_H__
@@ -0,0 +1,221 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+
+#include "log_async.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define LOG_ASYNC_PREFIX    24
+
+/* A slot is free for position pos while seq is pos and holds the record of
+ * pos once seq is pos + 1; the writer frees it for pos + LOG_ASYNC_SLOTS. */
+typedef struct
+{
+    unsigned long seq;
+    int level;
+    int len;                    /* bytes of a hex dump, -1 for a message */
+    char prefix[LOG_ASYNC_PREFIX];
+    unsigned char data[LOG_ASYNC_SIZE];
+} log_async_slot_t;
+
+struct log_async
+{
+    rl78_log_t lower;           /* the sink the records are written to */
+    unsigned long head;         /* next position to take, by any thread */
+    unsigned long tail;         /* next position to write, by the writer */
+    int stopping;
+    sem_t ready;                /* posted for each record and to stop */
+    sem_t space;                /* free slots, posted by the writer */
+    pthread_t thread;
+    log_async_slot_t slots[LOG_ASYNC_SLOTS];
+};
+
+/* Take the slot of the next position, sleeping until the writer frees one
+ * while the ring is full: a spin would starve a writer of lower priority
+ * than the caller, as under -S */
+static
+log_async_slot_t *log_async_take(log_async_t *a, unsigned long *pos)
+{
+    while (0 != sem_wait(&a->space) && EINTR == errno)
+    {
+    }
+    // The slot reserved above is freed before it is posted, so seq lags p
+    // only while another thread is between its sem_wait() and the exchange
+    unsigned long p = __atomic_load_n(&a->head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        log_async_slot_t *slot = &a->slots[p & (LOG_ASYNC_SLOTS - 1)];
+        const long diff = (long)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - p);
+        if (0 == diff)
+        {
+            if (__atomic_compare_exchange_n(&a->head, &p, p + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *pos = p;
+                return slot;
+            }
+        }
+        else
+        {
+            p = __atomic_load_n(&a->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static
+void log_async_put(log_async_t *a, log_async_slot_t *slot, unsigned long pos)
+{
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    sem_post(&a->ready);
+}
+
+static
+void log_async_message(void *ctx, int level, const char *message)
+{
+    log_async_t *a = (log_async_t*)ctx;
+    unsigned long pos;
+    log_async_slot_t *slot = log_async_take(a, &pos);
+    size_t len = strlen(message);
+    if (LOG_ASYNC_SIZE <= len)
+    {
+        len = LOG_ASYNC_SIZE - 1;
+    }
+    memcpy(slot->data, message, len);
+    slot->data[len] = '\0';
+    slot->level = level;
+    slot->len = -1;
+    log_async_put(a, slot, pos);
+}
+
+static
+void log_async_hex(void *ctx, int level, const char *prefix, const void *data, int len)
+{
+    log_async_t *a = (log_async_t*)ctx;
+    unsigned long pos;
+    log_async_slot_t *slot = log_async_take(a, &pos);
+    size_t n = strlen(prefix);
+    if (LOG_ASYNC_PREFIX <= n)
+    {
+        n = LOG_ASYNC_PREFIX - 1;
+    }
+    memcpy(slot->prefix, prefix, n);
+    slot->prefix[n] = '\0';
+    if (LOG_ASYNC_SIZE < len)
+    {
+        len = LOG_ASYNC_SIZE;
+    }
+    memcpy(slot->data, data, len);
+    slot->level = level;
+    slot->len = len;
+    log_async_put(a, slot, pos);
+}
+
+static
+void *log_async_writer(void *arg)
+{
+    log_async_t *a = (log_async_t*)arg;
+    for (;;)
+    {
+        while (0 != sem_wait(&a->ready) && EINTR == errno)
+        {
+        }
+        // Every post but the last one of log_async_stop() is for a record
+        if (__atomic_load_n(&a->stopping, __ATOMIC_ACQUIRE)
+            && a->tail == __atomic_load_n(&a->head, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        log_async_slot_t *slot = &a->slots[a->tail & (LOG_ASYNC_SLOTS - 1)];
+        // Records are put in any order, the one at tail may still be filled
+        while (a->tail + 1 != __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE))
+        {
+            sched_yield();
+        }
+        if (0 > slot->len)
+        {
+            rl78_log(&a->lower, slot->level, "%s", (const char*)slot->data);
+        }
+        else
+        {
+            rl78_log_hex(&a->lower, slot->level, slot->prefix, slot->data, slot->len);
+        }
+        __atomic_store_n(&slot->seq, a->tail + LOG_ASYNC_SLOTS, __ATOMIC_RELEASE);
+        ++a->tail;
+        sem_post(&a->space);
+    }
+    return NULL;
+}
+
+log_async_t *log_async_start(rl78_log_t *log)
+{
+    log_async_t *a = calloc(1, sizeof *a);
+    if (NULL == a)
+    {
+        return NULL;
+    }
+    a->lower = *log;
+    unsigned long i;
+    for (i = 0; i < LOG_ASYNC_SLOTS; ++i)
+    {
+        a->slots[i].seq = i;
+    }
+    if (0 != sem_init(&a->ready, 0, 0))
+    {
+        free(a);
+        return NULL;
+    }
+    if (0 != sem_init(&a->space, 0, LOG_ASYNC_SLOTS))
+    {
+        sem_destroy(&a->ready);
+        free(a);
+        return NULL;
+    }
+    if (0 != pthread_create(&a->thread, NULL, log_async_writer, a))
+    {
+        sem_destroy(&a->space);
+        sem_destroy(&a->ready);
+        free(a);
+        return NULL;
+    }
+    log->func = log_async_message;
+    log->ctx = a;
+    log->hex = log_async_hex;
+    log->hex_ctx = a;
+    return a;
+}
+
+void log_async_stop(log_async_t *a, rl78_log_t *log)
+{
+    __atomic_store_n(&a->stopping, 1, __ATOMIC_RELEASE);
+    sem_post(&a->ready);
+    pthread_join(a->thread, NULL);
+    sem_destroy(&a->space);
+    sem_destroy(&a->ready);
+    log->func = a->lower.func;
+    log->ctx = a->lower.ctx;
+    log->hex = a->lower.hex;
+    log->hex_ctx = a->lower.hex_ctx;
+    free(a);
+}
@@ -0,0 +1,44 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+
+#ifndef LOG_ASYNC_H__
+#define LOG_ASYNC_H__
+
+#include "log.h"
+
+/* Log messages and hex dumps are queued in a lock-free ring and written by a
+ * thread of their own, so that the protocol dumps of -vvvv cost a copy
+ * instead of formatting and a write to the terminal per frame. Any thread
+ * may log; one which finds the ring full waits for the writer, so nothing is
+ * lost. Output written to stdout directly may overtake the queued messages. */
+
+#define LOG_ASYNC_SLOTS     1024    /* records in the ring, a power of two */
+#define LOG_ASYNC_SIZE      512     /* bytes of a message or hex dump */
+
+typedef struct log_async log_async_t;
+
+/* Route log through the ring to the sink it has now */
+log_async_t *log_async_start(rl78_log_t *log);
+/* Write what is queued and restore the sink of log */
+void log_async_stop(log_async_t *a, rl78_log_t *log);
+
+#endif  // LOG_ASYNC_H__
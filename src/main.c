@@ -23,15 +23,37 @@
 #include <string.h>
 #include <errno.h>
 #include <stdint.h>
+#include <getopt.h>
+#ifndef WIN32
+#include <sched.h>
+#endif
 #include "rl78.h"
 #include "serial.h"
-#include "srec.h"
+#include "session.h"
+#include "patch.h"
+#include "image.h"
+#include "job.h"
+#include "gang.h"
 #include "terminal.h"
-
-int verbose_level = 0;
+#include "recipe.h"
+#include "latency.h"
+#include "stats.h"
+#include "trace.h"
+#include "probe.h"
+#include "capture.h"
+#include "fault.h"
+#include "metrics.h"
+#include "wear.h"
+#include "progress.h"
+#include "log_async.h"
+#ifndef WIN32
+#include "daemon.h"
+#include "watch.h"
+#include "realtime.h"
+#endif
 
 const char *usage =
-    "rl78flash [options] <port> [<file>]\n"
+    "rl78flash [options] <port> [<file>...]\n"
     "\t-v\tVerbose mode (several times increase verbose level)\n"
     "\t-i\tDisplay info about MCU\n"
     "\t-a\tAuto mode (Erase-Write-Verify-Reset)\n"
@@ -49,13 +71,392 @@ const char *usage =
     "\t\t\tn=2 Two-wire UART, Reset by DTR\n"
     "\t\t\tn=3 Single-wire UART, Reset by RTS\n"
     "\t\t\tn=4 Two-wire UART, Reset by RTS\n"
+    "\t\t\tn=auto Detect the mode and reset polarity\n"
     "\t\t\tdefault: n=1\n"
     "\t-n\tInvert reset\n"
+    "\t-M file\tKeep detected modes per port in a state file\n"
+    "\t-T t\tReset timing: standard, fast, slow or a list of delays in ms\n"
+    "\t\t\treset_low,tool0_low,tool0_high,mode_settle\n"
+    "\t\t\tdefault: standard (1,3,1,1)\n"
+    "\t-H\tAdaptive handshake: poll with Reset for the first ACK instead of\n"
+    "\t\t\twaiting mode_settle\n"
     "\t-p v\tSpecify power supply voltage\n"
     "\t\t\tdefault: 3.3\n"
     "\t-t baud\tStart terminal with specified baudrate\n"
+    "\t-j n\tParse files on n threads and check for conflicting records\n"
+    "\t\t\tn=0 One thread per CPU\n"
+    "\t-P file\tApply per-unit values from a patch table to the image\n"
+    "\t-N n\tUnit number for the patch table; gang and watch modes count\n"
+    "\t\t\tup from it per port, daemon requests give their own\n"
+    "\t\t\tdefault: 0\n"
+    "\t-R file\tRun the steps of a recipe file on <port>\n"
+    "\t-L\tReport round trip latency per command, time per phase\n"
+    "\t\t\tand throughput\n"
+    "\t--stats-json file\n"
+    "\t\tWrite the same report as JSON to file (- for stdout)\n"
+    "\t--trace file\n"
+    "\t\tWrite protocol activity to file in Chrome trace format\n"
+    "\t--capture file\n"
+    "\t\tRecord the bytes and line events on <port> to file\n"
+    "\t--replay file\n"
+    "\t\tPlay a capture back at full speed instead of opening <port>\n"
+    "\t--faults spec\n"
+    "\t\tDrop, flip and truncate bytes and stall reads on <port>,\n"
+    "\t\te.g. drop=0.0001,flip=0.0001,stall=0.01:200 (see src/fault.h)\n"
+    "\t--metrics file\n"
+    "\t\tCount jobs per port in a Prometheus textfile, updated after\n"
+    "\t\teach job\n"
+    "\t--wear file\n"
+    "\t\tFlag blocks and boards whose erase or program times are over\n"
+    "\t\tthe baseline of the device type kept in file\n"
+    "\t--progress jsonl\n"
+    "\t\tReport phases and blocks as JSON lines on stdout instead of\n"
+    "\t\tthe progress marks; all other output goes to stderr\n"
+    "\t--progress-interval ms\n"
+    "\t\tLeast time between block events of a port\n"
+    "\t\t\tdefault: 200\n"
+#ifndef WIN32
+    "\t-S prio\tRun the I/O under SCHED_FIFO with priority prio (1..99)\n"
+    "\t\t\tand lock the memory of the process\n"
+    "\t-A cpu\tPin the I/O to CPU number cpu\n"
+    "\t--log-async\n"
+    "\t\tWrite log messages and protocol dumps (-vvvv) on a thread\n"
+    "\t\tof their own instead of in the I/O path\n"
+#endif
+    "\t-g\tGang mode: <port> is a comma-separated list of ports\n"
+    "\t\t\tto be programmed at once\n"
+#ifndef WIN32
+    "\t-D sock\tDaemon mode: serve jobs for the comma-separated list\n"
+    "\t\t\tof ports in <port> on a Unix domain socket\n"
+    "\t-W dir\tWatch mode: run the job on every new node in dir\n"
+    "\t\t\twhich matches the pattern given as <port>\n"
+#endif
     "\t-h\tDisplay help\n";
 
+#define OPT_STATS_JSON  256
+#define OPT_TRACE       257
+#define OPT_CAPTURE     258
+#define OPT_REPLAY      259
+#define OPT_METRICS     260
+#define OPT_FAULTS      261
+#define OPT_WEAR        262
+#define OPT_PROGRESS    263
+#define OPT_PROGRESS_INTERVAL   264
+#define OPT_LOG_ASYNC   265
+
+static const struct option long_options[] =
+{
+    { "stats-json", required_argument, NULL, OPT_STATS_JSON },
+    { "trace", required_argument, NULL, OPT_TRACE },
+    { "capture", required_argument, NULL, OPT_CAPTURE },
+    { "replay", required_argument, NULL, OPT_REPLAY },
+    { "metrics", required_argument, NULL, OPT_METRICS },
+    { "faults", required_argument, NULL, OPT_FAULTS },
+    { "wear", required_argument, NULL, OPT_WEAR },
+    { "progress", required_argument, NULL, OPT_PROGRESS },
+    { "progress-interval", required_argument, NULL, OPT_PROGRESS_INTERVAL },
+#ifndef WIN32
+    { "log-async", no_argument, NULL, OPT_LOG_ASYNC },
+#endif
+    { NULL, 0, NULL, 0 }
+};
+
+typedef struct
+{
+    image_t image;
+    image_loader_t loader;
+    const patch_table_t *patches;
+    unsigned int unit;
+    const rl78_log_t *log;
+} main_image_t;
+
+static
+const image_t *main_get_image(void *ctx, const job_result_t *device)
+{
+    main_image_t *image = (main_image_t*)ctx;
+    (void)device;
+    if (0 != image_load_wait(&image->loader))
+    {
+        return NULL;
+    }
+    if (0 != image_patch(&image->image, image->patches, image->unit, image->log))
+    {
+        rl78_log(image->log, RL78_LOG_ERROR, "Patching failed\n");
+        return NULL;
+    }
+    return &image->image;
+}
+
+static
+int main_probe(rl78_session_t *s, const char *port, const char *state_file)
+{
+    const int cached = NULL == state_file ? PROBE_NO_MODE : probe_cache_get(state_file, port, &s->log);
+    if (PROBE_NO_ERROR != probe_mode(s, cached))
+    {
+        return EIO;
+    }
+    if (NULL != state_file
+        && cached != s->mode)
+    {
+        // Not being able to remember the mode is not fatal
+        probe_cache_put(state_file, port, s->mode, &s->log);
+    }
+    return 0;
+}
+
+static
+int main_trace_open(rl78_session_t *s, const char *filename, const char *port, int gang)
+{
+    if (NULL == filename)
+    {
+        return 0;
+    }
+    s->trace = trace_open(filename);
+    if (NULL == s->trace)
+    {
+        fprintf(stderr, "Unable to write %s: %s\n", filename, strerror(errno));
+        return EIO;
+    }
+    // Gang mode names a track for each port
+    if (!gang)
+    {
+        s->trace_track = 1;
+        trace_track(s->trace, 1, port);
+    }
+    return 0;
+}
+
+static
+void main_trace_close(rl78_session_t *s)
+{
+    if (NULL != s->trace
+        && 0 != trace_close(s->trace))
+    {
+        fprintf(stderr, "Failed to write the trace\n");
+    }
+    s->trace = NULL;
+}
+
+/* A replay takes the place of the port, a capture records whatever is below it */
+static
+int main_capture_start(rl78_session_t *s, const char *capture_file, const char *replay_file,
+                       capture_t **capture, capture_t **replay)
+{
+    *capture = NULL;
+    *replay = NULL;
+    if (NULL != replay_file)
+    {
+        *replay = capture_replay(s, replay_file);
+        if (NULL == *replay)
+        {
+            fprintf(stderr, "Unable to read capture %s\n", replay_file);
+            return EIO;
+        }
+    }
+    if (NULL != capture_file)
+    {
+        *capture = capture_start(s, capture_file);
+        if (NULL == *capture)
+        {
+            fprintf(stderr, "Unable to write %s: %s\n", capture_file, strerror(errno));
+            return EIO;
+        }
+    }
+    return 0;
+}
+
+static
+void main_capture_stop(rl78_session_t *s, capture_t *capture, capture_t *replay)
+{
+    if (NULL != capture
+        && 0 != capture_stop(s, capture))
+    {
+        fprintf(stderr, "Failed to write the capture\n");
+    }
+    // A diverging replay has failed the run already
+    if (NULL != replay)
+    {
+        (void)capture_stop(s, replay);
+    }
+}
+
+/* Faults are injected below a capture, so that it records what the protocol
+ * code has seen */
+static
+int main_faults_start(rl78_session_t *s, const char *fault_spec, const fault_config_t *config, fault_t **faults)
+{
+    *faults = NULL;
+    if (NULL != fault_spec)
+    {
+        *faults = fault_start(s, config);
+        if (NULL == *faults)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static
+void main_faults_stop(rl78_session_t *s, fault_t *faults)
+{
+    if (NULL != faults)
+    {
+        fault_report(fault_counts(faults), &s->log);
+        fault_stop(s, faults);
+    }
+}
+
+/* The events keep a copy of stdout to themselves, and stdout is pointed at
+ * stderr, so that the log, tables and stats don't mix with the JSON lines */
+static
+FILE *main_progress_stream(void)
+{
+    fflush(stdout);
+    const int fd = dup(STDOUT_FILENO);
+    FILE *out = (0 <= fd) ? fdopen(fd, "w") : NULL;
+    if (NULL == out
+        || 0 > dup2(STDERR_FILENO, STDOUT_FILENO))
+    {
+        fprintf(stderr, "Unable to separate the progress stream: %s\n", strerror(errno));
+        if (NULL != out)
+        {
+            fclose(out);
+        }
+        else if (0 <= fd)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+    return out;
+}
+
+static
+int main_progress_open(rl78_session_t *s, FILE *out, unsigned int interval)
+{
+    if (NULL != out)
+    {
+        s->events = progress_open(out, interval);
+        if (NULL == s->events)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static
+void main_progress_close(rl78_session_t *s)
+{
+    if (NULL != s->events)
+    {
+        progress_close(s->events);
+        s->events = NULL;
+    }
+}
+
+static
+void main_metrics(rl78_session_t *s, const char *port, job_result_t *result, int retcode)
+{
+    if (NULL == s->metrics)
+    {
+        return;
+    }
+    // A port which could not be opened or probed has failed the job as well
+    if (0 == result->retcode)
+    {
+        result->retcode = retcode;
+    }
+    metrics_job(s->metrics, port, s, result);
+}
+
+static
+int main_realtime(int priority, int cpu, const rl78_log_t *log)
+{
+#ifndef WIN32
+    if (0 != realtime_setup(priority, cpu, log))
+    {
+        return EPERM;
+    }
+#else
+    (void)priority;
+    (void)cpu;
+    (void)log;
+#endif
+    return 0;
+}
+
+/* The writer is started before main_realtime() and the image loader, so it
+ * keeps the default policy and no thread sees the log being switched */
+static
+int main_log_start(rl78_session_t *s, int async, log_async_t **writer)
+{
+    *writer = NULL;
+#ifndef WIN32
+    if (async)
+    {
+        *writer = log_async_start(&s->log);
+        if (NULL == *writer)
+        {
+            fprintf(stderr, "Unable to start the log writer\n");
+            return ENOMEM;
+        }
+    }
+#else
+    (void)s;
+    (void)async;
+#endif
+    return 0;
+}
+
+static
+void main_log_stop(rl78_session_t *s, log_async_t *writer)
+{
+#ifndef WIN32
+    if (NULL != writer)
+    {
+        log_async_stop(writer, &s->log);
+    }
+#else
+    (void)s;
+    (void)writer;
+#endif
+}
+
+static
+void main_report(const rl78_session_t *s, int retcode, int text, const char *json, int priority, int cpu)
+{
+    if (NULL == s->latency)
+    {
+        return;
+    }
+    if (NULL != json)
+    {
+        stats_write_json(s, retcode, json);
+    }
+    if (!text)
+    {
+        return;
+    }
+    stats_report(s);
+    if (0 < priority)
+    {
+        rl78_log(&s->log, RL78_LOG_OUTPUT, "Scheduling: SCHED_FIFO priority %i", priority);
+    }
+    else
+    {
+        rl78_log(&s->log, RL78_LOG_OUTPUT, "Scheduling: default");
+    }
+    if (0 <= cpu)
+    {
+        rl78_log(&s->log, RL78_LOG_OUTPUT, ", CPU %i", cpu);
+    }
+    rl78_log(&s->log, RL78_LOG_OUTPUT, "\n");
+}
+
 int main(int argc, char *argv[])
 {
     char erase = 0;
@@ -72,10 +473,38 @@ int main(int argc, char *argv[])
     int terminal_baud = 0;
     char nodata = 0;
     char nocode = 0;
+    char parallel_parse = 0;
+    unsigned int parse_threads = 0;
+    const char *patch_file = NULL;
+    unsigned int unit = 0;
+    char gang = 0;
+    const char *recipe_file = NULL;
+    const char *daemon_socket = NULL;
+    const char *watch_dir = NULL;
+    const char *timing = NULL;
+    char adaptive = 0;
+    char probe = 0;
+    const char *state_file = NULL;
+    char latency_stats = 0;
+    const char *stats_json = NULL;
+    const char *trace_file = NULL;
+    const char *capture_file = NULL;
+    const char *replay_file = NULL;
+    const char *metrics_file = NULL;
+    const char *fault_spec = NULL;
+    const char *wear_file = NULL;
+    int progress_jsonl = 0;
+    unsigned int progress_interval = PROGRESS_INTERVAL;
+    int log_async = 0;
+    log_async_t *log_writer;
+    fault_config_t fault_config;
+    int rt_priority = 0;
+    int rt_cpu = -1;
+    int verbose_level = 0;
 
     char *endp;
     int opt;
-    while ((opt = getopt(argc, argv, "xyab:cvwrdeim:np:t:h?")) != -1)
+    while ((opt = getopt_long(argc, argv, "xyab:cvwrdegij:m:M:nN:p:P:R:t:T:HD:W:LS:A:h?", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -101,6 +530,11 @@ int main(int argc, char *argv[])
             }
             break;
         case 'm':
+            if (0 == strcmp(optarg, "auto"))
+            {
+                probe = 1;
+                break;
+            }
             mode = strtol(optarg, &endp, 10) - 1;
             if (optarg == endp
                 || MODE_MAX_VALUE < mode
@@ -121,6 +555,123 @@ int main(int argc, char *argv[])
                 return EINVAL;
             }
             break;
+        case 'j':
+            parallel_parse = 1;
+            parse_threads = strtoul(optarg, &endp, 10);
+            if (optarg == endp)
+            {
+                fprintf(stderr, "Number of threads is not defined\n");
+                printf("%s", usage);
+                return EINVAL;
+            }
+            break;
+        case 'g':
+            gang = 1;
+            break;
+#ifndef WIN32
+        case 'D':
+            daemon_socket = optarg;
+            break;
+        case 'W':
+            watch_dir = optarg;
+            break;
+        case OPT_LOG_ASYNC:
+            log_async = 1;
+            break;
+        case 'S':
+            rt_priority = strtol(optarg, &endp, 10);
+            if (optarg == endp
+                || sched_get_priority_min(SCHED_FIFO) > rt_priority
+                || sched_get_priority_max(SCHED_FIFO) < rt_priority)
+            {
+                fprintf(stderr, "Invalid priority: %s\n", optarg);
+                printf("%s", usage);
+                return EINVAL;
+            }
+            break;
+        case 'A':
+            rt_cpu = strtol(optarg, &endp, 10);
+            if (optarg == endp
+                || 0 > rt_cpu)
+            {
+                fprintf(stderr, "Invalid CPU number: %s\n", optarg);
+                printf("%s", usage);
+                return EINVAL;
+            }
+            break;
+#endif
+        case 'M':
+            state_file = optarg;
+            break;
+        case 'T':
+            timing = optarg;
+            break;
+        case 'H':
+            adaptive = 1;
+            break;
+        case 'L':
+            latency_stats = 1;
+            break;
+        case OPT_STATS_JSON:
+            stats_json = optarg;
+            break;
+        case OPT_TRACE:
+            trace_file = optarg;
+            break;
+        case OPT_CAPTURE:
+            capture_file = optarg;
+            break;
+        case OPT_REPLAY:
+            replay_file = optarg;
+            break;
+        case OPT_METRICS:
+            metrics_file = optarg;
+            break;
+        case OPT_WEAR:
+            wear_file = optarg;
+            break;
+        case OPT_PROGRESS:
+            if (0 != strcmp(optarg, "jsonl"))
+            {
+                fprintf(stderr, "Unsupported progress format: %s\n", optarg);
+                printf("%s", usage);
+                return EINVAL;
+            }
+            progress_jsonl = 1;
+            break;
+        case OPT_PROGRESS_INTERVAL:
+            progress_interval = strtoul(optarg, &endp, 10);
+            if ('\0' == *optarg || '\0' != *endp)
+            {
+                fprintf(stderr, "Invalid progress interval: %s\n", optarg);
+                printf("%s", usage);
+                return EINVAL;
+            }
+            break;
+        case OPT_FAULTS:
+            fault_spec = optarg;
+            if (0 != fault_parse(&fault_config, fault_spec))
+            {
+                fprintf(stderr, "Invalid fault spec: %s\n", optarg);
+                printf("%s", usage);
+                return EINVAL;
+            }
+            break;
+        case 'P':
+            patch_file = optarg;
+            break;
+        case 'R':
+            recipe_file = optarg;
+            break;
+        case 'N':
+            unit = strtoul(optarg, &endp, 10);
+            if (optarg == endp)
+            {
+                fprintf(stderr, "Unit number is not defined\n");
+                printf("%s", usage);
+                return EINVAL;
+            }
+            break;
         case 'p':
             if (1 != sscanf(optarg, "%f", &voltage))
             {
@@ -174,35 +725,248 @@ int main(int argc, char *argv[])
     {
         mode |= MODE_INVERT_RESET;
     }
-    char *portname = NULL;
-    char *filename = NULL;
-    switch (argc - optind)
-    {
-    case 2:
-        filename = argv[optind + 1];
-        /* fall-through */
-    case 1:
-        portname = argv[optind + 0];
-        break;
-    default:
+    if (1 > argc - optind)
+    {
         printf("%s", usage);
         return EINVAL;
     }
+    char *portname = argv[optind];
+    // Several files are merged into a single image
+    const char *const *filenames = (const char *const *)&argv[optind + 1];
+    const unsigned int nfiles = argc - optind - 1;
 
     // If file is not specified, but required - show error message
-    if (NULL == filename
+    if (0 == nfiles
         && (1 == write || 1 == verify))
     {
         fprintf(stderr, "File not specified\n");
         return ENOENT;
     }
 
-    port_handle_t fd = serial_open(portname);
-    int rc = 0;
-    if (INVALID_HANDLE_VALUE == fd)
+    if ((gang || NULL != watch_dir)
+        && (wait || terminal))
+    {
+        fprintf(stderr, "Options -d and -t are not supported in gang and watch modes\n");
+        return EINVAL;
+    }
+
+    if (probe
+        && (gang || NULL != daemon_socket || NULL != watch_dir || NULL != recipe_file))
+    {
+        fprintf(stderr, "Mode detection is supported only for a single port\n");
+        return EINVAL;
+    }
+    if (NULL != state_file
+        && !probe)
+    {
+        fprintf(stderr, "Option -M requires -m auto\n");
+        return EINVAL;
+    }
+    if ((latency_stats || NULL != stats_json)
+        && (gang || NULL != daemon_socket || NULL != watch_dir))
+    {
+        fprintf(stderr, "Options -L and --stats-json are not supported in gang, daemon and watch modes\n");
+        return EINVAL;
+    }
+    if (progress_jsonl
+        && NULL != stats_json
+        && 0 == strcmp(stats_json, "-"))
+    {
+        // stdout carries only the progress events
+        fprintf(stderr, "Option --stats-json - is not supported with --progress=jsonl\n");
+        return EINVAL;
+    }
+    if (NULL != trace_file
+        && (NULL != daemon_socket || NULL != watch_dir))
+    {
+        fprintf(stderr, "Option --trace is not supported in daemon and watch modes\n");
+        return EINVAL;
+    }
+    if ((NULL != capture_file || NULL != replay_file)
+        && (gang || NULL != daemon_socket || NULL != watch_dir))
+    {
+        fprintf(stderr, "Options --capture and --replay are supported only for a single port\n");
+        return EINVAL;
+    }
+    if (NULL != fault_spec
+        && (NULL != replay_file || gang || NULL != daemon_socket || NULL != watch_dir))
+    {
+        fprintf(stderr, "Option --faults is supported only for a single port and not with --replay\n");
+        return EINVAL;
+    }
+    if (NULL != replay_file
+        && terminal)
+    {
+        fprintf(stderr, "Option -t is not supported with --replay\n");
+        return EINVAL;
+    }
+    if (NULL != daemon_socket
+        && (0 != rt_priority || 0 <= rt_cpu))
     {
-        return EBADF;
+        fprintf(stderr, "Options -S and -A are not supported in daemon mode\n");
+        return EINVAL;
+    }
+    FILE *progress_out = NULL;
+    if (progress_jsonl)
+    {
+        progress_out = main_progress_stream();
+        if (NULL == progress_out)
+        {
+            return EIO;
+        }
+    }
+
+    rl78_session_t session;
+    rl78_session_init(&session, verbose_level);
+    session.mode = mode;
+    session.baud = baud;
+    session.voltage = voltage;
+    session.timing.adaptive = adaptive;
+    if (NULL != timing
+        && 0 != rl78_session_timing(&session.timing, timing))
+    {
+        fprintf(stderr, "Invalid reset timing: %s\n", timing);
+        printf("%s", usage);
+        return EINVAL;
+    }
+    latency_t latency;
+    if (latency_stats || NULL != stats_json)
+    {
+        latency_init(&latency);
+        session.latency = &latency;
+    }
+
+    patch_table_t patches = { NULL, 0 };
+    if (NULL != patch_file
+        && PATCH_NO_ERROR != patch_table_load(&patches, patch_file, &session.log))
+    {
+        patch_table_free(&patches);
+        return EINVAL;
+    }
+
+    if (NULL != recipe_file)
+    {
+        // Steps, images and actions are given by the recipe
+        if (0 != nfiles
+            || gang || wait || terminal
+            || NULL != daemon_socket || NULL != watch_dir
+            || NULL != metrics_file || NULL != wear_file)
+        {
+            fprintf(stderr, "Files and options -d, -g, -t, -D, -W, --metrics and --wear are not supported with a recipe\n");
+            patch_table_free(&patches);
+            return EINVAL;
+        }
+        recipe_t recipe;
+        if (RECIPE_NO_ERROR != recipe_load(&recipe, recipe_file, &session, &session.log))
+        {
+            patch_table_free(&patches);
+            return EINVAL;
+        }
+        // One board per run, so the image is patched in place
+        if (NULL != patch_file)
+        {
+            recipe.patches = &patches;
+            recipe.unit = unit;
+        }
+        int retcode = main_log_start(&session, log_async, &log_writer);
+        if (0 == retcode)
+        {
+            retcode = main_realtime(rt_priority, rt_cpu, &session.log);
+        }
+        if (0 == retcode)
+        {
+            retcode = main_trace_open(&session, trace_file, portname, 0);
+        }
+        if (0 == retcode)
+        {
+            retcode = main_progress_open(&session, progress_out, progress_interval);
+        }
+        fault_t *faults = NULL;
+        capture_t *capture = NULL;
+        capture_t *replay = NULL;
+        if (0 == retcode)
+        {
+            retcode = main_faults_start(&session, fault_spec, &fault_config, &faults);
+        }
+        if (0 == retcode)
+        {
+            retcode = main_capture_start(&session, capture_file, replay_file, &capture, &replay);
+        }
+        if (0 == retcode)
+        {
+            retcode = EBADF;
+            if (0 == serial_open(&session, portname))
+            {
+                retcode = recipe_run(&recipe, &session);
+                serial_close(&session);
+                main_report(&session, retcode, latency_stats, stats_json, rt_priority, rt_cpu);
+            }
+        }
+        main_capture_stop(&session, capture, replay);
+        main_faults_stop(&session, faults);
+        main_trace_close(&session);
+        main_progress_close(&session);
+        main_log_stop(&session, log_writer);
+        recipe_free(&recipe);
+        patch_table_free(&patches);
+        return retcode;
+    }
+
+#ifndef WIN32
+    if (NULL != daemon_socket)
+    {
+        // Actions, files and units are given by each request
+        if (0 != nfiles
+            || gang || wait || terminal)
+        {
+            fprintf(stderr, "Files and options -d, -g and -t are not supported in daemon mode\n");
+            patch_table_free(&patches);
+            return EINVAL;
+        }
+        char *ports[strlen(portname) / 2 + 1];
+        unsigned int nports = 0;
+        char *port;
+        for (port = strtok(portname, ","); NULL != port; port = strtok(NULL, ","))
+        {
+            ports[nports++] = port;
+        }
+        // The daemon serves the counters even without a file
+        session.metrics = metrics_open(metrics_file, &session.log);
+        if (NULL != wear_file)
+        {
+            session.wear = wear_open(wear_file, &session.log);
+        }
+        if (NULL == session.metrics
+            || (NULL != wear_file && NULL == session.wear))
+        {
+            fprintf(stderr, "Out of memory\n");
+            if (NULL != session.metrics)
+            {
+                metrics_close(session.metrics);
+            }
+            patch_table_free(&patches);
+            return ENOMEM;
+        }
+        int retcode = main_log_start(&session, log_async, &log_writer);
+        if (0 == retcode)
+        {
+            retcode = main_progress_open(&session, progress_out, progress_interval);
+        }
+        if (0 == retcode)
+        {
+            retcode = daemon_run(daemon_socket, ports, nports, &session, parallel_parse, parse_threads, &patches);
+        }
+        main_progress_close(&session);
+        main_log_stop(&session, log_writer);
+        metrics_close(session.metrics);
+        if (NULL != session.wear)
+        {
+            wear_close(session.wear);
+        }
+        patch_table_free(&patches);
+        return retcode;
     }
+#endif
 
     // If no actions are specified - do nothing :)
     if (0 == write
@@ -212,173 +976,166 @@ int main(int argc, char *argv[])
         && 0 == display_info
         && 0 == terminal)
     {
+        patch_table_free(&patches);
         return 0;
     }
 
-    int retcode = 0;
-    do
+    job_options_t options;
+    memset(&options, 0, sizeof options);
+    options.erase = erase;
+    options.write = write;
+    options.verify = verify;
+    options.reset_after = reset_after && !terminal;
+    options.display_info = display_info;
+    options.nocode = nocode;
+    options.nodata = nodata;
+    options.wait = wait;
+
+    main_image_t image;
+    image.patches = &patches;
+    image.unit = unit;
+    image.log = &session.log;
+    const int need_image = write || verify;
+    int retcode = main_log_start(&session, log_async, &log_writer);
+    if (0 != retcode)
+    {
+        patch_table_free(&patches);
+        return retcode;
+    }
+    if (need_image)
     {
-        if (1 == write
-            || 1 == erase
-            || 1 == verify
-            || 1 == display_info)
+        if (0 != image_init(&image.image, IMAGE_CODE_MAX_SIZE, IMAGE_DATA_MAX_SIZE, &session.log))
         {
-            rc = rl78_reset_init(fd, wait, baud, mode, voltage);
-            if (0 > rc)
-            {
-                fprintf(stderr, "Initialization failed\n");
-                retcode = EIO;
-                break;
-            }
-            rc = rl78_cmd_reset(fd);
-            if (0 > rc)
-            {
-                fprintf(stderr, "Synchronization failed\n");
-                retcode = EIO;
-                break;
-            }
-            char device_name[11];
-            unsigned int code_size, data_size;
-            rc = rl78_cmd_silicon_signature(fd, device_name, &code_size, &data_size);
-            if (0 > rc)
-            {
-                fprintf(stderr, "Silicon signature read failed\n");
-                retcode = EIO;
-                break;
-            }
-            if (1 == display_info)
-            {
-                printf("Device: %s\n"
-                       "Code size: %u kB\n"
-                       "Data size: %u kB\n",
-                       device_name, code_size / 1024, data_size / 1024
-                    );
-            }
-            if (!nocode && (1 == erase))
-            {
-                if (1 <= verbose_level)
-                {
-                    printf("Erase code flash\n");
-                }
-                rc = rl78_erase(fd, CODE_OFFSET, code_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Code flash erase failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
-            if (!nodata && (1 == erase && data_size))
+            main_log_stop(&session, log_writer);
+            patch_table_free(&patches);
+            return ENOMEM;
+        }
+        // Parse the image while the bootloader is being initialized
+        image_load_start(&image.loader, &image.image, filenames, nfiles, parallel_parse, parse_threads,
+                         &session.log);
+    }
+
+    // The image loader has been started already and keeps the default policy
+    retcode = main_realtime(rt_priority, rt_cpu, &session.log);
+    if (0 == retcode)
+    {
+        retcode = main_trace_open(&session, trace_file, portname, gang);
+    }
+    if (0 == retcode)
+    {
+        retcode = main_progress_open(&session, progress_out, progress_interval);
+    }
+    if (0 == retcode
+        && NULL != metrics_file)
+    {
+        session.metrics = metrics_open(metrics_file, &session.log);
+        if (NULL == session.metrics)
+        {
+            fprintf(stderr, "Out of memory\n");
+            retcode = ENOMEM;
+        }
+    }
+    if (0 == retcode
+        && NULL != wear_file)
+    {
+        session.wear = wear_open(wear_file, &session.log);
+        if (NULL == session.wear)
+        {
+            fprintf(stderr, "Out of memory\n");
+            retcode = ENOMEM;
+        }
+    }
+    if (0 == retcode)
+    {
+#ifndef WIN32
+        if (NULL != watch_dir)
+        {
+            retcode = watch_run(watch_dir, portname, &options, &session, &image.image,
+                                need_image ? &image.loader : NULL, &patches, unit);
+        }
+        else
+#endif
+        if (gang)
+        {
+            char *ports[strlen(portname) / 2 + 1];
+            unsigned int nports = 0;
+            char *port;
+            for (port = strtok(portname, ","); NULL != port; port = strtok(NULL, ","))
             {
-                if (1 <= verbose_level)
-                {
-                    printf("Erase data flash\n");
-                }
-                rc = rl78_erase(fd, DATA_OFFSET, data_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Data flash erase failed\n");
-                    retcode = EIO;
-                    break;
-                }
+                ports[nports++] = port;
             }
-            unsigned char code[code_size];
-            unsigned char data[data_size];
-            if (1 == write
-                || 1 == verify)
+            retcode = gang_run(ports, nports, &options, &session, &image.image, need_image ? &image.loader : NULL,
+                               &patches, unit);
+        }
+        else
+        {
+            fault_t *faults;
+            capture_t *capture = NULL;
+            capture_t *replay = NULL;
+            job_result_t result;
+            memset(&result, 0, sizeof result);
+            if (NULL != session.metrics
+                && NULL == session.latency)
             {
-                memset(code, 0xFF, sizeof code);
-                memset(data, 0xFF, sizeof data);
-                if (1 <= verbose_level)
-                {
-                    printf("Read file \"%s\"\n", filename);
-                }
-                rc = srec_read(filename, code, code_size, data, data_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Read failed\n");
-                    retcode = EIO;
-                    break;
-                }
+                session.latency = metrics_latency(session.metrics, portname);
             }
-            if (!nocode && (1 == write))
+            retcode = main_faults_start(&session, fault_spec, &fault_config, &faults);
+            if (0 == retcode)
             {
-                if (1 <= verbose_level)
-                {
-                    printf("Write code flash\n");
-                }
-                rc = rl78_program(fd, CODE_OFFSET, code, code_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Code flash write failed\n");
-                    retcode = EIO;
-                    break;
-                }
+                retcode = main_capture_start(&session, capture_file, replay_file, &capture, &replay);
             }
-            if (!nodata && (1 == write && data_size))
+            if (0 == retcode
+                && 0 != serial_open(&session, portname))
             {
-                if (1 <= verbose_level)
-                {
-                    printf("Write data flash\n");
-                }
-                rc = rl78_program(fd, DATA_OFFSET, data, data_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Data flash write failed\n");
-                    retcode = EIO;
-                    break;
-                }
+                retcode = EBADF;
+                result.error = "Unable to open port";
+                main_metrics(&session, portname, &result, retcode);
             }
-            if (!nocode && (1 == verify))
+            else if (0 == retcode)
             {
-                if (1 <= verbose_level)
+                if (probe)
                 {
-                    printf("Verify Code flash\n");
+                    retcode = main_probe(&session, portname, state_file);
                 }
-                rc = rl78_verify(fd, CODE_OFFSET, code, code_size);
-                if (0 != rc)
+                if (0 == retcode)
                 {
-                    fprintf(stderr, "Code flash verification failed\n");
-                    retcode = EIO;
-                    break;
+                    retcode = job_run(&session, &options, main_get_image, &image, &result);
                 }
-            }
-            if (!nodata && (1 == verify && data_size))
-            {
-                if (1 <= verbose_level)
+                if (0 == retcode && 1 == terminal)
                 {
-                    printf("Verify Data flash\n");
+                    if (1 <= verbose_level)
+                    {
+                        printf("Start terminal\n");
+                    }
+                    int reset_before_terminal = write || verify || erase
+                        || reset_after || display_info;
+                    terminal_start(&session, terminal_baud, reset_before_terminal);
                 }
-                rc = rl78_verify(fd, DATA_OFFSET, data, data_size);
-                if (0 != rc)
-                {
-                    fprintf(stderr, "Data flash verification failed\n");
-                    retcode = EIO;
-                    break;
-                }
-            }
-        }
-        if (1 == terminal)
-        {
-            if (1 <= verbose_level)
-            {
-                printf("Start terminal\n");
+                serial_close(&session);
+                main_metrics(&session, portname, &result, retcode);
+                main_report(&session, retcode, latency_stats, stats_json, rt_priority, rt_cpu);
             }
-            int reset_before_terminal = write || verify || erase
-                || reset_after || display_info;
-            terminal_start(fd, terminal_baud, mode, reset_before_terminal);
-        }
-        else if (1 == reset_after)
-        {
-            if (1 <= verbose_level)
-            {
-                printf("Reset MCU\n");
-            }
-            rl78_reset(fd, mode);
+            main_capture_stop(&session, capture, replay);
+            main_faults_stop(&session, faults);
         }
     }
-    while (0);
-    serial_close(fd);
+    main_trace_close(&session);
+    main_progress_close(&session);
+    if (NULL != session.metrics)
+    {
+        metrics_close(session.metrics);
+    }
+    if (NULL != session.wear)
+    {
+        wear_close(session.wear);
+    }
+    if (need_image)
+    {
+        image_load_wait(&image.loader);
+        image_free(&image.image);
+    }
+    main_log_stop(&session, log_writer);
+    patch_table_free(&patches);
     printf("\n");
     return retcode;
 }
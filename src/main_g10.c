@@ -24,11 +24,10 @@
 #include <errno.h>
 #include "rl78g10.h"
 #include "serial.h"
+#include "session.h"
 #include "srec.h"
 #include "terminal.h"
 
-int verbose_level = 0;
-
 const char *usage =
     "rl78g10flash [options] <port> [<file> <size>]\n"
     "\t-a\tAuto mode (Erase/Write-Verify-Reset)\n"
@@ -55,6 +54,7 @@ int main(int argc, char *argv[])
     char invert_reset = 0;
     char terminal = 0;
     int terminal_baud = 0;
+    int verbose_level = 0;
 
     char *endp;
     int opt;
@@ -176,17 +176,19 @@ int main(int argc, char *argv[])
         return 0;
     }
 
-    port_handle_t fd = serial_open(portname);
-    int rc = 0;
-    if (INVALID_HANDLE_VALUE == fd)
+    rl78_session_t session;
+    rl78_session_init(&session, verbose_level);
+    session.mode = mode;
+    int rc = serial_open(&session, portname);
+    if (0 != rc)
     {
         return EBADF;
     }
-    rc = serial_set_parity(fd, ENABLE, ODD);
+    rc = serial_set_parity(&session, ENABLE, ODD);
     if (rc < 0)
     {
         perror("Failed to set port attributes:");
-        serial_close(fd);
+        serial_close(&session);
         return EIO;
     }
 
@@ -195,7 +197,7 @@ int main(int argc, char *argv[])
     {
         if (1 == write || 1 == verify)
         {
-            rc = rl78g10_reset_init(fd, wait, mode);
+            rc = rl78g10_reset_init(&session, wait);
             if (0 > rc)
             {
                 fprintf(stderr, "Initialization failed\n");
@@ -209,7 +211,7 @@ int main(int argc, char *argv[])
             {
                 printf("Read file \"%s\"\n", filename);
             }
-            rc = srec_read(filename, code, codesize, NULL, 0);
+            rc = srec_read(filename, code, codesize, NULL, 0, &session.log);
             if (0 != rc)
             {
                 fprintf(stderr, "Read failed\n");
@@ -223,7 +225,7 @@ int main(int argc, char *argv[])
                 {
                     printf("Write\n");
                 }
-                rc = rl78g10_erase_write(fd, code, codesize);
+                rc = rl78g10_erase_write(&session, code, codesize);
                 if (0 != rc)
                 {
                     fprintf(stderr, "Write failed\n");
@@ -237,7 +239,7 @@ int main(int argc, char *argv[])
                 {
                     printf("Verify\n");
                 }
-                rc = rl78g10_crc_check(fd, code, codesize);
+                rc = rl78g10_crc_check(&session, code, codesize);
                 if (0 != rc)
                 {
                     fprintf(stderr, "Verify failed\n");
@@ -253,8 +255,8 @@ int main(int argc, char *argv[])
                 printf("Start terminal\n");
             }
             int reset_before_terminal = write || verify || reset_after;
-            serial_set_parity(fd, DISABLE, 0);
-            terminal_start(fd, terminal_baud, mode, reset_before_terminal);
+            serial_set_parity(&session, DISABLE, 0);
+            terminal_start(&session, terminal_baud, reset_before_terminal);
         }
         else if (1 == reset_after)
         {
@@ -262,11 +264,11 @@ int main(int argc, char *argv[])
             {
                 printf("Reset MCU\n");
             }
-            rl78_reset(fd, mode);
+            rl78_reset(&session);
         }
     }
     while (0);
-    serial_close(fd);
+    serial_close(&session);
     printf("\n");
     return retcode;
 }
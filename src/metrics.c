@@ -0,0 +1,477 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "metrics.h"
+#include "rl78.h"
+#include "filelock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define METRICS_LINE_LENGTH 512
+#define METRICS_LABELS_LENGTH 64     /* labels besides the port */
+#define METRICS_FRAME_BITS  11          /* start bit, 8 data bits and 2 stop bits */
+
+#define METRICS_BOARDS      0
+#define METRICS_FAILURES    1
+#define METRICS_RETRIES     2
+#define METRICS_ERRORS      3
+#define METRICS_WRITTEN     4
+#define METRICS_WIRE        5
+#define METRICS_PHASE       6
+#define METRICS_BAUD        7
+#define METRICS_LAST_JOB    8
+#define METRICS_FAMILIES    9
+
+typedef struct
+{
+    const char *name;
+    const char *type;
+    const char *help;
+} metrics_family_t;
+
+static const metrics_family_t metrics_families[METRICS_FAMILIES] =
+{
+    { "rl78flash_boards_flashed_total", "counter", "Jobs finished without an error" },
+    { "rl78flash_failures_total", "counter", "Failed jobs by the STATUS_* or response error of the failed step" },
+    { "rl78flash_retries_total", "counter", "Commands repeated to get a response" },
+    { "rl78flash_response_errors_total", "counter", "Commands without a valid response" },
+    { "rl78flash_bytes_written_total", "counter", "Flash bytes covered by the program phase" },
+    { "rl78flash_wire_bytes_total", "counter", "Bytes on the serial line" },
+    { "rl78flash_phase_duration_seconds", "histogram", "Time of each phase of a job" },
+    { "rl78flash_effective_baud", "gauge", "Bits on the serial line per second of the last job" },
+    { "rl78flash_last_job_timestamp_seconds", "gauge", "Time of the end of the last job" },
+};
+
+/* Upper bounds of the phase duration buckets, in s; +Inf follows */
+static const double metrics_buckets[] = { 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60 };
+
+#define METRICS_BUCKETS (sizeof metrics_buckets / sizeof metrics_buckets[0])
+
+typedef struct
+{
+    char *key;                  /* name and labels */
+    int family;
+    double value;
+} metrics_series_t;
+
+typedef struct
+{
+    char *name;
+    char *label;                /* name escaped for a label value */
+    latency_t latency;
+    rl78_stats_t seen;          /* session counters accounted so far */
+    latency_phase_t phases[LATENCY_PHASES];
+} metrics_port_t;
+
+struct metrics
+{
+    const char *filename;
+    const rl78_log_t *log;
+    metrics_series_t *series;
+    unsigned int nseries;
+    metrics_port_t **ports;
+    unsigned int nports;
+};
+
+static
+const char *metrics_status_name(int status)
+{
+    switch (status)
+    {
+    case 0:
+        return "none";
+    case RESPONSE_CHECKSUM_ERROR:
+        return "response_checksum_error";
+    case RESPONSE_FORMAT_ERROR:
+        return "response_format_error";
+    case RESPONSE_EXPECTED_LENGTH_ERROR:
+        return "response_length_error";
+    case RESPONSE_TIMEOUT_ERROR:
+        return "timeout";
+    case STATUS_COMMAND_NUMBER_ERROR:
+        return "command_number_error";
+    case STATUS_PARAMETER_ERROR:
+        return "parameter_error";
+    case STATUS_CHECKSUM_ERROR:
+        return "checksum_error";
+    case STATUS_VERIFY_ERROR:
+        return "verify_error";
+    case STATUS_PROTECT_ERROR:
+        return "protect_error";
+    case STATUS_NACK:
+        return "nack";
+    case STATUS_ERASE_ERROR:
+        return "erase_error";
+    case STATUS_IVERIFY_BLANK_ERROR:
+        return "iverify_blank_error";
+    case STATUS_WRITE_ERROR:
+        return "write_error";
+    default:
+        return "other";
+    }
+}
+
+/* Family of a series name; histograms own the _bucket, _sum and _count series */
+static
+int metrics_family(const char *key)
+{
+    static const char *const suffixes[] = { "{", "_bucket{", "_sum{", "_count{" };
+    int i;
+    for (i = 0; METRICS_FAMILIES > i; ++i)
+    {
+        const size_t len = strlen(metrics_families[i].name);
+        if (0 != strncmp(key, metrics_families[i].name, len))
+        {
+            continue;
+        }
+        const unsigned int nsuffixes = (0 == strcmp(metrics_families[i].type, "histogram")) ? 4 : 1;
+        unsigned int j;
+        for (j = 0; j < nsuffixes; ++j)
+        {
+            if (0 == strncmp(key + len, suffixes[j], strlen(suffixes[j])))
+            {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+static
+metrics_series_t *metrics_find(metrics_t *m, int family, const char *key)
+{
+    unsigned int i;
+    for (i = 0; i < m->nseries; ++i)
+    {
+        if (0 == strcmp(key, m->series[i].key))
+        {
+            return &m->series[i];
+        }
+    }
+    metrics_series_t *series = realloc(m->series, (m->nseries + 1) * sizeof *series);
+    if (NULL == series)
+    {
+        return NULL;
+    }
+    m->series = series;
+    series = &m->series[m->nseries];
+    series->key = strdup(key);
+    if (NULL == series->key)
+    {
+        return NULL;
+    }
+    series->family = family;
+    series->value = 0;
+    ++m->nseries;
+    return series;
+}
+
+static
+void metrics_add(metrics_t *m, int family, const char *key, double value)
+{
+    metrics_series_t *series = metrics_find(m, family, key);
+    if (NULL != series)
+    {
+        series->value += value;
+    }
+}
+
+static
+void metrics_set(metrics_t *m, int family, const char *key, double value)
+{
+    metrics_series_t *series = metrics_find(m, family, key);
+    if (NULL != series)
+    {
+        series->value = value;
+    }
+}
+
+/* Build the key of a series of the port; extra labels start with a comma */
+static
+const char *metrics_key(char *key, size_t size, int family, const char *suffix,
+                        const metrics_port_t *port, const char *labels)
+{
+    snprintf(key, size, "%s%s{port=\"%s\"%s}", metrics_families[family].name, suffix, port->label, labels);
+    return key;
+}
+
+static
+void metrics_observe(metrics_t *m, const metrics_port_t *port, const char *phase, double seconds)
+{
+    char key[METRICS_LINE_LENGTH];
+    char labels[METRICS_LABELS_LENGTH];
+    unsigned int i;
+    // All buckets are created at once, so they stay in order
+    for (i = 0; i <= METRICS_BUCKETS; ++i)
+    {
+        if (METRICS_BUCKETS == i)
+        {
+            snprintf(labels, sizeof labels, ",phase=\"%s\",le=\"+Inf\"", phase);
+        }
+        else
+        {
+            snprintf(labels, sizeof labels, ",phase=\"%s\",le=\"%g\"", phase, metrics_buckets[i]);
+        }
+        metrics_add(m, METRICS_PHASE, metrics_key(key, sizeof key, METRICS_PHASE, "_bucket", port, labels),
+                    (METRICS_BUCKETS == i || seconds <= metrics_buckets[i]) ? 1 : 0);
+    }
+    snprintf(labels, sizeof labels, ",phase=\"%s\"", phase);
+    metrics_add(m, METRICS_PHASE, metrics_key(key, sizeof key, METRICS_PHASE, "_sum", port, labels), seconds);
+    metrics_add(m, METRICS_PHASE, metrics_key(key, sizeof key, METRICS_PHASE, "_count", port, labels), 1);
+}
+
+static
+void metrics_load(metrics_t *m)
+{
+    FILE *in = fopen(m->filename, "r");
+    if (NULL == in)
+    {
+        // The first run starts from zero
+        return;
+    }
+    char line[METRICS_LINE_LENGTH];
+    while (NULL != fgets(line, sizeof line, in))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *value = strrchr(line, ' ');
+        if ('#' == line[0]
+            || NULL == value)
+        {
+            continue;
+        }
+        *value++ = '\0';
+        const int family = metrics_family(line);
+        char *endp;
+        const double number = strtod(value, &endp);
+        if (0 <= family
+            && value != endp)
+        {
+            metrics_set(m, family, line, number);
+        }
+    }
+    fclose(in);
+}
+
+metrics_t *metrics_open(const char *filename, const rl78_log_t *log)
+{
+    metrics_t *m = calloc(1, sizeof *m);
+    if (NULL == m)
+    {
+        return NULL;
+    }
+    m->filename = filename;
+    m->log = log;
+    if (NULL != filename)
+    {
+        metrics_load(m);
+    }
+    return m;
+}
+
+static
+metrics_port_t *metrics_port(metrics_t *m, const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < m->nports; ++i)
+    {
+        if (0 == strcmp(name, m->ports[i]->name))
+        {
+            return m->ports[i];
+        }
+    }
+    metrics_port_t **ports = realloc(m->ports, (m->nports + 1) * sizeof *ports);
+    if (NULL == ports)
+    {
+        return NULL;
+    }
+    m->ports = ports;
+    metrics_port_t *port = calloc(1, sizeof *port);
+    if (NULL == port)
+    {
+        return NULL;
+    }
+    port->name = strdup(name);
+    // Quotes and backslashes are escaped in label values
+    port->label = malloc(2 * strlen(name) + 1);
+    if (NULL == port->name
+        || NULL == port->label)
+    {
+        free(port->name);
+        free(port->label);
+        free(port);
+        return NULL;
+    }
+    char *p = port->label;
+    for (; '\0' != *name; ++name)
+    {
+        if ('"' == *name || '\\' == *name)
+        {
+            *p++ = '\\';
+        }
+        *p++ = *name;
+    }
+    *p = '\0';
+    latency_init(&port->latency);
+    m->ports[m->nports++] = port;
+    return port;
+}
+
+latency_t *metrics_latency(metrics_t *m, const char *port)
+{
+    metrics_port_t *p = metrics_port(m, port);
+    return (NULL != p) ? &p->latency : NULL;
+}
+
+static
+void metrics_line(void *ctx, const char *line)
+{
+    fprintf((FILE*)ctx, "%s\n", line);
+}
+
+static
+void metrics_text(FILE *out, const void *ctx)
+{
+    metrics_emit(ctx, metrics_line, out);
+}
+
+void metrics_job(metrics_t *m, const char *port, const rl78_session_t *s, const job_result_t *result)
+{
+    metrics_port_t *p = metrics_port(m, port);
+    if (NULL == p)
+    {
+        return;
+    }
+    int lock = -1;
+    if (NULL != m->filename)
+    {
+        // Other processes may have counted jobs since; the file holds all of
+        // ours, so its counters are taken over before adding this job
+        lock = filelock_acquire(m->filename, m->log);
+        if (0 <= lock)
+        {
+            metrics_load(m);
+        }
+    }
+    char key[METRICS_LINE_LENGTH];
+    char labels[METRICS_LABELS_LENGTH];
+    if (0 == result->retcode)
+    {
+        metrics_add(m, METRICS_BOARDS, metrics_key(key, sizeof key, METRICS_BOARDS, "", p, ""), 1);
+    }
+    else
+    {
+        snprintf(labels, sizeof labels, ",status=\"%s\"", metrics_status_name(result->status));
+        metrics_add(m, METRICS_FAILURES, metrics_key(key, sizeof key, METRICS_FAILURES, "", p, labels), 1);
+    }
+    // Sessions keep their counters between jobs; only the growth is new
+    const unsigned long sent = s->stats.bytes_sent - p->seen.bytes_sent;
+    const unsigned long received = s->stats.bytes_received - p->seen.bytes_received;
+    if (0 < result->seconds)
+    {
+        // Single-wire mode receives its own bytes as well
+        const unsigned long bytes = (1 == s->communication_mode) ? received : sent + received;
+        metrics_set(m, METRICS_BAUD, metrics_key(key, sizeof key, METRICS_BAUD, "", p, ""),
+                    bytes * METRICS_FRAME_BITS / result->seconds);
+    }
+    metrics_add(m, METRICS_RETRIES, metrics_key(key, sizeof key, METRICS_RETRIES, "", p, ""),
+                s->stats.retries - p->seen.retries);
+    metrics_add(m, METRICS_ERRORS, metrics_key(key, sizeof key, METRICS_ERRORS, "", p, ""),
+                s->stats.errors - p->seen.errors);
+    metrics_add(m, METRICS_WIRE, metrics_key(key, sizeof key, METRICS_WIRE, "", p, ",direction=\"sent\""),
+                sent);
+    metrics_add(m, METRICS_WIRE, metrics_key(key, sizeof key, METRICS_WIRE, "", p, ",direction=\"received\""),
+                received);
+    p->seen = s->stats;
+    if (NULL != s->latency)
+    {
+        int i;
+        for (i = 0; LATENCY_PHASES > i; ++i)
+        {
+            const latency_phase_t *phase = &s->latency->phases[i];
+            if (phase->count == p->phases[i].count)
+            {
+                continue;
+            }
+            const double seconds = (phase->time - p->phases[i].time) / 1e6;
+            metrics_observe(m, p, latency_phase_name(i), seconds);
+            if (LATENCY_PHASE_PROGRAM == i)
+            {
+                metrics_add(m, METRICS_WRITTEN, metrics_key(key, sizeof key, METRICS_WRITTEN, "", p, ""),
+                            phase->bytes - p->phases[i].bytes);
+            }
+            p->phases[i] = *phase;
+        }
+    }
+    metrics_set(m, METRICS_LAST_JOB, metrics_key(key, sizeof key, METRICS_LAST_JOB, "", p, ""), time(NULL));
+    if (0 <= lock)
+    {
+        filelock_replace(m->filename, metrics_text, m, m->log);
+        filelock_release(lock);
+    }
+}
+
+void metrics_emit(const metrics_t *m, metrics_line_func_t func, void *ctx)
+{
+    char line[METRICS_LINE_LENGTH + 32];
+    int family;
+    for (family = 0; METRICS_FAMILIES > family; ++family)
+    {
+        unsigned int i;
+        for (i = 0; i < m->nseries && family != m->series[i].family; ++i)
+        {
+        }
+        if (i == m->nseries)
+        {
+            continue;
+        }
+        snprintf(line, sizeof line, "# HELP %s %s", metrics_families[family].name, metrics_families[family].help);
+        func(ctx, line);
+        snprintf(line, sizeof line, "# TYPE %s %s", metrics_families[family].name, metrics_families[family].type);
+        func(ctx, line);
+        for (; i < m->nseries; ++i)
+        {
+            if (family == m->series[i].family)
+            {
+                snprintf(line, sizeof line, "%s %.15g", m->series[i].key, m->series[i].value);
+                func(ctx, line);
+            }
+        }
+    }
+}
+
+void metrics_close(metrics_t *m)
+{
+    unsigned int i;
+    for (i = 0; i < m->nseries; ++i)
+    {
+        free(m->series[i].key);
+    }
+    for (i = 0; i < m->nports; ++i)
+    {
+        free(m->ports[i]->name);
+        free(m->ports[i]->label);
+        free(m->ports[i]);
+    }
+    free(m->series);
+    free(m->ports);
+    free(m);
+}
@@ -0,0 +1,49 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef METRICS_H__
+#define METRICS_H__
+
+#include "session.h"
+#include "job.h"
+#include "latency.h"
+
+/* Counters and histograms of a station per port, in the Prometheus text
+ * exposition format. The counters of earlier runs are read back from the
+ * file, so one file kept for the node_exporter textfile collector counts
+ * over any number of runs; it is replaced atomically after each job. Processes
+ * may share a file: each job locks it (see filelock.h) and reads it again
+ * before adding its counts. */
+
+typedef struct metrics metrics_t;
+
+typedef void (*metrics_line_func_t)(void *ctx, const char *line);
+
+/* filename may be NULL if the counters are only served (see metrics_emit()) */
+metrics_t *metrics_open(const char *filename, const rl78_log_t *log);
+/* Phase timing of the port, to be kept by its session between jobs */
+latency_t *metrics_latency(metrics_t *m, const char *port);
+/* Account a finished job of the port and write the file */
+void metrics_job(metrics_t *m, const char *port, const rl78_session_t *s, const job_result_t *result);
+/* Pass the exposition text line by line, without line ends */
+void metrics_emit(const metrics_t *m, metrics_line_func_t func, void *ctx);
+void metrics_close(metrics_t *m);
+
+#endif // METRICS_H__
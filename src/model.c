@@ -0,0 +1,611 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+#include "model.h"
+#include "rl78.h"
+#include "session.h"
+#include "transport.h"
+#include "latency.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MODEL_DATA_SIZE     4096        /* bytes of data flash */
+#define MODEL_FRAME_SIZE    (256 + 4)   /* largest frame from the host */
+#define MODEL_QUEUE_SIZE    1024        /* bytes on their way to the host */
+#define MODEL_FREQUENCY     32          /* MHz, reported by Baud Rate Set */
+
+struct model
+{
+    const rl78_transport_t *lower;  /* transport of the session before the model */
+    void *lower_ctx;
+    model_timing_t timing;
+    unsigned char *flash;           /* code flash followed by data flash */
+    unsigned int code_size;
+    unsigned char security[SECURITY_DATA_LENGTH];
+    int baud;
+    int wire;                       /* 1 or 2 after the mode byte, 0 before it */
+    unsigned char in[MODEL_FRAME_SIZE];
+    int in_len;
+    int cmd;                        /* command which takes data frames */
+    unsigned int address;           /* next address of its data */
+    unsigned char out[MODEL_QUEUE_SIZE];
+    unsigned long long ready[MODEL_QUEUE_SIZE];     /* ns, arrival of each byte */
+    int out_pos;
+    int out_len;
+    unsigned long long now;         /* ns */
+    unsigned long long synced;      /* us, real time of the last call */
+    int virtual_only;               /* the time of the host is not added */
+    unsigned long long line_free;   /* ns, end of the last byte on the line */
+    unsigned long long line;        /* ns the line has carried data */
+    unsigned long long busy;        /* ns the device has been busy */
+};
+
+/* Add the time the host has spent since the previous call */
+static
+void model_sync(model_t *m)
+{
+    const unsigned long long now = latency_now();
+    if (!m->virtual_only)
+    {
+        m->now += (now - m->synced) * 1000;
+    }
+    m->synced = now;
+}
+
+static
+unsigned long long model_byte_time(const model_t *m)
+{
+    return 11000000000ULL / m->baud;
+}
+
+static
+void model_reset(model_t *m)
+{
+    m->baud = SESSION_DEFAULT_BAUD;
+    m->wire = 0;
+    m->in_len = 0;
+    m->cmd = -1;
+    m->out_pos = 0;
+    m->out_len = 0;
+}
+
+/* Put a byte on the line to the host, it arrives at ready */
+static
+void model_queue(model_t *m, unsigned char byte, unsigned long long ready)
+{
+    if (m->out_len == MODEL_QUEUE_SIZE)
+    {
+        if (0 == m->out_pos)
+        {
+            return;
+        }
+        memmove(m->out, &m->out[m->out_pos], m->out_len - m->out_pos);
+        memmove(m->ready, &m->ready[m->out_pos], (m->out_len - m->out_pos) * sizeof m->ready[0]);
+        m->out_len -= m->out_pos;
+        m->out_pos = 0;
+    }
+    m->out[m->out_len] = byte;
+    m->ready[m->out_len] = ready;
+    ++m->out_len;
+}
+
+/* Send a status or data frame, which the device starts at start */
+static
+void model_respond(model_t *m, unsigned long long start, const unsigned char *data, int len)
+{
+    const unsigned long long byte_time = model_byte_time(m);
+    unsigned char frame[MODEL_FRAME_SIZE];
+    unsigned int sum = 0;
+    int i;
+    frame[0] = STX;
+    frame[1] = len;
+    memcpy(&frame[2], data, len);
+    for (i = 1; i < len + 2; ++i)
+    {
+        sum -= frame[i];
+    }
+    frame[len + 2] = sum;
+    frame[len + 3] = ETX;
+    unsigned long long t = start > m->line_free ? start : m->line_free;
+    for (i = 0; i < len + 4; ++i)
+    {
+        t += byte_time;
+        model_queue(m, frame[i], t);
+    }
+    m->line += (len + 4) * byte_time;
+    m->line_free = t;
+}
+
+static
+void model_status(model_t *m, unsigned long long start, unsigned char status)
+{
+    model_respond(m, start, &status, 1);
+}
+
+/* Keep the device busy for us, from the end of a frame at t */
+static
+unsigned long long model_busy(model_t *m, unsigned long long t, unsigned int us)
+{
+    m->busy += us * 1000ULL;
+    return t + us * 1000ULL;
+}
+
+/* Flash at address, NULL if the range is outside of the device */
+static
+unsigned char *model_flash(model_t *m, unsigned int address, unsigned int end)
+{
+    if (address <= end
+        && m->code_size > end)
+    {
+        return &m->flash[address];
+    }
+    if (DATA_OFFSET <= address
+        && address <= end
+        && DATA_OFFSET + MODEL_DATA_SIZE > end)
+    {
+        return &m->flash[m->code_size + address - DATA_OFFSET];
+    }
+    return NULL;
+}
+
+static
+unsigned int model_address(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+/* Read time of a range, one timing.read per data frame */
+static
+unsigned int model_read_time(const model_t *m, unsigned int address, unsigned int end)
+{
+    return (end - address + 256) / 256 * m->timing.read;
+}
+
+static
+void model_command(model_t *m, unsigned long long t, int cmd, const unsigned char *p, int len)
+{
+    unsigned int address = 0;
+    unsigned int end = 0;
+    unsigned char *flash = NULL;
+    if (6 <= len)
+    {
+        address = model_address(&p[0]);
+        end = model_address(&p[3]);
+        flash = model_flash(m, address, end);
+    }
+    t = model_busy(m, t, m->timing.command);
+    m->cmd = -1;
+    switch (cmd)
+    {
+    case CMD_RESET:
+        model_status(m, t, STATUS_ACK);
+        break;
+    case CMD_BAUD_RATE_SET:
+        {
+            const unsigned char data[3] = { STATUS_ACK, MODEL_FREQUENCY, 0 };
+            model_respond(m, t, data, sizeof data);
+        }
+        break;
+    case CMD_SILICON_SIGNATURE:
+        {
+            const unsigned int code_end = m->code_size - 1;
+            const unsigned int data_end = DATA_OFFSET + MODEL_DATA_SIZE - 1;
+            unsigned char data[22] = { 0x10, 0x00, 0x06, 'R', '5', 'F', '1', '0', '4', 'L', 'E', ' ', ' ' };
+            data[13] = code_end;
+            data[14] = code_end >> 8;
+            data[15] = code_end >> 16;
+            data[16] = data_end & 0xFF;
+            data[17] = (data_end >> 8) & 0xFF;
+            data[18] = data_end >> 16;
+            data[19] = 1;
+            data[20] = 2;
+            data[21] = 3;
+            model_status(m, t, STATUS_ACK);
+            model_respond(m, t, data, sizeof data);
+        }
+        break;
+    case CMD_BLOCK_ERASE:
+        if (3 <= len)
+        {
+            address = model_address(p);
+            flash = model_flash(m, address, address + FLASH_BLOCK_SIZE - 1);
+        }
+        if (NULL == flash)
+        {
+            model_status(m, t, STATUS_PARAMETER_ERROR);
+            break;
+        }
+        memset(flash, 0xFF, FLASH_BLOCK_SIZE);
+        model_status(m, model_busy(m, t, m->timing.erase), STATUS_ACK);
+        break;
+    case CMD_BLOCK_BLANK_CHECK:
+        if (NULL == flash)
+        {
+            model_status(m, t, STATUS_PARAMETER_ERROR);
+            break;
+        }
+        t = model_busy(m, t, model_read_time(m, address, end));
+        for (; address <= end && 0xFF == *flash; ++address, ++flash)
+        {
+        }
+        model_status(m, t, address > end ? STATUS_ACK : STATUS_IVERIFY_BLANK_ERROR);
+        break;
+    case CMD_PROGRAMMING:
+    case CMD_VERIFY:
+        if (NULL == flash)
+        {
+            model_status(m, t, STATUS_PARAMETER_ERROR);
+            break;
+        }
+        m->cmd = cmd;
+        m->address = address;
+        model_status(m, t, STATUS_ACK);
+        break;
+    case CMD_CHECKSUM:
+        if (NULL == flash)
+        {
+            model_status(m, t, STATUS_PARAMETER_ERROR);
+            break;
+        }
+        {
+            const unsigned long long done = model_busy(m, t, model_read_time(m, address, end));
+            unsigned int sum = 0;
+            for (; address <= end; ++address)
+            {
+                sum -= *flash++;
+            }
+            const unsigned char data[2] = { sum, sum >> 8 };
+            model_status(m, t, STATUS_ACK);
+            model_respond(m, done, data, sizeof data);
+        }
+        break;
+    case CMD_SECURITY_SET:
+        m->cmd = cmd;
+        model_status(m, t, STATUS_ACK);
+        break;
+    case CMD_SECURITY_GET:
+        model_status(m, t, STATUS_ACK);
+        model_respond(m, t, m->security, sizeof m->security);
+        break;
+    default:
+        model_status(m, t, STATUS_COMMAND_NUMBER_ERROR);
+        break;
+    }
+}
+
+static
+void model_data(model_t *m, unsigned long long t, const unsigned char *p, int len, int last)
+{
+    unsigned char *flash = model_flash(m, m->address, m->address + len - 1);
+    unsigned char data[2] = { STATUS_ACK, STATUS_ACK };
+    t = model_busy(m, t, m->timing.command);
+    switch (m->cmd)
+    {
+    case CMD_PROGRAMMING:
+        if (NULL == flash)
+        {
+            data[1] = STATUS_WRITE_ERROR;
+            model_respond(m, t, data, sizeof data);
+            break;
+        }
+        memcpy(flash, p, len);
+        m->address += len;
+        t = model_busy(m, t, m->timing.write);
+        model_respond(m, t, data, sizeof data);
+        if (last)
+        {
+            // Internal verify of the written range
+            model_status(m, model_busy(m, t, m->timing.read), STATUS_ACK);
+        }
+        break;
+    case CMD_VERIFY:
+        if (NULL == flash
+            || 0 != memcmp(flash, p, len))
+        {
+            data[1] = STATUS_VERIFY_ERROR;
+        }
+        m->address += len;
+        model_respond(m, model_busy(m, t, m->timing.read), data, sizeof data);
+        break;
+    case CMD_SECURITY_SET:
+        memcpy(m->security, p, len < SECURITY_DATA_LENGTH ? len : SECURITY_DATA_LENGTH);
+        model_status(m, model_busy(m, t, m->timing.write), STATUS_ACK);
+        break;
+    default:
+        model_status(m, t, STATUS_COMMAND_NUMBER_ERROR);
+        break;
+    }
+    if (last)
+    {
+        m->cmd = -1;
+    }
+}
+
+/* A byte from the host has been received at t */
+static
+void model_receive(model_t *m, unsigned char byte, unsigned long long t)
+{
+    if (0 == m->wire)
+    {
+        if (SET_MODE_1WIRE_UART == byte)
+        {
+            m->wire = 1;
+        }
+        else if (SET_MODE_2WIRE_UART == byte)
+        {
+            m->wire = 2;
+        }
+        return;
+    }
+    if (0 == m->in_len
+        && SOH != byte
+        && STX != byte)
+    {
+        return;
+    }
+    m->in[m->in_len++] = byte;
+    if (2 > m->in_len)
+    {
+        return;
+    }
+    const int len = (0 == m->in[1]) ? 256 : m->in[1];
+    if (len + 4 > m->in_len)
+    {
+        return;
+    }
+    m->in_len = 0;
+    unsigned int sum = 0;
+    int i;
+    for (i = 1; i < len + 2; ++i)
+    {
+        sum -= m->in[i];
+    }
+    if ((sum & 0xFF) != m->in[len + 2])
+    {
+        model_status(m, model_busy(m, t, m->timing.command), STATUS_CHECKSUM_ERROR);
+    }
+    else if (SOH == m->in[0])
+    {
+        model_command(m, t, m->in[2], &m->in[3], len - 1);
+    }
+    else
+    {
+        model_data(m, t, &m->in[2], len, ETX == m->in[len + 3]);
+    }
+}
+
+static
+int model_open(void *ctx, rl78_session_t *s, const char *port)
+{
+    model_t *m = (model_t*)ctx;
+    model_sync(m);
+    model_reset(m);
+    s->port_name = port;
+    return 0;
+}
+
+static
+int model_set_baud(void *ctx, rl78_session_t *s, int baud)
+{
+    model_t *m = (model_t*)ctx;
+    (void)s;
+    model_sync(m);
+    if (0 >= baud)
+    {
+        return -1;
+    }
+    m->baud = baud;
+    return 0;
+}
+
+static
+int model_set_parity(void *ctx, rl78_session_t *s, int enable, int odd_parity)
+{
+    (void)ctx;
+    (void)s;
+    (void)enable;
+    (void)odd_parity;
+    return 0;
+}
+
+/* Any change of the RESET line restarts the bootloader */
+static
+int model_set_reset(void *ctx, rl78_session_t *s, int level)
+{
+    model_t *m = (model_t*)ctx;
+    (void)s;
+    (void)level;
+    model_sync(m);
+    model_reset(m);
+    return 0;
+}
+
+static
+int model_set_txd(void *ctx, rl78_session_t *s, int level)
+{
+    (void)ctx;
+    (void)s;
+    (void)level;
+    return 0;
+}
+
+static
+int model_flush(void *ctx, rl78_session_t *s)
+{
+    model_t *m = (model_t*)ctx;
+    (void)s;
+    model_sync(m);
+    m->out_pos = 0;
+    m->out_len = 0;
+    return 0;
+}
+
+static
+int model_write(void *ctx, rl78_session_t *s, const void *buf, int len)
+{
+    model_t *m = (model_t*)ctx;
+    const unsigned char *p = (const unsigned char*)buf;
+    const unsigned long long byte_time = model_byte_time(m);
+    (void)s;
+    model_sync(m);
+    unsigned long long t = m->now > m->line_free ? m->now : m->line_free;
+    int i;
+    for (i = 0; i < len; ++i)
+    {
+        t += byte_time;
+        // TOOL0 is a single line in 1-wire mode, the host sees its own bytes
+        if (1 == m->wire
+            || (0 == m->wire && SET_MODE_1WIRE_UART == p[i]))
+        {
+            model_queue(m, p[i], t);
+        }
+        m->line_free = t;
+        model_receive(m, p[i], t);
+    }
+    m->line += len * byte_time;
+    return len;
+}
+
+/* Bytes which have not arrived within the read timeout are not returned */
+static
+int model_read(void *ctx, rl78_session_t *s, void *buf, int len)
+{
+    model_t *m = (model_t*)ctx;
+    unsigned char *p = (unsigned char*)buf;
+    const unsigned long long deadline_step = s->read_timeout * 1000000ULL;
+    int n = 0;
+    model_sync(m);
+    while (n < len
+           && m->out_pos < m->out_len
+           && m->ready[m->out_pos] <= m->now + deadline_step)
+    {
+        if (m->ready[m->out_pos] > m->now)
+        {
+            m->now = m->ready[m->out_pos];
+        }
+        p[n++] = m->out[m->out_pos++];
+    }
+    if (n < len)
+    {
+        m->now += deadline_step;
+    }
+    if (m->out_pos == m->out_len)
+    {
+        m->out_pos = 0;
+        m->out_len = 0;
+    }
+    return n;
+}
+
+static
+void model_delay(void *ctx, rl78_session_t *s, unsigned int us)
+{
+    model_t *m = (model_t*)ctx;
+    (void)s;
+    model_sync(m);
+    m->now += us * 1000ULL;
+}
+
+static
+int model_close(void *ctx, rl78_session_t *s)
+{
+    (void)ctx;
+    (void)s;
+    return 0;
+}
+
+static const rl78_transport_t model_transport =
+{
+    model_open,
+    model_set_baud,
+    model_set_parity,
+    model_set_reset,
+    model_set_reset,
+    model_set_txd,
+    model_flush,
+    model_write,
+    model_read,
+    model_delay,
+    model_close,
+};
+
+void model_timing_init(model_timing_t *timing)
+{
+    timing->command = MODEL_DEFAULT_COMMAND;
+    timing->erase = MODEL_DEFAULT_ERASE;
+    timing->write = MODEL_DEFAULT_WRITE;
+    timing->read = MODEL_DEFAULT_READ;
+}
+
+model_t *model_start(rl78_session_t *s, const model_timing_t *timing, unsigned int code_size)
+{
+    model_t *m = calloc(1, sizeof *m);
+    if (NULL == m)
+    {
+        return NULL;
+    }
+    m->flash = malloc(code_size + MODEL_DATA_SIZE);
+    if (NULL == m->flash)
+    {
+        free(m);
+        return NULL;
+    }
+    memset(m->flash, 0x00, code_size + MODEL_DATA_SIZE);
+    memset(m->security, 0xFF, sizeof m->security);
+    m->timing = *timing;
+    m->code_size = code_size;
+    m->synced = latency_now();
+    model_reset(m);
+    m->lower = s->transport;
+    m->lower_ctx = s->transport_ctx;
+    s->transport = &model_transport;
+    s->transport_ctx = m;
+    return m;
+}
+
+unsigned long long model_now(model_t *m)
+{
+    model_sync(m);
+    return m->now;
+}
+
+void model_virtual(model_t *m)
+{
+    m->virtual_only = 1;
+}
+
+unsigned long long model_line_time(const model_t *m)
+{
+    return m->line;
+}
+
+unsigned long long model_busy_time(const model_t *m)
+{
+    return m->busy;
+}
+
+void model_stop(rl78_session_t *s, model_t *m)
+{
+    s->transport = m->lower;
+    s->transport_ctx = m->lower_ctx;
+    free(m->flash);
+    free(m);
+}
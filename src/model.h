@@ -0,0 +1,66 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+#ifndef MODEL_H__
+#define MODEL_H__
+
+/* An in-process model of the RL78 bootloader, installed as the transport of a
+ * session. It answers the commands used by rl78flash from a flash array and
+ * keeps a virtual clock instead of sleeping: every byte takes 11 bit times at
+ * the current baud rate (8 data bits, 2 stop bits and a start bit), and
+ * erase, program and read operations keep the device busy for the times given
+ * in model_timing_t. Delays of the host only move the clock; the time spent by
+ * the host itself between the calls is added to it as well. */
+
+typedef struct rl78_session rl78_session_t;
+typedef struct model model_t;
+
+/* Device operation times, in us */
+typedef struct
+{
+    unsigned int command;       /* turnaround of a command or data frame */
+    unsigned int erase;         /* Block Erase of one flash block */
+    unsigned int write;         /* programming of one data frame */
+    unsigned int read;          /* blank check or verify of one data frame */
+} model_timing_t;
+
+#define MODEL_DEFAULT_COMMAND   50
+#define MODEL_DEFAULT_ERASE     5000
+#define MODEL_DEFAULT_WRITE     1200
+#define MODEL_DEFAULT_READ      100
+
+void model_timing_init(model_timing_t *timing);
+/* Serve s from a device with code_size bytes of code flash, all of which
+ * hold data; NULL if out of memory */
+model_t *model_start(rl78_session_t *s, const model_timing_t *timing, unsigned int code_size);
+/* Virtual time, in ns */
+unsigned long long model_now(model_t *m);
+/* Leave the time of the host out of the clock, so that it only depends on
+ * the bytes and delays of the host and runs can be repeated exactly */
+void model_virtual(model_t *m);
+/* Time the line has carried data and the device has been busy, in ns; both
+ * together are the least time the protocol can take */
+unsigned long long model_line_time(const model_t *m);
+unsigned long long model_busy_time(const model_t *m);
+/* Give s its previous transport back */
+void model_stop(rl78_session_t *s, model_t *m);
+
+#endif  // MODEL_H__
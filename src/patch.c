@@ -0,0 +1,364 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "patch.h"
+#include "rl78.h"
+#include "srec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+
+/* Patch table format (one entry per line, '#' starts a comment):
+ *
+ *   <address> <length> counter:<start>[:<step>]
+ *   <address> <length> csv:<file>:<column>
+ *   <address> <length> stdin
+ *
+ * Counters are written as little-endian integers. CSV cells and stdin lines
+ * contain hexadecimal bytes in address order; ':', '-' and spaces between
+ * bytes are ignored. The unit number selects the counter value and the CSV
+ * row (comment and empty lines are not counted). */
+
+static
+char *patch_trim(char *str)
+{
+    while (isspace((unsigned char)*str))
+    {
+        ++str;
+    }
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+    {
+        --end;
+    }
+    *end = '\0';
+    return str;
+}
+
+static
+int patch_parse_source(patch_entry_t *entry, char *source)
+{
+    char *endp;
+    if (0 == strcmp(source, "stdin"))
+    {
+        entry->source = PATCH_SOURCE_STDIN;
+        return PATCH_NO_ERROR;
+    }
+    if (0 == strncmp(source, "counter:", 8))
+    {
+        entry->source = PATCH_SOURCE_COUNTER;
+        entry->start = strtoull(source + 8, &endp, 0);
+        entry->step = 1;
+        if (source + 8 == endp)
+        {
+            return PATCH_FORMAT_ERROR;
+        }
+        if (':' == *endp)
+        {
+            char *step = endp + 1;
+            entry->step = strtoull(step, &endp, 0);
+            if (step == endp)
+            {
+                return PATCH_FORMAT_ERROR;
+            }
+        }
+        return ('\0' == *endp) ? PATCH_NO_ERROR : PATCH_FORMAT_ERROR;
+    }
+    if (0 == strncmp(source, "csv:", 4))
+    {
+        char *column = strrchr(source + 4, ':');
+        if (NULL == column || source + 4 == column)
+        {
+            return PATCH_FORMAT_ERROR;
+        }
+        *column++ = '\0';
+        entry->source = PATCH_SOURCE_CSV;
+        entry->csv_column = strtoul(column, &endp, 10);
+        if (column == endp || '\0' != *endp)
+        {
+            return PATCH_FORMAT_ERROR;
+        }
+        entry->csv_file = strdup(source + 4);
+        return (NULL != entry->csv_file) ? PATCH_NO_ERROR : PATCH_MEMORY_ERROR;
+    }
+    return PATCH_FORMAT_ERROR;
+}
+
+int patch_table_load(patch_table_t *table, const char *filename, const rl78_log_t *log)
+{
+    FILE *pfile = fopen(filename, "r");
+    if (NULL == pfile)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to open file \"%s\"\n", filename);
+        return PATCH_IO_ERROR;
+    }
+    char line[512];
+    unsigned int line_number = 0;
+    int rc = PATCH_NO_ERROR;
+    while (PATCH_NO_ERROR == rc
+           && NULL != fgets(line, sizeof line, pfile))
+    {
+        ++line_number;
+        char *comment = strchr(line, '#');
+        if (NULL != comment)
+        {
+            *comment = '\0';
+        }
+        char *p = patch_trim(line);
+        if ('\0' == *p)
+        {
+            continue;
+        }
+        patch_entry_t entry;
+        memset(&entry, 0, sizeof entry);
+        char *endp;
+        const unsigned long address = strtoul(p, &endp, 0);
+        entry.address = (unsigned int)address;
+        const int address_valid = (p != endp && UINT_MAX >= address);
+        p = endp;
+        entry.length = strtoul(p, &endp, 0);
+        if (!address_valid
+            || p == endp
+            || !isspace((unsigned char)*endp)
+            || 0 == entry.length
+            || PATCH_MAX_LENGTH < entry.length)
+        {
+            rc = PATCH_FORMAT_ERROR;
+        }
+        else
+        {
+            rc = patch_parse_source(&entry, patch_trim(endp));
+        }
+        if (PATCH_NO_ERROR == rc)
+        {
+            patch_entry_t *entries = realloc(table->entries, (table->count + 1) * sizeof *entries);
+            if (NULL == entries)
+            {
+                free(entry.csv_file);
+                rc = PATCH_MEMORY_ERROR;
+                break;
+            }
+            table->entries = entries;
+            table->entries[table->count++] = entry;
+        }
+        else
+        {
+            rl78_log(log, RL78_LOG_ERROR, "%s:%u: Invalid patch entry\n", filename, line_number);
+        }
+    }
+    if (PATCH_NO_ERROR == rc && ferror(pfile))
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to read file \"%s\"\n", filename);
+        rc = PATCH_IO_ERROR;
+    }
+    fclose(pfile);
+    return rc;
+}
+
+void patch_table_free(patch_table_t *table)
+{
+    unsigned int i;
+    for (i = 0; i < table->count; ++i)
+    {
+        free(table->entries[i].csv_file);
+    }
+    free(table->entries);
+    table->entries = NULL;
+    table->count = 0;
+}
+
+static
+int patch_parse_hex(const char *str, unsigned char *value, unsigned int length)
+{
+    unsigned int i = 0;
+    while ('\0' != *str)
+    {
+        if (':' == *str || '-' == *str || isspace((unsigned char)*str))
+        {
+            ++str;
+            continue;
+        }
+        if (!isxdigit((unsigned char)str[0])
+            || !isxdigit((unsigned char)str[1])
+            || length <= i)
+        {
+            return PATCH_FORMAT_ERROR;
+        }
+        char digits[3] = { str[0], str[1], '\0' };
+        value[i++] = strtoul(digits, NULL, 16);
+        str += 2;
+    }
+    return (length == i) ? PATCH_NO_ERROR : PATCH_FORMAT_ERROR;
+}
+
+static
+int patch_read_csv(const patch_entry_t *entry, unsigned int unit, unsigned char *value, const rl78_log_t *log)
+{
+    FILE *pfile = fopen(entry->csv_file, "r");
+    if (NULL == pfile)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to open file \"%s\"\n", entry->csv_file);
+        return PATCH_IO_ERROR;
+    }
+    char line[1024];
+    unsigned int row = 0;
+    int rc = PATCH_IO_ERROR;
+    while (NULL != fgets(line, sizeof line, pfile))
+    {
+        char *p = patch_trim(line);
+        if ('\0' == *p || '#' == *p)
+        {
+            continue;
+        }
+        if (row++ != unit)
+        {
+            continue;
+        }
+        unsigned int column = entry->csv_column;
+        while (column && NULL != p)
+        {
+            p = strchr(p, ',');
+            if (NULL != p)
+            {
+                ++p;
+            }
+            --column;
+        }
+        if (NULL == p)
+        {
+            rc = PATCH_FORMAT_ERROR;
+            break;
+        }
+        char *end = strchr(p, ',');
+        if (NULL != end)
+        {
+            *end = '\0';
+        }
+        rc = patch_parse_hex(patch_trim(p), value, entry->length);
+        break;
+    }
+    fclose(pfile);
+    if (PATCH_NO_ERROR != rc)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "No valid value for unit %u in column %u of \"%s\"\n",
+                 unit, entry->csv_column, entry->csv_file);
+    }
+    return rc;
+}
+
+static
+int patch_read_stdin(const patch_entry_t *entry, unsigned char *value, const rl78_log_t *log)
+{
+    char line[PATCH_MAX_LENGTH * 3 + 2];
+    if (NULL == fgets(line, sizeof line, stdin))
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to read patch value from stdin\n");
+        return PATCH_IO_ERROR;
+    }
+    int rc = patch_parse_hex(patch_trim(line), value, entry->length);
+    if (PATCH_NO_ERROR != rc)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Invalid patch value \"%s\"\n", line);
+    }
+    return rc;
+}
+
+int patch_table_apply(const patch_table_t *table, unsigned int unit,
+                      void *code, unsigned int code_len,
+                      void *data, unsigned int data_len,
+                      unsigned char *code_dirty, unsigned char *data_dirty,
+                      const rl78_log_t *log)
+{
+    unsigned int i;
+    for (i = 0; i < table->count; ++i)
+    {
+        const patch_entry_t *entry = &table->entries[i];
+        unsigned char value[PATCH_MAX_LENGTH];
+        int rc = PATCH_NO_ERROR;
+        switch (entry->source)
+        {
+        case PATCH_SOURCE_COUNTER:
+        {
+            unsigned long long counter = entry->start + entry->step * unit;
+            unsigned int j;
+            for (j = 0; j < entry->length; ++j)
+            {
+                value[j] = counter & 0xFFU;
+                counter >>= 8;
+            }
+            break;
+        }
+        case PATCH_SOURCE_CSV:
+            rc = patch_read_csv(entry, unit, value, log);
+            break;
+        case PATCH_SOURCE_STDIN:
+            rc = patch_read_stdin(entry, value, log);
+            break;
+        default:
+            rc = PATCH_FORMAT_ERROR;
+            break;
+        }
+        if (PATCH_NO_ERROR != rc)
+        {
+            return rc;
+        }
+        unsigned int address = entry->address;
+        unsigned char *memory;
+        unsigned char *dirty;
+        if (srec_in_range(address, entry->length, CODE_OFFSET, code_len)
+            && NULL != code)
+        {
+            memory = (unsigned char*)code;
+            dirty = code_dirty;
+            address -= CODE_OFFSET;
+        }
+        else if (srec_in_range(address, entry->length, DATA_OFFSET, data_len)
+                 && NULL != data)
+        {
+            memory = (unsigned char*)data;
+            dirty = data_dirty;
+            address -= DATA_OFFSET;
+        }
+        else
+        {
+            rl78_log(log, RL78_LOG_ERROR, "Patch address %06X is out of memory range\n", entry->address);
+            return PATCH_MEMORY_ERROR;
+        }
+        memcpy(memory + address, value, entry->length);
+        if (NULL != dirty)
+        {
+            unsigned int block;
+            for (block = address / FLASH_BLOCK_SIZE;
+                 block <= (address + entry->length - 1) / FLASH_BLOCK_SIZE;
+                 ++block)
+            {
+                dirty[block] = 1;
+            }
+        }
+        if (rl78_log_enabled(log, 3))
+        {
+            char prefix[16];
+            snprintf(prefix, sizeof prefix, "Patch %06X", entry->address);
+            rl78_log_hex(log, 3, prefix, value, entry->length);
+        }
+    }
+    return PATCH_NO_ERROR;
+}
@@ -0,0 +1,63 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef PATCH_H__
+#define PATCH_H__
+
+#include "log.h"
+
+#define PATCH_SOURCE_COUNTER    0
+#define PATCH_SOURCE_CSV        1
+#define PATCH_SOURCE_STDIN      2
+
+#define PATCH_MAX_LENGTH        256
+
+typedef struct
+{
+    unsigned int address;
+    unsigned int length;
+    int source;
+    unsigned long long start;   /* counter: value for unit 0 */
+    unsigned long long step;    /* counter: increment per unit */
+    char *csv_file;
+    unsigned int csv_column;
+} patch_entry_t;
+
+typedef struct
+{
+    patch_entry_t *entries;
+    unsigned int count;
+} patch_table_t;
+
+int patch_table_load(patch_table_t *table, const char *filename, const rl78_log_t *log);
+void patch_table_free(patch_table_t *table);
+/* Write values of the unit into the image. Blocks that have been touched are
+ * marked in code_dirty/data_dirty (one flag per flash block, may be NULL). */
+int patch_table_apply(const patch_table_t *table, unsigned int unit,
+                      void *code, unsigned int code_len,
+                      void *data, unsigned int data_len,
+                      unsigned char *code_dirty, unsigned char *data_dirty,
+                      const rl78_log_t *log);
+
+#define PATCH_NO_ERROR          (0)
+#define PATCH_IO_ERROR          (-1)
+#define PATCH_FORMAT_ERROR      (-2)
+#define PATCH_MEMORY_ERROR      (-3)
+
+#endif // PATCH_H__
@@ -0,0 +1,193 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "probe.h"
+#include "rl78.h"
+#include "filelock.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PROBE_LINE_LENGTH   512
+
+/* Most fixtures use the defaults; inverted reset lines are the rarest */
+static const int probe_modes[] =
+{
+    MODE_UART_1 | MODE_RESET_DTR,
+    MODE_UART_2 | MODE_RESET_DTR,
+    MODE_UART_1 | MODE_RESET_RTS,
+    MODE_UART_2 | MODE_RESET_RTS,
+    MODE_UART_1 | MODE_RESET_DTR | MODE_INVERT_RESET,
+    MODE_UART_2 | MODE_RESET_DTR | MODE_INVERT_RESET,
+    MODE_UART_1 | MODE_RESET_RTS | MODE_INVERT_RESET,
+    MODE_UART_2 | MODE_RESET_RTS | MODE_INVERT_RESET,
+};
+
+#define PROBE_MODES (sizeof probe_modes / sizeof probe_modes[0])
+
+static
+int probe_try(rl78_session_t *s, int mode)
+{
+    s->mode = mode;
+    rl78_log(&s->log, 2, "Probing mode %u%s... ",
+             (mode & (MODE_UART | MODE_RESET)) + 1,
+             (mode & MODE_INVERT_RESET) ? " with RESET inversion" : "");
+    // A wrong guess is expected to fail, so errors are shown only in traces
+    const rl78_log_t log = s->log;
+    if (3 > log.level)
+    {
+        s->log.func = rl78_log_quiet;
+        s->log.ctx = (void*)&log;
+    }
+    const int rc = rl78_reset_probe(s);
+    s->log = log;
+    rl78_log(&s->log, 2, "%s\n", 0 == rc ? "OK" : "FAILED");
+    return rc;
+}
+
+int probe_mode(rl78_session_t *s, int hint)
+{
+    const unsigned int read_timeout = s->read_timeout;
+    s->read_timeout = PROBE_TIMEOUT;
+    int rc = PROBE_NOT_FOUND;
+    if (PROBE_NO_MODE != hint
+        && 0 == probe_try(s, hint))
+    {
+        rc = PROBE_NO_ERROR;
+    }
+    unsigned int i;
+    for (i = 0; PROBE_NOT_FOUND == rc && PROBE_MODES > i; ++i)
+    {
+        if (probe_modes[i] != hint
+            && 0 == probe_try(s, probe_modes[i]))
+        {
+            rc = PROBE_NO_ERROR;
+        }
+    }
+    s->read_timeout = read_timeout;
+    if (PROBE_NO_ERROR != rc)
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "No communication mode is acknowledged by the device\n");
+        return rc;
+    }
+    rl78_log(&s->log, 1, "Detected communication mode %u%s\n",
+             (s->mode & (MODE_UART | MODE_RESET)) + 1,
+             (s->mode & MODE_INVERT_RESET) ? " with RESET inversion" : "");
+    return PROBE_NO_ERROR;
+}
+
+/* Parse a state file line; returns the mode or PROBE_NO_MODE */
+static
+int probe_parse(char *line, const char **port)
+{
+    unsigned int mode;
+    unsigned int invert;
+    int offset = 0;
+    if (2 != sscanf(line, "%u %u %n", &mode, &invert, &offset)
+        || 0 == offset
+        || MODE_MIN_VALUE + 1 > mode
+        || MODE_MAX_VALUE + 1 < mode)
+    {
+        return PROBE_NO_MODE;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    *port = line + offset;
+    return (mode - 1) | (invert ? MODE_INVERT_RESET : 0);
+}
+
+int probe_cache_get(const char *filename, const char *port, const rl78_log_t *log)
+{
+    FILE *f = fopen(filename, "r");
+    if (NULL == f)
+    {
+        return PROBE_NO_MODE;
+    }
+    int mode = PROBE_NO_MODE;
+    char line[PROBE_LINE_LENGTH];
+    while (PROBE_NO_MODE == mode
+           && NULL != fgets(line, sizeof line, f))
+    {
+        const char *name = NULL;
+        const int m = probe_parse(line, &name);
+        if (PROBE_NO_MODE != m
+            && 0 == strcmp(name, port))
+        {
+            mode = m;
+        }
+    }
+    fclose(f);
+    if (PROBE_NO_MODE != mode)
+    {
+        rl78_log(log, 2, "Cached communication mode %u%s for %s\n",
+                 (mode & (MODE_UART | MODE_RESET)) + 1,
+                 (mode & MODE_INVERT_RESET) ? " with RESET inversion" : "", port);
+    }
+    return mode;
+}
+
+typedef struct
+{
+    const char *filename;
+    const char *port;
+    int mode;
+} probe_entry_t;
+
+static
+void probe_cache_emit(FILE *out, const void *ctx)
+{
+    const probe_entry_t *entry = ctx;
+    // Keep the entries of the other ports
+    FILE *in = fopen(entry->filename, "r");
+    if (NULL != in)
+    {
+        char line[PROBE_LINE_LENGTH];
+        char copy[PROBE_LINE_LENGTH];
+        while (NULL != fgets(line, sizeof line, in))
+        {
+            const char *name = NULL;
+            strcpy(copy, line);
+            if (PROBE_NO_MODE != probe_parse(copy, &name)
+                && 0 != strcmp(name, entry->port))
+            {
+                fputs(line, out);
+                if (NULL == strchr(line, '\n'))
+                {
+                    fputc('\n', out);
+                }
+            }
+        }
+        fclose(in);
+    }
+    fprintf(out, "%u %u %s\n", (entry->mode & (MODE_UART | MODE_RESET)) + 1,
+            (entry->mode & MODE_INVERT_RESET) ? 1 : 0, entry->port);
+}
+
+int probe_cache_put(const char *filename, const char *port, int mode, const rl78_log_t *log)
+{
+    // Entries put by other processes between reading and renaming would be lost
+    const int lock = filelock_acquire(filename, log);
+    if (0 > lock)
+    {
+        return PROBE_IO_ERROR;
+    }
+    const probe_entry_t entry = { filename, port, mode };
+    const int rc = filelock_replace(filename, probe_cache_emit, &entry, log);
+    filelock_release(lock);
+    return (0 == rc) ? PROBE_NO_ERROR : PROBE_IO_ERROR;
+}
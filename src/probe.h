@@ -0,0 +1,45 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef PROBE_H__
+#define PROBE_H__
+
+#include "session.h"
+
+#define PROBE_TIMEOUT       20      /* ms to wait for the answer to a mode */
+#define PROBE_NO_MODE       (-1)
+
+#define PROBE_NO_ERROR      0
+#define PROBE_NOT_FOUND     1
+#define PROBE_IO_ERROR      2
+
+/* Find the communication mode and reset polarity a device answers to. The
+ * combinations are tried from the most common one (single-wire UART, reset by
+ * DTR) with hint, if not PROBE_NO_MODE, going first. On success s->mode is
+ * set to the MODE_* value which has been acknowledged. */
+int probe_mode(rl78_session_t *s, int hint);
+
+/* The state file keeps a line "<mode> <invert> <port>" per port, with mode
+ * given as for -m (1..4). Missing files and ports are not errors: get returns
+ * PROBE_NO_MODE in that case. */
+int probe_cache_get(const char *filename, const char *port, const rl78_log_t *log);
+int probe_cache_put(const char *filename, const char *port, int mode, const rl78_log_t *log);
+
+#endif // PROBE_H__
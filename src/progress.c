@@ -0,0 +1,172 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+
+#include "progress.h"
+#include "latency.h"
+#include "json.h"
+#include "rl78.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    char *name;
+    int phase;
+    unsigned int total;         /* blocks */
+    unsigned long long started; /* us */
+    unsigned long long last;    /* us, last block event */
+} progress_port_t;
+
+struct progress
+{
+    FILE *out;
+    unsigned long long interval;    /* us */
+    unsigned long long started;
+    progress_port_t *ports;
+    unsigned int nports;
+};
+
+static
+progress_port_t *progress_port(progress_t *p, const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < p->nports; ++i)
+    {
+        if (0 == strcmp(name, p->ports[i].name))
+        {
+            return &p->ports[i];
+        }
+    }
+    progress_port_t *ports = realloc(p->ports, (p->nports + 1) * sizeof *ports);
+    if (NULL == ports)
+    {
+        return NULL;
+    }
+    p->ports = ports;
+    progress_port_t *port = &p->ports[p->nports];
+    memset(port, 0, sizeof *port);
+    port->name = strdup(name);
+    if (NULL == port->name)
+    {
+        return NULL;
+    }
+    port->phase = LATENCY_NO_PHASE;
+    ++p->nports;
+    return port;
+}
+
+/* Common head of an event, the caller closes the object */
+static
+void progress_event(progress_t *p, const progress_port_t *port, const char *event, unsigned long long now)
+{
+    fprintf(p->out, "{\"time_ms\":%llu,\"port\":", (now - p->started) / 1000);
+    json_string(p->out, port->name);
+    fprintf(p->out, ",\"event\":\"%s\",\"phase\":\"%s\"", event, latency_phase_name(port->phase));
+}
+
+static
+void progress_bytes(progress_t *p, const progress_port_t *port, unsigned int done)
+{
+    fprintf(p->out, ",\"blocks_done\":%u,\"blocks\":%u,\"bytes_done\":%lu,\"bytes_total\":%lu",
+            done, port->total,
+            (unsigned long)done * FLASH_BLOCK_SIZE, (unsigned long)port->total * FLASH_BLOCK_SIZE);
+}
+
+progress_t *progress_open(FILE *out, unsigned int interval)
+{
+    progress_t *p = calloc(1, sizeof *p);
+    if (NULL == p)
+    {
+        return NULL;
+    }
+    p->out = out;
+    p->interval = (unsigned long long)interval * 1000;
+    p->started = latency_now();
+    return p;
+}
+
+void progress_phase_begin(progress_t *p, const char *port, int phase, unsigned int address, unsigned int total)
+{
+    progress_port_t *pp = progress_port(p, port);
+    if (NULL == pp)
+    {
+        return;
+    }
+    const unsigned long long now = latency_now();
+    pp->phase = phase;
+    pp->total = total;
+    pp->started = now;
+    pp->last = now;
+    progress_event(p, pp, "phase_start", now);
+    fprintf(p->out, ",\"address\":%u", address);
+    progress_bytes(p, pp, 0);
+    fprintf(p->out, "}\n");
+    fflush(p->out);
+}
+
+void progress_block(progress_t *p, const char *port, unsigned int address, unsigned int done)
+{
+    progress_port_t *pp = progress_port(p, port);
+    const unsigned long long now = latency_now();
+    if (NULL == pp
+        || LATENCY_NO_PHASE == pp->phase
+        || now - pp->last < p->interval)
+    {
+        return;
+    }
+    pp->last = now;
+    // The blocks left are expected to take as long as those done so far
+    const unsigned long long eta = (now - pp->started) / done * (pp->total - done);
+    progress_event(p, pp, "block", now);
+    fprintf(p->out, ",\"address\":%u", address);
+    progress_bytes(p, pp, done);
+    fprintf(p->out, ",\"eta_ms\":%llu}\n", eta / 1000);
+    fflush(p->out);
+}
+
+void progress_phase_end(progress_t *p, const char *port, unsigned int done)
+{
+    progress_port_t *pp = progress_port(p, port);
+    if (NULL == pp
+        || LATENCY_NO_PHASE == pp->phase)
+    {
+        return;
+    }
+    const unsigned long long now = latency_now();
+    progress_event(p, pp, "phase_end", now);
+    progress_bytes(p, pp, done);
+    fprintf(p->out, ",\"elapsed_ms\":%llu,\"result\":\"%s\"}\n",
+            (now - pp->started) / 1000, done == pp->total ? "ok" : "failed");
+    fflush(p->out);
+    pp->phase = LATENCY_NO_PHASE;
+}
+
+void progress_close(progress_t *p)
+{
+    unsigned int i;
+    for (i = 0; i < p->nports; ++i)
+    {
+        free(p->ports[i].name);
+    }
+    free(p->ports);
+    free(p);
+}
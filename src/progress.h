@@ -0,0 +1,47 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+
+#ifndef PROGRESS_H__
+#define PROGRESS_H__
+
+#include <stdio.h>
+
+/* Machine-readable progress of erase, program and verify: one JSON object
+ * per line for the start and end of each phase and for the blocks in
+ * between. Block events of a port are written at most once per interval, so
+ * a UI gets an even stream of events without a write per block; each event
+ * carries the bytes done and total and an estimate of the time left in the
+ * phase. Phases are LATENCY_PHASE_*. */
+
+#define PROGRESS_INTERVAL   200     /* ms, default between block events */
+
+typedef struct progress progress_t;
+
+progress_t *progress_open(FILE *out, unsigned int interval);
+void progress_phase_begin(progress_t *p, const char *port, int phase, unsigned int address, unsigned int total);
+/* Blocks are counted from 1 to total, as by the session progress callback */
+void progress_block(progress_t *p, const char *port, unsigned int address, unsigned int done);
+/* done blocks of the phase were completed, it failed if that is short of total */
+void progress_phase_end(progress_t *p, const char *port, unsigned int done);
+void progress_close(progress_t *p);
+
+#endif  // PROGRESS_H__
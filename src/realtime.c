@@ -0,0 +1,64 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#define _GNU_SOURCE
+#include "realtime.h"
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+int realtime_setup(int priority, int cpu, const rl78_log_t *log)
+{
+    if (REALTIME_NO_CPU != cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        const int rc = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+        if (0 != rc)
+        {
+            rl78_log(log, RL78_LOG_ERROR, "Unable to pin to CPU %i: %s\n", cpu, strerror(rc));
+            return -1;
+        }
+        rl78_log(log, 1, "Pinned to CPU %i\n", cpu);
+    }
+    if (0 < priority)
+    {
+        if (0 != mlockall(MCL_CURRENT | MCL_FUTURE))
+        {
+            rl78_log(log, RL78_LOG_ERROR, "Unable to lock memory: %s\n", strerror(errno));
+            return -1;
+        }
+        struct sched_param param;
+        memset(&param, 0, sizeof param);
+        param.sched_priority = priority;
+        const int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (0 != rc)
+        {
+            rl78_log(log, RL78_LOG_ERROR, "Unable to set SCHED_FIFO priority %i: %s\n", priority, strerror(rc));
+            munlockall();
+            return -1;
+        }
+        rl78_log(log, 1, "Running with SCHED_FIFO priority %i, memory locked\n", priority);
+    }
+    return 0;
+}
@@ -0,0 +1,705 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "recipe.h"
+#include "rl78.h"
+#include "serial.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#define RECIPE_SECTION_NONE     0
+#define RECIPE_SECTION_RECIPE   1
+#define RECIPE_SECTION_IMAGE    2
+#define RECIPE_SECTION_STEP     3
+
+#define RECIPE_EXPECT_TIMEOUT   5000    /* ms */
+
+static const char *const recipe_actions[] =
+{
+    "info",
+    "erase",
+    "write",
+    "verify",
+    "security",
+    "reset",
+    "expect",
+};
+
+static
+char *recipe_trim(char *str)
+{
+    while (isspace((unsigned char)*str))
+    {
+        ++str;
+    }
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+    {
+        --end;
+    }
+    *end = '\0';
+    return str;
+}
+
+static
+int recipe_uint(const char *value, unsigned int *result)
+{
+    char *endp;
+    *result = strtoul(value, &endp, 0);
+    return (value != endp && '\0' == *endp) ? RECIPE_NO_ERROR : RECIPE_FORMAT_ERROR;
+}
+
+static
+int recipe_bool(const char *value, int *result)
+{
+    if (0 == strcmp(value, "yes") || 0 == strcmp(value, "1"))
+    {
+        *result = 1;
+        return RECIPE_NO_ERROR;
+    }
+    if (0 == strcmp(value, "no") || 0 == strcmp(value, "0"))
+    {
+        *result = 0;
+        return RECIPE_NO_ERROR;
+    }
+    return RECIPE_FORMAT_ERROR;
+}
+
+static
+int recipe_set_name(char *name, const char *value)
+{
+    if (RECIPE_NAME_LENGTH <= strlen(value))
+    {
+        return RECIPE_FORMAT_ERROR;
+    }
+    strcpy(name, value);
+    return RECIPE_NO_ERROR;
+}
+
+static
+int recipe_find_image(const recipe_t *recipe, const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < recipe->nimages; ++i)
+    {
+        if (0 == strcmp(name, recipe->images[i].name))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static
+int recipe_section(recipe_t *recipe, char *header, int *section)
+{
+    char *end = strchr(header, ']');
+    if (NULL == end || '\0' != *recipe_trim(end + 1))
+    {
+        return RECIPE_FORMAT_ERROR;
+    }
+    *end = '\0';
+    char *name = recipe_trim(header + 1);
+    char *arg = name + strcspn(name, " \t");
+    if ('\0' != *arg)
+    {
+        *arg++ = '\0';
+        arg = recipe_trim(arg);
+    }
+    if (0 == strcmp(name, "recipe"))
+    {
+        *section = RECIPE_SECTION_RECIPE;
+        return RECIPE_NO_ERROR;
+    }
+    if (0 == strcmp(name, "image"))
+    {
+        if ('\0' == *arg || 0 <= recipe_find_image(recipe, arg))
+        {
+            return RECIPE_FORMAT_ERROR;
+        }
+        recipe_image_t *images = realloc(recipe->images, (recipe->nimages + 1) * sizeof *images);
+        if (NULL == images)
+        {
+            return RECIPE_MEMORY_ERROR;
+        }
+        recipe->images = images;
+        recipe_image_t *image = &recipe->images[recipe->nimages++];
+        memset(image, 0, sizeof *image);
+        *section = RECIPE_SECTION_IMAGE;
+        return recipe_set_name(image->name, arg);
+    }
+    if (0 == strcmp(name, "step"))
+    {
+        recipe_step_t *steps = realloc(recipe->steps, (recipe->nsteps + 1) * sizeof *steps);
+        if (NULL == steps)
+        {
+            return RECIPE_MEMORY_ERROR;
+        }
+        recipe->steps = steps;
+        recipe_step_t *step = &recipe->steps[recipe->nsteps++];
+        memset(step, 0, sizeof *step);
+        step->action = -1;
+        step->region = RECIPE_REGION_ALL;
+        step->image = -1;
+        step->baud = SESSION_DEFAULT_BAUD;
+        step->timeout = RECIPE_EXPECT_TIMEOUT;
+        step->reset = 1;
+        *section = RECIPE_SECTION_STEP;
+        if ('\0' == *arg)
+        {
+            snprintf(step->name, sizeof step->name, "%u", recipe->nsteps);
+            return RECIPE_NO_ERROR;
+        }
+        return recipe_set_name(step->name, arg);
+    }
+    return RECIPE_FORMAT_ERROR;
+}
+
+static
+int recipe_add_files(recipe_image_t *image, char *value, const char *dir, int dir_len)
+{
+    char *save;
+    char *file;
+    for (file = strtok_r(value, " \t", &save); NULL != file; file = strtok_r(NULL, " \t", &save))
+    {
+        if (RECIPE_MAX_FILES == image->nfiles)
+        {
+            return RECIPE_FORMAT_ERROR;
+        }
+        // Relative paths start at the directory of the recipe
+        const int relative = ('/' != file[0]);
+        char *path = malloc((relative ? dir_len : 0) + strlen(file) + 1);
+        if (NULL == path)
+        {
+            return RECIPE_MEMORY_ERROR;
+        }
+        sprintf(path, "%.*s%s", relative ? dir_len : 0, dir, file);
+        image->files[image->nfiles++] = path;
+    }
+    return RECIPE_NO_ERROR;
+}
+
+static
+int recipe_option(recipe_t *recipe, const char *key, const char *value)
+{
+    unsigned int n;
+    int flag;
+    if (0 == strcmp(key, "mode"))
+    {
+        if (RECIPE_NO_ERROR != recipe_uint(value, &n)
+            || MODE_MIN_VALUE > (int)n - 1
+            || MODE_MAX_VALUE < (int)n - 1)
+        {
+            return RECIPE_FORMAT_ERROR;
+        }
+        recipe->mode = (recipe->mode & MODE_INVERT_RESET) | (n - 1);
+        return RECIPE_NO_ERROR;
+    }
+    if (0 == strcmp(key, "invert_reset"))
+    {
+        if (RECIPE_NO_ERROR != recipe_bool(value, &flag))
+        {
+            return RECIPE_FORMAT_ERROR;
+        }
+        recipe->mode = flag ? (recipe->mode | MODE_INVERT_RESET) : (recipe->mode & ~MODE_INVERT_RESET);
+        return RECIPE_NO_ERROR;
+    }
+    if (0 == strcmp(key, "baud"))
+    {
+        if (RECIPE_NO_ERROR != recipe_uint(value, &n))
+        {
+            return RECIPE_FORMAT_ERROR;
+        }
+        recipe->baud = n;
+        return RECIPE_NO_ERROR;
+    }
+    if (0 == strcmp(key, "voltage"))
+    {
+        if (1 != sscanf(value, "%f", &recipe->voltage)
+            || RL78_MIN_VOLTAGE > recipe->voltage
+            || RL78_MAX_VOLTAGE < recipe->voltage)
+        {
+            return RECIPE_FORMAT_ERROR;
+        }
+        return RECIPE_NO_ERROR;
+    }
+    return RECIPE_FORMAT_ERROR;
+}
+
+static
+int recipe_step_option(recipe_t *recipe, recipe_step_t *step, const char *key, const char *value)
+{
+    unsigned int n;
+    if (0 == strcmp(key, "action"))
+    {
+        for (n = 0; n < sizeof recipe_actions / sizeof recipe_actions[0]; ++n)
+        {
+            if (0 == strcmp(value, recipe_actions[n]))
+            {
+                step->action = n;
+                return RECIPE_NO_ERROR;
+            }
+        }
+        return RECIPE_FORMAT_ERROR;
+    }
+    if (0 == strcmp(key, "region"))
+    {
+        step->region = (0 == strcmp(value, "code")) ? RECIPE_REGION_CODE
+            : (0 == strcmp(value, "data")) ? RECIPE_REGION_DATA
+            : (0 == strcmp(value, "all")) ? RECIPE_REGION_ALL : 0;
+        return (0 != step->region) ? RECIPE_NO_ERROR : RECIPE_FORMAT_ERROR;
+    }
+    if (0 == strcmp(key, "image"))
+    {
+        step->image = recipe_find_image(recipe, value);
+        return (0 <= step->image) ? RECIPE_NO_ERROR : RECIPE_FORMAT_ERROR;
+    }
+    if (0 == strcmp(key, "text"))
+    {
+        free(step->text);
+        step->text = strdup(value);
+        return (NULL != step->text) ? RECIPE_NO_ERROR : RECIPE_MEMORY_ERROR;
+    }
+    if (0 == strcmp(key, "reset"))
+    {
+        return recipe_bool(value, &step->reset);
+    }
+    if (RECIPE_NO_ERROR != recipe_uint(value, &n))
+    {
+        return RECIPE_FORMAT_ERROR;
+    }
+    if (0 == strcmp(key, "flg") && 0xFF >= n)
+    {
+        step->flg = n;
+        step->security_set |= RECIPE_SECURITY_FLG;
+    }
+    else if (0 == strcmp(key, "bot") && 0xFF >= n)
+    {
+        step->bot = n;
+        step->security_set |= RECIPE_SECURITY_BOT;
+    }
+    else if (0 == strcmp(key, "fsws") && 0xFFFF >= n)
+    {
+        step->fsws = n;
+        step->security_set |= RECIPE_SECURITY_FSWS;
+    }
+    else if (0 == strcmp(key, "fswe") && 0xFFFF >= n)
+    {
+        step->fswe = n;
+        step->security_set |= RECIPE_SECURITY_FSWE;
+    }
+    else if (0 == strcmp(key, "baud"))
+    {
+        step->baud = n;
+    }
+    else if (0 == strcmp(key, "timeout"))
+    {
+        step->timeout = n;
+    }
+    else
+    {
+        return RECIPE_FORMAT_ERROR;
+    }
+    return RECIPE_NO_ERROR;
+}
+
+static
+const char *recipe_check_step(const recipe_step_t *step)
+{
+    switch (step->action)
+    {
+    case -1:
+        return "no action";
+    case RECIPE_STEP_WRITE:
+    case RECIPE_STEP_VERIFY:
+        return (0 > step->image) ? "no image" : NULL;
+    case RECIPE_STEP_EXPECT:
+        return (NULL == step->text || '\0' == step->text[0]) ? "no text" : NULL;
+    case RECIPE_STEP_SECURITY:
+        return (0 == step->security_set) ? "no security data" : NULL;
+    default:
+        return NULL;
+    }
+}
+
+int recipe_load(recipe_t *recipe, const char *filename, const rl78_session_t *defaults, const rl78_log_t *log)
+{
+    memset(recipe, 0, sizeof *recipe);
+    recipe->mode = defaults->mode;
+    recipe->baud = defaults->baud;
+    recipe->voltage = defaults->voltage;
+    FILE *pfile = fopen(filename, "r");
+    if (NULL == pfile)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to open file \"%s\"\n", filename);
+        return RECIPE_IO_ERROR;
+    }
+    const char *slash = strrchr(filename, '/');
+    const int dir_len = (NULL != slash) ? slash - filename + 1 : 0;
+    char line[512];
+    unsigned int line_number = 0;
+    int section = RECIPE_SECTION_NONE;
+    int rc = RECIPE_NO_ERROR;
+    while (RECIPE_NO_ERROR == rc
+           && NULL != fgets(line, sizeof line, pfile))
+    {
+        ++line_number;
+        char *str = recipe_trim(line);
+        if ('\0' == *str || '#' == *str || ';' == *str)
+        {
+            continue;
+        }
+        if ('[' == *str)
+        {
+            rc = recipe_section(recipe, str, &section);
+            if (RECIPE_SECTION_STEP == section && RECIPE_NO_ERROR == rc)
+            {
+                recipe->steps[recipe->nsteps - 1].line = line_number;
+            }
+            continue;
+        }
+        char *value = strchr(str, '=');
+        if (NULL == value)
+        {
+            rc = RECIPE_FORMAT_ERROR;
+            break;
+        }
+        *value++ = '\0';
+        const char *key = recipe_trim(str);
+        value = recipe_trim(value);
+        switch (section)
+        {
+        case RECIPE_SECTION_RECIPE:
+            rc = recipe_option(recipe, key, value);
+            break;
+        case RECIPE_SECTION_IMAGE:
+            rc = (0 == strcmp(key, "files"))
+                ? recipe_add_files(&recipe->images[recipe->nimages - 1], value, filename, dir_len)
+                : RECIPE_FORMAT_ERROR;
+            break;
+        case RECIPE_SECTION_STEP:
+            rc = recipe_step_option(recipe, &recipe->steps[recipe->nsteps - 1], key, value);
+            break;
+        default:
+            rc = RECIPE_FORMAT_ERROR;
+            break;
+        }
+    }
+    fclose(pfile);
+    if (RECIPE_NO_ERROR != rc)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "%s:%u: %s\n", filename, line_number,
+                 (RECIPE_MEMORY_ERROR == rc) ? "Out of memory" : "Invalid line");
+        recipe_free(recipe);
+        return rc;
+    }
+    unsigned int i;
+    for (i = 0; i < recipe->nsteps; ++i)
+    {
+        const char *error = recipe_check_step(&recipe->steps[i]);
+        if (NULL != error)
+        {
+            rl78_log(log, RL78_LOG_ERROR, "%s:%u: Step %s: %s\n", filename, recipe->steps[i].line,
+                     recipe->steps[i].name, error);
+            recipe_free(recipe);
+            return RECIPE_FORMAT_ERROR;
+        }
+    }
+    for (i = 0; i < recipe->nimages; ++i)
+    {
+        if (0 == recipe->images[i].nfiles)
+        {
+            rl78_log(log, RL78_LOG_ERROR, "%s: Image %s has no files\n", filename, recipe->images[i].name);
+            recipe_free(recipe);
+            return RECIPE_FORMAT_ERROR;
+        }
+    }
+    return RECIPE_NO_ERROR;
+}
+
+void recipe_free(recipe_t *recipe)
+{
+    unsigned int i;
+    for (i = 0; i < recipe->nimages; ++i)
+    {
+        recipe_image_t *image = &recipe->images[i];
+        unsigned int j;
+        for (j = 0; j < image->nfiles; ++j)
+        {
+            free(image->files[j]);
+        }
+        if (image->loaded)
+        {
+            image_free(&image->image);
+        }
+    }
+    for (i = 0; i < recipe->nsteps; ++i)
+    {
+        free(recipe->steps[i].text);
+    }
+    free(recipe->images);
+    free(recipe->steps);
+    memset(recipe, 0, sizeof *recipe);
+}
+
+typedef struct
+{
+    int connected;
+    char device_name[11];
+    unsigned int code_size;
+    unsigned int data_size;
+} recipe_state_t;
+
+static
+const char *recipe_connect(rl78_session_t *s, recipe_state_t *state)
+{
+    if (state->connected)
+    {
+        return NULL;
+    }
+    if (0 > rl78_reset_init(s, 0))
+    {
+        return "Initialization failed";
+    }
+    if (0 > rl78_cmd_reset(s))
+    {
+        return "Synchronization failed";
+    }
+    if (0 > rl78_cmd_silicon_signature(s, state->device_name, &state->code_size, &state->data_size))
+    {
+        return "Silicon signature read failed";
+    }
+    state->connected = 1;
+    return NULL;
+}
+
+static
+const image_t *recipe_image(recipe_t *recipe, const recipe_step_t *step, const recipe_state_t *state,
+                            rl78_session_t *s)
+{
+    recipe_image_t *image = &recipe->images[step->image];
+    if (!image->loaded)
+    {
+        if (0 != image_init(&image->image, IMAGE_CODE_MAX_SIZE, IMAGE_DATA_MAX_SIZE, &s->log))
+        {
+            return NULL;
+        }
+        if (0 != image_load(&image->image, (const char *const *)image->files, image->nfiles, 0, 0, &s->log))
+        {
+            image_free(&image->image);
+            return NULL;
+        }
+        if (NULL != recipe->patches
+            && 0 != image_patch(&image->image, recipe->patches, recipe->unit, &s->log))
+        {
+            rl78_log(&s->log, RL78_LOG_ERROR, "Patching failed\n");
+            image_free(&image->image);
+            return NULL;
+        }
+        image->loaded = 1;
+    }
+    if (!image_fits(&image->image, state->code_size, state->data_size, &s->log))
+    {
+        return NULL;
+    }
+    return &image->image;
+}
+
+static
+const char *recipe_expect(rl78_session_t *s, const recipe_step_t *step)
+{
+    const size_t len = strlen(step->text);
+    char *window = calloc(1, len + 1);
+    if (NULL == window)
+    {
+        return "Out of memory";
+    }
+    // Listen before the reset, so the start of the banner is not lost
+    serial_set_baud(s, step->baud);
+    serial_flush(s);
+    if (step->reset)
+    {
+        rl78_reset(s);
+    }
+    const unsigned long long deadline = latency_now() + step->timeout * 1000ULL;
+    const char *error = "Text not received";
+    while (latency_now() < deadline)
+    {
+        char c;
+        if (1 != serial_read(s, &c, 1))
+        {
+            continue;
+        }
+        rl78_log(&s->log, 1, "%c", c);
+        // The window holds the last len characters
+        memmove(window, window + 1, len - 1);
+        window[len - 1] = c;
+        if (0 == memcmp(window, step->text, len))
+        {
+            error = NULL;
+            break;
+        }
+    }
+    free(window);
+    return error;
+}
+
+static
+const char *recipe_security(rl78_session_t *s, const recipe_step_t *step)
+{
+    unsigned char security[SECURITY_DATA_LENGTH];
+    // Keys which the step does not give and the reserved bytes are written
+    // back as they have been read: zeros there would lock the device
+    if (0 != rl78_cmd_security_get(s, security))
+    {
+        return "Security read failed";
+    }
+    if (step->security_set & RECIPE_SECURITY_FLG)
+    {
+        security[0] = step->flg;
+    }
+    if (step->security_set & RECIPE_SECURITY_BOT)
+    {
+        security[1] = step->bot;
+    }
+    if (step->security_set & RECIPE_SECURITY_FSWS)
+    {
+        security[2] = step->fsws & 0xFF;
+        security[3] = (step->fsws >> 8) & 0xFF;
+    }
+    if (step->security_set & RECIPE_SECURITY_FSWE)
+    {
+        security[4] = step->fswe & 0xFF;
+        security[5] = (step->fswe >> 8) & 0xFF;
+    }
+    if (0 != rl78_cmd_security_set(s, security))
+    {
+        return "Security set failed";
+    }
+    return NULL;
+}
+
+static
+const char *recipe_step(recipe_t *recipe, const recipe_step_t *step, rl78_session_t *s, recipe_state_t *state)
+{
+    const char *error;
+    if (RECIPE_STEP_RESET != step->action
+        && RECIPE_STEP_EXPECT != step->action
+        && NULL != (error = recipe_connect(s, state)))
+    {
+        return error;
+    }
+    const int code = (step->region & RECIPE_REGION_CODE);
+    const int data = (step->region & RECIPE_REGION_DATA) && state->data_size;
+    const image_t *image = NULL;
+    if (RECIPE_STEP_WRITE == step->action
+        || RECIPE_STEP_VERIFY == step->action)
+    {
+        image = recipe_image(recipe, step, state, s);
+        if (NULL == image)
+        {
+            return "Read failed";
+        }
+    }
+    switch (step->action)
+    {
+    case RECIPE_STEP_INFO:
+        rl78_log(&s->log, RL78_LOG_OUTPUT,
+                 "Device: %s\n"
+                 "Code size: %u kB\n"
+                 "Data size: %u kB\n",
+                 state->device_name, state->code_size / 1024, state->data_size / 1024);
+        return NULL;
+    case RECIPE_STEP_ERASE:
+        if (code && 0 != rl78_erase(s, CODE_OFFSET, state->code_size))
+        {
+            return "Code flash erase failed";
+        }
+        if (data && 0 != rl78_erase(s, DATA_OFFSET, state->data_size))
+        {
+            return "Data flash erase failed";
+        }
+        return NULL;
+    case RECIPE_STEP_WRITE:
+        if (code && 0 != rl78_program(s, CODE_OFFSET, image->code, state->code_size, image->code_blocks))
+        {
+            return "Code flash write failed";
+        }
+        if (data && 0 != rl78_program(s, DATA_OFFSET, image->data, state->data_size, image->data_blocks))
+        {
+            return "Data flash write failed";
+        }
+        return NULL;
+    case RECIPE_STEP_VERIFY:
+        if (code && 0 != rl78_verify(s, CODE_OFFSET, image->code, state->code_size, image->code_blocks))
+        {
+            return "Code flash verification failed";
+        }
+        if (data && 0 != rl78_verify(s, DATA_OFFSET, image->data, state->data_size, image->data_blocks))
+        {
+            return "Data flash verification failed";
+        }
+        return NULL;
+    case RECIPE_STEP_SECURITY:
+        return recipe_security(s, step);
+    case RECIPE_STEP_RESET:
+        state->connected = 0;
+        rl78_reset(s);
+        return NULL;
+    default:
+        state->connected = 0;
+        return recipe_expect(s, step);
+    }
+}
+
+int recipe_run(recipe_t *recipe, rl78_session_t *s)
+{
+    s->mode = recipe->mode;
+    s->baud = recipe->baud;
+    s->voltage = recipe->voltage;
+    recipe_state_t state;
+    memset(&state, 0, sizeof state);
+    const unsigned long long start = latency_now();
+    int retcode = 0;
+    unsigned int i;
+    printf("%-16s %-10s %-8s %8s  %s\n", "Step", "Action", "Result", "Time", "Error");
+    for (i = 0; i < recipe->nsteps && 0 == retcode; ++i)
+    {
+        const recipe_step_t *step = &recipe->steps[i];
+        rl78_log(&s->log, 1, "Step %s: %s\n", step->name, recipe_actions[step->action]);
+        const unsigned long long step_start = latency_now();
+        const char *error = recipe_step(recipe, step, s, &state);
+        if (NULL != error)
+        {
+            rl78_log(&s->log, RL78_LOG_ERROR, "%s\n", error);
+            retcode = EIO;
+        }
+        printf("%-16s %-10s %-8s %7.2fs  %s\n",
+               step->name, recipe_actions[step->action],
+               (NULL == error) ? "OK" : "FAILED",
+               (latency_now() - step_start) / 1e6,
+               (NULL != error) ? error : "");
+    }
+    printf("%u of %u steps done in %.2fs\n", (0 == retcode) ? i : i - 1, recipe->nsteps, (latency_now() - start) / 1e6);
+    return retcode;
+}
@@ -0,0 +1,122 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef RECIPE_H__
+#define RECIPE_H__
+
+#include "session.h"
+#include "image.h"
+
+#define RECIPE_NO_ERROR     0
+#define RECIPE_IO_ERROR     (-1)
+#define RECIPE_FORMAT_ERROR (-2)
+#define RECIPE_MEMORY_ERROR (-3)
+
+#define RECIPE_MAX_FILES    16
+#define RECIPE_NAME_LENGTH  32
+
+#define RECIPE_STEP_INFO        0
+#define RECIPE_STEP_ERASE       1
+#define RECIPE_STEP_WRITE       2
+#define RECIPE_STEP_VERIFY      3
+#define RECIPE_STEP_SECURITY    4
+#define RECIPE_STEP_RESET       5
+#define RECIPE_STEP_EXPECT      6
+
+#define RECIPE_REGION_CODE      1
+#define RECIPE_REGION_DATA      2
+#define RECIPE_REGION_ALL       (RECIPE_REGION_CODE | RECIPE_REGION_DATA)
+
+typedef struct
+{
+    char name[RECIPE_NAME_LENGTH];
+    char *files[RECIPE_MAX_FILES];
+    unsigned int nfiles;
+    int loaded;
+    image_t image;
+} recipe_image_t;
+
+#define RECIPE_SECURITY_FLG     0x01
+#define RECIPE_SECURITY_BOT     0x02
+#define RECIPE_SECURITY_FSWS    0x04
+#define RECIPE_SECURITY_FSWE    0x08
+
+typedef struct
+{
+    char name[RECIPE_NAME_LENGTH];
+    unsigned int line;
+    int action;
+    int region;
+    int image;                  /* index into the images, -1 if none */
+    unsigned int flg;           /* security step */
+    unsigned int bot;
+    unsigned int fsws;
+    unsigned int fswe;
+    unsigned int security_set;  /* RECIPE_SECURITY_* of the keys given */
+    int baud;                   /* expect step */
+    char *text;
+    unsigned int timeout;       /* ms */
+    int reset;
+} recipe_step_t;
+
+typedef struct
+{
+    int mode;
+    int baud;
+    float voltage;
+    recipe_image_t *images;
+    unsigned int nimages;
+    recipe_step_t *steps;
+    unsigned int nsteps;
+    const patch_table_t *patches;   /* applied to every image, may be NULL */
+    unsigned int unit;
+} recipe_t;
+
+/* Recipe file format (INI, '#' and ';' start a comment):
+ *
+ *   [recipe]                     session settings, default to the command line
+ *   mode = 1..4
+ *   invert_reset = yes|no
+ *   baud = 115200|250000|500000|1000000
+ *   voltage = 3.3
+ *
+ *   [image <name>]               files merged into one image; relative
+ *   files = boot.mot app.mot     paths start at the recipe file
+ *
+ *   [step <name>]                steps run in file order
+ *   action = info|erase|write|verify|security|reset|expect
+ *   region = code|data|all       erase, write, verify; default: all
+ *   image = <name>               write, verify
+ *   flg, bot, fsws, fswe = <n>   security: values of the security data; at
+ *                                least one, the others are kept as they are
+ *   baud = <n>                   expect: baudrate of the application
+ *   text = <banner>              expect: text to wait for
+ *   timeout = <ms>               expect: default 5000
+ *   reset = yes|no               expect: reset the MCU first; default yes
+ *
+ * The bootloader session is opened by the first step which needs it and is
+ * kept until a reset or expect step starts the application. */
+int recipe_load(recipe_t *recipe, const char *filename, const rl78_session_t *defaults, const rl78_log_t *log);
+void recipe_free(recipe_t *recipe);
+/* Run the steps on an open port; stops at the first failed step. Returns 0
+ * or the errno value of the failed step. */
+int recipe_run(recipe_t *recipe, rl78_session_t *s);
+
+#endif // RECIPE_H__
@@ -19,81 +19,291 @@
 
 #include "serial.h"
 #include "rl78.h"
+#include "block.h"
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include "wait_kbhit.h"
+#include "trace.h"
+#include "wear.h"
+#include "progress.h"
 
-extern int verbose_level;
-static unsigned char communication_mode;
+/* Progress marks are shown only at verbose level 2,
+ * higher levels print a message per command instead;
+ * JSONL progress replaces them */
+static void rl78_progress(rl78_session_t *s, const char *mark)
+{
+    if (2 == s->log.level
+        && NULL == s->events)
+    {
+        rl78_log(&s->log, 2, "%s", mark);
+    }
+}
 
-static void rl78_set_reset(port_handle_t fd, int mode, int value)
+static void rl78_set_reset(rl78_session_t *s, int value)
 {
-    int level  = (mode & MODE_INVERT_RESET) ? !value : value;
+    int level  = (s->mode & MODE_INVERT_RESET) ? !value : value;
 
-    if (MODE_RESET_RTS == (mode & MODE_RESET))
+    if (MODE_RESET_RTS == (s->mode & MODE_RESET))
     {
-        serial_set_rts(fd, level);
+        serial_set_rts(s, level);
     }
     else
     {
-        serial_set_dtr(fd, level);
+        serial_set_dtr(s, level);
+    }
+}
+
+/* Start of a traced span, 0 if the session is not traced */
+static
+unsigned long long rl78_trace_now(const rl78_session_t *s)
+{
+    return NULL != s->trace ? latency_now() : 0;
+}
+
+static
+void rl78_trace(const rl78_session_t *s, const char *name, const char *category, unsigned long long start)
+{
+    if (NULL != s->trace)
+    {
+        trace_span(s->trace, s->trace_track, name, category, start, latency_now());
+    }
+}
+
+/* Start of an erase or program command, 0 if block times are not kept */
+static
+unsigned long long rl78_wear_now(const rl78_session_t *s)
+{
+    return NULL != s->wear ? latency_now() : 0;
+}
+
+static
+void rl78_wear(const rl78_session_t *s, int op, unsigned int address, unsigned long long start)
+{
+    if (NULL != s->wear)
+    {
+        wear_record(s->wear, s->port_name, op, address, latency_now() - start);
+    }
+}
+
+static
+void rl78_sleep(rl78_session_t *s, unsigned int us)
+{
+    const unsigned long long start = rl78_trace_now(s);
+    serial_delay(s, us);
+    rl78_trace(s, "sleep", TRACE_CAT_SLEEP, start);
+}
+
+static
+void rl78_delay(rl78_session_t *s, unsigned int ms)
+{
+    if (0 < ms)
+    {
+        rl78_sleep(s, ms * 1000);
+    }
+}
+
+static
+unsigned long long rl78_phase_begin(rl78_session_t *s, int phase)
+{
+    if (NULL != s->latency)
+    {
+        latency_phase_begin(s->latency, phase);
+    }
+    return rl78_trace_now(s);
+}
+
+static
+void rl78_phase_end(rl78_session_t *s, int phase, unsigned long long start, unsigned long long bytes)
+{
+    if (NULL != s->latency)
+    {
+        latency_phase_end(s->latency, bytes);
+    }
+    rl78_trace(s, latency_phase_name(phase), TRACE_CAT_PHASE, start);
+}
+
+static
+void rl78_events_begin(rl78_session_t *s, int phase, unsigned int address, unsigned int total)
+{
+    if (NULL != s->events)
+    {
+        progress_phase_begin(s->events, s->port_name, phase, address, total);
+    }
+}
+
+static
+void rl78_events_block(rl78_session_t *s, int operation, unsigned int address,
+                       unsigned int done, unsigned int total)
+{
+    rl78_session_progress(s, operation, address, done, total);
+    if (NULL != s->events)
+    {
+        progress_block(s->events, s->port_name, address, done);
+    }
+}
+
+static
+void rl78_events_end(rl78_session_t *s, unsigned int done)
+{
+    if (NULL != s->events)
+    {
+        progress_phase_end(s->events, s->port_name, done);
     }
 }
 
-int rl78_reset_init(port_handle_t fd, int wait, int baud, int mode, float voltage)
+/* Reset the device into the bootloader and send the mode byte. Returns the
+ * time of RESET release, in us; started is set to the start of the sequence
+ * for the trace. */
+static
+unsigned long long rl78_enter_bootloader(rl78_session_t *s, int wait, unsigned long long *started)
 {
     unsigned char r;
-    if (MODE_UART_1 == (mode & MODE_UART))
+    if (MODE_UART_1 == (s->mode & MODE_UART))
     {
         r = SET_MODE_1WIRE_UART;
-        communication_mode = 1;
+        s->communication_mode = 1;
     }
     else
     {
         r = SET_MODE_2WIRE_UART;
-        communication_mode = 2;
+        s->communication_mode = 2;
     }
-    if (4 <= verbose_level)
-    {
-        printf("Using communication mode %u%s\n",
-               (mode & (MODE_UART | MODE_RESET)) + 1,
-               (mode & MODE_INVERT_RESET) ? " with RESET inversion" : "");
-    }
-    rl78_set_reset(fd, mode, 0);                            /* RESET -> 0 */
-    serial_set_txd(fd, 0);                                  /* TOOL0 -> 0 */
+    rl78_log(&s->log, 4, "Using communication mode %u%s\n",
+             (s->mode & (MODE_UART | MODE_RESET)) + 1,
+             (s->mode & MODE_INVERT_RESET) ? " with RESET inversion" : "");
+    rl78_set_reset(s, 0);                            /* RESET -> 0 */
+    serial_set_txd(s, 0);                                  /* TOOL0 -> 0 */
     if (wait)
     {
-        printf("Turn MCU's power on and press any key...");
+        rl78_log(&s->log, RL78_LOG_OUTPUT, "Turn MCU's power on and press any key...");
         wait_kbhit();
-        printf("\n");
+        rl78_log(&s->log, RL78_LOG_OUTPUT, "\n");
+    }
+    // Waiting for a keypress is not part of the connection time
+    *started = rl78_phase_begin(s, LATENCY_PHASE_CONNECT);
+    serial_flush(s);
+    rl78_delay(s, s->timing.reset_low);
+    rl78_set_reset(s, 1);                            /* RESET -> 1 */
+    const unsigned long long released = latency_now();
+    rl78_delay(s, s->timing.tool0_low);
+    serial_set_txd(s, 1);                                  /* TOOL0 -> 1 */
+    rl78_delay(s, s->timing.tool0_high);
+    serial_flush(s);
+    rl78_log(&s->log, 3, "Send 1-byte data for setting mode\n");
+    serial_write(s, &r, 1);
+    if (1 == s->communication_mode)
+    {
+        serial_read(s, &r, 1);
+    }
+    return released;
+}
+
+/* Read and drop what comes until the line has been quiet for a read timeout */
+static
+void rl78_drain(rl78_session_t *s)
+{
+    unsigned char in[MAX_RESPONSE_LENGTH];
+    while (0 < serial_read(s, in, sizeof in))
+    {
+    }
+}
+
+/* Poll with "Reset" until the bootloader answers or the read timeout has
+ * passed, instead of waiting for a fixed time after the mode byte. Reset
+ * leaves the baud rate alone, so a late answer does no harm. A poll is only
+ * sent again if nothing at all has come back; a partial or garbled answer is
+ * read to its end, as are the answers to earlier polls after the first ACK. */
+static
+int rl78_handshake_poll(rl78_session_t *s)
+{
+    const unsigned int read_timeout = s->read_timeout;
+    const unsigned long long until = latency_now() + read_timeout * 1000ULL;
+    const rl78_log_t log = s->log;
+    s->log.func = rl78_log_quiet;
+    s->log.ctx = (void*)&log;
+    s->read_timeout = RL78_HANDSHAKE_POLL;
+    unsigned int polls = 0;
+    int rc;
+    for (;;)
+    {
+        unsigned char data[MAX_RESPONSE_LENGTH];
+        int len = 0;
+        ++polls;
+        rl78_send_cmd(s, CMD_RESET, NULL, 0);
+        const unsigned long long received = s->stats.bytes_received;
+        rc = rl78_recv(s, data, &len, 1);
+        if (RESPONSE_OK == rc
+            && STATUS_ACK != data[0])
+        {
+            rc = data[0];
+        }
+        if (0 == rc
+            || latency_now() >= until)
+        {
+            break;
+        }
+        ++s->stats.retries;
+        if (received != s->stats.bytes_received)
+        {
+            rl78_drain(s);
+        }
+    }
+    if (0 == rc
+        && 1 < polls)
+    {
+        rl78_drain(s);
+    }
+    s->read_timeout = read_timeout;
+    s->log = log;
+    if (0 != rc)
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "No answer from the bootloader within %u ms\n", read_timeout);
+        return rc;
     }
-    serial_flush(fd);
-    usleep(1000);
-    rl78_set_reset(fd, mode, 1);                            /* RESET -> 1 */
-    usleep(3000);
-    serial_set_txd(fd, 1);                                  /* TOOL0 -> 1 */
-    usleep(1000);
-    serial_flush(fd);
-    if (3 <= verbose_level)
+    return rl78_cmd_baud_rate_set(s, s->baud, s->voltage);
+}
+
+int rl78_reset_init(rl78_session_t *s, int wait)
+{
+    unsigned long long started;
+    const unsigned long long released = rl78_enter_bootloader(s, wait, &started);
+    int rc;
+    if (s->timing.adaptive)
     {
-        printf("Send 1-byte data for setting mode\n");
+        rc = rl78_handshake_poll(s);
     }
-    serial_write(fd, &r, 1);
-    if (1 == communication_mode)
+    else
     {
-        serial_read(fd, &r, 1);
+        rl78_delay(s, s->timing.mode_settle);
+        rc = rl78_cmd_baud_rate_set(s, s->baud, s->voltage);
     }
-    usleep(1000);
-    return rl78_cmd_baud_rate_set(fd, baud, voltage);
+    rl78_phase_end(s, LATENCY_PHASE_CONNECT, started, 0);
+    if (0 == rc)
+    {
+        s->handshake = latency_now() - released;
+        rl78_log(&s->log, 1, "Handshake: %u.%03u ms from RESET release to the first ACK\n",
+                 s->handshake / 1000, s->handshake % 1000);
+    }
+    return rc;
+}
+
+int rl78_reset_probe(rl78_session_t *s)
+{
+    unsigned long long started;
+    rl78_enter_bootloader(s, 0, &started);
+    rl78_delay(s, s->timing.mode_settle);
+    const int rc = rl78_cmd_reset(s);
+    rl78_phase_end(s, LATENCY_PHASE_CONNECT, started, 0);
+    return rc;
 }
 
-int rl78_reset(port_handle_t fd, int mode)
+int rl78_reset(rl78_session_t *s)
 {
-    serial_set_txd(fd, 1);                                  /* TOOL0 -> 1 */
-    rl78_set_reset(fd, mode, 0);                            /* RESET -> 0 */
-    usleep(10000);
-    rl78_set_reset(fd, mode, 1);                            /* RESET -> 1 */
+    serial_set_txd(s, 1);                                  /* TOOL0 -> 1 */
+    rl78_set_reset(s, 0);                            /* RESET -> 0 */
+    rl78_sleep(s, 10000);
+    rl78_set_reset(s, 1);                            /* RESET -> 1 */
     return 0;
 }
 
@@ -109,72 +319,52 @@ int checksum(const void *data, int len)
     return sum & 0x00FF;
 }
 
-int rl78_send_cmd(port_handle_t fd, int cmd, const void *data, int len)
+int rl78_frame_cmd(unsigned char *buf, int cmd, const void *data, int len)
 {
     if (255 < len)
     {
         return -1;
     }
-    unsigned char buf[len + 5];
     buf[0] = SOH;
     buf[1] = (len + 1) & 0xFFU;
     buf[2] = cmd;
-    memcpy(&buf[3], data, len);
-    buf[len + 3] = checksum(&buf[1], len + 2);
-    buf[len + 4] = ETX;
-    int ret = serial_write(fd, buf, sizeof buf);
-    // Read back echo
-    if (1 == communication_mode)
+    if (0 < len)
     {
-        serial_read(fd, buf, sizeof buf);
+        memcpy(&buf[3], data, len);
     }
-    return ret;
+    buf[len + 3] = checksum(&buf[1], len + 2);
+    buf[len + 4] = ETX;
+    return len + 5;
 }
 
-int rl78_send_data(port_handle_t fd, const void *data, int len, int last)
+int rl78_frame_data(unsigned char *buf, const void *data, int len, int last)
 {
     if (256 < len)
     {
         return -1;
     }
-    unsigned char buf[len + 4];
     buf[0] = STX;
     buf[1] = len & 0xFFU;
     memcpy(&buf[2], data, len);
     buf[len + 2] = checksum(&buf[1], len + 1);
     buf[len + 3] = last ? ETX : ETB;
-    int ret = serial_write(fd, buf, sizeof buf);
-    // Read back echo
-    if (1 == communication_mode)
-    {
-        serial_read(fd, buf, sizeof buf);
-    }
-    return ret;
+    return len + 4;
 }
 
-int rl78_recv(port_handle_t fd, void *data, int *len, int explen)
+int rl78_frame_header(const unsigned char *frame)
 {
-    unsigned char in[MAX_RESPONSE_LENGTH];
-    int data_len;
-    // receive header
-    serial_read(fd, in, 2);
-    data_len = in[1];
-    if (0 == data_len)
-    {
-        data_len = 256;
-    }
+    const int data_len = (0 == frame[1]) ? 256 : frame[1];
     if ((MAX_RESPONSE_LENGTH - 4) < data_len
-        || STX != in[0])
+        || STX != frame[0])
     {
         return RESPONSE_FORMAT_ERROR;
     }
-    if (explen != data_len)
-    {
-        return RESPONSE_EXPECTED_LENGTH_ERROR;
-    }
-    // receive data field, checksum and footer byte
-    serial_read(fd, in + 2, data_len + 2);
-    switch (in[data_len + 3])
+    return data_len;
+}
+
+int rl78_frame_check(const unsigned char *frame, int data_len, void *data)
+{
+    switch (frame[data_len + 3])
     {
     case ETB:
     case ETX:
@@ -182,53 +372,137 @@ int rl78_recv(port_handle_t fd, void *data, int *len, int explen)
     default:
         return RESPONSE_FORMAT_ERROR;
     }
-    if (checksum(in + 1, data_len + 1) != in[data_len + 2])
+    if (checksum(frame + 1, data_len + 1) != frame[data_len + 2])
     {
         return RESPONSE_CHECKSUM_ERROR;
     }
-    memcpy(data, in + 2, data_len);
-    *len = data_len;
+    memcpy(data, frame + 2, data_len);
     return RESPONSE_OK;
 }
 
-int rl78_cmd_reset(port_handle_t fd)
+int rl78_send_cmd(rl78_session_t *s, int cmd, const void *data, int len)
+{
+    unsigned char buf[len + 5];
+    if (0 > rl78_frame_cmd(buf, cmd, data, len))
+    {
+        return -1;
+    }
+    ++s->stats.commands;
+    if (NULL != s->latency)
+    {
+        latency_start(s->latency, cmd);
+    }
+    const unsigned long long start = rl78_trace_now(s);
+    int ret = serial_write(s, buf, sizeof buf);
+    // Read back echo
+    if (1 == s->communication_mode)
+    {
+        serial_read(s, buf, sizeof buf);
+    }
+    rl78_trace(s, latency_command_name(latency_command(cmd)), TRACE_CAT_COMMAND, start);
+    return ret;
+}
+
+int rl78_send_data(rl78_session_t *s, const void *data, int len, int last)
+{
+    unsigned char buf[len + 4];
+    if (0 > rl78_frame_data(buf, data, len, last))
+    {
+        return -1;
+    }
+    ++s->stats.frames;
+    if (NULL != s->latency)
+    {
+        latency_start(s->latency, -1);
+    }
+    const unsigned long long start = rl78_trace_now(s);
+    int ret = serial_write(s, buf, sizeof buf);
+    // Read back echo
+    if (1 == s->communication_mode)
+    {
+        serial_read(s, buf, sizeof buf);
+    }
+    rl78_trace(s, "data", TRACE_CAT_DATA, start);
+    return ret;
+}
+
+static
+int rl78_recv_frame(rl78_session_t *s, void *data, int *len, int explen)
+{
+    unsigned char in[MAX_RESPONSE_LENGTH];
+    // receive header
+    serial_read(s, in, 2);
+    const int data_len = rl78_frame_header(in);
+    if (0 > data_len)
+    {
+        return data_len;
+    }
+    if (explen != data_len)
+    {
+        return RESPONSE_EXPECTED_LENGTH_ERROR;
+    }
+    // receive data field, checksum and footer byte
+    serial_read(s, in + 2, data_len + 2);
+    const int rc = rl78_frame_check(in, data_len, data);
+    if (RESPONSE_OK == rc)
+    {
+        *len = data_len;
+    }
+    return rc;
+}
+
+int rl78_recv(rl78_session_t *s, void *data, int *len, int explen)
 {
-    if (3 <= verbose_level)
+    const unsigned long long start = rl78_trace_now(s);
+    const int rc = rl78_recv_frame(s, data, len, explen);
+    rl78_trace(s, "response", TRACE_CAT_WAIT, start);
+    if (NULL != s->latency)
+    {
+        latency_stop(s->latency);
+    }
+    if (RESPONSE_OK == rc)
+    {
+        ++s->stats.responses;
+    }
+    else
     {
-        printf("Send \"Reset\" command\n");
+        ++s->stats.errors;
     }
-    rl78_send_cmd(fd, CMD_RESET, NULL, 0);
+    return rc;
+}
+
+int rl78_cmd_reset(rl78_session_t *s)
+{
+    rl78_log(&s->log, 3, "Send \"Reset\" command\n");
+    rl78_send_cmd(s, CMD_RESET, NULL, 0);
     int len = 0;
     unsigned char data[3];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
     else
     {
-        if (3 <= verbose_level)
-        {
-            printf("\tOK\n");
-        }
+        rl78_log(&s->log, 3, "\tOK\n");
     }
     return 0;
 }
 
-int rl78_cmd_baud_rate_set(port_handle_t fd, int baud, float voltage)
+int rl78_cmd_baud_rate_set(rl78_session_t *s, int baud, float voltage)
 {
     unsigned char buf[2];
     int baud_code;
     switch (baud)
     {
     default:
-        fprintf(stderr, "Unsupported baudrate %ubps. Using default baudrate 115200bps.\n", baud);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unsupported baudrate %ubps. Using default baudrate 115200bps.\n", baud);
         baud = 115200;
         // fall through
     case 115200:
@@ -244,64 +518,56 @@ int rl78_cmd_baud_rate_set(port_handle_t fd, int baud, float voltage)
         baud_code = RL78_BAUD_1000000;
         break;
     }
+    s->baud = baud;
     buf[0] = baud_code;
     buf[1] = (int)(voltage * 10);
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Set Baud Rate\" command (baud=%ubps, voltage=%1.1fV)\n", baud, voltage);
-    }
-    rl78_send_cmd(fd, CMD_BAUD_RATE_SET, buf, 2);
+    rl78_log(&s->log, 3, "Send \"Set Baud Rate\" command (baud=%ubps, voltage=%1.1fV)\n", baud, voltage);
+    rl78_send_cmd(s, CMD_BAUD_RATE_SET, buf, 2);
     int len = 0;
     unsigned char data[3];
-    int rc = rl78_recv(fd, &data, &len, 3);
+    int rc = rl78_recv(s, &data, &len, 3);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-        printf("\tFrequency: %u MHz\n", data[1]);
-        printf("\tMode: %s\n", 0 == data[2] ? "full-speed mode" : "wide-voltage mode");
-    }
+    rl78_log(&s->log, 3, "\tOK\n");
+    rl78_log(&s->log, 3, "\tFrequency: %u MHz\n", data[1]);
+    rl78_log(&s->log, 3, "\tMode: %s\n", 0 == data[2] ? "full-speed mode" : "wide-voltage mode");
     /* If no need to change baudrate, just exit */
     if (115200 == baud)
     {
         return 0;
     }
-    return serial_set_baud(fd, baud);
+    return serial_set_baud(s, baud);
 }
 
-int rl78_cmd_silicon_signature(port_handle_t fd, char device_name[11], unsigned int *code_size, unsigned int *data_size)
+int rl78_cmd_silicon_signature(rl78_session_t *s, char device_name[11], unsigned int *code_size, unsigned int *data_size)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Get Silicon Signature\" command\n");
-    }
-    rl78_send_cmd(fd, CMD_SILICON_SIGNATURE, NULL, 0);
+    rl78_log(&s->log, 3, "Send \"Get Silicon Signature\" command\n");
+    rl78_send_cmd(s, CMD_SILICON_SIGNATURE, NULL, 0);
     int len = 0;
     unsigned char data[22];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    rc = rl78_recv(fd, &data, &len, 22);
+    rc = rl78_recv(s, &data, &len, 22);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (NULL != device_name)
@@ -324,75 +590,65 @@ int rl78_cmd_silicon_signature(port_handle_t fd, char device_name[11], unsigned
     {
         *data_size = rom_data_size;
     }
-    if (3 <= verbose_level)
+    rl78_log(&s->log, 3, "\tOK\n");
+    rl78_log(&s->log, 3, "\tDevice code: %02X%02X%02X\n", data[0], data[1], data[2]);
+    rl78_log(&s->log, 3, "\tDevice name: %s\n", device_name);
+    rl78_log(&s->log, 3, "\tCode flash size: %ukB\n", rom_code_size / 1024);
+    if (rom_data_size != 0)
     {
-        printf("\tOK\n");
-        printf("\tDevice code: %02X%02X%02X\n", data[0], data[1], data[2]);
-        printf("\tDevice name: %s\n", device_name);
-        printf("\tCode flash size: %ukB\n", rom_code_size / 1024);
-        if (rom_data_size != 0)
-        {
-            printf("\tData flash size: %ukB\n", rom_data_size / 1024);
-        }
-        else
-        {
-            printf("\tData flash not present\n");
-        }
-        printf("\tFirmware version: %X.%X%X\n", data[19], data[20], data[21]);
+        rl78_log(&s->log, 3, "\tData flash size: %ukB\n", rom_data_size / 1024);
     }
+    else
+    {
+        rl78_log(&s->log, 3, "\tData flash not present\n");
+    }
+    rl78_log(&s->log, 3, "\tFirmware version: %X.%X%X\n", data[19], data[20], data[21]);
     return 0;
 }
 
-int rl78_cmd_block_erase(port_handle_t fd, unsigned int address)
+int rl78_cmd_block_erase(rl78_session_t *s, unsigned int address)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Block Erase\" command (addres=%06X)\n", address);
-    }
-    rl78_send_cmd(fd, CMD_BLOCK_ERASE, &address, 3);
+    rl78_log(&s->log, 3, "Send \"Block Erase\" command (addres=%06X)\n", address);
+    const unsigned long long start = rl78_wear_now(s);
+    rl78_send_cmd(s, CMD_BLOCK_ERASE, &address, 3);
     int len = 0;
     unsigned char data[1];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-    }
+    rl78_wear(s, WEAR_ERASE, address, start);
+    rl78_log(&s->log, 3, "\tOK\n");
     return 0;
 }
 
-int rl78_cmd_block_blank_check(port_handle_t fd, unsigned int address_start, unsigned int address_end)
+int rl78_cmd_block_blank_check(rl78_session_t *s, unsigned int address_start, unsigned int address_end)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Block Blank Check\" command (range=%06X..%06X)\n", address_start, address_end);
-    }
+    rl78_log(&s->log, 3, "Send \"Block Blank Check\" command (range=%06X..%06X)\n", address_start, address_end);
     unsigned char buf[7];
     memcpy(buf + 0, &address_start, 3);
     memcpy(buf + 3, &address_end, 3);
     buf[6] = 0;
-    rl78_send_cmd(fd, CMD_BLOCK_BLANK_CHECK, buf, sizeof buf);
+    rl78_send_cmd(s, CMD_BLOCK_BLANK_CHECK, buf, sizeof buf);
     int len = 0;
     unsigned char data[1];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0]
         && STATUS_IVERIFY_BLANK_ERROR != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
     if (STATUS_ACK == data[0])
@@ -404,74 +660,121 @@ int rl78_cmd_block_blank_check(port_handle_t fd, unsigned int address_start, uns
         rc = 1;
     }
 
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-        if (0 == rc)
-        {
-            printf("\tBlock is empty\n");
-        }
-        else
-        {
-            printf("\tBlock is not empty\n");
-        }
-    }
+    rl78_log(&s->log, 3, "\tOK\n");
+    rl78_log(&s->log, 3, (0 == rc) ? "\tBlock is empty\n" : "\tBlock is not empty\n");
     return rc;
 }
 
-int rl78_cmd_checksum(port_handle_t fd, unsigned int address_start, unsigned int address_end)
+int rl78_cmd_checksum(rl78_session_t *s, unsigned int address_start, unsigned int address_end)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Checksum\" command (range=%06X..%06X)\n", address_start, address_end);
-    }
+    rl78_log(&s->log, 3, "Send \"Checksum\" command (range=%06X..%06X)\n", address_start, address_end);
     unsigned char buf[6];
     memcpy(buf + 0, &address_start, 3);
     memcpy(buf + 3, &address_end, 3);
-    rl78_send_cmd(fd, CMD_CHECKSUM, buf, sizeof buf);
+    rl78_send_cmd(s, CMD_CHECKSUM, buf, sizeof buf);
     int len = 0;
     unsigned char data[2];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    rc = rl78_recv(fd, &data, &len, 2);
-    if (3 <= verbose_level)
+    rc = rl78_recv(s, &data, &len, 2);
+    rl78_log(&s->log, 3, "\tOK\n");
+    rl78_log(&s->log, 3, "\tValue: %02X%02X\n", data[1], data[0]);
+    return rc;
+}
+
+int rl78_cmd_security_get(rl78_session_t *s, unsigned char security[SECURITY_DATA_LENGTH])
+{
+    rl78_log(&s->log, 3, "Send \"Security Get\" command\n");
+    rl78_send_cmd(s, CMD_SECURITY_GET, NULL, 0);
+    int len = 0;
+    unsigned char data[SECURITY_DATA_LENGTH];
+    int rc = rl78_recv(s, &data, &len, 1);
+    if (RESPONSE_OK != rc)
     {
-        printf("\tOK\n");
-        printf("\tValue: %02X%02X\n", data[1], data[0]);
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
+        return rc;
     }
-    return rc;
+    if (STATUS_ACK != data[0])
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
+        return data[0];
+    }
+    rc = rl78_recv(s, security, &len, SECURITY_DATA_LENGTH);
+    if (RESPONSE_OK != rc)
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
+        return rc;
+    }
+    rl78_log(&s->log, 3, "\tOK\n");
+    rl78_log(&s->log, 3, "\tFLG: %02X, BOT: %02X, FSWS: %02X%02X, FSWE: %02X%02X\n",
+             security[0], security[1], security[3], security[2], security[5], security[4]);
+    return 0;
 }
 
-int rl78_cmd_programming(port_handle_t fd, unsigned int address_start, unsigned int address_end, const void *rom)
+int rl78_cmd_security_set(rl78_session_t *s, const unsigned char security[SECURITY_DATA_LENGTH])
 {
-    if (3 <= verbose_level)
+    rl78_log(&s->log, 3, "Send \"Security Set\" command\n");
+    rl78_send_cmd(s, CMD_SECURITY_SET, NULL, 0);
+    int len = 0;
+    unsigned char data[1];
+    int rc = rl78_recv(s, &data, &len, 1);
+    if (RESPONSE_OK != rc)
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
+        return rc;
+    }
+    if (STATUS_ACK != data[0])
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
+        return data[0];
+    }
+    rl78_send_data(s, security, SECURITY_DATA_LENGTH, 1);
+    // The status is sent after the extra area has been written
+    const unsigned int read_timeout = s->read_timeout;
+    s->read_timeout = SECURITY_SET_TIMEOUT;
+    rc = rl78_recv(s, &data, &len, 1);
+    s->read_timeout = read_timeout;
+    if (RESPONSE_OK != rc)
     {
-        printf("Send \"Programming\" command (range=%06X..%06X)\n", address_start, address_end);
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
+        return rc;
     }
+    if (STATUS_ACK != data[0])
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
+        return data[0];
+    }
+    rl78_log(&s->log, 3, "\tOK\n");
+    return 0;
+}
+
+int rl78_cmd_programming(rl78_session_t *s, unsigned int address_start, unsigned int address_end, const void *rom)
+{
+    rl78_log(&s->log, 3, "Send \"Programming\" command (range=%06X..%06X)\n", address_start, address_end);
     unsigned char buf[6];
     memcpy(buf + 0, &address_start, 3);
     memcpy(buf + 3, &address_end, 3);
-    rl78_send_cmd(fd, CMD_PROGRAMMING, buf, sizeof buf);
+    rl78_send_cmd(s, CMD_PROGRAMMING, buf, sizeof buf);
     int len = 0;
     unsigned char data[2];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
     unsigned int rom_length = address_end - address_start + 1;
@@ -481,14 +784,11 @@ int rl78_cmd_programming(port_handle_t fd, unsigned int address_start, unsigned
     // Send data
     while (rom_length)
     {
-        if (3 <= verbose_level)
-        {
-            printf("\tSend data to address %06X\n", address_current);
-        }
+        rl78_log(&s->log, 3, "\tSend data to address %06X\n", address_current);
         if (256 < rom_length)
         {
             // Not last data frame
-            rl78_send_data(fd, rom_p, 256, 0);
+            rl78_send_data(s, rom_p, 256, 0);
             address_current += 256;
             rom_p += 256;
             rom_length -= 256;
@@ -496,81 +796,71 @@ int rl78_cmd_programming(port_handle_t fd, unsigned int address_start, unsigned
         else
         {
             // Last data frame
-            rl78_send_data(fd, rom_p, rom_length, 1);
+            rl78_send_data(s, rom_p, rom_length, 1);
             address_current += rom_length;
             rom_p += rom_length;
             rom_length -= rom_length;
         }
-        rc = rl78_recv(fd, &data, &len, 2);
+        rc = rl78_recv(s, &data, &len, 2);
         if (RESPONSE_OK != rc)
         {
-            fprintf(stderr, "FAILED\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
             return rc;
         }
         if (STATUS_ACK != data[0])
         {
-            fprintf(stderr, "ACK not received\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
             return data[0];
         }
         if (STATUS_ACK != data[1])
         {
-            fprintf(stderr, "Data not written\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "Data not written\n");
             return data[1];
         }
     }
-    usleep(final_delay);
-    // Receive status of completion
-    rc = rl78_recv(fd, &data, &len, 1);
+    rl78_sleep(s, final_delay);
+    // Receive status of completion, timing how long the device is busy with
+    // the block past the fixed delay
+    const unsigned long long start = rl78_wear_now(s);
+    rc = rl78_recv(s, &data, &len, 1);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
         }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-    }
+    rl78_wear(s, WEAR_PROGRAM, address_start, start);
+    rl78_log(&s->log, 3, "\tOK\n");
     return rc;
 }
 
 unsigned int rl78_checksum(const void *rom, unsigned int len)
 {
-    unsigned int sum = 0;
-    unsigned char *p = (unsigned char*)rom;
-    unsigned int i = len;
-    for (; i; --i)
-    {
-        sum -= *p++;
-    }
-    return sum & 0x0000FFFFU;
+    return block_checksum(rom, len);
 }
 
-int rl78_cmd_verify(port_handle_t fd, unsigned int address_start, unsigned int address_end, const void *rom)
+int rl78_cmd_verify(rl78_session_t *s, unsigned int address_start, unsigned int address_end, const void *rom)
 {
-    if (3 <= verbose_level)
-    {
-        printf("Send \"Verify\" command (range=%06X..%06X)\n", address_start, address_end);
-    }
+    rl78_log(&s->log, 3, "Send \"Verify\" command (range=%06X..%06X)\n", address_start, address_end);
     unsigned char buf[6];
     memcpy(buf + 0, &address_start, 3);
     memcpy(buf + 3, &address_end, 3);
-    rl78_send_cmd(fd, CMD_VERIFY, buf, sizeof buf);
+    rl78_send_cmd(s, CMD_VERIFY, buf, sizeof buf);
     int len = 0;
     unsigned char data[2];
-    int rc = rl78_recv(fd, &data, &len, 1);
+    int rc = rl78_recv(s, &data, &len, 1);
     if (RESPONSE_OK != rc)
     {
-        fprintf(stderr, "FAILED\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
         return rc;
     }
     if (STATUS_ACK != data[0])
     {
-        fprintf(stderr, "ACK not received\n");
+        rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
         return data[0];
     }
     unsigned int rom_length = address_end - address_start + 1;
@@ -579,14 +869,11 @@ int rl78_cmd_verify(port_handle_t fd, unsigned int address_start, unsigned int a
     // Send data
     while (rom_length)
     {
-        if (3 <= verbose_level)
-        {
-            printf("\tSend data to address %06X\n", address_current);
-        }
+        rl78_log(&s->log, 3, "\tSend data to address %06X\n", address_current);
         if (256 < rom_length)
         {
             // Not last data frame
-            rl78_send_data(fd, rom_p, 256, 0);
+            rl78_send_data(s, rom_p, 256, 0);
             address_current += 256;
             rom_p += 256;
             rom_length -= 256;
@@ -594,212 +881,194 @@ int rl78_cmd_verify(port_handle_t fd, unsigned int address_start, unsigned int a
         else
         {
             // Last data frame
-            rl78_send_data(fd, rom_p, rom_length, 1);
+            rl78_send_data(s, rom_p, rom_length, 1);
             address_current += rom_length;
             rom_p += rom_length;
             rom_length -= rom_length;
         }
-        usleep(10000);
-        rc = rl78_recv(fd, &data, &len, 2);
+        rl78_sleep(s, 10000);
+        rc = rl78_recv(s, &data, &len, 2);
         if (RESPONSE_OK != rc)
         {
-            fprintf(stderr, "FAILED\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "FAILED\n");
             return rc;
         }
         if (STATUS_ACK != data[0])
         {
-            fprintf(stderr, "ACK not received\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "ACK not received\n");
             return data[0];
         }
         if (STATUS_ACK != data[1])
         {
-            fprintf(stderr, "Verify failed\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "Verify failed\n");
             return data[1];
         }
     }
-    if (3 <= verbose_level)
-    {
-        printf("\tOK\n");
-    }
+    rl78_log(&s->log, 3, "\tOK\n");
     return rc;
 }
 
 static
-int allFFs(const void *mem, unsigned int size)
+int allFFs(const void *mem, const block_info_t *block)
 {
-    unsigned char *p = (unsigned char*)mem;
-    unsigned int i = size;
-    for (; i; --i)
+    if (NULL != block)
     {
-        if (0xFF != *p++)
-        {
-            return 0;
-        }
+        return block->blank;
     }
-    return 1;
+    return block_is_blank(mem, FLASH_BLOCK_SIZE);
 }
 
-int rl78_program(port_handle_t fd, unsigned int address, const void *data, unsigned int size)
+int rl78_program(rl78_session_t *s, unsigned int address, const void *data, unsigned int size,
+                 const block_info_t *blocks)
 {
     // Make sure size is aligned to flash block boundary
     unsigned int i = size & ~(FLASH_BLOCK_SIZE - 1);
     const unsigned char *mem = (const unsigned char*)data;
+    const unsigned int total = i / FLASH_BLOCK_SIZE;
     int rc = 0;;
+    const unsigned long long started = rl78_phase_begin(s, LATENCY_PHASE_PROGRAM);
+    rl78_events_begin(s, LATENCY_PHASE_PROGRAM, address, total);
     for (; i; i -= FLASH_BLOCK_SIZE)
     {
-        if (!allFFs(mem, FLASH_BLOCK_SIZE))
+        if (!allFFs(mem, blocks))
         {
-            if (3 <= verbose_level)
-            {
-                printf("Program block %06X\n", address);
-            }
+            rl78_log(&s->log, 3, "Program block %06X\n", address);
             // Check if block is ready to program new content
-            rc = rl78_cmd_block_blank_check(fd, address, address + FLASH_BLOCK_SIZE - 1);
+            rc = rl78_cmd_block_blank_check(s, address, address + FLASH_BLOCK_SIZE - 1);
             if (0 > rc)
             {
-                fprintf(stderr, "Block Blank Check failed (%06X)\n", address);
+                rl78_log(&s->log, RL78_LOG_ERROR, "Block Blank Check failed (%06X)\n", address);
                 break;
             }
             if (0 < rc)
             {
                 // If block is not empty - erase it
-                rc = rl78_cmd_block_erase(fd, address);
+                rc = rl78_cmd_block_erase(s, address);
                 if (0 > rc)
                 {
-                    fprintf(stderr, "Block Erase failed (%06X)\n", address);
+                    rl78_log(&s->log, RL78_LOG_ERROR, "Block Erase failed (%06X)\n", address);
                     break;
                 }
             }
             // Write new content
-            rc = rl78_cmd_programming(fd, address, address + FLASH_BLOCK_SIZE - 1, mem);
+            rc = rl78_cmd_programming(s, address, address + FLASH_BLOCK_SIZE - 1, mem);
             if (0 > rc)
             {
-                fprintf(stderr, "Programming failed (%06X)\n", address);
+                rl78_log(&s->log, RL78_LOG_ERROR, "Programming failed (%06X)\n", address);
                 break;
             }
-            if (2 == verbose_level)
-            {
-                printf("*");
-                fflush(stdout);
-            }
+            rl78_progress(s, "*");
         }
         else
         {
-            if (3 <= verbose_level)
-            {
-                printf("No data at block %06X\n", address);
-            }
+            rl78_log(&s->log, 3, "No data at block %06X\n", address);
         }
+        rl78_events_block(s, RL78_PROGRESS_PROGRAM, address, total - i / FLASH_BLOCK_SIZE + 1, total);
         mem += FLASH_BLOCK_SIZE;
         address += FLASH_BLOCK_SIZE;
+        if (NULL != blocks)
+        {
+            ++blocks;
+        }
     }
-    if (2 == verbose_level)
-    {
-        printf("\n");
-    }
+    rl78_phase_end(s, LATENCY_PHASE_PROGRAM, started, (unsigned long long)(total - i / FLASH_BLOCK_SIZE) * FLASH_BLOCK_SIZE);
+    rl78_events_end(s, total - i / FLASH_BLOCK_SIZE);
+    rl78_progress(s, "\n");
     return rc;
 }
 
-int rl78_erase(port_handle_t fd, unsigned int start_address, unsigned int size)
+int rl78_erase(rl78_session_t *s, unsigned int start_address, unsigned int size)
 {
     // Make sure size is aligned to flash block boundary
     unsigned int i = size & ~(FLASH_BLOCK_SIZE - 1);
     unsigned int address = start_address;
+    const unsigned int total = i / FLASH_BLOCK_SIZE;
     int rc = 0;
+    const unsigned long long started = rl78_phase_begin(s, LATENCY_PHASE_ERASE);
+    rl78_events_begin(s, LATENCY_PHASE_ERASE, start_address, total);
     for (; i; i -= FLASH_BLOCK_SIZE)
     {
-        rc = rl78_cmd_block_blank_check(fd, address, address + FLASH_BLOCK_SIZE - 1);
+        rc = rl78_cmd_block_blank_check(s, address, address + FLASH_BLOCK_SIZE - 1);
         if (0 > rc)
         {
-            fprintf(stderr, "Block Blank Check failed (%06X)\n", address);
+            rl78_log(&s->log, RL78_LOG_ERROR, "Block Blank Check failed (%06X)\n", address);
             break;
         }
         if (0 < rc)
         {
             // If block is not empty
-            rc = rl78_cmd_block_erase(fd, address);
+            rc = rl78_cmd_block_erase(s, address);
             if (0 > rc)
             {
-                fprintf(stderr, "Block Erase failed (%06X)\n", address);
+                rl78_log(&s->log, RL78_LOG_ERROR, "Block Erase failed (%06X)\n", address);
                 break;
             }
-            if (2 == verbose_level)
-            {
-                printf("*");
-                fflush(stdout);
-            }
+            rl78_progress(s, "*");
         }
         else
         {
             // if block is already empty
-            if (2 == verbose_level)
-            {
-                printf(".");
-                fflush(stdout);
-            }
+            rl78_progress(s, ".");
         }
+        rl78_events_block(s, RL78_PROGRESS_ERASE, address, total - i / FLASH_BLOCK_SIZE + 1, total);
         address += FLASH_BLOCK_SIZE;
     }
-    if (2 == verbose_level)
-    {
-        printf("\n");
-    }
+    rl78_phase_end(s, LATENCY_PHASE_ERASE, started, (unsigned long long)(total - i / FLASH_BLOCK_SIZE) * FLASH_BLOCK_SIZE);
+    rl78_events_end(s, total - i / FLASH_BLOCK_SIZE);
+    rl78_progress(s, "\n");
     return rc;
 }
 
-int rl78_verify(port_handle_t fd, unsigned int address, const void *data, unsigned int size)
+int rl78_verify(rl78_session_t *s, unsigned int address, const void *data, unsigned int size,
+                const block_info_t *blocks)
 {
     // Make sure size is aligned to flash block boundary
     unsigned int i = size & ~(FLASH_BLOCK_SIZE - 1);
     const unsigned char *mem = (const unsigned char*)data;
+    const unsigned int total = i / FLASH_BLOCK_SIZE;
     int rc = 0;
+    const unsigned long long started = rl78_phase_begin(s, LATENCY_PHASE_VERIFY);
+    rl78_events_begin(s, LATENCY_PHASE_VERIFY, address, total);
     for (; i; i -= FLASH_BLOCK_SIZE)
     {
-        if (3 <= verbose_level)
-        {
-            printf("Verify block %06X\n", address);
-        }
-        if (allFFs(mem, FLASH_BLOCK_SIZE))
+        rl78_log(&s->log, 3, "Verify block %06X\n", address);
+        if (allFFs(mem, blocks))
         {
             // Check if block is blank
-            rc = rl78_cmd_block_blank_check(fd, address, address + FLASH_BLOCK_SIZE - 1);
+            rc = rl78_cmd_block_blank_check(s, address, address + FLASH_BLOCK_SIZE - 1);
             if (0 > rc)
             {
-                fprintf(stderr, "Block Blank Check failed (%06X)\n", address);
+                rl78_log(&s->log, RL78_LOG_ERROR, "Block Blank Check failed (%06X)\n", address);
                 break;
             }
             if (0 < rc)
             {
-                fprintf(stderr, "Block content does not match (%06X)\n", address);
+                rl78_log(&s->log, RL78_LOG_ERROR, "Block content does not match (%06X)\n", address);
                 break;
             }
-            if (2 == verbose_level)
-            {
-                printf(".");
-                fflush(stdout);
-            }
+            rl78_progress(s, ".");
         }
         else
         {
             // If block is not blank
-            rc = rl78_cmd_verify(fd, address, address + FLASH_BLOCK_SIZE - 1, mem);
+            rc = rl78_cmd_verify(s, address, address + FLASH_BLOCK_SIZE - 1, mem);
             if (0 != rc)
             {
-                fprintf(stderr, "Block content does not match (%06X)\n", address);
+                rl78_log(&s->log, RL78_LOG_ERROR, "Block content does not match (%06X)\n", address);
                 break;
             }
-            if (2 == verbose_level)
-            {
-                printf("*");
-                fflush(stdout);
-            }
+            rl78_progress(s, "*");
         }
+        rl78_events_block(s, RL78_PROGRESS_VERIFY, address, total - i / FLASH_BLOCK_SIZE + 1, total);
         mem += FLASH_BLOCK_SIZE;
         address += FLASH_BLOCK_SIZE;
+        if (NULL != blocks)
+        {
+            ++blocks;
+        }
     }
-    if (2 == verbose_level)
-    {
-        printf("\n");
-    }
+    rl78_phase_end(s, LATENCY_PHASE_VERIFY, started, (unsigned long long)(total - i / FLASH_BLOCK_SIZE) * FLASH_BLOCK_SIZE);
+    rl78_events_end(s, total - i / FLASH_BLOCK_SIZE);
+    rl78_progress(s, "\n");
     return rc;
 }
@@ -63,6 +63,7 @@
 #define RESPONSE_CHECKSUM_ERROR         (-1)
 #define RESPONSE_FORMAT_ERROR           (-2)
 #define RESPONSE_EXPECTED_LENGTH_ERROR  (-3)
+#define RESPONSE_TIMEOUT_ERROR          (-4)
 
 #define SET_MODE_1WIRE_UART 0x3A
 #define SET_MODE_2WIRE_UART 0x00
@@ -81,23 +82,48 @@
 #define MODE_INVERT_RESET 0x80
 
 #include "serial.h"
+#include "session.h"
+#include "block.h"
 
-int rl78_reset_init(port_handle_t fd, int wait, int baud, int mode, float voltage);
-int rl78_reset(port_handle_t fd, int mode);
-int rl78_send_cmd(port_handle_t fd, int cmd, const void *data, int len);
-int rl78_send_data(port_handle_t fd, const void *data, int len, int last);
-int rl78_recv(port_handle_t fd, void *data, int *len, int explen);
-int rl78_cmd_reset(port_handle_t fd);
-int rl78_cmd_baud_rate_set(port_handle_t fd, int baud, float voltage);
-int rl78_cmd_silicon_signature(port_handle_t fd, char device_name[11], unsigned int *code_size, unsigned int *data_size);
-int rl78_cmd_block_erase(port_handle_t fd, unsigned int address);
-int rl78_cmd_block_blank_check(port_handle_t fd, unsigned int address_start, unsigned int address_end);
-int rl78_cmd_checksum(port_handle_t fd, unsigned int address_start, unsigned int address_end);
-int rl78_cmd_programming(port_handle_t fd, unsigned int address_start, unsigned int address_end, const void *rom);
+/* Mode, baudrate and voltage are taken from the session */
+int rl78_reset_init(rl78_session_t *s, int wait);
+/* Enter the bootloader at 115200bps and check that it acknowledges a "Reset"
+ * command, so a wrong mode fails within one read timeout */
+int rl78_reset_probe(rl78_session_t *s);
+int rl78_reset(rl78_session_t *s);
+/* Frames shared by the blocking and the non-blocking engine (fsm.c). The
+ * builders return the length of the frame put in buf, -1 if len is too long;
+ * buf must hold len + 5 bytes. */
+int rl78_frame_cmd(unsigned char *buf, int cmd, const void *data, int len);
+int rl78_frame_data(unsigned char *buf, const void *data, int len, int last);
+/* Length of the data field announced by the STX and length bytes of a
+ * response, RESPONSE_FORMAT_ERROR if they are malformed */
+int rl78_frame_header(const unsigned char *frame);
+/* Check the footer and checksum of a whole response with a data field of
+ * data_len bytes and copy the data field */
+int rl78_frame_check(const unsigned char *frame, int data_len, void *data);
+
+int rl78_send_cmd(rl78_session_t *s, int cmd, const void *data, int len);
+int rl78_send_data(rl78_session_t *s, const void *data, int len, int last);
+int rl78_recv(rl78_session_t *s, void *data, int *len, int explen);
+int rl78_cmd_reset(rl78_session_t *s);
+int rl78_cmd_baud_rate_set(rl78_session_t *s, int baud, float voltage);
+int rl78_cmd_silicon_signature(rl78_session_t *s, char device_name[11], unsigned int *code_size, unsigned int *data_size);
+int rl78_cmd_block_erase(rl78_session_t *s, unsigned int address);
+int rl78_cmd_block_blank_check(rl78_session_t *s, unsigned int address_start, unsigned int address_end);
+int rl78_cmd_checksum(rl78_session_t *s, unsigned int address_start, unsigned int address_end);
+/* Security data: FLG, BOT, FSWS (2 bytes), FSWE (2 bytes) and 2 reserved bytes */
+#define SECURITY_DATA_LENGTH    8
+#define SECURITY_SET_TIMEOUT    1000    /* ms to write the security data */
+int rl78_cmd_security_get(rl78_session_t *s, unsigned char security[SECURITY_DATA_LENGTH]);
+int rl78_cmd_security_set(rl78_session_t *s, const unsigned char security[SECURITY_DATA_LENGTH]);
+int rl78_cmd_programming(rl78_session_t *s, unsigned int address_start, unsigned int address_end, const void *rom);
 unsigned int rl78_checksum(const void *rom, unsigned int len);
-int rl78_cmd_verify(port_handle_t fd, unsigned int address_start, unsigned int address_end, const void *rom);
-int rl78_program(port_handle_t fd, unsigned int address, const void *data, unsigned int size);
-int rl78_erase(port_handle_t fd, unsigned int start_address, unsigned int size);
-int rl78_verify(port_handle_t fd, unsigned int address, const void *data, unsigned int size);
+int rl78_cmd_verify(rl78_session_t *s, unsigned int address_start, unsigned int address_end, const void *rom);
+int rl78_program(rl78_session_t *s, unsigned int address, const void *data, unsigned int size,
+                 const block_info_t *blocks);
+int rl78_erase(rl78_session_t *s, unsigned int start_address, unsigned int size);
+int rl78_verify(rl78_session_t *s, unsigned int address, const void *data, unsigned int size,
+                const block_info_t *blocks);
 
 #endif  // RL78_H__
@@ -0,0 +1,140 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef RL78FLASH_H__
+#define RL78FLASH_H__
+
+/* Public API of librl78flash.
+ *
+ * Only this header is installed. Sessions and images are opaque, so their
+ * layout may change without breaking callers. Structures defined here and
+ * the meaning of existing calls only change together with
+ * RL78FLASH_API_VERSION, which is also the major version of the shared
+ * library (librl78flash.so.1).
+ *
+ * Every call returns RL78FLASH_OK or one of the negative RL78FLASH_E*
+ * codes. Messages go to the log callback of the session, progress of the
+ * erase, program and verify loops to its progress callback. No call prints
+ * to stdout or stderr unless the log callback is left NULL. A session must
+ * only be used by one thread at a time; different sessions are
+ * independent. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RL78FLASH_API_VERSION   1
+
+/* The shared library is built with hidden visibility; only these calls are exported */
+#if defined(__GNUC__)
+#define RL78FLASH_API __attribute__((visibility("default")))
+#else
+#define RL78FLASH_API
+#endif
+
+#define RL78FLASH_OK            0
+#define RL78FLASH_EINVAL        (-1)    /* invalid argument */
+#define RL78FLASH_ENOMEM        (-2)
+#define RL78FLASH_EPORT         (-3)    /* unable to open the port */
+#define RL78FLASH_ECONNECT      (-4)    /* no answer from the bootloader */
+#define RL78FLASH_ESTATE        (-5)    /* the session is not connected */
+#define RL78FLASH_EFILE         (-6)    /* unable to read or parse an image file */
+#define RL78FLASH_EFIT          (-7)    /* the image does not fit the device */
+#define RL78FLASH_EERASE        (-8)
+#define RL78FLASH_EPROGRAM      (-9)
+#define RL78FLASH_EVERIFY       (-10)
+
+/* Flash areas */
+#define RL78FLASH_CODE          1
+#define RL78FLASH_DATA          2
+#define RL78FLASH_ALL           (RL78FLASH_CODE | RL78FLASH_DATA)
+
+/* Operations reported to the progress callback */
+#define RL78FLASH_ERASE         0
+#define RL78FLASH_PROGRAM       1
+#define RL78FLASH_VERIFY        2
+
+/* Log levels: 0 - errors, 1..4 - the same as -v..-vvvv of rl78flash,
+ * -1 - requested output (device information) */
+typedef void (*rl78flash_log_func_t)(void *ctx, int level, const char *message);
+/* Called after each flash block; blocks are counted from 1 to total */
+typedef void (*rl78flash_progress_func_t)(void *ctx, int operation, unsigned int address,
+                                          unsigned int done, unsigned int total);
+
+typedef struct
+{
+    int mode;                   /* 1..4, the same as -m of rl78flash */
+    int invert_reset;
+    int baud;                   /* 115200, 250000, 500000 or 1000000 */
+    float voltage;              /* supply voltage of the target */
+    int log_level;              /* messages above this level are dropped */
+    rl78flash_log_func_t log;   /* NULL: stdout, errors to stderr */
+    rl78flash_progress_func_t progress;
+    void *ctx;                  /* passed to both callbacks */
+} rl78flash_config_t;
+
+typedef struct
+{
+    char name[11];
+    unsigned int code_size;     /* bytes */
+    unsigned int data_size;     /* bytes */
+} rl78flash_device_t;
+
+/* What rl78flash_program() would do with an image on the connected device */
+typedef struct
+{
+    unsigned int code_blocks;   /* blocks of code flash */
+    unsigned int code_used;     /* of them holding data of the image */
+    unsigned int data_blocks;
+    unsigned int data_used;
+} rl78flash_plan_t;
+
+typedef struct rl78flash_session rl78flash_session_t;
+typedef struct rl78flash_image rl78flash_image_t;
+
+RL78FLASH_API int rl78flash_api_version(void);
+RL78FLASH_API const char *rl78flash_strerror(int rc);
+RL78FLASH_API void rl78flash_config_init(rl78flash_config_t *config);
+
+RL78FLASH_API int rl78flash_open(rl78flash_session_t **session, const char *port, const rl78flash_config_t *config);
+RL78FLASH_API void rl78flash_close(rl78flash_session_t *session);
+/* Reset the target into the bootloader, set up the link and read the
+ * silicon signature. device may be NULL. */
+RL78FLASH_API int rl78flash_connect(rl78flash_session_t *session, rl78flash_device_t *device);
+/* Leave the bootloader and start the application */
+RL78FLASH_API int rl78flash_reset(rl78flash_session_t *session);
+
+/* Merge S-record files into one image. config may be NULL; only its log
+ * settings are used. */
+RL78FLASH_API int rl78flash_image_load(rl78flash_image_t **image, const char *const *filenames, unsigned int nfiles,
+                                       const rl78flash_config_t *config);
+RL78FLASH_API void rl78flash_image_free(rl78flash_image_t *image);
+
+RL78FLASH_API int rl78flash_plan(rl78flash_session_t *session, const rl78flash_image_t *image, int areas,
+                                 rl78flash_plan_t *plan);
+RL78FLASH_API int rl78flash_erase(rl78flash_session_t *session, int areas);
+RL78FLASH_API int rl78flash_program(rl78flash_session_t *session, const rl78flash_image_t *image, int areas);
+RL78FLASH_API int rl78flash_verify(rl78flash_session_t *session, const rl78flash_image_t *image, int areas);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RL78FLASH_H__
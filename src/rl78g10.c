@@ -19,14 +19,13 @@
 
 #include "serial.h"
 #include "rl78g10.h"
+#include "session.h"
 #include "crc16_ccit.h"
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include "wait_kbhit.h"
 
-extern int verbose_level;
-
 static int get_size_from_code (unsigned int code)
 {
     int size;
@@ -45,98 +44,89 @@ static int get_size_from_code (unsigned int code)
     return size;
 }
 
-static void rl78g10_set_reset(port_handle_t fd, int mode, int value)
+static void rl78g10_set_reset(rl78_session_t *s, int value)
 {
-    int level = (mode & MODE_INVERT_RESET) ? !value : value;
-    if (MODE_RESET_RTS == (mode & MODE_RESET))
+    int level = (s->mode & MODE_INVERT_RESET) ? !value : value;
+    if (MODE_RESET_RTS == (s->mode & MODE_RESET))
     {
-        serial_set_rts(fd, level);
+        serial_set_rts(s, level);
     }
     else
     {
-        serial_set_dtr(fd, level);
+        serial_set_dtr(s, level);
     }
 }
 
-int rl78g10_reset_init(port_handle_t fd, int wait, int mode)
+int rl78g10_reset_init(rl78_session_t *s, int wait)
 {
     unsigned char buf[2];
-    rl78g10_set_reset(fd, mode, 0);                         /* RESET -> 0 */
-    serial_set_txd(fd, 0);                                  /* TOOL0 -> 0 */
+    rl78g10_set_reset(s, 0);                         /* RESET -> 0 */
+    serial_set_txd(s, 0);                                  /* TOOL0 -> 0 */
     if (wait)
     {
-        printf("Turn MCU's power on and press any key...");
+        rl78_log(&s->log, RL78_LOG_OUTPUT, "Turn MCU's power on and press any key...");
         wait_kbhit();
-        printf("\n");
+        rl78_log(&s->log, RL78_LOG_OUTPUT, "\n");
     }
-    serial_flush(fd);
+    serial_flush(s);
     usleep(1000);
-    rl78g10_set_reset(fd, mode, 1);                         /* RESET -> 1 */
+    rl78g10_set_reset(s, 1);                         /* RESET -> 1 */
     usleep(2000);
-    serial_set_txd(fd, 1);                                  /* TOOL0 -> 1 */
+    serial_set_txd(s, 1);                                  /* TOOL0 -> 1 */
     usleep(1000);
-    serial_flush(fd);
-    if (3 <= verbose_level)
-    {
-        printf("Send 1-byte data for setting mode\n");
-    }
+    serial_flush(s);
+    rl78_log(&s->log, 3, "Send 1-byte data for setting mode\n");
     buf[0] = CMD_MODE_SET;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 2);
+    serial_write(s, buf, 1);
+    serial_read(s, buf, 2);
     if (buf[1] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
     return 0;
 }
 
-int rl78_reset(port_handle_t fd, int mode)
+int rl78_reset(rl78_session_t *s)
 {
-    serial_set_txd(fd, 1);                                  /* TOOL0 -> 1 */
-    rl78g10_set_reset(fd, mode, 0);                         /* RESET -> 0 */
+    serial_set_txd(s, 1);                                  /* TOOL0 -> 1 */
+    rl78g10_set_reset(s, 0);                         /* RESET -> 0 */
     usleep(10000);
-    rl78g10_set_reset(fd, mode, 1);                         /* RESET -> 1 */
+    rl78g10_set_reset(s, 1);                         /* RESET -> 1 */
     return 0;
 }
 
-int rl78g10_erase_write(port_handle_t fd, const void *data, int size)
+int rl78g10_erase_write(rl78_session_t *s, const void *data, int size)
 {
     unsigned char buf[5];
-    if (3 <= verbose_level)
-    {
-        printf("Send command byte\n");
-    }
+    rl78_log(&s->log, 3, "Send command byte\n");
     buf[0] = CMD_ERASE_WRITE;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 3);
+    serial_write(s, buf, 1);
+    serial_read(s, buf, 3);
     if (buf[1] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
     if (get_size_from_code(buf[2]) != size)
     {
-        fprintf(stderr, "Unexpected flash size %i, expected %i\n",
-                get_size_from_code(buf[2]), size);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected flash size %i, expected %i\n",
+                 get_size_from_code(buf[2]), size);
         buf[0] = STATUS_NACK;
-        serial_write(fd, buf, 1);
-        serial_read(fd, buf, 1);
+        serial_write(s, buf, 1);
+        serial_read(s, buf, 1);
         return -1;
     }
-    if (3 <= verbose_level)
-    {
-        printf("Acknowledge erasing\n");
-    }
+    rl78_log(&s->log, 3, "Acknowledge erasing\n");
     buf[0] = STATUS_ACK;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 1);
+    serial_write(s, buf, 1);
+    serial_read(s, buf, 1);
     /* Wait till end of erase cycle */
     int i = 100;
     int n;
     do
     {
-        n = serial_read(fd, buf, 1);
+        n = serial_read(s, buf, 1);
         --i;
     }
     while (n == 0 && i != 0);
@@ -148,69 +138,57 @@ int rl78g10_erase_write(port_handle_t fd, const void *data, int size)
     }
     if (buf[0] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
-    if (3 <= verbose_level)
-    {
-        printf("Write data\n");
-    }
+    rl78_log(&s->log, 3, "Write data\n");
     const unsigned char *pdata = (const unsigned char*)data;
     for (i = size; i; pdata += 4, i -= 4)
     {
         memcpy(buf, pdata, 4);
-        serial_write(fd, buf, 4);
-        serial_read(fd, buf, 5);
+        serial_write(s, buf, 4);
+        serial_read(s, buf, 5);
         if (buf[4] != STATUS_ACK)
         {
-            fprintf(stderr, "Unexpected response %02X\n", buf[4]);
+            rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected response %02X\n", buf[4]);
             return -2;
         }
     }
-    if (3 <= verbose_level)
-    {
-        printf("Read verification status\n");
-    }
-    serial_read(fd, buf, 1);
+    rl78_log(&s->log, 3, "Read verification status\n");
+    serial_read(s, buf, 1);
     if (buf[0] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
     return 0;
 }
 
-int rl78g10_crc_check(port_handle_t fd, const void *data, int size)
+int rl78g10_crc_check(rl78_session_t *s, const void *data, int size)
 {
     unsigned char buf[5];
-    if (3 <= verbose_level)
-    {
-        printf("Send command byte\n");
-    }
+    rl78_log(&s->log, 3, "Send command byte\n");
     buf[0] = CMD_CRC_CHECK;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 3);
+    serial_write(s, buf, 1);
+    serial_read(s, buf, 3);
     if (buf[1] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
     if (get_size_from_code(buf[2]) != size)
     {
-        fprintf(stderr, "Unexpected flash size %i, expected %i\n",
-                get_size_from_code(buf[2]), size);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected flash size %i, expected %i\n",
+                 get_size_from_code(buf[2]), size);
         buf[0] = STATUS_NACK;
-        serial_write(fd, buf, 1);
-        serial_read(fd, buf, 1);
+        serial_write(s, buf, 1);
+        serial_read(s, buf, 1);
         return -1;
     }
-    if (3 <= verbose_level)
-    {
-        printf("Acknowledge checking\n");
-    }
+    rl78_log(&s->log, 3, "Acknowledge checking\n");
     buf[0] = STATUS_ACK;
-    serial_write(fd, buf, 1);
-    serial_read(fd, buf, 1);
+    serial_write(s, buf, 1);
+    serial_read(s, buf, 1);
 
     /* Wait till end of CRC calculation */
     int i = 100;
@@ -219,7 +197,7 @@ int rl78g10_crc_check(port_handle_t fd, const void *data, int size)
     unsigned char *pbuf = buf;
     do
     {
-        n = serial_read(fd, pbuf, 3);
+        n = serial_read(s, pbuf, 3);
         pbuf += n;
         recieved += n;
         --i;
@@ -234,7 +212,7 @@ int rl78g10_crc_check(port_handle_t fd, const void *data, int size)
 
     if (buf[0] != STATUS_ACK)
     {
-        fprintf(stderr, "Unexpected response %02X\n", buf[1]);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unexpected response %02X\n", buf[1]);
         return -1;
     }
     unsigned int crc_recv = ((unsigned int)buf[2] << 8) | buf[1];
@@ -242,12 +220,9 @@ int rl78g10_crc_check(port_handle_t fd, const void *data, int size)
 
     if (crc_recv != crc_calc)
     {
-        fprintf(stderr, "CRC don't match (remote: %04Xh, local: %04Xh)\n", crc_recv, crc_calc);
+        rl78_log(&s->log, RL78_LOG_ERROR, "CRC don't match (remote: %04Xh, local: %04Xh)\n", crc_recv, crc_calc);
         return -2;
     }
-    if (1 <= verbose_level)
-    {
-        printf("CRC match %04Xh\n", crc_calc);
-    }
+    rl78_log(&s->log, 1, "CRC match %04Xh\n", crc_calc);
     return 0;
 }
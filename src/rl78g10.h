@@ -50,9 +50,10 @@
 
 #include "serial.h"
 
-int rl78_reset(port_handle_t fd, int mode);
-int rl78g10_reset_init(port_handle_t fd, int wait, int mode);
-int rl78g10_erase_write(port_handle_t fd, const void *data, int size);
-int rl78g10_crc_check(port_handle_t fd, const void *data, int size);
+/* Reset mode is taken from the session */
+int rl78_reset(rl78_session_t *s);
+int rl78g10_reset_init(rl78_session_t *s, int wait);
+int rl78g10_erase_write(rl78_session_t *s, const void *data, int size);
+int rl78g10_crc_check(rl78_session_t *s, const void *data, int size);
 
 #endif  // RL78G10_H__
@@ -18,26 +18,25 @@
  *********************************************************************************************************************/
 
 #include "serial.h"
+#include "session.h"
 #include "rl78.h"
 #include <termios.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
 #include <stdio.h>
 
-extern int verbose_level;
-
-int serial_open(const char *port)
+int serial_port_open(rl78_session_t *s, const char *port)
 {
     int fd;
-    if (4 <= verbose_level)
-    {
-        printf("\t\tOpen port: %s\n", port);
-    }
+    rl78_log(&s->log, 4, "\t\tOpen port: %s\n", port);
     fd = open(port, O_RDWR | O_NOCTTY | O_NDELAY);
     if (-1 == fd)
     {
-        perror("Unable to open port ");
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unable to open port %s: %s\n", port, strerror(errno));
     }
     else
     {
@@ -51,13 +50,16 @@ int serial_open(const char *port)
         options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
         options.c_iflag &= ~(IXON | IXOFF | IXANY);
         options.c_oflag &= ~OPOST;
+        // Read timeouts are handled by poll() (see serial_port_read())
         options.c_cc[VMIN] = 0;
-        options.c_cc[VTIME] = 1;
+        options.c_cc[VTIME] = 0;
         tcsetattr(fd, TCSANOW, &options);
         usleep(1000);
         ioctl(fd, TCFLSH, TCIOFLUSH);
     }
-    return fd;
+    s->fd = fd;
+    s->port_name = port;
+    return (-1 == fd) ? -1 : 0;
 }
 
 typedef struct {
@@ -79,7 +81,7 @@ const baudrate_code_t baudrates[] =
     { 0, 0}
 };
 
-int serial_set_baud(port_handle_t fd, int baud)
+int serial_port_set_baud(rl78_session_t *s, int baud)
 {
     const baudrate_code_t *pbaud = baudrates;
     while (0 != pbaud->baudrate)
@@ -92,20 +94,20 @@ int serial_set_baud(port_handle_t fd, int baud)
     }
     if (0 == pbaud->code)
     {
-        fprintf(stderr, "Failed to set baudrate %u\n", baud);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Failed to set baudrate %u\n", baud);
         return -1;
     }
     struct termios options;
-    tcgetattr(fd, &options);
+    tcgetattr(s->fd, &options);
     cfsetispeed(&options, pbaud->code);
     cfsetospeed(&options, pbaud->code);
-    return tcsetattr(fd, TCSANOW, &options);
+    return tcsetattr(s->fd, TCSANOW, &options);
 }
 
-int serial_set_parity(port_handle_t fd, int enable, int odd_parity)
+int serial_port_set_parity(rl78_session_t *s, int enable, int odd_parity)
 {
     struct termios options;
-    tcgetattr(fd, &options);
+    tcgetattr(s->fd, &options);
     options.c_cflag &= ~(PARENB | PARODD);
     if (enable)
     {
@@ -115,10 +117,10 @@ int serial_set_parity(port_handle_t fd, int enable, int odd_parity)
             options.c_cflag |= PARODD;
         }
     }
-    return tcsetattr(fd, TCSANOW, &options);
+    return tcsetattr(s->fd, TCSANOW, &options);
 }
 
-int serial_set_dtr(port_handle_t fd, int level)
+int serial_port_set_dtr(rl78_session_t *s, int level)
 {
     int command;
     const int dtr = TIOCM_DTR;
@@ -130,10 +132,10 @@ int serial_set_dtr(port_handle_t fd, int level)
     {
         command = TIOCMBIS;
     }
-    return ioctl(fd, command, &dtr);
+    return ioctl(s->fd, command, &dtr);
 }
 
-int serial_set_rts(port_handle_t fd, int level)
+int serial_port_set_rts(rl78_session_t *s, int level)
 {
     int command;
     const int rts = TIOCM_RTS;
@@ -145,10 +147,10 @@ int serial_set_rts(port_handle_t fd, int level)
     {
         command = TIOCMBIS;
     }
-    return ioctl(fd, command, &rts);
+    return ioctl(s->fd, command, &rts);
 }
 
-int serial_set_txd(port_handle_t fd, int level)
+int serial_port_set_txd(rl78_session_t *s, int level)
 {
     int command;
     if (level)
@@ -159,36 +161,25 @@ int serial_set_txd(port_handle_t fd, int level)
     {
         command = TIOCSBRK;
     }
-    return ioctl(fd, command);
+    return ioctl(s->fd, command);
 }
 
-int serial_flush(port_handle_t fd)
+int serial_port_flush(rl78_session_t *s)
 {
-    return tcflush(fd, TCIOFLUSH);
+    return tcflush(s->fd, TCIOFLUSH);
 }
 
-int serial_write(port_handle_t fd, const void *buf, int len)
+int serial_port_write(rl78_session_t *s, const void *buf, int len)
 {
-    if (4 <= verbose_level)
-    {
-        unsigned char *p = (unsigned char*)buf;
-        unsigned int i;
-        printf("\t\tsend(%u): ", len);
-        for (i = len; 0 < i; --i)
-        {
-            printf("%02X ", *p++);
-        }
-        printf("\n");
-    }
     int bytes_left = len;
     int rc = 0;
     unsigned char *pbuf = (unsigned char*)buf;
     do
     {
-        rc = write(fd, pbuf, bytes_left);
+        rc = write(s->fd, pbuf, bytes_left);
         if (0 > rc)
         {
-            fprintf(stderr, "Failed to write to port.\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "Failed to write to port.\n");
             return rc;
         }
         pbuf += rc;
@@ -198,17 +189,27 @@ int serial_write(port_handle_t fd, const void *buf, int len)
     return len - bytes_left;
 }
 
-int serial_read(port_handle_t fd, void *buf, int len)
+int serial_port_read(rl78_session_t *s, void *buf, int len)
 {
     int bytes_left = len;
     int rc = 0;
     unsigned char *pbuf = (unsigned char*)buf;
     do
     {
-        rc = read(fd, pbuf, bytes_left);
+        // Give up when no data arrives within the read timeout
+        struct pollfd pfd = { s->fd, POLLIN, 0 };
+        rc = poll(&pfd, 1, s->read_timeout);
+        if (0 > rc && EINTR == errno)
+        {
+            continue;
+        }
+        if (0 < rc)
+        {
+            rc = read(s->fd, pbuf, bytes_left);
+        }
         if (0 > rc)
         {
-            fprintf(stderr, "Failed to read from port.\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "Failed to read from port.\n");
             return rc;
         }
         if (0 == rc)
@@ -219,26 +220,13 @@ int serial_read(port_handle_t fd, void *buf, int len)
         bytes_left -= rc;
     }
     while (0 < bytes_left);
-    const int nbytes = len - bytes_left;
-    if (4 <= verbose_level)
-    {
-        pbuf = buf;
-        unsigned int i;
-        printf("\t\trecv(%u): ", nbytes);
-        for (i = nbytes; 0 < i; --i)
-        {
-            printf("%02X ", *pbuf++);
-        }
-        printf("\n");
-    }
-    return nbytes;
+    return len - bytes_left;
 }
 
-int serial_close(port_handle_t fd)
+int serial_port_close(rl78_session_t *s)
 {
-    if (4 <= verbose_level)
-    {
-        printf("\t\tClose port\n");
-    }
-    return close(fd);
+    rl78_log(&s->log, 4, "\t\tClose port\n");
+    const int rc = close(s->fd);
+    s->fd = INVALID_HANDLE_VALUE;
+    return rc;
 }
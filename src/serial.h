@@ -32,20 +32,38 @@ typedef HANDLE port_handle_t;
 
 #endif
 
+typedef struct rl78_session rl78_session_t;
+
 #define DISABLE 0
 #define ENABLE  1
 #define EVEN    0
 #define ODD     1
 
-port_handle_t serial_open(const char *port);
-int serial_set_baud(port_handle_t fd, int baud);
-int serial_set_parity(port_handle_t fd, int enable, int odd_parity);
-int serial_set_dtr(port_handle_t fd, int level);
-int serial_set_rts(port_handle_t fd, int level);
-int serial_set_txd(port_handle_t fd, int level);
-int serial_flush(port_handle_t fd);
-int serial_write(port_handle_t fd, const void *buf, int len);
-int serial_read(port_handle_t fd, void *buf, int len);
-int serial_close(port_handle_t fd);
+/* I/O of a session: the serial port, or the transport of the session if it
+ * has one (see transport.h) */
+int serial_open(rl78_session_t *s, const char *port);
+int serial_set_baud(rl78_session_t *s, int baud);
+int serial_set_parity(rl78_session_t *s, int enable, int odd_parity);
+int serial_set_dtr(rl78_session_t *s, int level);
+int serial_set_rts(rl78_session_t *s, int level);
+int serial_set_txd(rl78_session_t *s, int level);
+int serial_flush(rl78_session_t *s);
+int serial_write(rl78_session_t *s, const void *buf, int len);
+int serial_read(rl78_session_t *s, void *buf, int len);
+/* Host delay between line events, in us; a replay does not wait */
+void serial_delay(rl78_session_t *s, unsigned int us);
+int serial_close(rl78_session_t *s);
+
+/* The serial port itself (serial.c or serial_win32.c) */
+int serial_port_open(rl78_session_t *s, const char *port);
+int serial_port_set_baud(rl78_session_t *s, int baud);
+int serial_port_set_parity(rl78_session_t *s, int enable, int odd_parity);
+int serial_port_set_dtr(rl78_session_t *s, int level);
+int serial_port_set_rts(rl78_session_t *s, int level);
+int serial_port_set_txd(rl78_session_t *s, int level);
+int serial_port_flush(rl78_session_t *s);
+int serial_port_write(rl78_session_t *s, const void *buf, int len);
+int serial_port_read(rl78_session_t *s, void *buf, int len);
+int serial_port_close(rl78_session_t *s);
 
 #endif  // SERIAL_H__
@@ -18,24 +18,34 @@
  *********************************************************************************************************************/
 
 #include "serial.h"
+#include "session.h"
 #include "rl78.h"
 #include <unistd.h>
 #include <stdio.h>
 
-extern int verbose_level;
-static int last_dtr_setting;
-static int last_rts_setting;
+/* The read timeout is set on the port, so a change of s->read_timeout (e.g.
+ * the longer waits of Security Set or of the handshake poll) is passed on
+ * before the next read */
+static
+void serial_port_timeouts(rl78_session_t *s, port_handle_t fd)
+{
+    COMMTIMEOUTS timeouts;
+    timeouts.ReadIntervalTimeout=s->read_timeout / 2;
+    timeouts.ReadTotalTimeoutConstant=s->read_timeout / 2;
+    timeouts.ReadTotalTimeoutMultiplier=10;
+    timeouts.WriteTotalTimeoutConstant=0;
+    timeouts.WriteTotalTimeoutMultiplier=0;
+    SetCommTimeouts(fd, &timeouts);
+    s->port_timeout = s->read_timeout;
+}
 
-port_handle_t serial_open(const char *port)
+int serial_port_open(rl78_session_t *s, const char *port)
 {
     port_handle_t fd;
     char port_full_name[20];
     snprintf(port_full_name, sizeof port_full_name - 2u,
              "\\\\.\\%s", port);
-    if (4 <= verbose_level)
-    {
-        printf("\t\tOpen port: %s\n", port_full_name);
-    }
+    rl78_log(&s->log, 4, "\t\tOpen port: %s\n", port_full_name);
     fd = CreateFile(port_full_name,
                     GENERIC_READ | GENERIC_WRITE,
                     0,
@@ -54,7 +64,7 @@ port_handle_t serial_open(const char *port)
                       error_string,
                       sizeof error_string,
                       NULL);
-        fprintf(stderr, "Unable to open port: (%i) %s\n", error_num, error_string);
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unable to open port: (%i) %s\n", error_num, error_string);
     }
     else
     {
@@ -64,38 +74,34 @@ port_handle_t serial_open(const char *port)
         dcbSerialParams.ByteSize = 8;
         dcbSerialParams.StopBits = TWOSTOPBITS;
         dcbSerialParams.Parity = NOPARITY;
-        last_dtr_setting = (DTR_CONTROL_ENABLE == dcbSerialParams.fDtrControl) ? SETDTR : CLRDTR;
-        last_rts_setting = (RTS_CONTROL_ENABLE == dcbSerialParams.fRtsControl) ? SETRTS : CLRRTS;
+        s->dtr = (DTR_CONTROL_ENABLE == dcbSerialParams.fDtrControl) ? SETDTR : CLRDTR;
+        s->rts = (RTS_CONTROL_ENABLE == dcbSerialParams.fRtsControl) ? SETRTS : CLRRTS;
         dcbSerialParams.fInX = FALSE;
         dcbSerialParams.fOutX = FALSE;
         SetCommState(fd, &dcbSerialParams);
 
-        COMMTIMEOUTS timeouts;
-        timeouts.ReadIntervalTimeout=50;
-        timeouts.ReadTotalTimeoutConstant=50;
-        timeouts.ReadTotalTimeoutMultiplier=10;
-        timeouts.WriteTotalTimeoutConstant=0;
-        timeouts.WriteTotalTimeoutMultiplier=0;
-        SetCommTimeouts(fd, &timeouts);
+        serial_port_timeouts(s, fd);
         FlushFileBuffers(fd);
     }
-    return fd;
+    s->fd = fd;
+    s->port_name = port;
+    return (INVALID_HANDLE_VALUE == fd) ? -1 : 0;
 }
 
-int serial_set_baud(port_handle_t fd, int baud)
+int serial_port_set_baud(rl78_session_t *s, int baud)
 {
     DCB dcbSerialParams;
-    GetCommState(fd, &dcbSerialParams);
+    GetCommState(s->fd, &dcbSerialParams);
     dcbSerialParams.BaudRate = baud;
-    dcbSerialParams.fDtrControl = (SETDTR == last_dtr_setting) ? DTR_CONTROL_ENABLE : DTR_CONTROL_DISABLE;
-    dcbSerialParams.fRtsControl = (SETRTS == last_rts_setting) ? RTS_CONTROL_ENABLE : RTS_CONTROL_DISABLE;
-    return SetCommState(fd, &dcbSerialParams) != 0 ? 0 : -1;
+    dcbSerialParams.fDtrControl = (SETDTR == s->dtr) ? DTR_CONTROL_ENABLE : DTR_CONTROL_DISABLE;
+    dcbSerialParams.fRtsControl = (SETRTS == s->rts) ? RTS_CONTROL_ENABLE : RTS_CONTROL_DISABLE;
+    return SetCommState(s->fd, &dcbSerialParams) != 0 ? 0 : -1;
 }
 
-int serial_set_parity(port_handle_t fd, int enable, int odd_parity)
+int serial_port_set_parity(rl78_session_t *s, int enable, int odd_parity)
 {
     DCB dcbSerialParams;
-    GetCommState(fd, &dcbSerialParams);
+    GetCommState(s->fd, &dcbSerialParams);
     dcbSerialParams.Parity = NOPARITY;
     if (enable)
     {
@@ -108,10 +114,10 @@ int serial_set_parity(port_handle_t fd, int enable, int odd_parity)
             dcbSerialParams.Parity = EVENPARITY;
         }
     }
-    return SetCommState(fd, &dcbSerialParams) != 0 ? 0 : -1;
+    return SetCommState(s->fd, &dcbSerialParams) != 0 ? 0 : -1;
 }
 
-int serial_set_dtr(port_handle_t fd, int level)
+int serial_port_set_dtr(rl78_session_t *s, int level)
 {
     int command;
     if (level)
@@ -122,11 +128,11 @@ int serial_set_dtr(port_handle_t fd, int level)
     {
         command = SETDTR;
     }
-    last_dtr_setting = command;
-    return EscapeCommFunction(fd, command) != 0 ? 0 : -1;
+    s->dtr = command;
+    return EscapeCommFunction(s->fd, command) != 0 ? 0 : -1;
 }
 
-int serial_set_rts(port_handle_t fd, int level)
+int serial_port_set_rts(rl78_session_t *s, int level)
 {
     int command;
     if (level)
@@ -137,11 +143,11 @@ int serial_set_rts(port_handle_t fd, int level)
     {
         command = SETRTS;
     }
-    last_rts_setting = command;
-    return EscapeCommFunction(fd, command) != 0 ? 0 : -1;
+    s->rts = command;
+    return EscapeCommFunction(s->fd, command) != 0 ? 0 : -1;
 }
 
-int serial_set_txd(port_handle_t fd, int level)
+int serial_port_set_txd(rl78_session_t *s, int level)
 {
     int command;
     if (level)
@@ -152,39 +158,25 @@ int serial_set_txd(port_handle_t fd, int level)
     {
         command = SETBREAK;
     }
-    return EscapeCommFunction(fd, command) != 0 ? 0 : -1;
+    return EscapeCommFunction(s->fd, command) != 0 ? 0 : -1;
 }
 
-int serial_flush(port_handle_t fd)
+int serial_port_flush(rl78_session_t *s)
 {
-    if (4 <= verbose_level)
-    {
-        printf("\t\tFlush IO buffers\n");
-    }
-    return PurgeComm(fd, PURGE_RXCLEAR | PURGE_TXCLEAR) != 0 ? 0 : -1;
+    rl78_log(&s->log, 4, "\t\tFlush IO buffers\n");
+    return PurgeComm(s->fd, PURGE_RXCLEAR | PURGE_TXCLEAR) != 0 ? 0 : -1;
 }
 
-int serial_write(port_handle_t fd, const void *buf, int len)
+int serial_port_write(rl78_session_t *s, const void *buf, int len)
 {
-    if (4 <= verbose_level)
-    {
-        unsigned char *p = (unsigned char*)buf;
-        unsigned int i;
-        printf("\t\tsend(%u): ", len);
-        for (i = len; 0 < i; --i)
-        {
-            printf("%02X ", *p++);
-        }
-        printf("\n");
-    }
     int bytes_left = len;
     DWORD bytes_written;
     unsigned char *pbuf = (unsigned char*)buf;
     do
     {
-        if (0 == WriteFile(fd, pbuf, bytes_left, &bytes_written, NULL))
+        if (0 == WriteFile(s->fd, pbuf, bytes_left, &bytes_written, NULL))
         {
-            fprintf(stderr, "Failed to write to port.\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "Failed to write to port.\n");
             return -1;
         }
         pbuf += bytes_written;
@@ -194,16 +186,20 @@ int serial_write(port_handle_t fd, const void *buf, int len)
     return len - bytes_left;
 }
 
-int serial_read(port_handle_t fd, void *buf, int len)
+int serial_port_read(rl78_session_t *s, void *buf, int len)
 {
     int bytes_left = len;
     DWORD bytes_read;
     unsigned char *pbuf = (unsigned char*)buf;
+    if (s->port_timeout != s->read_timeout)
+    {
+        serial_port_timeouts(s, s->fd);
+    }
     do
     {
-        if (0 == ReadFile(fd, pbuf, bytes_left, &bytes_read, NULL))
+        if (0 == ReadFile(s->fd, pbuf, bytes_left, &bytes_read, NULL))
         {
-            fprintf(stderr, "Failed to read from port.\n");
+            rl78_log(&s->log, RL78_LOG_ERROR, "Failed to read from port.\n");
             return -1;
         }
         if (0 == bytes_read)
@@ -214,26 +210,13 @@ int serial_read(port_handle_t fd, void *buf, int len)
         bytes_left -= bytes_read;
     }
     while (0 < bytes_left);
-    const int nbytes = len - bytes_left;
-    if (4 <= verbose_level)
-    {
-        pbuf = buf;
-        unsigned int i;
-        printf("\t\trecv(%u): ", nbytes);
-        for (i = nbytes; 0 < i; --i)
-        {
-            printf("%02X ", *pbuf++);
-        }
-        printf("\n");
-    }
-    return nbytes;
+    return len - bytes_left;
 }
 
-int serial_close(port_handle_t fd)
+int serial_port_close(rl78_session_t *s)
 {
-    if (4 <= verbose_level)
-    {
-        printf("\t\tClose port\n");
-    }
-    return CloseHandle(fd) != 0 ? 0 : -1;
+    rl78_log(&s->log, 4, "\t\tClose port\n");
+    const int rc = CloseHandle(s->fd) != 0 ? 0 : -1;
+    s->fd = INVALID_HANDLE_VALUE;
+    return rc;
 }
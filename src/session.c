@@ -0,0 +1,85 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#include "session.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct
+{
+    const char *name;
+    rl78_timing_t timing;
+} session_profile_t;
+
+static const session_profile_t session_profiles[] =
+{
+    { "standard", { 1, 3, 1, 1, 0 } },
+    /* Boards without a reset supervisor or capacitor on RESET */
+    { "fast", { 1, 1, 1, 0, 0 } },
+    /* Large reset capacitors and slow supply ramps */
+    { "slow", { 10, 10, 5, 5, 0 } },
+};
+
+#define SESSION_PROFILES (sizeof session_profiles / sizeof session_profiles[0])
+
+void rl78_session_init(rl78_session_t *s, int log_level)
+{
+    memset(s, 0, sizeof *s);
+    s->fd = INVALID_HANDLE_VALUE;
+    s->communication_mode = 1;
+    s->baud = SESSION_DEFAULT_BAUD;
+    s->voltage = SESSION_DEFAULT_VOLTAGE;
+    s->read_timeout = SESSION_DEFAULT_READ_TIMEOUT;
+    s->timing = session_profiles[0].timing;
+    rl78_log_init(&s->log, log_level);
+}
+
+int rl78_session_timing(rl78_timing_t *timing, const char *spec)
+{
+    unsigned int i;
+    for (i = 0; SESSION_PROFILES > i; ++i)
+    {
+        if (0 == strcmp(spec, session_profiles[i].name))
+        {
+            timing->reset_low = session_profiles[i].timing.reset_low;
+            timing->tool0_low = session_profiles[i].timing.tool0_low;
+            timing->tool0_high = session_profiles[i].timing.tool0_high;
+            timing->mode_settle = session_profiles[i].timing.mode_settle;
+            return 0;
+        }
+    }
+    rl78_timing_t t = *timing;
+    int end = 0;
+    if (4 != sscanf(spec, "%u,%u,%u,%u%n", &t.reset_low, &t.tool0_low, &t.tool0_high, &t.mode_settle, &end)
+        || '\0' != spec[end])
+    {
+        return -1;
+    }
+    *timing = t;
+    return 0;
+}
+
+void rl78_session_progress(rl78_session_t *s, int operation, unsigned int address,
+                           unsigned int done, unsigned int total)
+{
+    if (NULL != s->progress)
+    {
+        s->progress(s->progress_ctx, operation, address, done, total);
+    }
+}
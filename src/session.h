@@ -0,0 +1,102 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+#ifndef SESSION_H__
+#define SESSION_H__
+
+#include "serial.h"
+#include "log.h"
+#include "latency.h"
+#include "trace.h"
+#include "transport.h"
+
+#define SESSION_DEFAULT_BAUD            115200
+#define SESSION_DEFAULT_VOLTAGE         3.3f
+#define SESSION_DEFAULT_READ_TIMEOUT    100     /* ms without incoming data */
+
+typedef struct
+{
+    unsigned long commands;     /* command frames sent */
+    unsigned long frames;       /* data frames sent */
+    unsigned long responses;    /* response frames received */
+    unsigned long bytes_sent;
+    unsigned long bytes_received;
+    unsigned long errors;       /* failed commands */
+    unsigned long retries;
+} rl78_stats_t;
+
+/* Delays of the bootloader entry sequence, in ms */
+typedef struct
+{
+    unsigned int reset_low;     /* RESET and TOOL0 held low */
+    unsigned int tool0_low;     /* from RESET release till TOOL0 release */
+    unsigned int tool0_high;    /* from TOOL0 release till the mode byte */
+    unsigned int mode_settle;   /* after the mode byte */
+    int adaptive;               /* poll for the first ACK instead of mode_settle */
+} rl78_timing_t;
+
+#define RL78_HANDSHAKE_POLL     3       /* ms to wait for each adaptive poll */
+
+#define RL78_PROGRESS_ERASE     0
+#define RL78_PROGRESS_PROGRAM   1
+#define RL78_PROGRESS_VERIFY    2
+
+/* Called after each flash block of an erase, program or verify loop. Blocks
+ * are counted from 1 to total; blocks without data are counted as well. */
+typedef void (*rl78_progress_func_t)(void *ctx, int operation, unsigned int address,
+                                     unsigned int done, unsigned int total);
+
+/* State of a connection to one device. Everything a command needs is kept
+ * here, so several devices can be driven from one process. */
+struct rl78_session
+{
+    port_handle_t fd;
+    const char *port_name;
+    const rl78_transport_t *transport;  /* NULL for the serial port */
+    void *transport_ctx;
+    int mode;                   /* MODE_* of the device family */
+    int communication_mode;     /* 1 - single-wire UART, 2 - two-wire UART */
+    int baud;
+    float voltage;
+    unsigned int read_timeout;  /* ms */
+    int dtr;                    /* last DTR setting (used by the Win32 backend) */
+    int rts;                    /* last RTS setting (used by the Win32 backend) */
+    unsigned int port_timeout;  /* read_timeout the port is set up for (used by the Win32 backend) */
+    rl78_timing_t timing;
+    unsigned int handshake;     /* us from RESET release till the first ACK */
+    rl78_log_t log;
+    rl78_progress_func_t progress;
+    void *progress_ctx;
+    rl78_stats_t stats;
+    latency_t *latency;         /* round trip samples, NULL if not collected */
+    trace_t *trace;             /* protocol trace, NULL if not written */
+    int trace_track;
+    struct metrics *metrics;    /* station counters, NULL if not exported */
+    struct wear *wear;          /* block times, NULL if not screened */
+    struct progress *events;    /* JSONL progress, NULL if not written */
+};
+
+void rl78_session_init(rl78_session_t *s, int log_level);
+/* Take the delays from a profile ("standard", "fast" or "slow") or from a
+ * list "reset_low,tool0_low,tool0_high,mode_settle"; 0 on success */
+int rl78_session_timing(rl78_timing_t *timing, const char *spec);
+void rl78_session_progress(rl78_session_t *s, int operation, unsigned int address,
+                           unsigned int done, unsigned int total);
+
+#endif // SESSION_H__
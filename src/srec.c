@@ -19,12 +19,22 @@
 
 #include "srec.h"
 #include "rl78.h"
+#include "log.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifndef WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
-extern unsigned int verbose_level;
+int srec_in_range(unsigned int address, unsigned int length, unsigned int offset, unsigned int size)
+{
+    return offset <= address
+        && length <= size
+        && address - offset <= size - length;
+}
 
-static
 int ascii2hex(const char *str, unsigned int len)
 {
     int res = 0;
@@ -56,7 +66,8 @@ int ascii2hex(const char *str, unsigned int len)
 
 int srec_read(const char *filename,
               void *code, unsigned int code_len,
-              void *data, unsigned int data_len)
+              void *data, unsigned int data_len,
+              const rl78_log_t *log)
 {
     FILE *pfile;
     char line[512];
@@ -64,7 +75,7 @@ int srec_read(const char *filename,
     pfile = fopen(filename, "r");
     if (NULL == pfile)
     {
-        fprintf(stderr, "Unable to open file \"%s\"\n", filename);
+        rl78_log(log, RL78_LOG_ERROR, "Unable to open file \"%s\"\n", filename);
         return SREC_IO_ERROR;
     }
     rewind(pfile);
@@ -74,7 +85,7 @@ int srec_read(const char *filename,
         {
             if (ferror(pfile))
             {
-                fprintf(stderr, "Unable to read file \"%s\"\n", filename);
+                rl78_log(log, RL78_LOG_ERROR, "Unable to read file \"%s\"\n", filename);
                 rc = SREC_IO_ERROR;
             }
             break;
@@ -82,16 +93,16 @@ int srec_read(const char *filename,
         const size_t len = strlen(line);
         if (0 == len || '\n' != line[len - 1])
         {
-            fprintf(stderr, "Unable to parse file: line is too long\n");
+            rl78_log(log, RL78_LOG_ERROR, "Unable to parse file: line is too long\n");
             rc = SREC_IO_ERROR;
         }
-        if (4 <= verbose_level)
+        if (rl78_log_enabled(log, 4))
         {
-            printf("srec: %s\n", line);
+            rl78_log(log, 4, "srec: %s\n", line);
         }
         if ('S' != line[0])
         {
-            fprintf(stderr, "File format error (\"%s\")\n", line);
+            rl78_log(log, RL78_LOG_ERROR, "File format error (\"%s\")\n", line);
             rc = SREC_FORMAT_ERROR;
             break;
         }
@@ -101,9 +112,9 @@ int srec_read(const char *filename,
             && 2 != record_type
             && 3 != record_type)
         {
-            if (4 <= verbose_level)
+            if (rl78_log_enabled(log, 4))
             {
-                printf("Record with no data (S%u)\n", record_type);
+                rl78_log(log, 4, "Record with no data (S%u)\n", record_type);
             }
             continue;
         }
@@ -113,7 +124,7 @@ int srec_read(const char *filename,
         const char *data_p = line + 4 + address_length;
         unsigned char *memory;
 
-        if ((CODE_OFFSET + code_len) >= (address + data_length))
+        if (srec_in_range(address, data_length, CODE_OFFSET, code_len))
         {
             if (NULL == code)
             {
@@ -121,13 +132,8 @@ int srec_read(const char *filename,
             }
             memory = (unsigned char*)code;
             address -= CODE_OFFSET;
-            if (4 <= verbose_level)
-            {
-                printf("srec_code (%06X) : ", address);
-            }
         }
-        else if (DATA_OFFSET <= address
-            && (DATA_OFFSET + data_len) >= (address + data_length))
+        else if (srec_in_range(address, data_length, DATA_OFFSET, data_len))
         {
             if (NULL == data)
             {
@@ -135,32 +141,521 @@ int srec_read(const char *filename,
             }
             memory = (unsigned char*)data;
             address -= DATA_OFFSET;
-            if (4 <= verbose_level)
-            {
-                printf("srec_data (%06X) : ", address);
-            }
         }
         else
         {
             rc = SREC_MEMORY_ERROR;
             break;
         }
+        unsigned char *const record = memory + address;
         unsigned int i = data_length;
         for(; 0 < i; --i)
         {
             memory[address] = ascii2hex(data_p, 2);
-            if (4 <= verbose_level)
-            {
-                printf("%02X ", memory[address]);
-            }
             ++address;
             data_p += 2;
         }
-        if (4 <= verbose_level)
+        rl78_log_hex(log, 4, memory == (unsigned char*)code ? "srec_code" : "srec_data", record, data_length);
+    }
+    fclose(pfile);
+    return rc;
+}
+
+/* Parallel parser
+ *
+ * Files are loaded into memory and split into chunks at line boundaries.
+ * Chunks of all files are decoded by a pool of threads into private lists
+ * of segments, so no thread touches the target image. Segments are then
+ * applied to the image in command line and file order, which makes overlap
+ * and conflict detection independent of thread scheduling. */
+
+#define SREC_MIN_CHUNK_SIZE     (64U * 1024U)
+
+typedef struct
+{
+    unsigned int address;
+    unsigned int length;
+    const unsigned char *bytes;
+    unsigned int line;
+} srec_segment_t;
+
+typedef struct
+{
+    const char *begin;
+    const char *end;
+    unsigned char *bytes;
+    srec_segment_t *segments;
+    unsigned int segment_count;
+    unsigned int segment_capacity;
+    unsigned int lines;
+    unsigned int error_line;
+    int rc;
+} srec_chunk_t;
+
+typedef struct
+{
+    const char *filename;
+    char *text;
+    srec_chunk_t *chunks;
+    unsigned int nchunks;
+    unsigned int first_line;    /* number of lines in all preceding files */
+    unsigned int lines;
+} srec_file_t;
+
+typedef struct
+{
+    srec_chunk_t **chunks;
+    unsigned int nchunks;
+    unsigned int next;
+} srec_pool_t;
+
+static
+int srec_decode_record(const char *line, size_t len,
+                       unsigned char *out, unsigned int *address, unsigned int *record_type)
+{
+    if (4 > len
+        || 'S' != line[0])
+    {
+        return SREC_FORMAT_ERROR;
+    }
+    const int type = ascii2hex(&line[1], 1);
+    const int count = ascii2hex(&line[2], 2);
+    if (0 > type
+        || 0 > count
+        || (4 + (size_t)count * 2) != len)
+    {
+        return SREC_FORMAT_ERROR;
+    }
+    unsigned int sum = count;
+    const char *p = &line[4];
+    int i;
+    for (i = count; i; --i, p += 2)
+    {
+        const int value = ascii2hex(p, 2);
+        if (0 > value)
         {
-            printf("\n");
+            return SREC_FORMAT_ERROR;
         }
+        sum += value;
+    }
+    if (0xFF != (sum & 0xFF))
+    {
+        return SREC_FORMAT_ERROR;
+    }
+    *record_type = type;
+    // Ignore non-data frames
+    if (1 != type
+        && 2 != type
+        && 3 != type)
+    {
+        return 0;
+    }
+    const int address_length = (type + 1) * 2; // in symbols
+    const int data_length = count - address_length / 2 - 1; // in bytes
+    if (0 > data_length)
+    {
+        return SREC_FORMAT_ERROR;
+    }
+    *address = ascii2hex(&line[4], address_length);
+    p = &line[4 + address_length];
+    for (i = 0; i < data_length; ++i, p += 2)
+    {
+        out[i] = ascii2hex(p, 2);
+    }
+    return data_length;
+}
+
+static
+void srec_parse_chunk(srec_chunk_t *chunk)
+{
+    const char *p = chunk->begin;
+    unsigned char *out = chunk->bytes;
+    while (p < chunk->end)
+    {
+        const char *eol = memchr(p, '\n', chunk->end - p);
+        const char *next = (NULL != eol) ? eol + 1 : chunk->end;
+        size_t len = ((NULL != eol) ? eol : chunk->end) - p;
+        ++chunk->lines;
+        while (len && ('\r' == p[len - 1] || ' ' == p[len - 1] || '\t' == p[len - 1]))
+        {
+            --len;
+        }
+        if (0 == len)
+        {
+            p = next;
+            continue;
+        }
+        unsigned int address = 0;
+        unsigned int record_type = 0;
+        const int data_length = srec_decode_record(p, len, out, &address, &record_type);
+        if (0 > data_length)
+        {
+            chunk->rc = data_length;
+            chunk->error_line = chunk->lines;
+            break;
+        }
+        if (0 < data_length)
+        {
+            if (chunk->segment_count == chunk->segment_capacity)
+            {
+                const unsigned int capacity = chunk->segment_capacity ? chunk->segment_capacity * 2 : 256;
+                srec_segment_t *segments = realloc(chunk->segments, capacity * sizeof *segments);
+                if (NULL == segments)
+                {
+                    chunk->rc = SREC_MEMORY_ERROR;
+                    chunk->error_line = chunk->lines;
+                    break;
+                }
+                chunk->segments = segments;
+                chunk->segment_capacity = capacity;
+            }
+            srec_segment_t *segment = &chunk->segments[chunk->segment_count++];
+            segment->address = address;
+            segment->length = data_length;
+            segment->bytes = out;
+            segment->line = chunk->lines;
+            out += data_length;
+        }
+        p = next;
+    }
+}
+
+static
+void *srec_pool_worker(void *arg)
+{
+    srec_pool_t *pool = (srec_pool_t*)arg;
+    for (;;)
+    {
+        const unsigned int n = __sync_fetch_and_add(&pool->next, 1);
+        if (pool->nchunks <= n)
+        {
+            break;
+        }
+        srec_parse_chunk(pool->chunks[n]);
+    }
+    return NULL;
+}
+
+static
+unsigned int srec_cpu_count(void)
+{
+#ifdef WIN32
+    return 1;
+#else
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (0 < cpus) ? (unsigned int)cpus : 1;
+#endif
+}
+
+static
+int srec_load_file(srec_file_t *file, unsigned int threads, const rl78_log_t *log)
+{
+    FILE *pfile = fopen(file->filename, "rb");
+    if (NULL == pfile)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to open file \"%s\"\n", file->filename);
+        return SREC_IO_ERROR;
+    }
+    long size = -1;
+    if (0 == fseek(pfile, 0, SEEK_END))
+    {
+        size = ftell(pfile);
+    }
+    if (0 <= size)
+    {
+        rewind(pfile);
+        file->text = malloc(size + 1);
+    }
+    if (NULL == file->text
+        || (size_t)size != fread(file->text, 1, size, pfile))
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Unable to read file \"%s\"\n", file->filename);
+        fclose(pfile);
+        return SREC_IO_ERROR;
     }
     fclose(pfile);
+
+    unsigned int nchunks = size / SREC_MIN_CHUNK_SIZE + 1;
+    if (threads < nchunks)
+    {
+        nchunks = threads;
+    }
+    file->chunks = calloc(nchunks, sizeof *file->chunks);
+    if (NULL == file->chunks)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Out of memory\n");
+        return SREC_MEMORY_ERROR;
+    }
+    file->nchunks = nchunks;
+    const char *begin = file->text;
+    const char *const end = file->text + size;
+    unsigned int n;
+    for (n = 0; n < nchunks; ++n)
+    {
+        const char *chunk_end = file->text + (size_t)size * (n + 1) / nchunks;
+        if (chunk_end < begin)
+        {
+            chunk_end = begin;
+        }
+        if (chunk_end < end)
+        {
+            const char *eol = memchr(chunk_end, '\n', end - chunk_end);
+            chunk_end = (NULL != eol) ? eol + 1 : end;
+        }
+        srec_chunk_t *chunk = &file->chunks[n];
+        chunk->begin = begin;
+        chunk->end = chunk_end;
+        // Every data byte takes two symbols in a record
+        chunk->bytes = malloc((chunk_end - begin) / 2 + 1);
+        if (NULL == chunk->bytes)
+        {
+            rl78_log(log, RL78_LOG_ERROR, "Out of memory\n");
+            return SREC_MEMORY_ERROR;
+        }
+        begin = chunk_end;
+    }
+    if (rl78_log_enabled(log, 4))
+    {
+        rl78_log(log, 4, "srec: \"%s\": %ld bytes in %u chunks\n", file->filename, size, nchunks);
+    }
+    return SREC_NO_ERROR;
+}
+
+static
+void srec_parse_all(srec_file_t *files, unsigned int nfiles, unsigned int threads)
+{
+    unsigned int nchunks = 0;
+    unsigned int f, n;
+    for (f = 0; f < nfiles; ++f)
+    {
+        nchunks += files[f].nchunks;
+    }
+    srec_chunk_t *chunks[nchunks ? nchunks : 1];
+    srec_pool_t pool = { chunks, nchunks, 0 };
+    nchunks = 0;
+    for (f = 0; f < nfiles; ++f)
+    {
+        for (n = 0; n < files[f].nchunks; ++n)
+        {
+            chunks[nchunks++] = &files[f].chunks[n];
+        }
+    }
+    if (threads > nchunks)
+    {
+        threads = nchunks;
+    }
+#ifndef WIN32
+    // The calling thread is a worker too
+    pthread_t workers[threads ? threads : 1];
+    unsigned int started = 0;
+    while (started + 1 < threads
+           && 0 == pthread_create(&workers[started], NULL, srec_pool_worker, &pool))
+    {
+        ++started;
+    }
+    srec_pool_worker(&pool);
+    for (n = 0; n < started; ++n)
+    {
+        pthread_join(workers[n], NULL);
+    }
+#else
+    srec_pool_worker(&pool);
+#endif
+}
+
+static
+const srec_file_t *srec_line_owner(const srec_file_t *files, unsigned int nfiles, unsigned int line)
+{
+    unsigned int f = nfiles - 1;
+    while (0 != f && files[f].first_line >= line)
+    {
+        --f;
+    }
+    return &files[f];
+}
+
+static
+int srec_apply(const srec_file_t *files, unsigned int nfiles,
+               unsigned char *code, unsigned int code_len,
+               unsigned char *data, unsigned int data_len,
+               const rl78_log_t *log)
+{
+    /* Owner of every byte of the image: line of the last record which has
+     * written it, counted through all files (0 - not written yet). */
+    unsigned int *owner = calloc((size_t)code_len + data_len + 1, sizeof *owner);
+    unsigned int *overlap = calloc((size_t)nfiles * nfiles, sizeof *overlap);
+    if (NULL == owner
+        || NULL == overlap)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Out of memory\n");
+        free(owner);
+        free(overlap);
+        return SREC_MEMORY_ERROR;
+    }
+    int rc = SREC_NO_ERROR;
+    unsigned int f, n, s, i;
+    for (f = 0; SREC_NO_ERROR == rc && f < nfiles; ++f)
+    {
+        const srec_file_t *file = &files[f];
+        unsigned int first_line = file->first_line;
+        for (n = 0; SREC_NO_ERROR == rc && n < file->nchunks; ++n)
+        {
+            const srec_chunk_t *chunk = &file->chunks[n];
+            for (s = 0; SREC_NO_ERROR == rc && s < chunk->segment_count; ++s)
+            {
+                const srec_segment_t *segment = &chunk->segments[s];
+                const unsigned int line = first_line + segment->line;
+                const unsigned int file_line = line - file->first_line;
+                unsigned int address = segment->address;
+                unsigned char *memory;
+                unsigned int *owner_p;
+                if (srec_in_range(address, segment->length, CODE_OFFSET, code_len))
+                {
+                    if (NULL == code)
+                    {
+                        continue;
+                    }
+                    memory = code;
+                    address -= CODE_OFFSET;
+                    owner_p = owner;
+                }
+                else if (srec_in_range(address, segment->length, DATA_OFFSET, data_len))
+                {
+                    if (NULL == data)
+                    {
+                        continue;
+                    }
+                    memory = data;
+                    address -= DATA_OFFSET;
+                    owner_p = owner + code_len;
+                }
+                else
+                {
+                    rl78_log(log, RL78_LOG_ERROR, "%s:%u: address %06X is out of memory range\n",
+                             file->filename, file_line, segment->address);
+                    rc = SREC_MEMORY_ERROR;
+                    break;
+                }
+                for (i = 0; i < segment->length; ++i, ++address)
+                {
+                    const unsigned int prev_line = owner_p[address];
+                    if (0 != prev_line)
+                    {
+                        const srec_file_t *prev = srec_line_owner(files, nfiles, prev_line);
+                        if (memory[address] != segment->bytes[i])
+                        {
+                            rl78_log(log, RL78_LOG_ERROR, "%s:%u: data at %06X conflicts with %s:%u\n",
+                                     file->filename, file_line, segment->address + i,
+                                     prev->filename, prev_line - prev->first_line);
+                            rc = SREC_CONFLICT_ERROR;
+                            break;
+                        }
+                        ++overlap[f * nfiles + (prev - files)];
+                    }
+                    memory[address] = segment->bytes[i];
+                    owner_p[address] = line;
+                }
+            }
+            first_line += chunk->lines;
+        }
+    }
+    for (f = 0; SREC_NO_ERROR == rc && f < nfiles; ++f)
+    {
+        for (n = 0; n < nfiles; ++n)
+        {
+            const unsigned int count = overlap[f * nfiles + n];
+            if (0 == count)
+            {
+                continue;
+            }
+            if (f != n)
+            {
+                rl78_log(log, RL78_LOG_ERROR, "Warning: %u bytes of \"%s\" overlap \"%s\"\n",
+                         count, files[f].filename, files[n].filename);
+            }
+            else if (rl78_log_enabled(log, 1))
+            {
+                rl78_log(log, 1, "%u bytes of \"%s\" are defined more than once\n",
+                         count, files[f].filename);
+            }
+        }
+    }
+    free(overlap);
+    free(owner);
+    return rc;
+}
+
+int srec_read_files(const char *const *filenames, unsigned int nfiles,
+                    void *code, unsigned int code_len,
+                    void *data, unsigned int data_len,
+                    unsigned int threads, const rl78_log_t *log)
+{
+    if (0 == nfiles)
+    {
+        return SREC_NO_ERROR;
+    }
+    if (0 == threads)
+    {
+        threads = srec_cpu_count();
+    }
+    srec_file_t *files = calloc(nfiles, sizeof *files);
+    if (NULL == files)
+    {
+        rl78_log(log, RL78_LOG_ERROR, "Out of memory\n");
+        return SREC_MEMORY_ERROR;
+    }
+    int rc = SREC_NO_ERROR;
+    unsigned int f, n;
+    for (f = 0; SREC_NO_ERROR == rc && f < nfiles; ++f)
+    {
+        files[f].filename = filenames[f];
+        rc = srec_load_file(&files[f], threads, log);
+    }
+    if (SREC_NO_ERROR == rc)
+    {
+        srec_parse_all(files, nfiles, threads);
+    }
+    // Report the first error in file order
+    unsigned int lines = 0;
+    for (f = 0; SREC_NO_ERROR == rc && f < nfiles; ++f)
+    {
+        srec_file_t *file = &files[f];
+        file->first_line = lines;
+        for (n = 0; n < file->nchunks; ++n)
+        {
+            const srec_chunk_t *chunk = &file->chunks[n];
+            if (SREC_NO_ERROR != chunk->rc)
+            {
+                rc = chunk->rc;
+                if (SREC_MEMORY_ERROR == rc)
+                {
+                    rl78_log(log, RL78_LOG_ERROR, "Out of memory\n");
+                }
+                else
+                {
+                    rl78_log(log, RL78_LOG_ERROR, "%s:%u: File format error\n",
+                             file->filename, file->lines + chunk->error_line);
+                }
+                break;
+            }
+            file->lines += chunk->lines;
+        }
+        lines += file->lines;
+    }
+    if (SREC_NO_ERROR == rc)
+    {
+        rc = srec_apply(files, nfiles, code, code_len, data, data_len, log);
+    }
+    for (f = 0; f < nfiles; ++f)
+    {
+        for (n = 0; n < files[f].nchunks; ++n)
+        {
+            free(files[f].chunks[n].segments);
+            free(files[f].chunks[n].bytes);
+        }
+        free(files[f].chunks);
+        free(files[f].text);
+    }
+    free(files);
     return rc;
 }
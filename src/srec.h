@@ -20,11 +20,25 @@
 #ifndef SREC_H__
 #define SREC_H__
 
-int srec_read(const char *filename, void *code, unsigned int code_len, void *data, unsigned int data_len);
+#include "log.h"
+
+int srec_read(const char *filename, void *code, unsigned int code_len, void *data, unsigned int data_len,
+              const rl78_log_t *log);
+int srec_read_files(const char *const *filenames, unsigned int nfiles,
+                    void *code, unsigned int code_len, void *data, unsigned int data_len,
+                    unsigned int threads, const rl78_log_t *log);
+
+/* Non-zero if length bytes at address lie within size bytes from offset;
+ * safe from the wrap of address + length */
+int srec_in_range(unsigned int address, unsigned int length, unsigned int offset, unsigned int size);
+
+/* Value of len hex digits, -1 if one of them is not a hex digit */
+int ascii2hex(const char *str, unsigned int len);
 
 #define SREC_NO_ERROR           (0)
 #define SREC_IO_ERROR           (-1)
 #define SREC_FORMAT_ERROR       (-2)
 #define SREC_MEMORY_ERROR       (-3)
+#define SREC_CONFLICT_ERROR     (-4)
 
 #endif // SREC_H__
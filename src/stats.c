@@ -0,0 +1,135 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "stats.h"
+#include "json.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static
+double stats_rate(unsigned long long bytes, unsigned long long us)
+{
+    return 0 == us ? 0.0 : bytes * 1000000.0 / us;
+}
+
+void stats_report(const rl78_session_t *s)
+{
+    const latency_t *l = s->latency;
+    const rl78_log_t *log = &s->log;
+    const unsigned long long elapsed = latency_now() - l->started;
+    rl78_log(log, RL78_LOG_OUTPUT, "\n%-14s %8s %10s %8s %8s %8s %8s\n",
+             "Command", "Count", "Total ms", "p50 us", "p95 us", "p99 us", "Max us");
+    int i;
+    for (i = 0; LATENCY_COMMANDS > i; ++i)
+    {
+        const latency_histogram_t *h = &l->commands[i];
+        if (0 == h->count)
+        {
+            continue;
+        }
+        rl78_log(log, RL78_LOG_OUTPUT, "%-14s %8lu %10.1f %8u %8u %8u %8u\n",
+                 latency_command_name(i), h->count, h->total / 1000.0,
+                 latency_percentile(h, 50.0), latency_percentile(h, 95.0),
+                 latency_percentile(h, 99.0), h->max);
+    }
+    rl78_log(log, RL78_LOG_OUTPUT, "\n%-14s %8s %10s %10s %8s\n",
+             "Phase", "Count", "Time ms", "Bytes", "kB/s");
+    for (i = 0; LATENCY_PHASES > i; ++i)
+    {
+        const latency_phase_t *p = &l->phases[i];
+        if (0 == p->count)
+        {
+            continue;
+        }
+        rl78_log(log, RL78_LOG_OUTPUT, "%-14s %8lu %10.1f %10llu %8.1f\n",
+                 latency_phase_name(i), p->count, p->time / 1000.0, p->bytes,
+                 stats_rate(p->bytes, p->time) / 1024);
+    }
+    const unsigned long long wire = (unsigned long long)s->stats.bytes_sent + s->stats.bytes_received;
+    rl78_log(log, RL78_LOG_OUTPUT, "\nWire: %lu bytes sent, %lu received in %.3fs (%.1f kB/s)\n",
+             s->stats.bytes_sent, s->stats.bytes_received, elapsed / 1000000.0,
+             stats_rate(wire, elapsed) / 1024);
+    rl78_log(log, RL78_LOG_OUTPUT, "Frames: %lu commands, %lu data, %lu responses, %lu errors, %lu retries\n",
+             s->stats.commands, s->stats.frames, s->stats.responses, s->stats.errors, s->stats.retries);
+}
+
+int stats_write_json(const rl78_session_t *s, int retcode, const char *filename)
+{
+    const latency_t *l = s->latency;
+    const int to_stdout = 0 == strcmp(filename, "-");
+    FILE *f = to_stdout ? stdout : fopen(filename, "w");
+    if (NULL == f)
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unable to write %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    const unsigned long long elapsed = latency_now() - l->started;
+    const unsigned long long wire = (unsigned long long)s->stats.bytes_sent + s->stats.bytes_received;
+    fprintf(f, "{\"port\":");
+    json_string(f, s->port_name);
+    fprintf(f, ",\"retcode\":%i,\"elapsed_us\":%llu,\"handshake_us\":%u", retcode, elapsed, s->handshake);
+    fprintf(f, ",\"bytes_sent\":%lu,\"bytes_received\":%lu,\"throughput_Bps\":%.0f",
+            s->stats.bytes_sent, s->stats.bytes_received, stats_rate(wire, elapsed));
+    fprintf(f, ",\"frames\":{\"commands\":%lu,\"data\":%lu,\"responses\":%lu,\"errors\":%lu,\"retries\":%lu}",
+            s->stats.commands, s->stats.frames, s->stats.responses, s->stats.errors, s->stats.retries);
+    fprintf(f, ",\"commands\":{");
+    const char *sep = "";
+    int i;
+    for (i = 0; LATENCY_COMMANDS > i; ++i)
+    {
+        const latency_histogram_t *h = &l->commands[i];
+        if (0 == h->count)
+        {
+            continue;
+        }
+        fprintf(f, "%s\"%s\":{\"count\":%lu,\"total_us\":%llu,\"min_us\":%u,"
+                "\"p50_us\":%u,\"p95_us\":%u,\"p99_us\":%u,\"max_us\":%u}",
+                sep, latency_command_name(i), h->count, h->total, h->min,
+                latency_percentile(h, 50.0), latency_percentile(h, 95.0),
+                latency_percentile(h, 99.0), h->max);
+        sep = ",";
+    }
+    fprintf(f, "},\"phases\":{");
+    sep = "";
+    for (i = 0; LATENCY_PHASES > i; ++i)
+    {
+        const latency_phase_t *p = &l->phases[i];
+        if (0 == p->count)
+        {
+            continue;
+        }
+        fprintf(f, "%s\"%s\":{\"count\":%lu,\"time_us\":%llu,\"bytes\":%llu,\"throughput_Bps\":%.0f}",
+                sep, latency_phase_name(i), p->count, p->time, p->bytes, stats_rate(p->bytes, p->time));
+        sep = ",";
+    }
+    fprintf(f, "}}\n");
+    if (to_stdout)
+    {
+        fflush(f);
+        return 0;
+    }
+    if (0 != fclose(f))
+    {
+        rl78_log(&s->log, RL78_LOG_ERROR, "Unable to write %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -21,6 +21,7 @@
 #define TERMINAL_H__
 
 #include "serial.h"
-void terminal_start(port_handle_t fd, int baud, int mode, int reset);
+/* Reset is done in the communication mode of the session */
+void terminal_start(rl78_session_t *s, int baud, int reset);
 
 #endif  /* TERMINAL_H__ */
@@ -34,14 +34,14 @@ static DWORD WINAPI receiver_func(LPVOID pfd)
 {
     char c;
     char prev = '\n';
-    port_handle_t fd = *(port_handle_t*)pfd;
+    rl78_session_t *s = (rl78_session_t*)pfd;
     for(;;)
     {
         if (WAIT_OBJECT_0 == WaitForSingleObject(receiver_stop, 1))
         {
             break;
         }
-        if (1 == serial_read(fd, &c, 1))
+        if (1 == serial_read(s, &c, 1))
         {
             if ('\n' == prev && '\n' != c)
             {
@@ -57,7 +57,7 @@ static DWORD WINAPI receiver_func(LPVOID pfd)
     return 0;
 }
 
-void terminal_start(port_handle_t fd, int baud, int mode, int reset)
+void terminal_start(rl78_session_t *s, int baud, int reset)
 {
     HANDLE    receiver;
     char c = 0;
@@ -77,7 +77,7 @@ void terminal_start(port_handle_t fd, int baud, int mode, int reset)
     new_mode = old_mode & ~(ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT);
     SetConsoleMode(hStdin, new_mode);
 
-    serial_set_baud(fd, baud);
+    serial_set_baud(s, baud);
     receiver_stop = CreateEvent(NULL,
                                 TRUE,
                                 FALSE,
@@ -85,13 +85,13 @@ void terminal_start(port_handle_t fd, int baud, int mode, int reset)
     receiver = CreateThread(NULL,
                             0,
                             receiver_func,
-                            &fd,
+                            s,
                             0,
                             NULL);
 
     if (reset)
     {
-        rl78_reset(fd, mode);
+        rl78_reset(s);
     }
     for (;;)
     {
@@ -101,7 +101,7 @@ void terminal_start(port_handle_t fd, int baud, int mode, int reset)
             {
                 break;
             }
-            serial_write(fd, &c, 1);
+            serial_write(s, &c, 1);
         }
     }
     SetEvent(receiver_stop);
@@ -0,0 +1,73 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "trace.h"
+#include "latency.h"
+#include "json.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+struct trace
+{
+    FILE *f;
+    unsigned long long origin;  /* us, timestamps are relative to it */
+};
+
+trace_t *trace_open(const char *filename)
+{
+    trace_t *t = malloc(sizeof *t);
+    if (NULL == t)
+    {
+        return NULL;
+    }
+    t->f = fopen(filename, "w");
+    if (NULL == t->f)
+    {
+        free(t);
+        return NULL;
+    }
+    t->origin = latency_now();
+    fprintf(t->f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"rl78flash\"}}");
+    return t;
+}
+
+void trace_track(trace_t *t, int track, const char *name)
+{
+    fprintf(t->f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":", track);
+    json_string(t->f, name);
+    fprintf(t->f, "}}");
+}
+
+void trace_span(trace_t *t, int track, const char *name, const char *category,
+                unsigned long long start, unsigned long long end)
+{
+    const unsigned long long ts = start > t->origin ? start - t->origin : 0;
+    fprintf(t->f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%llu,\"dur\":%llu}",
+            name, category, track, ts, end > start ? end - start : 0);
+}
+
+int trace_close(trace_t *t)
+{
+    fprintf(t->f, "\n]}\n");
+    const int rc = (0 != ferror(t->f)) | (0 != fclose(t->f));
+    free(t);
+    return rc ? -1 : 0;
+}
@@ -0,0 +1,44 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef TRACE_H__
+#define TRACE_H__
+
+/* Protocol activity in the Chrome trace event format: complete ("X") events
+ * on one track per port, timed by latency_now(). Open the file in
+ * chrome://tracing or Perfetto. */
+
+#define TRACE_CAT_PHASE     "phase"     /* erase, program and verify loops, connection */
+#define TRACE_CAT_COMMAND   "command"   /* a command frame on the wire */
+#define TRACE_CAT_DATA      "data"      /* a data frame on the wire */
+#define TRACE_CAT_WAIT      "wait"      /* waiting for a response */
+#define TRACE_CAT_SLEEP     "sleep"     /* host delays */
+
+typedef struct trace trace_t;
+
+trace_t *trace_open(const char *filename);
+/* Name a track; tracks are numbered by the caller, from 1 */
+void trace_track(trace_t *t, int track, const char *name);
+void trace_span(trace_t *t, int track, const char *name, const char *category,
+                unsigned long long start, unsigned long long end);
+/* Terminate the event list; 0 if everything has been written */
+int trace_close(trace_t *t);
+
+#endif // TRACE_H__
@@ -0,0 +1,153 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "transport.h"
+#include "session.h"
+#include "serial.h"
+#include <unistd.h>
+
+int transport_open(const rl78_transport_t *t, void *ctx, rl78_session_t *s, const char *port)
+{
+    return NULL != t ? t->open(ctx, s, port) : serial_port_open(s, port);
+}
+
+int transport_set_baud(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int baud)
+{
+    return NULL != t ? t->set_baud(ctx, s, baud) : serial_port_set_baud(s, baud);
+}
+
+int transport_set_parity(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int enable, int odd_parity)
+{
+    return NULL != t ? t->set_parity(ctx, s, enable, odd_parity) : serial_port_set_parity(s, enable, odd_parity);
+}
+
+int transport_set_dtr(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int level)
+{
+    return NULL != t ? t->set_dtr(ctx, s, level) : serial_port_set_dtr(s, level);
+}
+
+int transport_set_rts(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int level)
+{
+    return NULL != t ? t->set_rts(ctx, s, level) : serial_port_set_rts(s, level);
+}
+
+int transport_set_txd(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int level)
+{
+    return NULL != t ? t->set_txd(ctx, s, level) : serial_port_set_txd(s, level);
+}
+
+int transport_flush(const rl78_transport_t *t, void *ctx, rl78_session_t *s)
+{
+    return NULL != t ? t->flush(ctx, s) : serial_port_flush(s);
+}
+
+int transport_write(const rl78_transport_t *t, void *ctx, rl78_session_t *s, const void *buf, int len)
+{
+    return NULL != t ? t->write(ctx, s, buf, len) : serial_port_write(s, buf, len);
+}
+
+int transport_read(const rl78_transport_t *t, void *ctx, rl78_session_t *s, void *buf, int len)
+{
+    return NULL != t ? t->read(ctx, s, buf, len) : serial_port_read(s, buf, len);
+}
+
+void transport_delay(const rl78_transport_t *t, void *ctx, rl78_session_t *s, unsigned int us)
+{
+    if (NULL != t)
+    {
+        t->delay(ctx, s, us);
+    }
+    else
+    {
+        usleep(us);
+    }
+}
+
+int transport_close(const rl78_transport_t *t, void *ctx, rl78_session_t *s)
+{
+    return NULL != t ? t->close(ctx, s) : serial_port_close(s);
+}
+
+int serial_open(rl78_session_t *s, const char *port)
+{
+    return transport_open(s->transport, s->transport_ctx, s, port);
+}
+
+int serial_set_baud(rl78_session_t *s, int baud)
+{
+    return transport_set_baud(s->transport, s->transport_ctx, s, baud);
+}
+
+int serial_set_parity(rl78_session_t *s, int enable, int odd_parity)
+{
+    return transport_set_parity(s->transport, s->transport_ctx, s, enable, odd_parity);
+}
+
+int serial_set_dtr(rl78_session_t *s, int level)
+{
+    return transport_set_dtr(s->transport, s->transport_ctx, s, level);
+}
+
+int serial_set_rts(rl78_session_t *s, int level)
+{
+    return transport_set_rts(s->transport, s->transport_ctx, s, level);
+}
+
+int serial_set_txd(rl78_session_t *s, int level)
+{
+    return transport_set_txd(s->transport, s->transport_ctx, s, level);
+}
+
+int serial_flush(rl78_session_t *s)
+{
+    return transport_flush(s->transport, s->transport_ctx, s);
+}
+
+int serial_write(rl78_session_t *s, const void *buf, int len)
+{
+    rl78_log_hex(&s->log, 4, "\t\tsend", buf, len);
+    const int rc = transport_write(s->transport, s->transport_ctx, s, buf, len);
+    if (0 < rc)
+    {
+        s->stats.bytes_sent += rc;
+    }
+    return rc;
+}
+
+int serial_read(rl78_session_t *s, void *buf, int len)
+{
+    const int rc = transport_read(s->transport, s->transport_ctx, s, buf, len);
+    if (0 <= rc)
+    {
+        s->stats.bytes_received += rc;
+        rl78_log_hex(&s->log, 4, "\t\trecv", buf, rc);
+    }
+    return rc;
+}
+
+void serial_delay(rl78_session_t *s, unsigned int us)
+{
+    transport_delay(s->transport, s->transport_ctx, s, us);
+}
+
+int serial_close(rl78_session_t *s)
+{
+    return transport_close(s->transport, s->transport_ctx, s);
+}
@@ -0,0 +1,59 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef TRANSPORT_H__
+#define TRANSPORT_H__
+
+/* A replacement for the serial port of a session. When a session has a
+ * transport, the serial_*() calls go to it instead of the port; a transport
+ * may pass the calls on to the one below it (see transport_*()), which lets
+ * capture and replay sit between the protocol code and the port. */
+
+typedef struct rl78_session rl78_session_t;
+
+typedef struct
+{
+    int (*open)(void *ctx, rl78_session_t *s, const char *port);
+    int (*set_baud)(void *ctx, rl78_session_t *s, int baud);
+    int (*set_parity)(void *ctx, rl78_session_t *s, int enable, int odd_parity);
+    int (*set_dtr)(void *ctx, rl78_session_t *s, int level);
+    int (*set_rts)(void *ctx, rl78_session_t *s, int level);
+    int (*set_txd)(void *ctx, rl78_session_t *s, int level);
+    int (*flush)(void *ctx, rl78_session_t *s);
+    int (*write)(void *ctx, rl78_session_t *s, const void *buf, int len);
+    int (*read)(void *ctx, rl78_session_t *s, void *buf, int len);
+    void (*delay)(void *ctx, rl78_session_t *s, unsigned int us);
+    int (*close)(void *ctx, rl78_session_t *s);
+} rl78_transport_t;
+
+/* Calls of a given transport; NULL stands for the serial port */
+int transport_open(const rl78_transport_t *t, void *ctx, rl78_session_t *s, const char *port);
+int transport_set_baud(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int baud);
+int transport_set_parity(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int enable, int odd_parity);
+int transport_set_dtr(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int level);
+int transport_set_rts(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int level);
+int transport_set_txd(const rl78_transport_t *t, void *ctx, rl78_session_t *s, int level);
+int transport_flush(const rl78_transport_t *t, void *ctx, rl78_session_t *s);
+int transport_write(const rl78_transport_t *t, void *ctx, rl78_session_t *s, const void *buf, int len);
+int transport_read(const rl78_transport_t *t, void *ctx, rl78_session_t *s, void *buf, int len);
+void transport_delay(const rl78_transport_t *t, void *ctx, rl78_session_t *s, unsigned int us);
+int transport_close(const rl78_transport_t *t, void *ctx, rl78_session_t *s);
+
+#endif  // TRANSPORT_H__
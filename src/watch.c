@@ -0,0 +1,392 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#include "watch.h"
+#include "session.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define WATCH_EVENTS    (IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM)
+
+typedef struct watch watch_t;
+
+typedef struct
+{
+    char path[PATH_MAX];
+    rl78_session_t session;
+    job_machine_t job;
+    job_result_t result;
+    watch_t *watch;
+    unsigned int unit;
+    image_t patched;            /* copy of the image with the values of the unit */
+} watch_job_t;
+
+struct watch
+{
+    const char *dir;
+    const char *pattern;
+    const job_options_t *options;
+    const rl78_session_t *defaults;
+    image_t *image;
+    image_loader_t *loader;
+    int loaded;
+    int load_rc;
+    const patch_table_t *patches;
+    unsigned int unit;          /* of the next board */
+    rl78_fsm_loop_t *loop;
+    watch_job_t **jobs;         /* running jobs, indexed by their loop index */
+    unsigned int njobs;
+    char **seen;                /* nodes handled since they have appeared */
+    unsigned int nseen;
+    unsigned int total;
+    unsigned int failed;
+    int retcode;
+};
+
+static volatile sig_atomic_t watch_stop = 0;
+
+static
+void watch_signal(int sig)
+{
+    (void)sig;
+    watch_stop = 1;
+}
+
+static
+const image_t *watch_get_image(void *ctx, const job_result_t *device)
+{
+    watch_job_t *job = (watch_job_t*)ctx;
+    watch_t *w = job->watch;
+    (void)device;
+    if (!w->loaded)
+    {
+        w->load_rc = (NULL != w->loader) ? image_load_wait(w->loader) : -1;
+        w->loaded = 1;
+    }
+    if (0 != w->load_rc)
+    {
+        return NULL;
+    }
+    if (NULL == w->patches)
+    {
+        return w->image;
+    }
+    if (0 != image_patch_copy(&job->patched, w->image, w->patches, job->unit, &job->session.log))
+    {
+        rl78_log(&job->session.log, RL78_LOG_ERROR, "Patching failed\n");
+        return NULL;
+    }
+    return &job->patched;
+}
+
+static
+void watch_job_free(watch_job_t *job)
+{
+    image_free(&job->patched);
+    free(job);
+}
+
+static
+int watch_seen_find(const watch_t *w, const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < w->nseen; ++i)
+    {
+        if (0 == strcmp(name, w->seen[i]))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static
+void watch_seen_add(watch_t *w, const char *name)
+{
+    char **seen = realloc(w->seen, (w->nseen + 1) * sizeof *seen);
+    if (NULL == seen)
+    {
+        return;
+    }
+    w->seen = seen;
+    w->seen[w->nseen] = strdup(name);
+    if (NULL != w->seen[w->nseen])
+    {
+        ++w->nseen;
+    }
+}
+
+static
+void watch_seen_remove(watch_t *w, const char *name)
+{
+    const int i = watch_seen_find(w, name);
+    if (0 <= i)
+    {
+        free(w->seen[i]);
+        w->seen[i] = w->seen[--w->nseen];
+    }
+}
+
+static
+void watch_report(watch_t *w, const char *port, const rl78_session_t *s, const job_result_t *result)
+{
+    printf("%-24s %-12s %-8s %7.2fs  %s\n",
+           port,
+           ('\0' != result->device_name[0]) ? result->device_name : "-",
+           (0 == result->retcode) ? "OK" : "FAILED",
+           result->seconds,
+           (NULL != result->error) ? result->error : "");
+    fflush(stdout);
+    if (NULL != s->metrics)
+    {
+        metrics_job(s->metrics, port, s, result);
+    }
+    ++w->total;
+    if (0 != result->retcode)
+    {
+        ++w->failed;
+        if (0 == w->retcode)
+        {
+            w->retcode = result->retcode;
+        }
+    }
+}
+
+static
+void watch_next(void *ctx, rl78_fsm_t *m, unsigned int index)
+{
+    watch_t *w = (watch_t*)ctx;
+    (void)m;
+    job_machine_next(&w->jobs[index]->job);
+}
+
+static
+void watch_finished(void *ctx, rl78_fsm_t *m, unsigned int index)
+{
+    watch_t *w = (watch_t*)ctx;
+    watch_job_t *job = w->jobs[index];
+    (void)m;
+    serial_close(&job->session);
+    watch_report(w, job->path, &job->session, &job->result);
+    w->jobs[index] = NULL;
+    watch_job_free(job);
+}
+
+static
+void watch_start(watch_t *w, const char *name)
+{
+    watch_job_t *job = calloc(1, sizeof *job);
+    if (NULL == job)
+    {
+        return;
+    }
+    snprintf(job->path, sizeof job->path, "%s/%s", w->dir, name);
+    struct stat st;
+    // Wait for udev to finish with the node: it must be a tty we may open
+    if (0 != stat(job->path, &st)
+        || !S_ISCHR(st.st_mode)
+        || 0 != access(job->path, R_OK | W_OK))
+    {
+        free(job);
+        return;
+    }
+    watch_seen_add(w, name);
+    unsigned int index;
+    for (index = 0; index < w->njobs && NULL != w->jobs[index]; ++index)
+    {
+    }
+    if (w->njobs == index)
+    {
+        watch_job_t **jobs = realloc(w->jobs, (w->njobs + 1) * sizeof *jobs);
+        if (NULL == jobs)
+        {
+            free(job);
+            return;
+        }
+        w->jobs = jobs;
+        w->jobs[w->njobs++] = NULL;
+    }
+    rl78_log(&w->defaults->log, 1, "New port %s\n", job->path);
+    job->watch = w;
+    if (NULL != w->patches)
+    {
+        // Every board plugged in takes the next unit, even if its job fails
+        job->unit = w->unit++;
+        rl78_log(&w->defaults->log, 1, "Unit %u on %s\n", job->unit, job->path);
+    }
+    job->session = *w->defaults;
+    if (NULL != job->session.metrics)
+    {
+        job->session.latency = metrics_latency(job->session.metrics, job->path);
+    }
+    if (0 != serial_open(&job->session, job->path))
+    {
+        job->result.retcode = EBADF;
+        job->result.error = "Unable to open port";
+        watch_report(w, job->path, &job->session, &job->result);
+        free(job);
+        return;
+    }
+    w->jobs[index] = job;
+    job_machine_start(&job->job, &job->session, w->options, watch_get_image, job, &job->result);
+    if (0 != rl78_fsm_loop_add(w->loop, &job->job.fsm, index))
+    {
+        // The machine has been aborted; report the port as failed
+        job->result.retcode = EIO;
+        job->result.error = "Unable to start event loop";
+        watch_finished(w, &job->job.fsm, index);
+    }
+}
+
+static
+void watch_events(void *ctx, int fd)
+{
+    watch_t *w = (watch_t*)ctx;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while (0 < (len = read(fd, buf, sizeof buf)))
+    {
+        const char *p;
+        for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((const struct inotify_event*)p)->len)
+        {
+            const struct inotify_event *ev = (const struct inotify_event*)p;
+            if (0 == ev->len
+                || 0 != fnmatch(w->pattern, ev->name, 0))
+            {
+                continue;
+            }
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                // The next node with this name is a new board
+                watch_seen_remove(w, ev->name);
+            }
+            else if (!watch_stop
+                     && 0 > watch_seen_find(w, ev->name))
+            {
+                watch_start(w, ev->name);
+            }
+        }
+    }
+}
+
+int watch_run(const char *dir, const char *pattern, const job_options_t *options,
+              const rl78_session_t *defaults, image_t *image, image_loader_t *loader,
+              const patch_table_t *patches, unsigned int unit)
+{
+    watch_t w;
+    memset(&w, 0, sizeof w);
+    w.dir = dir;
+    w.pattern = pattern;
+    w.options = options;
+    w.defaults = defaults;
+    w.image = image;
+    w.loader = loader;
+    w.patches = (NULL != patches && 0 < patches->count) ? patches : NULL;
+    w.unit = unit;
+
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (0 > fd
+        || 0 > inotify_add_watch(fd, dir, WATCH_EVENTS))
+    {
+        fprintf(stderr, "Unable to watch %s: %s\n", dir, strerror(errno));
+        if (0 <= fd)
+        {
+            close(fd);
+        }
+        return EIO;
+    }
+    w.loop = rl78_fsm_loop_create(watch_next, watch_finished, &w);
+    if (NULL == w.loop
+        || 0 != rl78_fsm_loop_watch(w.loop, fd, watch_events, &w))
+    {
+        fprintf(stderr, "Unable to start event loop\n");
+        if (NULL != w.loop)
+        {
+            rl78_fsm_loop_destroy(w.loop);
+        }
+        close(fd);
+        return EIO;
+    }
+    // Boards which are already connected are not touched
+    DIR *d = opendir(dir);
+    if (NULL != d)
+    {
+        struct dirent *entry;
+        while (NULL != (entry = readdir(d)))
+        {
+            if (0 == fnmatch(pattern, entry->d_name, 0))
+            {
+                watch_seen_add(&w, entry->d_name);
+            }
+        }
+        closedir(d);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof action);
+    action.sa_handler = watch_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Watching %s for %s\n", dir, pattern);
+    printf("\n%-24s %-12s %-8s %8s  %s\n", "Port", "Device", "Result", "Time", "Error");
+    fflush(stdout);
+    // Running jobs are finished after a signal, so no board is left half-written
+    while (!watch_stop
+           || 0 < rl78_fsm_loop_active(w.loop))
+    {
+        if (0 != rl78_fsm_loop_iterate(w.loop))
+        {
+            fprintf(stderr, "Event loop failed: %s\n", strerror(errno));
+            break;
+        }
+    }
+    printf("%u of %u ports succeeded\n", w.total - w.failed, w.total);
+
+    rl78_fsm_loop_destroy(w.loop);
+    close(fd);
+    unsigned int i;
+    for (i = 0; i < w.njobs; ++i)
+    {
+        if (NULL != w.jobs[i])
+        {
+            serial_close(&w.jobs[i]->session);
+            watch_job_free(w.jobs[i]);
+        }
+    }
+    free(w.jobs);
+    for (i = 0; i < w.nseen; ++i)
+    {
+        free(w.seen[i]);
+    }
+    free(w.seen);
+    return w.retcode;
+}
@@ -0,0 +1,37 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+#ifndef WATCH_H__
+#define WATCH_H__
+
+#include "job.h"
+#include "image.h"
+
+/* Watch a directory for new tty nodes whose names match a shell pattern and
+ * run the job on each of them as soon as it appears. Nodes present at start
+ * are left alone. All jobs run at once on one event loop; a result row is
+ * printed when a job is finished. With a patch table (may be NULL) the boards
+ * take units <unit>, <unit>+1 and so on as they appear. Returns on SIGINT or
+ * SIGTERM after the running jobs are finished; non-zero if any job has failed. */
+int watch_run(const char *dir, const char *pattern, const job_options_t *options,
+              const rl78_session_t *defaults, image_t *image, image_loader_t *loader,
+              const patch_table_t *patches, unsigned int unit);
+
+#endif // WATCH_H__
@@ -0,0 +1,385 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+#include "wear.h"
+#include "rl78.h"
+#include "filelock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WEAR_KINDS          4       /* erase and program of code and data flash */
+#define WEAR_LINE_LENGTH    128
+#define WEAR_DEVICE_LENGTH  11
+
+static const char *const wear_kind_names[WEAR_KINDS] =
+{
+    "code-erase", "code-program", "data-erase", "data-program"
+};
+
+typedef struct
+{
+    unsigned int address;
+    int kind;
+    double us;
+} wear_sample_t;
+
+typedef struct
+{
+    unsigned long n;
+    double mean;                /* us */
+    double variance;
+} wear_stats_t;
+
+/* The times include the frames on the line around the busy device, so a
+ * baseline is kept per baud rate and communication mode as well */
+typedef struct
+{
+    char name[WEAR_DEVICE_LENGTH];
+    unsigned int baud;
+    unsigned int wire;
+    wear_stats_t kinds[WEAR_KINDS];
+} wear_device_t;
+
+typedef struct
+{
+    char *name;
+    wear_sample_t *samples;
+    unsigned int count;
+    unsigned int size;
+} wear_port_t;
+
+struct wear
+{
+    const char *filename;
+    const rl78_log_t *log;
+    wear_device_t *devices;
+    unsigned int ndevices;
+    wear_port_t *ports;
+    unsigned int nports;
+};
+
+static
+int wear_kind(int op, unsigned int address)
+{
+    return (DATA_OFFSET <= address ? 2 : 0) + op;
+}
+
+/* Device names are padded with spaces by the bootloader */
+static
+void wear_device_name(char name[WEAR_DEVICE_LENGTH], const char *device)
+{
+    unsigned int i;
+    for (i = 0; i < WEAR_DEVICE_LENGTH - 1 && '\0' != device[i]; ++i)
+    {
+        name[i] = (' ' == device[i]) ? '_' : device[i];
+    }
+    for (; 0 < i && '_' == name[i - 1]; --i)
+    {
+    }
+    name[i] = '\0';
+}
+
+static
+wear_device_t *wear_device(wear_t *w, const char *name, unsigned int baud, unsigned int wire)
+{
+    unsigned int i;
+    for (i = 0; i < w->ndevices; ++i)
+    {
+        if (0 == strcmp(name, w->devices[i].name)
+            && baud == w->devices[i].baud
+            && wire == w->devices[i].wire)
+        {
+            return &w->devices[i];
+        }
+    }
+    wear_device_t *devices = realloc(w->devices, (w->ndevices + 1) * sizeof *devices);
+    if (NULL == devices)
+    {
+        return NULL;
+    }
+    w->devices = devices;
+    wear_device_t *d = &w->devices[w->ndevices++];
+    memset(d, 0, sizeof *d);
+    strcpy(d->name, name);
+    d->baud = baud;
+    d->wire = wire;
+    return d;
+}
+
+static
+wear_port_t *wear_port(wear_t *w, const char *name)
+{
+    unsigned int i;
+    for (i = 0; i < w->nports; ++i)
+    {
+        if (0 == strcmp(name, w->ports[i].name))
+        {
+            return &w->ports[i];
+        }
+    }
+    wear_port_t *ports = realloc(w->ports, (w->nports + 1) * sizeof *ports);
+    if (NULL == ports)
+    {
+        return NULL;
+    }
+    w->ports = ports;
+    wear_port_t *p = &w->ports[w->nports];
+    memset(p, 0, sizeof *p);
+    p->name = strdup(name);
+    if (NULL == p->name)
+    {
+        return NULL;
+    }
+    ++w->nports;
+    return p;
+}
+
+static
+void wear_load(wear_t *w)
+{
+    FILE *in = fopen(w->filename, "r");
+    if (NULL == in)
+    {
+        // The first run starts without a baseline
+        return;
+    }
+    char line[WEAR_LINE_LENGTH];
+    while (NULL != fgets(line, sizeof line, in))
+    {
+        char device[WEAR_LINE_LENGTH];
+        char kind[WEAR_LINE_LENGTH];
+        unsigned int baud;
+        unsigned int wire;
+        wear_stats_t stats;
+        if ('#' == line[0]
+            || 7 != sscanf(line, "%127s %u %u %127s %lu %lf %lf", device, &baud, &wire, kind,
+                           &stats.n, &stats.mean, &stats.variance))
+        {
+            continue;
+        }
+        char name[WEAR_DEVICE_LENGTH];
+        wear_device_name(name, device);
+        int k;
+        for (k = 0; k < WEAR_KINDS && 0 != strcmp(kind, wear_kind_names[k]); ++k)
+        {
+        }
+        wear_device_t *d = (WEAR_KINDS > k) ? wear_device(w, name, baud, wire) : NULL;
+        if (NULL != d)
+        {
+            d->kinds[k] = stats;
+        }
+    }
+    fclose(in);
+}
+
+static
+void wear_emit(FILE *out, const void *ctx)
+{
+    const wear_t *w = ctx;
+    fprintf(out, "# <device> <baud> <wire> <operation> <samples> <mean, us> <variance, us^2>\n");
+    unsigned int i;
+    int k;
+    for (i = 0; i < w->ndevices; ++i)
+    {
+        for (k = 0; k < WEAR_KINDS; ++k)
+        {
+            const wear_stats_t *stats = &w->devices[i].kinds[k];
+            if (0 < stats->n)
+            {
+                fprintf(out, "%s %u %u %s %lu %.3f %.3f\n", w->devices[i].name, w->devices[i].baud,
+                        w->devices[i].wire, wear_kind_names[k], stats->n, stats->mean, stats->variance);
+            }
+        }
+    }
+}
+
+wear_t *wear_open(const char *filename, const rl78_log_t *log)
+{
+    wear_t *w = calloc(1, sizeof *w);
+    if (NULL == w)
+    {
+        return NULL;
+    }
+    w->filename = filename;
+    w->log = log;
+    wear_load(w);
+    return w;
+}
+
+void wear_start(wear_t *w, const char *port)
+{
+    wear_port_t *p = wear_port(w, port);
+    if (NULL != p)
+    {
+        p->count = 0;
+    }
+}
+
+void wear_record(wear_t *w, const char *port, int op, unsigned int address, unsigned long long us)
+{
+    wear_port_t *p = wear_port(w, port);
+    if (NULL == p)
+    {
+        return;
+    }
+    if (p->count == p->size)
+    {
+        const unsigned int size = (0 < p->size) ? 2 * p->size : 256;
+        wear_sample_t *samples = realloc(p->samples, size * sizeof *samples);
+        if (NULL == samples)
+        {
+            return;
+        }
+        p->samples = samples;
+        p->size = size;
+    }
+    wear_sample_t *sample = &p->samples[p->count++];
+    sample->address = address;
+    sample->kind = wear_kind(op, address);
+    sample->us = us;
+}
+
+/* 1 if a block which has taken us is slow; never while the baseline is too
+ * short. Squares are compared, so no square root is needed. */
+static
+int wear_slow(const wear_stats_t *stats, double us)
+{
+    if (WEAR_MIN_SAMPLES > stats->n
+        || stats->mean >= us)
+    {
+        return 0;
+    }
+    double variance = stats->variance;
+    const double least = stats->mean * WEAR_MIN_SPREAD;
+    if (least * least > variance)
+    {
+        variance = least * least;
+    }
+    const double excess = us - stats->mean;
+    return excess * excess > WEAR_SIGMAS * WEAR_SIGMAS * variance;
+}
+
+/* Exponentially weighted mean and variance over the last WEAR_WINDOW samples,
+ * a plain average before that */
+static
+void wear_update(wear_stats_t *stats, double us)
+{
+    ++stats->n;
+    const double alpha = (WEAR_WINDOW > stats->n) ? 1.0 / stats->n : 1.0 / WEAR_WINDOW;
+    const double delta = us - stats->mean;
+    stats->mean += alpha * delta;
+    stats->variance = (1 - alpha) * (stats->variance + alpha * delta * delta);
+}
+
+void wear_check(wear_t *w, const char *port, const char *device, unsigned int baud, unsigned int wire, int update,
+                wear_result_t *result)
+{
+    memset(result, 0, sizeof *result);
+    wear_port_t *p = wear_port(w, port);
+    char name[WEAR_DEVICE_LENGTH];
+    wear_device_name(name, device);
+    wear_device_t *d = ('\0' != name[0]) ? wear_device(w, name, baud, wire) : NULL;
+    if (NULL == p
+        || NULL == d
+        || 0 == p->count)
+    {
+        return;
+    }
+    double sums[WEAR_KINDS] = { 0 };
+    unsigned int counts[WEAR_KINDS] = { 0 };
+    unsigned int i;
+    int k;
+    for (i = 0; i < p->count; ++i)
+    {
+        const wear_sample_t *sample = &p->samples[i];
+        const wear_stats_t *stats = &d->kinds[sample->kind];
+        sums[sample->kind] += sample->us;
+        ++counts[sample->kind];
+        if (wear_slow(stats, sample->us))
+        {
+            ++result->slow_blocks;
+            if (result->ratio < sample->us / stats->mean)
+            {
+                result->ratio = sample->us / stats->mean;
+                result->address = sample->address;
+            }
+        }
+    }
+    for (k = 0; k < WEAR_KINDS; ++k)
+    {
+        const wear_stats_t *stats = &d->kinds[k];
+        if (0 < counts[k]
+            && WEAR_MIN_SAMPLES <= stats->n
+            && stats->mean * WEAR_BOARD_RATIO < sums[k] / counts[k])
+        {
+            result->slow_board = 1;
+        }
+    }
+    if (WEAR_BOARD_BLOCKS <= result->slow_blocks)
+    {
+        result->slow_board = 1;
+    }
+    if (update
+        && !result->slow_board)
+    {
+        // The baseline may have been moved by other processes since
+        const int lock = filelock_acquire(w->filename, w->log);
+        if (0 <= lock)
+        {
+            wear_load(w);
+            d = wear_device(w, name, baud, wire);
+        }
+        if (NULL != d
+            && 0 <= lock)
+        {
+            // Slow blocks of a good board do not move the baseline either
+            for (i = 0; i < p->count; ++i)
+            {
+                const wear_sample_t *sample = &p->samples[i];
+                wear_stats_t *stats = &d->kinds[sample->kind];
+                if (!wear_slow(stats, sample->us))
+                {
+                    wear_update(stats, sample->us);
+                }
+            }
+            filelock_replace(w->filename, wear_emit, w, w->log);
+        }
+        if (0 <= lock)
+        {
+            filelock_release(lock);
+        }
+    }
+    p->count = 0;
+}
+
+void wear_close(wear_t *w)
+{
+    unsigned int i;
+    for (i = 0; i < w->nports; ++i)
+    {
+        free(w->ports[i].name);
+        free(w->ports[i].samples);
+    }
+    free(w->ports);
+    free(w->devices);
+    free(w);
+}
@@ -0,0 +1,72 @@
+/*********************************************************************************************************************
+ * The MIT License (MIT)                                                                                             *
+ * Copyright (c) 2012-2016 Maksim Salau                                                                              *
+ *                                                                                                                   *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated      *
+ * documentation files (the "Software"), to deal in the Software without restriction, including without limitation   *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and  *
+ * to permit persons to whom the Software is furnished to do so, subject to the following conditions:                *
+ *                                                                                                                   *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions     *
+ * of the Software.                                                                                                  *
+ *                                                                                                                   *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO  *
+ * THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE    *
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF         *
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS *
+ * IN THE SOFTWARE.                                                                                                  *
+ *********************************************************************************************************************/
+
+
+
+#ifndef WEAR_H__
+#define WEAR_H__
+
+#include "log.h"
+
+/* Screening of worn or marginal flash by the time of Block Erase and
+ * Programming per block: from the erase command to its ACK, and from the end
+ * of the fixed delay after the last data frame to the status of completion,
+ * while the device is still verifying the block it has written. The times of
+ * each job are compared with a rolling baseline per device type, baud rate and
+ * communication mode, kept separately for erase and program of code and data
+ * flash: a block is slow if it takes longer than WEAR_SIGMAS standard
+ * deviations over the mean, and a board is slow if its mean time is over the
+ * baseline by WEAR_BOARD_RATIO or it has WEAR_BOARD_BLOCKS slow blocks. Only
+ * successful jobs of boards which are not slow update the baseline, which is
+ * kept in a text file over runs; processes sharing the file lock it and read
+ * it again before each update. */
+
+#define WEAR_ERASE          0
+#define WEAR_PROGRAM        1
+
+#define WEAR_WINDOW         1000    /* samples the baseline is averaged over */
+#define WEAR_MIN_SAMPLES    64      /* samples before blocks are judged */
+#define WEAR_SIGMAS         4.0
+#define WEAR_MIN_SPREAD     0.05    /* least standard deviation, relative to the mean */
+#define WEAR_BOARD_RATIO    1.25
+#define WEAR_BOARD_BLOCKS   4
+
+typedef struct wear wear_t;
+
+typedef struct
+{
+    unsigned int slow_blocks;   /* erase and program commands over the limit */
+    unsigned int address;       /* the slowest of them */
+    double ratio;               /* its time over the mean of the baseline */
+    int slow_board;
+} wear_result_t;
+
+/* filename is read if it exists and written after each job */
+wear_t *wear_open(const char *filename, const rl78_log_t *log);
+/* Forget the times recorded on the port, at the start of a job */
+void wear_start(wear_t *w, const char *port);
+void wear_record(wear_t *w, const char *port, int op, unsigned int address, unsigned long long us);
+/* Judge the times of the job on the port against the baseline of the device
+ * at baud in communication mode wire; the baseline is updated if update is
+ * set and the board is not slow */
+void wear_check(wear_t *w, const char *port, const char *device, unsigned int baud, unsigned int wire, int update,
+                wear_result_t *result);
+void wear_close(wear_t *w);
+
+#endif  // WEAR_H__